@@ -0,0 +1,58 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_ALIGNED_BUFFER_HPP
+#define INCLUDED_ALIGNED_BUFFER_HPP
+
+#include <complex>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+static const size_t CACHE_LINE_SIZE = 64;
+
+/*!
+ * Allocator handing out memory aligned to Alignment bytes, so vector data
+ * can be fed straight to SIMD loads and O_DIRECT writes.
+ */
+template<typename T, size_t Alignment = CACHE_LINE_SIZE>
+class aligned_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U> struct rebind { typedef aligned_allocator<U, Alignment> other; };
+
+    aligned_allocator(void) {}
+    template<typename U> aligned_allocator(const aligned_allocator<U, Alignment> &) {}
+
+    T *allocate(size_t n){
+        void *p = NULL;
+        if (n == 0)
+            return NULL;
+        if (posix_memalign(&p, Alignment, n*sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t){
+        free(p);
+    }
+};
+
+template<typename T, typename U, size_t A>
+bool operator==(const aligned_allocator<T, A> &, const aligned_allocator<U, A> &) { return true; }
+template<typename T, typename U, size_t A>
+bool operator!=(const aligned_allocator<T, A> &, const aligned_allocator<U, A> &) { return false; }
+
+typedef std::vector<std::complex<short>, aligned_allocator<std::complex<short>>> sc16_buffer_t;
+
+#endif /* INCLUDED_ALIGNED_BUFFER_HPP */
@@ -0,0 +1,98 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_CAPTURE_CODEC_HPP
+#define INCLUDED_CAPTURE_CODEC_HPP
+
+#include "aligned_buffer.hpp"
+#include "pulse_arena.hpp"
+#include <boost/noncopyable.hpp>
+#include <complex>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+ * Lossless sc16 block codec of encoded captures
+ *
+ * Each block of up to block_samps samples is coded on its own, so blocks
+ * encode and decode in parallel. I and Q each get the fixed polynomial
+ * predictor (order 0, 1 or 2) with the smallest residuals in the block,
+ * then every partition of CODEC_PARTITION residuals (zigzag mapped) is
+ * either bit packed at the width of its largest residual or Rice coded,
+ * whichever is shorter:
+ *
+ *   per component: [order:2] then per partition [rice:1][width or k:5][residuals]
+ *
+ * Bits are packed LSB first. A Rice code is q zeros, a one and the k low
+ * bits; q >= CODEC_RICE_ESCAPE is sent as that many zeros and the raw 18 bit
+ * residual. A block that would not be shorter than its samples holds the
+ * samples themselves. An encoded pulse is a table of the byte length of every block
+ * (uint32_t, little endian) followed by the blocks.
+ */
+
+static const size_t CODEC_PARTITION = 32;
+static const unsigned CODEC_RICE_ESCAPE = 24;
+static const size_t CODEC_DEFAULT_BLOCK = 4096;
+
+//! Most bytes encode_block() writes for n samples
+size_t codec_block_bound(size_t n);
+
+//! Encode n samples into out (codec_block_bound(n) bytes); returns the bytes used
+size_t encode_block(const std::complex<short> *in, size_t n, uint8_t *out);
+
+//! Decode a block of n samples; throws std::runtime_error unless it is exactly nbytes long
+void decode_block(const uint8_t *in, size_t nbytes, std::complex<short> *out, size_t n);
+
+typedef struct {
+  uint64_t pulses;
+  uint64_t samples;
+  uint64_t coded_bytes;    // table and blocks, without page padding
+  double secs;             // time spent encoding
+} codec_stats_t;
+
+/*!
+ * Encodes pulses (or stream chunks) block by block, the blocks of a pulse
+ * split over up to threads threads (0: one per CPU). Pulses of a few blocks
+ * are encoded on the calling thread; spawning threads would cost more.
+ * The output is page aligned and padded, ready for an O_DIRECT write.
+ */
+class capture_encoder : boost::noncopyable
+{
+public:
+    capture_encoder(size_t block_samps, size_t threads);
+
+    //! Encode a pulse into data(); returns its size in bytes
+    size_t encode(const std::complex<short> *in, size_t nsamps);
+    const uint8_t *data(void) const { return _out.data(); }
+
+    const codec_stats_t &get_stats(void) const { return _stats; }
+
+private:
+    size_t _block_samps;
+    size_t _threads;
+    std::vector<uint8_t, aligned_allocator<uint8_t, PAGE_SIZE_BYTES>> _out;
+    std::vector<uint8_t> _scratch;        // blocks at codec_block_bound() strides
+    std::vector<uint32_t> _sizes;
+    codec_stats_t _stats;
+};
+
+/*!
+ * Samples per second a capture_encoder of threads threads (0: one per CPU)
+ * sustains on pulses of nsamps samples of receiver noise, timed for at
+ * least secs after a warm-up pulse. A start-up check that the encoder keeps
+ * up with the capture it is given; the host is assumed otherwise idle.
+ */
+double measure_encode_rate(size_t nsamps, size_t block_samps, size_t threads, double secs = 0.2);
+
+//! Bytes of an encoded pulse of nsamps samples, read from its table; throws if it is not within avail bytes
+size_t encoded_pulse_bytes(const uint8_t *data, size_t avail, size_t nsamps, size_t block_samps);
+
+//! Decode an encoded pulse, its blocks split over threads threads
+void decode_pulse(const uint8_t *data, size_t nbytes, size_t nsamps, size_t block_samps,
+                  std::complex<short> *out, size_t threads = 1);
+
+void print_codec_stats(std::ostream &os, const codec_stats_t &stats);
+
+#endif /* INCLUDED_CAPTURE_CODEC_HPP */
@@ -0,0 +1,242 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_CAPTURE_FILE_HPP
+#define INCLUDED_CAPTURE_FILE_HPP
+
+#include "capture_codec.hpp"
+#include "mapped_file.hpp"
+#include "pulse_writer.hpp"
+#include "sample_convert.hpp"
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Multi-pulse capture container (.cap)
+ *
+ *   [capture_header_t, padded to CAPTURE_DATA_ALIGN]
+ *   [pulse samples, pulse-major, in .dat (I,Q) order]
+ *   [capture_index_t x npulses]
+ *   [capture_tag_t x ntags]
+ *
+ * All fields are little endian. The index is written when the capture is
+ * closed; index_offset stays 0 in a capture that was never closed. Tags
+ * record the settings of ranges of pulses (sweeps); captures written
+ * before tags existed have ntags = 0 in what used to be reserved space.
+ *
+ * An encoded capture (CAPTURE_ENCODING_LOSSLESS, sc16 only) stores every
+ * pulse as a capture_codec.hpp encoded pulse instead; the index still
+ * records its length in samples. Encoded captures are version 2 so readers
+ * that predate the encoding refuse them rather than misread them.
+ */
+
+static const char CAPTURE_MAGIC[8] = {'N','3','0','0','C','A','P','\0'};
+static const uint32_t CAPTURE_VERSION = 1;
+static const uint32_t CAPTURE_VERSION_ENCODED = 2;
+static const uint64_t CAPTURE_DATA_ALIGN = 4096;
+
+static const uint32_t CAPTURE_FORMAT_SC16 = 1;
+static const uint32_t CAPTURE_FORMAT_FC32 = 2;   // complex float, e.g. range profiles
+static const uint32_t CAPTURE_FORMAT_SC8 = 3;
+
+static const uint32_t CAPTURE_ENCODING_NONE = 0;
+static const uint32_t CAPTURE_ENCODING_LOSSLESS = 1;
+
+// capture_index_t::flags
+static const uint32_t CAPTURE_FLAG_HAS_TIME_SPEC = 0x1;
+// RX channel of the pulse (0 = rx0, 1 = rx1) in bits 8..15
+static const uint32_t CAPTURE_FLAG_CHANNEL_SHIFT = 8;
+static const uint32_t CAPTURE_FLAG_CHANNEL_MASK = 0xff00;
+
+#pragma pack(push, 1)
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes;     // sizeof(capture_header_t)
+  double rate;
+  double freq;
+  double txgain;
+  double rxgain;
+  uint32_t rx_channels;      // bit mask, bit 0 = rx0, bit 1 = rx1
+  uint32_t tx_channels;      // bit mask, bit 0 = tx0, bit 1 = tx1
+  uint32_t sample_format;    // CAPTURE_FORMAT_*
+  uint32_t bytes_per_sample;
+  uint64_t waveform_hash;    // capture_hash() of the TX waveform(s)
+  uint64_t npulses;          // entries in the index
+  uint64_t data_offset;      // first byte of the sample region
+  uint64_t index_offset;     // first byte of the index table
+  uint64_t tag_offset;       // first byte of the tag table
+  uint64_t ntags;
+  uint32_t encoding;         // CAPTURE_ENCODING_*
+  uint32_t block_samps;      // samples per codec block of an encoded capture
+  uint8_t reserved[24];
+} capture_header_t;
+
+typedef struct {
+  uint64_t pulse;            // pulse number in the run
+  uint64_t offset;           // byte offset of the samples in the file
+  uint64_t nsamps;
+  int64_t time_full_secs;    // rx_metadata_t::time_spec
+  double time_frac_secs;
+  uint32_t error_code;       // rx_metadata_t::error_code
+  uint32_t flags;            // CAPTURE_FLAG_*
+} capture_index_t;
+
+typedef struct {
+  uint64_t first_pulse;      // pulses first_pulse .. first_pulse+npulses-1 were taken with
+  uint64_t npulses;          // these settings
+  double freq;
+  double txgain;
+  double rxgain;
+  int64_t time_full_secs;    // device time of the first of them
+  double time_frac_secs;
+} capture_tag_t;
+#pragma pack(pop)
+
+//! 64-bit FNV-1a, chainable through seed
+uint64_t capture_hash(const void *data, size_t nbytes, uint64_t seed = 0xcbf29ce484222325ULL);
+
+//! capture_header_t::waveform_hash of a TX waveform sequence
+uint64_t capture_waveform_hash(const std::vector<const sc16_buffer_t *> &waves);
+
+//! Header with magic/version/format filled in and everything else zeroed
+capture_header_t make_capture_header(void);
+
+//! Set sample_format and bytes_per_sample of header
+void set_capture_format(capture_header_t &header, sample_format_t format);
+
+/*!
+ * Set the encoding (and version) of header; block_samps 0 means
+ * CODEC_DEFAULT_BLOCK. Throws std::invalid_argument for lossless encoding
+ * of anything but sc16 samples, so set the sample format first.
+ */
+void set_capture_encoding(capture_header_t &header, uint32_t encoding, size_t block_samps = 0);
+
+//! CAPTURE_ENCODING_* of "none" or "lossless"; throws std::invalid_argument for others
+uint32_t parse_capture_encoding(const std::string &name);
+
+//! sample_format_t of a CAPTURE_FORMAT_*; throws std::runtime_error for unknown ones
+sample_format_t capture_sample_format(uint32_t capture_format);
+
+/*!
+ * pulse_sink that appends every pulse to one capture container. With
+ * direct_io each pulse is padded to CAPTURE_DATA_ALIGN and written with
+ * O_DIRECT; the index records the real length.
+ *
+ * write() stores the slot's own samples, which must be in the header's
+ * sample_format; append() stores other data under the slot's index entry.
+ * An encoded header makes both encode the pulse first, on the writer
+ * thread, spreading long pulses over codec_threads threads.
+ */
+class capture_file_sink : public pulse_sink
+{
+public:
+    capture_file_sink(const std::string &fname, const capture_header_t &header, bool direct_io, bool preallocate,
+                      uint64_t expected_bytes = 0, size_t codec_threads = 1);
+    ~capture_file_sink(void);
+
+    //! Append the slot (the RX CPU format, or fc32 from a ddc_sink)
+    void write(const pulse_slot &slot);
+    void close(void);
+
+    /*!
+     * Append nsamps samples of the header's sample_format from data, indexed
+     * with the pulse number, channel and metadata of slot. With direct_io
+     * data must be page aligned and padded to a whole page.
+     */
+    void append(const pulse_slot &slot, const void *data, size_t nsamps);
+
+    /*!
+     * Tag a range of pulse numbers with the settings they were taken with.
+     * May be called while pulses are being written, but not concurrently
+     * with close().
+     */
+    void add_tag(const capture_tag_t &tag);
+
+    bool encoded(void) const { return _encoder.get() != NULL; }
+    //! Encoder statistics of an encoded capture
+    const codec_stats_t &get_codec_stats(void) const { return _encoder->get_stats(); }
+
+private:
+    void write_at(const void *data, size_t nbytes, uint64_t offset);
+    //! Write nbytes of data for a pulse of nsamps samples and index it
+    void store(const pulse_slot &slot, const void *data, size_t nbytes, size_t nsamps);
+
+    std::string _fname;
+    capture_header_t _header;
+    bool _direct_io;
+    int _fd;
+    uint64_t _offset;
+    std::vector<capture_index_t> _index;
+    std::vector<capture_tag_t> _tags;
+    std::unique_ptr<capture_encoder> _encoder;
+};
+
+/*!
+ * Read access to a closed capture container. The file is mapped, so
+ * samples() returns a pointer straight into the mapping. Pulses of an
+ * encoded capture are only available decoded, through read().
+ */
+class capture_file_reader : boost::noncopyable
+{
+public:
+    //! Throws std::runtime_error if the file is not a valid capture
+    capture_file_reader(const std::string &fname);
+
+    const capture_header_t &header(void) const { return *_header; }
+    size_t size(void) const { return (size_t)_header->npulses; }
+    const capture_index_t &index(size_t k) const;
+    bool encoded(void) const { return _header->encoding != CAPTURE_ENCODING_NONE; }
+    //! sc16 samples of pulse k; throws std::runtime_error for other formats and encoded captures
+    const std::complex<short> *samples(size_t k) const;
+    //! Raw samples of pulse k in the header's sample_format; throws std::runtime_error for encoded captures
+    const void *data(size_t k) const;
+
+    //! Pulse k converted to std::complex<T> (short, float or int8_t), whatever the capture holds
+    template<typename T> void read(size_t k, std::complex<T> *out) const {
+        size_t nsamps = (size_t)index(k).nsamps;
+        if (not encoded())
+            convert_samples(_format, data(k), sample_traits<T>::format, out, nsamps);
+        else if (sample_traits<T>::format == SAMPLE_FORMAT_SC16)
+            decode(k, reinterpret_cast<std::complex<short> *>(out));
+        else {
+            std::vector<std::complex<short>> wide(nsamps);
+            decode(k, wide.data());
+            convert_samples(SAMPLE_FORMAT_SC16, wide.data(), sample_traits<T>::format, out, nsamps);
+        }
+    }
+
+    //! Decode pulse k of an encoded capture
+    void decode(size_t k, std::complex<short> *out) const;
+
+    size_t ntags(void) const { return (size_t)_header->ntags; }
+    const capture_tag_t &tag(size_t i) const;
+    //! Tag covering pulse number pulse, or NULL
+    const capture_tag_t *find_tag(uint64_t pulse) const;
+
+private:
+    mapped_file _file;
+    const capture_header_t *_header;
+    sample_format_t _format;
+    const capture_index_t *_index;
+    const capture_tag_t *_tags;
+    std::vector<size_t> _coded_bytes;   // per pulse of an encoded capture
+};
+
+//! True if fname starts with the capture magic
+bool is_capture_file(const std::string &fname);
+
+/*!
+ * Write every pulse of a capture to its own file (see pulse_filename()),
+ * decoded and converted to sc16 .dat samples: sc8 is widened and fc32
+ * rounded and saturated to sc16 counts. With an fname ending in .fc32
+ * the pulses are written as fc32 (I,Q order) instead, which keeps range
+ * profiles and fc32 captures exact.
+ */
+void export_capture_pulses(const std::string &capture_fname, const std::string &fname);
+
+#endif /* INCLUDED_CAPTURE_FILE_HPP */
@@ -0,0 +1,144 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_DDC_HPP
+#define INCLUDED_DDC_HPP
+
+#include "aligned_buffer.hpp"
+#include "fft.hpp"
+#include "pulse_arena.hpp"
+#include "pulse_writer.hpp"
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+//! out[i] = in[i]*lo[i] of n sc16 samples (NEON / SSE2 / AVX2)
+void mix_sc16(const std::complex<short> *in, const fc32_t *lo, fc32_t *out, size_t n);
+
+typedef struct {
+  size_t decim;      // integer decimation factor, 1 for a frequency shift only
+  double freq;       // offset from the RF center moved to 0 Hz
+  double bw;         // bandwidth kept, Hz (0: 0.8 of the output rate, all of it without decimation)
+  size_t taps;       // FIR length (0: enough for a Blackman window to reach the aliased band)
+  bool fc32;         // fc32 output instead of sc16
+} ddc_config_t;
+
+ddc_config_t default_ddc_config(void);
+
+/*!
+ * Digital downconverter: an NCO moving config.freq to 0 Hz followed by a
+ * windowed sinc lowpass FIR, evaluated only at the output samples it keeps,
+ * so it costs taps/decim complex MACs per input sample like a polyphase
+ * decimator. Output sample m is aligned with input sample m*decim: the
+ * filter is centered on it, looking (taps - 1)/2 samples ahead, so range
+ * bins and time stamps keep their meaning at the lower rate.
+ *
+ * A pulse or stream is fed by reset(), any number of process() calls and,
+ * for a pulse, flush(), which supplies zeros past its end. The NCO phase
+ * starts at 0 at reset(), so every pulse of a train is shifted the same way.
+ * Not thread safe; use one filter per thread.
+ */
+class ddc_filter
+{
+public:
+    //! Throws std::invalid_argument for a decimation of 0 or a bandwidth the output rate cannot hold
+    ddc_filter(const ddc_config_t &config, double rate);
+
+    size_t decim(void) const { return _decim; }
+    size_t ntaps(void) const { return _ntaps; }
+    double rate(void) const { return _rate; }
+    double out_rate(void) const { return _rate/_decim; }
+
+    //! Samples decimate() makes of a pulse of n samples
+    size_t pulse_output(size_t n) const { return (n + _decim - 1)/_decim; }
+
+    //! Most samples one process() or flush() call makes from n samples
+    size_t max_output(size_t n) const { return n/_decim + _ntaps/_decim + 2; }
+
+    void reset(void);
+    size_t process(const std::complex<short> *in, size_t n, fc32_t *out);
+    size_t flush(fc32_t *out);
+
+    //! reset(), process() and flush() of one pulse
+    size_t decimate(const std::complex<short> *in, size_t n, fc32_t *out);
+
+    //! Input samples since reset() and the input sample the next output is aligned with
+    uint64_t consumed(void) const { return _consumed; }
+    uint64_t next_output(void) const { return _next_out*_decim; }
+
+private:
+    void append(size_t n);
+    size_t drain(fc32_t *out);
+
+    double _rate;
+    size_t _decim;
+    bool _mix;                                         // the NCO is not a no-op
+    size_t _ntaps;                                     // taps of the filter
+    size_t _padded;                                    // ... zero padded to whole vectors
+    size_t _lookahead;                                 // (ntaps - 1)/2
+    std::vector<float, aligned_allocator<float>> _taps_iq;   // reversed, every tap doubled
+    uint64_t _phase_step;                              // NCO, turns in 64 bit fixed point
+    fc32_buffer_t _lo;                                 // NCO samples from phase 0
+    fc32_buffer_t _lo_rot;                             // ... rotated to the current phase
+    fc32_buffer_t _buf;                                // mixed input, history first
+    size_t _fill;
+    uint64_t _consumed;
+    uint64_t _next_out;
+    int64_t _buf_start;                                // stream sample number of _buf[0]
+};
+
+typedef struct {
+  size_t pulses;        // pulses (or stream chunks) downconverted
+  uint64_t samples_in;
+  uint64_t samples_out;
+  double dsp_secs;      // time spent filtering
+} ddc_stats_t;
+
+/*!
+ * pulse_sink downconverting every pulse into a slot of out_arena and
+ * submitting it to the pulse_writer out, so the DSP runs on the thread of
+ * the writer feeding this sink and storage on out's thread. With fc32
+ * output the slots hold fc32 samples in their storage (nsamps counts fc32
+ * samples), which only a CAPTURE_FORMAT_FC32 capture_file_sink can take.
+ * With continuous the slots are chunks of one stream and the filter state
+ * carries across them; the time stamp of an output chunk is moved to its
+ * first sample. close() closes out.
+ */
+class ddc_sink : public pulse_sink
+{
+public:
+    typedef boost::shared_ptr<ddc_sink> sptr;
+
+    ddc_sink(const ddc_config_t &config, double rate, pulse_arena::sptr out_arena,
+             boost::shared_ptr<pulse_writer> out, bool continuous = false);
+
+    void write(const pulse_slot &slot);
+    void close(void);
+
+    //! Only valid once the pulse_writer feeding this sink has been closed
+    const ddc_stats_t &get_stats(void) const { return _stats; }
+
+    //! Slot capacity out_arena needs for input slots of n samples
+    static size_t out_capacity(const ddc_config_t &config, double rate, size_t n);
+
+private:
+    //! Pass the n samples in _work on as a slot like slot, its time moved by shift input samples
+    void submit(const pulse_slot &slot, size_t n, int64_t shift);
+
+    ddc_filter _filter;
+    bool _fc32;
+    pulse_arena::sptr _arena;
+    boost::shared_ptr<pulse_writer> _out;
+    bool _continuous;
+    bool _started;
+    pulse_slot _last;                                  // metadata of the last stream chunk
+    fc32_buffer_t _work;
+    ddc_stats_t _stats;
+};
+
+void print_ddc_stats(std::ostream &os, const ddc_stats_t &stats, size_t decim);
+
+#endif /* INCLUDED_DDC_HPP */
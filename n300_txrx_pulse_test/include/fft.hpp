@@ -0,0 +1,56 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_FFT_HPP
+#define INCLUDED_FFT_HPP
+
+#include "aligned_buffer.hpp"
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef std::complex<float> fc32_t;
+typedef std::vector<fc32_t, aligned_allocator<fc32_t>> fc32_buffer_t;
+
+//! Smallest power of two >= n
+size_t next_pow2(size_t n);
+
+/*!
+ * In-place radix-2 complex FFT of one fixed power-of-two size. Twiddle
+ * factors (laid out per stage, so every butterfly pass reads them
+ * sequentially) and the bit reversal permutation are computed once when the
+ * plan is made; transforms then allocate nothing. A plan is read-only after
+ * construction and can be shared between threads.
+ */
+class fft_plan
+{
+public:
+    //! Throws std::invalid_argument unless n is a power of two >= 2
+    explicit fft_plan(size_t n);
+
+    size_t size(void) const { return _n; }
+
+    //! X[k] = sum x[n] exp(-2 pi i k n / N)
+    void forward(fc32_t *data) const;
+
+    //! x[n] = 1/N sum X[k] exp(+2 pi i k n / N)
+    void inverse(fc32_t *data) const;
+
+private:
+    void transform(fc32_t *data, const fc32_t *twiddle) const;
+
+    size_t _n;
+    std::vector<uint32_t> _bitrev;
+    fc32_buffer_t _twiddle;        // forward twiddles, stage by stage
+    fc32_buffer_t _twiddle_inv;    // their conjugates
+};
+
+//! out[i] = a[i]*b[i]; out may alias a or b
+void complex_multiply(const fc32_t *a, const fc32_t *b, fc32_t *out, size_t n);
+
+//! out[i] = a[i]*conj(b[i]); out may alias a or b
+void complex_multiply_conj(const fc32_t *a, const fc32_t *b, fc32_t *out, size_t n);
+
+#endif /* INCLUDED_FFT_HPP */
@@ -0,0 +1,45 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_FILE2WAVE_HPP
+#define INCLUDED_FILE2WAVE_HPP
+
+#include "mapped_file.hpp"
+#include "sample_convert.hpp"
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*!
+ * Append the samples of a .bin/.dat/.ref file to data. The file is mapped
+ * rather than read, and the I/Q swap for .bin files is decided once per
+ * file and done by the vectorized converters. Matches file2wave.m.
+ *
+ * .sc8 and .fc32 files (I,Q order, see file_sample_format()) are converted
+ * to the type of data on load; the converter is picked at compile time from
+ * the file's and the buffer's sample type.
+ */
+template<typename data_type, typename alloc_type> void file2wave(std::vector<std::complex<data_type>, alloc_type> &data, const std::string &fname){
+    mapped_file file(fname);
+    sample_format_t format = file_sample_format(fname);
+    size_t nsamps = file.size()/sample_size(format);
+    size_t offset = data.size();
+    data.resize(offset + nsamps);
+    if (nsamps == 0)
+        return;
+    switch (format){
+    case SAMPLE_FORMAT_SC8:
+        convert_samples(file.as<sc8_t>(), &data[offset], nsamps);
+        break;
+    case SAMPLE_FORMAT_FC32:
+        convert_samples(file.as<std::complex<float>>(), &data[offset], nsamps);
+        break;
+    case SAMPLE_FORMAT_SC16:
+        convert_sc16(file.as<std::complex<short>>(), &data[offset], nsamps, file_iq_swapped(fname));
+        break;
+    }
+}
+
+#endif /* INCLUDED_FILE2WAVE_HPP */
@@ -0,0 +1,164 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_IMPULSE_DETECT_HPP
+#define INCLUDED_IMPULSE_DETECT_HPP
+
+#include "aligned_buffer.hpp"
+#include "pulse_writer.hpp"
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+//! |x| of n sc16 samples (NEON / SSE2 / AVX2); in and out may be unaligned
+void magnitude_sc16(const std::complex<short> *in, float *out, size_t n);
+
+//! max |x[i] - center| of n floats (NEON / SSE2 / AVX2)
+float max_deviation(const float *x, size_t n, float center);
+
+typedef struct {
+  size_t block;          // samples per local median/MAD estimate
+  size_t estimate;       // evenly spaced samples of a block the estimate is taken from (0 for all)
+  double threshold;      // flag |mag - median| > threshold*sigma, sigma = 1.4826*MAD
+  double min_deviation;  // ... and > this many sc16 counts (guards MAD = 0 on quiet input)
+  size_t merge;          // flagged samples closer than this are one impulse
+  size_t max_width;      // wider runs are level steps, not impulses
+  size_t max_impulses;   // impulses kept; later ones are only counted
+} impulse_config_t;
+
+impulse_config_t default_impulse_config(void);
+
+//! One impulse: a run of flagged samples
+typedef struct {
+  size_t pulse;          // pulse (0 for a continuous stream)
+  size_t channel;
+  uint64_t offset;       // first flagged sample from the start of the pulse / stream
+  uint32_t width;        // samples from the first to the last flagged sample
+  float peak;            // magnitude of the strongest sample, sc16 counts
+  float median;          // local median magnitude it deviated from
+  float score;           // largest deviation in sigmas
+} impulse_t;
+
+typedef struct {
+  uint64_t samples;      // samples scanned
+  size_t blocks;
+  size_t impulses;       // impulses found, including those not kept
+  size_t dropped;        // impulses past max_impulses
+  size_t steps;          // level steps (pulse edges), ignored
+  size_t pulses;         // pulses (streams) scanned
+  size_t pulses_hit;     // ... with at least one impulse
+  double scan_secs;      // time spent in scan()
+} impulse_stats_t;
+
+/*!
+ * Flags samples whose magnitude deviates from a robust local estimate. The
+ * input is cut into blocks of config.block samples; every block's median
+ * and MAD are taken from config.estimate of its own magnitudes, so a few
+ * impulses do not move the estimate while the signal level (noise floor,
+ * pulse envelope) is tracked block by block along the stream. Blocks whose
+ * largest deviation is under the threshold, nearly all of them, cost one
+ * vector pass besides the estimate. A run of flagged samples wider than
+ * config.max_width, or at a block boundary across which the level changes,
+ * is a level step such as a pulse edge and not an impulse.
+ *
+ * A pulse or stream is scanned by begin(), any number of scan() calls and
+ * end(); samples are numbered from begin(), so a stream may be fed in
+ * chunks of any size. All buffers, including the impulse list, are sized in
+ * the constructor, so scanning never allocates. Not thread safe; use one
+ * detector per thread.
+ */
+class impulse_detector
+{
+public:
+    //! Throws std::invalid_argument for a block shorter than 16 samples
+    impulse_detector(const impulse_config_t &config);
+
+    void begin(size_t pulse, size_t channel);
+    void scan(const std::complex<short> *samps, size_t n);
+    //! Scans the partial last block
+    void end(void);
+
+    const std::vector<impulse_t> &impulses(void) const { return _impulses; }
+    const impulse_stats_t &get_stats(void) const { return _stats; }
+
+    //! Forget the impulses and statistics
+    void clear(void);
+
+private:
+    void scan_block(size_t n);
+    void finish_run(void);
+
+    impulse_config_t _config;
+    std::vector<float, aligned_allocator<float>> _mag;   // magnitudes of the current block
+    std::vector<float> _sorted;                          // scratch for the median/MAD
+    size_t _fill;
+    size_t _pulse;
+    size_t _channel;
+    uint64_t _offset;                                    // sample number of _mag[0]
+    bool _hit;                                           // this pulse has an impulse
+    bool _in_run;                                        // a run of flagged samples may still grow
+    bool _run_kept;                                      // ... and is _impulses.back()
+    uint64_t _run_first;                                 // its first and last flagged sample
+    uint64_t _run_last;
+    bool _run_step;                                      // ... is part of a level step
+    bool _run_at_end;                                    // ... reaches the end of the last block,
+    float _run_median;                                   // whose median and limit were these
+    float _run_limit;
+    float _median;                                       // estimate of the last full block
+    float _sigma;
+    bool _have_estimate;
+    std::vector<impulse_t> _impulses;
+    impulse_stats_t _stats;
+};
+
+typedef struct {
+  size_t impulses;
+  size_t spp;               // samples per packet the offsets are compared to
+  size_t tolerance;         // samples
+  uint64_t spacing;         // most common spacing of successive impulses in a pulse, 0 if none
+  double spacing_fraction;  // spacings within tolerance of it
+  size_t phase;             // most common offset modulo spp
+  double phase_fraction;    // impulses within tolerance of that phase
+  double boundary_fraction; // impulses within tolerance of a packet boundary (phase 0)
+} impulse_periodicity_t;
+
+/*!
+ * How periodic the impulses are and how they line up with packet
+ * boundaries. The first sample of a pulse or stream starts a packet, so
+ * packet boundaries are the multiples of spp.
+ */
+impulse_periodicity_t impulse_periodicity(const std::vector<impulse_t> &impulses, size_t spp, size_t tolerance = 2);
+
+void print_impulse_report(std::ostream &os, const impulse_stats_t &stats, const impulse_periodicity_t &periodicity);
+
+/*!
+ * pulse_sink scanning every pulse for impulses before passing it on to
+ * next (which may be NULL). With continuous the slots are chunks of one
+ * stream (stream_capture) and are scanned as one pulse. Runs on the writer
+ * thread, so RX never waits for the scan.
+ */
+class impulse_sink : public pulse_sink
+{
+public:
+    typedef boost::shared_ptr<impulse_sink> sptr;
+
+    impulse_sink(const impulse_config_t &config, pulse_sink::sptr next, bool continuous = false);
+
+    void write(const pulse_slot &slot);
+    void close(void);
+
+    //! Only valid once the pulse_writer feeding this sink has been closed
+    const impulse_detector &detector(void) const { return _detector; }
+
+private:
+    impulse_detector _detector;
+    pulse_sink::sptr _next;
+    bool _continuous;
+    bool _started;
+};
+
+#endif /* INCLUDED_IMPULSE_DETECT_HPP */
@@ -0,0 +1,81 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_LOOPBACK_DEVICE_HPP
+#define INCLUDED_LOOPBACK_DEVICE_HPP
+
+#include "radio_device.hpp"
+#include <boost/shared_ptr.hpp>
+
+typedef struct {
+  double rate;           // sample rate of the simulated device timeline
+  size_t spp;            // samples per packet returned by recv(one_packet)
+  size_t delay;          // TX->RX delay in samples
+  double gain;           // linear TX->RX loopback gain
+  double noise;          // RX noise standard deviation in sc16 counts
+  double overflow_prob;  // chance that a recv() call reports an overflow
+  unsigned int seed;
+  stream_formats_t formats;
+} loopback_config_t;
+
+loopback_config_t default_loopback_config(double rate);
+
+class loopback_air;
+
+/*!
+ * Software stand-in for the N300. The device time runs in real time at the
+ * configured sample rate and every timed TX burst is echoed into all RX
+ * channels after a fixed delay, with optional noise and injected overflows.
+ *
+ * The streamers honor the same metadata as the UHD ones: timed
+ * start_of_burst/end_of_burst bursts, late TX bursts are dropped and
+ * reported as EVENT_CODE_TIME_ERROR, stream commands with a time_spec in
+ * the past return ERROR_CODE_LATE_COMMAND, and recv() returns
+ * ERROR_CODE_TIMEOUT when no samples arrive in time. The streamers honor
+ * config.formats like the UHD converters: an sc8 wire quantizes the
+ * samples to 8 bits and RX samples are delivered in their CPU format.
+ * Frequency and gain settings are stored and read back but do not change
+ * the echo.
+ */
+class loopback_device : public radio_device
+{
+public:
+    static sptr make(const loopback_config_t &config);
+
+    std::string get_name(void) const { return "loopback"; }
+
+    double get_rate(void);
+    uhd::time_spec_t get_time_now(void);
+    uhd::time_spec_t get_time_last_pps(void);
+    void set_time_now(const uhd::time_spec_t &time_spec);
+    void set_time_next_pps(const uhd::time_spec_t &time_spec);
+    std::string get_time_source(void) { return "internal"; }
+    int get_gps_time(int &gps_time);
+
+    double get_freq(size_t chan);
+    void set_freq(size_t chan, double freq);
+    double get_rx_gain(size_t chan);
+    void set_rx_gain(size_t chan, double gain);
+    double get_tx_gain(size_t chan);
+    void set_tx_gain(size_t chan, double gain);
+    //! Settings are stored at once; they do not change the echo anyway
+    void set_command_time(size_t, const uhd::time_spec_t &) {}
+    void clear_command_time(size_t) {}
+
+    uhd::rx_streamer::sptr get_rx_stream(size_t chan);
+    uhd::tx_streamer::sptr get_tx_stream(size_t chan);
+    stream_formats_t get_stream_formats(void);
+
+private:
+    loopback_device(void) : _freq(), _rx_gain(), _tx_gain() {}
+
+    boost::shared_ptr<loopback_air> _air;
+    uhd::rx_streamer::sptr _rx_stream[2];
+    uhd::tx_streamer::sptr _tx_stream[2];
+    double _freq[2];
+    double _rx_gain[2];
+    double _tx_gain[2];
+};
+
+#endif /* INCLUDED_LOOPBACK_DEVICE_HPP */
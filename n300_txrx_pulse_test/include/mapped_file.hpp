@@ -0,0 +1,36 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_MAPPED_FILE_HPP
+#define INCLUDED_MAPPED_FILE_HPP
+
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*!
+ * Read-only memory mapping of a whole file. The mapping is advised for
+ * sequential access and released when the object goes out of scope.
+ * Throws std::runtime_error("Could not open file") like file2wave does.
+ */
+class mapped_file : boost::noncopyable
+{
+public:
+    mapped_file(const std::string &fname);
+    ~mapped_file(void);
+
+    const uint8_t *data(void) const { return _data; }
+    size_t size(void) const { return _size; }
+
+    template<typename T> const T *as(size_t byte_offset = 0) const {
+        return reinterpret_cast<const T *>(_data + byte_offset);
+    }
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+};
+
+#endif /* INCLUDED_MAPPED_FILE_HPP */
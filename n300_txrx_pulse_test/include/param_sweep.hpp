@@ -0,0 +1,93 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PARAM_SWEEP_HPP
+#define INCLUDED_PARAM_SWEEP_HPP
+
+#include "capture_file.hpp"
+#include "pulse_train.hpp"
+#include "radio_device.hpp"
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*!
+ * Values of one swept parameter: a comma separated list ("0,10,20") or an
+ * inclusive range start:stop:step ("0:30:5", step may be negative).
+ * Throws std::invalid_argument for an empty or malformed spec.
+ */
+std::vector<double> parse_sweep_values(const std::string &spec);
+
+typedef struct {
+  double freq;
+  double txgain;
+  double rxgain;
+} sweep_point_t;
+
+/*!
+ * Every combination of the values, frequency outermost and TX gain
+ * innermost, so the slow LO retunes happen as rarely as possible.
+ */
+std::vector<sweep_point_t> make_sweep_points(const std::vector<double> &freqs,
+                                             const std::vector<double> &txgains,
+                                             const std::vector<double> &rxgains);
+
+typedef struct {
+  pulse_train_config_t train;  // the train run at every point
+  double lead;                 // retune command time ahead of the device time, seconds
+  double settle;               // from the retune command time to the point's first pulse, seconds
+                               // (at least lead after the retune calls return)
+} sweep_config_t;
+
+typedef struct {
+  sweep_point_t point;         // settings read back from the radio once the point ran
+  uint64_t first_pulse;        // pulse number of the point's first pulse
+  uhd::time_spec_t t0;         // device time of that pulse
+  pulse_train_stats_t train;
+  double retune_secs;          // host time spent issuing the retune
+} sweep_result_t;
+
+/*!
+ * Runs a pulse train at every point of a parameter sweep in one device
+ * session. Between points only the settings that change are sent, all
+ * with the same command time, config.lead ahead of the device time; the
+ * next train starts config.settle after it. The previous point's pulses
+ * are still being written (or analyzed) by the pulse_writer thread while
+ * the radio retunes and the next train runs, so a point costs its pulses
+ * plus the settle time instead of a whole program start and usrpInit().
+ *
+ * Pulses are numbered across the whole sweep, point*npulses + k, so one
+ * capture holds them all; see capture_tags().
+ */
+class param_sweep
+{
+public:
+    //! As pulse_train::pulse_handler_t, plus the sweep point of the pulse
+    typedef std::function<void(size_t point, pulse_slot *slot)> pulse_handler_t;
+
+    param_sweep(radio_device::sptr device, const sweep_config_t &config, ch_select_t ch_select);
+
+    //! Throws std::runtime_error like pulse_train::run()
+    std::vector<sweep_result_t> run(const std::vector<sweep_point_t> &points,
+                                    const std::vector<const sc16_buffer_t *> &waves,
+                                    pulse_arena::sptr arena,
+                                    const pulse_handler_t &handler);
+
+private:
+    void retune(const sweep_point_t &point, const sweep_point_t *last, const uhd::time_spec_t &time_spec);
+    sweep_point_t read_back(const sweep_point_t &requested);
+
+    radio_device::sptr _device;
+    sweep_config_t _config;
+    ch_select_t _ch_select;
+    pulse_train _train;
+};
+
+//! One capture_tag_t per sweep point
+std::vector<capture_tag_t> capture_tags(const std::vector<sweep_result_t> &results, size_t npulses);
+
+void print_sweep_results(std::ostream &os, const std::vector<sweep_result_t> &results, double wall_secs);
+
+#endif /* INCLUDED_PARAM_SWEEP_HPP */
@@ -0,0 +1,90 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_ARENA_HPP
+#define INCLUDED_PULSE_ARENA_HPP
+
+#include "aligned_buffer.hpp"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+static const size_t PAGE_SIZE_BYTES = 4096;
+
+typedef std::vector<std::complex<short>, aligned_allocator<std::complex<short>, PAGE_SIZE_BYTES>> sc16_page_buffer_t;
+
+//! Slot capacity (in sc16 samples) holding nsamps samples of sample_bytes each
+inline size_t slot_samps(size_t nsamps, size_t sample_bytes){
+    return (nsamps*sample_bytes + sizeof(std::complex<short>) - 1)/sizeof(std::complex<short>);
+}
+
+//! One pulse worth of arena storage, received into directly
+struct pulse_slot {
+    size_t index;                  // pulse number
+    size_t channel;                // RX channel (RADIO_CHAN_*)
+    size_t wave;                   // TX waveform of the pulse, in the run's waveform list
+    size_t nsamps;                 // valid samples in samps
+    std::complex<short> *samps;    // page aligned, capacity samples, page padded
+                                   // (RX streamer CPU format samples, see slot_samps())
+    size_t capacity;
+    // rx_metadata_t of the pulse
+    bool has_time_spec;
+    int64_t time_full_secs;
+    double time_frac_secs;
+    uint32_t error_code;
+    size_t refs;                   // stages still holding the slot (arena mutex)
+};
+
+typedef struct {
+  size_t dropped;       // acquire() calls that found no free slot and dropped
+  size_t blocked;       // acquire() calls that had to wait for a slot
+  double max_block_secs;
+} pulse_arena_stats_t;
+
+/*!
+ * Pulse storage for the whole run: one page aligned allocation carved into
+ * nslots fixed size slots. The receive path acquire()s a slot and recv()s
+ * straight into it; every stage the slot is handed to (writer, DSP) calls
+ * release() when done and the last release recycles the slot.
+ */
+class pulse_arena : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<pulse_arena> sptr;
+
+    pulse_arena(size_t nslots, size_t slot_samps, bool drop);
+
+    /*!
+     * Get a free slot holding one reference. Waits for a release when all
+     * slots are in use, or returns NULL (a dropped pulse) if drop is set.
+     */
+    pulse_slot *acquire(void);
+
+    //! Add references for additional stages the slot is handed to
+    void retain(pulse_slot *slot, size_t refs = 1);
+
+    //! Drop one reference; the slot is free again when none are left
+    void release(pulse_slot *slot);
+
+    size_t size(void) const { return _slots.size(); }
+    size_t slot_capacity(void) const { return _capacity; }
+
+    pulse_arena_stats_t get_stats(void);
+
+private:
+    sc16_page_buffer_t _storage;
+    size_t _capacity;
+    bool _drop;
+    std::vector<pulse_slot> _slots;
+    std::vector<pulse_slot *> _free;
+    std::mutex _mutex;
+    std::condition_variable _free_cond;
+    pulse_arena_stats_t _stats;
+};
+
+#endif /* INCLUDED_PULSE_ARENA_HPP */
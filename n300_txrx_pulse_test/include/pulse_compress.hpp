@@ -0,0 +1,93 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_COMPRESS_HPP
+#define INCLUDED_PULSE_COMPRESS_HPP
+
+#include "aligned_buffer.hpp"
+#include "capture_file.hpp"
+#include "fft.hpp"
+#include "pulse_writer.hpp"
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <ostream>
+#include <vector>
+
+/*!
+ * FFT matched filter for one TX waveform. Range bin k of a received pulse
+ * x is sum_m x[k+m]*conj(ref[m]) / sum_m |ref[m]|^2, so an echo a*ref
+ * starting at sample k shows up as a peak of height |a| in bin k. The
+ * correlation is done by overlap-save: blocks of fft_size() input samples,
+ * stepping by fft_size() - ref_size() + 1, are multiplied in the frequency
+ * domain by the reference spectrum computed once in the constructor.
+ *
+ * Not thread safe (compress() uses a work buffer of the object); use one
+ * compressor per thread.
+ */
+class pulse_compressor
+{
+public:
+    /*!
+     * fft_size 0 picks the smallest power of two that either covers a whole
+     * pulse of nsamps samples in one block or is 4x the waveform length.
+     * Throws std::invalid_argument for an empty or all-zero waveform or an
+     * fft_size that is not a power of two >= the waveform length.
+     */
+    pulse_compressor(const sc16_buffer_t &ref, size_t nsamps, size_t fft_size = 0);
+
+    size_t ref_size(void) const { return _ref_size; }
+    size_t fft_size(void) const { return _plan.size(); }
+
+    //! n range bins of the n received samples in into out
+    void compress(const std::complex<short> *in, size_t n, fc32_t *out);
+
+private:
+    size_t _ref_size;
+    fft_plan _plan;
+    fc32_buffer_t _ref_spectrum;   // FFT of the zero padded waveform / its energy
+    fc32_buffer_t _work;
+};
+
+typedef struct {
+  size_t pulses;          // pulses compressed
+  double peak_db_min;     // 20*log10 of the strongest range bin, dB relative to the TX waveform
+  double peak_db_max;
+  double peak_db_sum;
+  size_t last_peak_bin;   // strongest range bin of the last pulse
+  double compress_secs;   // time spent in compress()
+} pulse_compress_stats_t;
+
+/*!
+ * pulse_sink running every received pulse through the matched filter of the
+ * waveform it was sent with (waves[slot.wave], which the pulse train and
+ * pulse loop fill in as they cycle through them) and appending the range profile
+ * to an fc32 capture container. The raw pulse also goes to raw unless that
+ * is NULL. Runs on the writer thread, so RX never waits for the FFTs.
+ */
+class compress_sink : public pulse_sink
+{
+public:
+    typedef boost::shared_ptr<compress_sink> sptr;
+
+    //! profiles must be a capture of CAPTURE_FORMAT_FC32
+    compress_sink(const std::vector<const sc16_buffer_t *> &waves, size_t nsamps,
+                  pulse_sink::sptr raw, boost::shared_ptr<capture_file_sink> profiles);
+
+    void write(const pulse_slot &slot);
+    void close(void);
+
+    //! Only valid once the pulse_writer feeding this sink has been closed
+    const pulse_compress_stats_t &get_stats(void) const { return _stats; }
+
+private:
+    std::vector<boost::shared_ptr<pulse_compressor>> _compressors;
+    pulse_sink::sptr _raw;
+    boost::shared_ptr<capture_file_sink> _profiles;
+    std::vector<fc32_t, aligned_allocator<fc32_t, PAGE_SIZE_BYTES>> _profile;
+    pulse_compress_stats_t _stats;
+};
+
+void print_compress_stats(std::ostream &os, const pulse_compress_stats_t &stats);
+
+#endif /* INCLUDED_PULSE_COMPRESS_HPP */
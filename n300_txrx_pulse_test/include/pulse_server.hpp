@@ -0,0 +1,97 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_SERVER_HPP
+#define INCLUDED_PULSE_SERVER_HPP
+
+#include "pulse_train.hpp"
+#include "radio_device.hpp"
+#include "waveform_cache.hpp"
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+/*!
+ * One pulse job. On the socket a job is a single line of whitespace
+ * separated key=value pairs, e.g.
+ *
+ *   freq=2.4e9 rxgain=20 ch_rx=2 wavefile=chirp.bin nsamps=4096 npulses=100 pri=0.001
+ *
+ * Keys that are left out keep the server's defaults (its command line).
+ */
+typedef struct {
+  double freq;
+  double txgain;
+  double rxgain;
+  int ch_rx;                           // -1, 0, 1 or 2 (both), as --ch_rx
+  int ch_tx;                           // -1, 0 or 1, as --ch_tx
+  std::vector<std::string> wavefiles;  // wavefile=a.bin,b.bin cycles pulse by pulse; entries may be
+                                       // synthesizer specs (wavefile=lfm:bw=50e6:len=2048)
+  size_t nsamps;
+  size_t npulses;
+  double pri;                          // <= 0 picks the shortest PRI that fits the pulse
+  size_t depth;
+  double secs;                         // lead time of the first pulse
+  std::string file;                    // capture path; empty sends the samples back
+} pulse_job_t;
+
+//! Parse a job line on top of defaults; throws std::invalid_argument
+pulse_job_t parse_pulse_job(const std::string &line, const pulse_job_t &defaults);
+
+typedef struct {
+  std::string socket_path;
+  pulse_train_config_t train;   // threading/scheduling/timeouts of every job
+  size_t slots;                 // pulse arena slots per job
+} pulse_server_config_t;
+
+/*!
+ * Daemon mode: serve pulse jobs over a Unix domain socket with a radio
+ * that stays initialized, streamers and all, between jobs. Waveforms
+ * stay in a waveform_cache and frequency and gains are only set when a
+ * job asks for different values than the radio already has.
+ *
+ * Clients connect, send one job line and get one reply line:
+ *
+ *   OK file=<path> npulses=<n> errors=<n>                  (job with file=)
+ *   OK npulses=<n> nchans=<c> nsamps=<s> errors=<n> bytes=<b>
+ *   ERROR <message>
+ *
+ * The second form is followed by b bytes of interleaved sc16 samples,
+ * pulse by pulse and channel by channel within a pulse, each pulse
+ * zero padded to nsamps. The line "ping" is answered with "OK" and
+ * "quit" stops the server.
+ */
+class pulse_server : boost::noncopyable
+{
+public:
+    pulse_server(radio_device::sptr device, const pulse_server_config_t &config, const pulse_job_t &defaults);
+    ~pulse_server(void);
+
+    //! Serve jobs one client at a time until a client sends "quit"
+    void run(void);
+
+private:
+    void apply_settings(const pulse_job_t &job, const ch_select_t &ch_select);
+    void serve_client(int fd, bool &quit);
+    void run_job(int fd, const pulse_job_t &job);
+
+    radio_device::sptr _device;
+    pulse_server_config_t _config;
+    pulse_job_t _defaults;
+    waveform_cache _waves;
+    int _listen_fd;
+    // last applied settings per channel
+    double _freq[2];
+    double _rx_gain[2];
+    double _tx_gain[2];
+};
+
+/*!
+ * Send one job line to a server and wait for the reply. Samples in the
+ * reply are written to fname. Returns the reply line; throws
+ * std::runtime_error if the server cannot be reached.
+ */
+std::string pulse_server_request(const std::string &socket_path, const std::string &job, const std::string &fname);
+
+#endif /* INCLUDED_PULSE_SERVER_HPP */
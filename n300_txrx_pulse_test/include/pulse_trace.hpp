@@ -0,0 +1,75 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_TRACE_HPP
+#define INCLUDED_PULSE_TRACE_HPP
+
+#include <boost/noncopyable.hpp>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// stages timed per pulse
+enum trace_stage_t {
+  TRACE_SEND = 0,       // tx_streamer::send() of the burst
+  TRACE_STREAM_CMD,     // rx_streamer::issue_stream_cmd()
+  TRACE_RECV,           // recv() of the whole pulse
+  TRACE_WRITE,          // pulse_sink::write() on the writer thread
+  TRACE_NUM_STAGES
+};
+
+static const size_t TRACE_MAX_CHANS = 2;
+
+typedef struct {
+  int64_t start_ns[TRACE_NUM_STAGES];  // monotonic, relative to the trace start
+  int64_t dur_ns[TRACE_NUM_STAGES];    // -1 if the stage did not run
+  bool received;
+  bool has_time_error;
+  int64_t time_error;                  // RX time_spec minus requested time, in samples
+  uint32_t error_code;                 // rx_metadata_t::error_code
+} pulse_trace_record_t;
+
+/*!
+ * Per pulse timing of the hot path. All records are allocated up front and
+ * every field of a record is written by exactly one thread (TX, RX or
+ * writer), so recording is two clock reads and a store. report() and
+ * write() are for after the run, once those threads are done.
+ *
+ * Records are kept per pulse and channel: the TX channel for TRACE_SEND,
+ * the RX channel for the other stages.
+ */
+class pulse_trace : boost::noncopyable
+{
+public:
+    pulse_trace(size_t npulses);
+
+    //! Monotonic time in ns since the trace was created
+    int64_t now_ns(void) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _origin).count();
+    }
+
+    //! Close a stage that started at start_ns (from now_ns())
+    void stage(size_t pulse, size_t chan, trace_stage_t stage, int64_t start_ns);
+
+    //! RX outcome of a pulse: error code and time_spec error in samples
+    void rx_result(size_t pulse, size_t chan, uint32_t error_code, bool has_time_error, int64_t time_error);
+
+    //! p50/p99/max and log2 histograms per stage, time errors, error code counts
+    void report(std::ostream &out) const;
+
+    //! Write every record as CSV, or as JSON if fname ends in .json
+    void write(const std::string &fname) const;
+
+private:
+    pulse_trace_record_t *record(size_t pulse, size_t chan);
+
+    std::chrono::steady_clock::time_point _origin;
+    size_t _npulses;
+    std::vector<pulse_trace_record_t> _records;
+};
+
+#endif /* INCLUDED_PULSE_TRACE_HPP */
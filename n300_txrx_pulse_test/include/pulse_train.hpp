@@ -0,0 +1,162 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_TRAIN_HPP
+#define INCLUDED_PULSE_TRAIN_HPP
+
+#include "aligned_buffer.hpp"
+#include "pulse_arena.hpp"
+#include "pulse_trace.hpp"
+#include "radio_device.hpp"
+#include "thread_sched.hpp"
+#include "tx_worker.hpp"
+#include <uhd/types/metadata.hpp>
+#include <complex>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef struct {
+  double pri;        // pulse repetition interval in seconds
+  size_t depth;      // pulses scheduled on the device ahead of the one being received
+  size_t npulses;    // pulses in the train
+  size_t nsamps;     // RX samples per pulse
+  double rx_timeout; // extra recv() timeout on top of the time until the pulse ends
+  bool threaded;     // send TX bursts and receive on separate threads
+  thread_sched_t tx_sched;
+  thread_sched_t rx_sched;
+  std::vector<double> offsets; // pulse start times in seconds from t0; empty for k*pri
+} pulse_train_config_t;
+
+typedef struct {
+  size_t pulses;         // pulses received on every channel
+  size_t errors;         // pulses that came back with an rx_metadata_t error on any channel
+  size_t short_pulses;   // pulses with fewer than nsamps samples on any channel
+  size_t misaligned;     // multi-channel pulses whose channels started at different times
+  long long max_skew;    // largest start time difference between channels, in samples
+  double wall_secs;      // host time from the first schedule to the last recv
+} pulse_train_stats_t;
+
+/*!
+ * Hardware-timed pulse train. Pulse k is transmitted and received at
+ * t0 + k*pri on the device timeline, or at t0 + offsets[k] when a schedule
+ * is given. Pulse times are computed in ticks from t0 rather than from the
+ * previous pulse, so with t0 on a PPS-set epoch every pulse lands on the
+ * same place of the GPS timeline across runs and units. The first depth pulses (TX burst and
+ * RX stream command) are queued on the device before anything is received,
+ * and every received pulse frees a slot for the pulse depth ahead of it,
+ * so the host round trip no longer limits the PRF.
+ *
+ * With threaded set, TX bursts go out from a tx_worker thread and the RX
+ * stream commands and recv() calls run on an RX thread, so a long burst
+ * being sent never delays the RX command for the same pulse.
+ *
+ * When both rx0 and rx1 are selected, both streamers get the same timed
+ * stream commands and each channel is drained by a thread of its own. A
+ * pulse is only rescheduled once every channel has received it, and the
+ * channels' rx_metadata_t time specs are checked to be sample aligned.
+ */
+class pulse_train
+{
+public:
+    /*!
+     * Called for every received pulse, in order per channel, with the arena
+     * slot the pulse was received into (samples, channel and metadata filled
+     * in). The handler owns the slot's reference. slot is NULL if the arena
+     * had no free slot and the pulse was dropped. With several RX channels
+     * the handler is called from several threads at once.
+     */
+    typedef std::function<void(size_t pulse, pulse_slot *slot)> pulse_handler_t;
+
+    pulse_train(radio_device::sptr device, const pulse_train_config_t &config, ch_select_t ch_select);
+
+    /*!
+     * Run the train starting at t0, cycling through waves pulse by pulse and
+     * receiving every pulse straight into a slot of arena.
+     * Throws std::runtime_error if the PRI (or a schedule gap) is shorter
+     * than a pulse, the schedule has fewer than npulses entries or the
+     * arena slots are smaller than nsamps.
+     */
+    pulse_train_stats_t run(const uhd::time_spec_t &t0,
+                            const std::vector<const sc16_buffer_t *> &waves,
+                            pulse_arena::sptr arena,
+                            const pulse_handler_t &handler);
+
+    //! Device time of pulse k
+    uhd::time_spec_t pulse_time(size_t k) const;
+
+    //! Time send/stream command/recv of every pulse into trace (NULL to stop)
+    void set_trace(pulse_trace *trace) { _trace = trace; }
+
+private:
+    void schedule(size_t k, const std::vector<const sc16_buffer_t *> &waves);
+    void receive_pulses(size_t chan_idx, const std::vector<const sc16_buffer_t *> &waves,
+                        pulse_arena::sptr arena, const pulse_handler_t &handler,
+                        pulse_train_stats_t &stats);
+    void pulse_received(size_t k, size_t num_rx_samps, const uhd::rx_metadata_t &md,
+                        const std::vector<const sc16_buffer_t *> &waves,
+                        pulse_train_stats_t &stats);
+
+    radio_device::sptr _device;
+    pulse_train_config_t _config;
+    std::vector<size_t> _rx_chans;
+    std::vector<uhd::rx_streamer::sptr> _rx_streams;
+    std::vector<size_t> _rx_sample_bytes;     // CPU sample size of each RX streamer
+    uhd::tx_streamer::sptr _tx_stream;
+    size_t _tx_chan;
+    std::unique_ptr<tx_worker> _tx_worker;
+    pulse_trace *_trace;
+    double _rate;
+    long long _t0_ticks;
+    double _max_gap;                      // longest time between pulse starts
+    double _first_timeout;
+
+    // shared by the channel threads
+    std::mutex _mutex;
+    std::atomic<bool> _abort;             // a channel thread failed
+    size_t _scheduled;
+    std::vector<size_t> _arrived;         // channels done with pulse k, at k % depth
+    std::vector<long long> _first_tick;   // start tick of the first channel, at k % depth
+    std::vector<bool> _failed;            // a channel reported an error for pulse k, at k % depth
+    std::vector<bool> _short;             // a channel came up short for pulse k, at k % depth
+};
+
+/*!
+ * Load a pulse schedule: one pulse start time per line, in seconds from the
+ * first pulse's epoch. Blank lines and # comments are skipped.
+ * Throws std::runtime_error if the file can't be read, a line isn't a
+ * number, or the times aren't increasing.
+ */
+std::vector<double> load_pulse_schedule(const std::string &fname);
+
+//! Copy the rx_metadata_t fields a pulse is stored with into its slot
+void set_slot_metadata(pulse_slot &slot, const uhd::rx_metadata_t &md);
+
+//! A recv() result past the end of recv_pulse()'s pulse, kept for the next one
+typedef struct {
+  bool pending;               // a result is waiting
+  std::vector<char> samps;
+  size_t nsamps;              // 0 for an error report
+  uhd::rx_metadata_t md;
+} rx_carry_t;
+
+/*!
+ * recv() one pulse of nsamps samples of sample_bytes each into buff,
+ * possibly in several calls. The pulse is expected to start at start_tick
+ * (in ticks of rate) and every chunk has to continue it: the pulse stops
+ * at the first sample that does not, and after an error other than a
+ * timeout or late command the rest of its burst is drained, so lost
+ * samples leave the pulse short rather than shift it. Chunks of earlier
+ * pulses are dropped, and a chunk or error of a later pulse is left in
+ * carry for the next call on the same channel to start from. md gets the
+ * time spec of the first samples and the first error code.
+ */
+size_t recv_pulse(uhd::rx_streamer::sptr rx_stream, void *buff, size_t nsamps, size_t sample_bytes,
+                  long long start_tick, double rate, uhd::rx_metadata_t &md, double timeout,
+                  rx_carry_t &carry);
+
+#endif /* INCLUDED_PULSE_TRAIN_HPP */
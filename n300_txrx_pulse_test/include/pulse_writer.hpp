@@ -0,0 +1,104 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_PULSE_WRITER_HPP
+#define INCLUDED_PULSE_WRITER_HPP
+
+#include "pulse_arena.hpp"
+#include "pulse_trace.hpp"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Destination of the pulses written by pulse_writer
+class pulse_sink
+{
+public:
+    typedef boost::shared_ptr<pulse_sink> sptr;
+    virtual ~pulse_sink(void) {}
+    virtual void write(const pulse_slot &slot) = 0;
+    virtual void close(void) {}
+};
+
+//! Output file of pulse `pulse`: fname itself for single pulse runs, else base-<pulse>.ext
+std::string pulse_filename(const std::string &fname, size_t pulse, size_t npulses);
+
+//! Per channel output file of dual channel runs: base-ch<channel>.ext
+std::string channel_filename(const std::string &fname, size_t channel);
+
+/*!
+ * Writes every pulse to its own file (see pulse_filename()). Files can be
+ * pre-sized with fallocate and written with O_DIRECT, bypassing the page
+ * cache; O_DIRECT falls back to buffered writes where the filesystem does
+ * not support it. With per_channel the pulses of each RX channel go to
+ * their own set of files (see channel_filename()).
+ */
+class pulse_file_sink : public pulse_sink
+{
+public:
+    pulse_file_sink(const std::string &fname, size_t npulses, bool direct_io, bool preallocate, bool per_channel = false);
+    void write(const pulse_slot &slot);
+
+private:
+    std::string _fname;
+    size_t _npulses;
+    bool _direct_io;
+    bool _preallocate;
+    bool _per_channel;
+};
+
+typedef struct {
+  size_t written;       // pulses written by the sink
+  size_t high_water;    // most pulses queued for writing at once
+  size_t write_errors;  // sink writes that threw
+  double write_secs;    // time spent inside the sink
+  size_t bytes;
+} pulse_writer_stats_t;
+
+/*!
+ * Dedicated writer thread. The acquisition loop receives into an arena
+ * slot and submit()s it; the filesystem is only touched by the writer
+ * thread, which releases the slot back to the arena once it is written.
+ */
+class pulse_writer : boost::noncopyable
+{
+public:
+    pulse_writer(pulse_sink::sptr sink, pulse_arena::sptr arena);
+    ~pulse_writer(void);
+
+    //! Queue a filled slot for writing; the writer takes over one reference
+    void submit(pulse_slot *slot);
+
+    //! Write everything queued, stop the thread and close the sink
+    void close(void);
+
+    pulse_writer_stats_t get_stats(void);
+
+    //! Time every sink write into trace (NULL to stop); set before submitting
+    void set_trace(pulse_trace *trace) { _trace = trace; }
+
+private:
+    void run(void);
+
+    pulse_sink::sptr _sink;
+    pulse_arena::sptr _arena;
+    pulse_trace *_trace;
+    std::deque<pulse_slot *> _queue;
+    std::mutex _mutex;
+    std::condition_variable _queue_cond;
+    bool _done;
+    pulse_writer_stats_t _stats;
+    std::thread _thread;
+};
+
+void print_writer_stats(const pulse_writer_stats_t &stats, const pulse_arena_stats_t &arena_stats, size_t nslots);
+
+#endif /* INCLUDED_PULSE_WRITER_HPP */
@@ -0,0 +1,159 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_RADIO_DEVICE_HPP
+#define INCLUDED_RADIO_DEVICE_HPP
+
+#include <uhd/device3.hpp>
+#include <uhd/rfnoc/radio_ctrl.hpp>
+#include <uhd/stream.hpp>
+#include <uhd/types/time_spec.hpp>
+#include "sample_convert.hpp"
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+// Channel indices used by get_rx_stream()/get_tx_stream(). These follow
+// ch_select_t: channel 0 is the main radio channel, channel 1 the calib one.
+static const size_t RADIO_CHAN_MAIN = 0;
+static const size_t RADIO_CHAN_CALIB = 1;
+
+typedef struct {
+  int rx0;
+  int rx1;
+  int tx0;
+  int tx1;
+} ch_select_t;
+
+//! ch_select_t of the --ch_rx (-1, 0, 1 or 2 = both) and --ch_tx (-1, 0 or 1) options
+ch_select_t make_ch_select(int ch_rx, int ch_tx);
+
+typedef struct {
+  sample_format_t cpu;    // host buffers: sc8, sc16 or fc32
+  sample_format_t wire;   // over the transport: sc8 or sc16
+} stream_format_t;
+
+typedef struct {
+  stream_format_t rx[2];  // by RADIO_CHAN_*
+  stream_format_t tx[2];
+} stream_formats_t;
+
+/*!
+ * Streamer formats of the --cpu_format and --wire_format options. Each is
+ * one format for every streamer ("sc8") or a comma separated list of
+ * streamer=format, the streamers being rx0, rx1, tx0, tx1, or rx and tx
+ * for both channels ("rx=sc8,tx0=sc16"); unlisted streamers stay sc16.
+ * TX streamers send the sc16 waveform buffers, so their CPU format is
+ * always sc16 and a bare CPU format only sets the RX streamers. Throws
+ * std::invalid_argument.
+ */
+stream_formats_t parse_stream_formats(const std::string &cpu, const std::string &wire);
+
+//! Streamer arguments of a format; fc32 is requested in sc16 counts (fullscale)
+uhd::stream_args_t make_stream_args(const stream_format_t &format);
+
+/*!
+ * Everything the pulse pipeline needs from a radio: the device timeline and
+ * one rx/tx streamer per channel. The streamers keep the plain UHD
+ * send()/recv()/issue_stream_cmd() semantics so the pipeline code does not
+ * care whether it talks to an N300 or to a software backend.
+ */
+class radio_device
+{
+public:
+    typedef boost::shared_ptr<radio_device> sptr;
+
+    virtual ~radio_device(void) {}
+
+    //! Short name of the backend ("uhd", "loopback", ...)
+    virtual std::string get_name(void) const = 0;
+
+    virtual double get_rate(void) = 0;
+
+    virtual uhd::time_spec_t get_time_now(void) = 0;
+    virtual uhd::time_spec_t get_time_last_pps(void) = 0;
+    virtual void set_time_now(const uhd::time_spec_t &time_spec) = 0;
+    virtual void set_time_next_pps(const uhd::time_spec_t &time_spec) = 0;
+    virtual std::string get_time_source(void) = 0;
+
+    /*!
+     * Read the GPS time (whole seconds) from the GPSDO sensors.
+     * \return 0 on success, -1 if no GPS time is available
+     */
+    virtual int get_gps_time(int &gps_time) = 0;
+
+    //! RF settings of a channel; set_freq() tunes its RX and TX side
+    virtual double get_freq(size_t chan) = 0;
+    virtual void set_freq(size_t chan, double freq) = 0;
+    virtual double get_rx_gain(size_t chan) = 0;
+    virtual void set_rx_gain(size_t chan, double gain) = 0;
+    virtual double get_tx_gain(size_t chan) = 0;
+    virtual void set_tx_gain(size_t chan, double gain) = 0;
+
+    /*!
+     * Time the following set_*() calls on chan with a command time, so they
+     * take effect at that device time instead of when they arrive. Settings
+     * the radio cannot time are applied at once.
+     */
+    virtual void set_command_time(size_t chan, const uhd::time_spec_t &time_spec) = 0;
+    virtual void clear_command_time(size_t chan) = 0;
+
+    //! Streamer for a channel, or a null sptr if the channel does not exist
+    virtual uhd::rx_streamer::sptr get_rx_stream(size_t chan) = 0;
+    virtual uhd::tx_streamer::sptr get_tx_stream(size_t chan) = 0;
+
+    //! CPU and wire formats the streamers were made with
+    virtual stream_formats_t get_stream_formats(void) = 0;
+};
+
+/*!
+ * radio_device on top of the RFNoC radio block and the streamers that
+ * usrpInit() sets up.
+ */
+class uhd_radio_device : public radio_device
+{
+public:
+    static sptr make(
+        uhd::device3::sptr usrp,
+        uhd::rfnoc::radio_ctrl::sptr radio_ctrl,
+        uhd::rx_streamer::sptr rx_stream,
+        uhd::rx_streamer::sptr rx_cal_stream,
+        uhd::tx_streamer::sptr tx_stream,
+        uhd::tx_streamer::sptr tx_cal_stream,
+        const stream_formats_t &formats
+    );
+
+    std::string get_name(void) const { return "uhd"; }
+
+    double get_rate(void);
+    uhd::time_spec_t get_time_now(void);
+    uhd::time_spec_t get_time_last_pps(void);
+    void set_time_now(const uhd::time_spec_t &time_spec);
+    void set_time_next_pps(const uhd::time_spec_t &time_spec);
+    std::string get_time_source(void);
+    int get_gps_time(int &gps_time);
+
+    double get_freq(size_t chan);
+    void set_freq(size_t chan, double freq);
+    double get_rx_gain(size_t chan);
+    void set_rx_gain(size_t chan, double gain);
+    double get_tx_gain(size_t chan);
+    void set_tx_gain(size_t chan, double gain);
+    void set_command_time(size_t chan, const uhd::time_spec_t &time_spec);
+    void clear_command_time(size_t chan);
+
+    uhd::rx_streamer::sptr get_rx_stream(size_t chan);
+    uhd::tx_streamer::sptr get_tx_stream(size_t chan);
+    stream_formats_t get_stream_formats(void) { return _formats; }
+
+private:
+    uhd_radio_device(void) {}
+
+    uhd::device3::sptr _usrp;
+    uhd::rfnoc::radio_ctrl::sptr _radio_ctrl;
+    uhd::rx_streamer::sptr _rx_stream[2];
+    uhd::tx_streamer::sptr _tx_stream[2];
+    stream_formats_t _formats;
+};
+
+#endif /* INCLUDED_RADIO_DEVICE_HPP */
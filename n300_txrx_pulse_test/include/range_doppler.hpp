@@ -0,0 +1,100 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_RANGE_DOPPLER_HPP
+#define INCLUDED_RANGE_DOPPLER_HPP
+
+#include "capture_file.hpp"
+#include "fft.hpp"
+#include "window.hpp"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*!
+ * rows x cols -> cols x rows, in square tiles of block x block elements so
+ * both the reads and the writes of a tile stay in cache. Only output rows
+ * [col_begin, col_end) are written, so several threads can split one
+ * transpose between them.
+ */
+void transpose_blocked(const fc32_t *in, fc32_t *out, size_t rows, size_t cols,
+                       size_t col_begin, size_t col_end, size_t block = 32);
+
+/*!
+ * Pulses x range bins data cube (one channel), stored pulse-major in one
+ * contiguous aligned allocation so each pulse is a row of nbins samples.
+ */
+class data_cube : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<data_cube> sptr;
+
+    //! Zero filled cube
+    data_cube(size_t npulses, size_t nbins);
+
+    size_t npulses(void) const { return _npulses; }
+    size_t nbins(void) const { return _nbins; }
+
+    fc32_t *pulse(size_t k) { return &_data[k*_nbins]; }
+    const fc32_t *pulse(size_t k) const { return &_data[k*_nbins]; }
+    const fc32_t *data(void) const { return &_data.front(); }
+
+private:
+    size_t _npulses;
+    size_t _nbins;
+    fc32_buffer_t _data;
+};
+
+/*!
+ * Stack the pulses of one channel of a capture (sc16 pulses or fc32 range
+ * profiles) into a cube, in the order they were captured. Pulses shorter
+ * than the longest one are zero padded. prf is estimated from the pulse
+ * time specs (0 if there are fewer than two or they have no time spec).
+ * Throws std::runtime_error if the capture has no pulses on channel.
+ */
+data_cube::sptr load_data_cube(const capture_file_reader &reader, size_t channel, double &prf);
+
+//! Channels with pulses in a capture, in ascending order
+std::vector<size_t> capture_channels(const capture_file_reader &reader);
+
+typedef struct {
+  window_t window;   // slow-time window applied before the Doppler FFT
+  size_t nfft;       // Doppler bins; 0 is the next power of two >= npulses
+  size_t threads;    // threads splitting the range bins; 0 is one per CPU
+} range_doppler_config_t;
+
+range_doppler_config_t default_range_doppler_config(void);
+
+typedef struct {
+  size_t nbins;                  // range bins (rows)
+  size_t nfft;                   // Doppler bins (columns), zero Doppler at nfft/2
+  double prf;                    // pulse repetition frequency, 0 if unknown
+  std::vector<float> power_db;   // nbins x nfft, row-major
+  size_t peak_bin;               // strongest cell
+  size_t peak_doppler;
+  float peak_db;
+  float median_db;               // median over the whole map, a noise floor estimate
+} range_doppler_map_t;
+
+/*!
+ * Range-Doppler map of a cube: the cube is transposed so every range bin's
+ * slow-time samples are contiguous, windowed, zero padded to nfft and
+ * FFTed across pulses (coherent integration over the whole train), and the
+ * power of every cell is taken in dB. The range bins are split across
+ * config.threads threads.
+ */
+range_doppler_map_t range_doppler(const data_cube &cube, const range_doppler_config_t &config, double prf);
+
+/*!
+ * Write the map as little endian float32 dB, nbins rows of nfft Doppler
+ * bins (in MATLAB: fread(f, [nfft nbins], 'float32')).
+ */
+void write_range_doppler_map(const std::string &fname, const range_doppler_map_t &map);
+
+//! Doppler frequency of column d of a map (0 at nfft/2)
+double doppler_hz(const range_doppler_map_t &map, size_t d);
+
+#endif /* INCLUDED_RANGE_DOPPLER_HPP */
@@ -0,0 +1,125 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_REPLAY_DEVICE_HPP
+#define INCLUDED_REPLAY_DEVICE_HPP
+
+#include "radio_device.hpp"
+#include <boost/shared_ptr.hpp>
+#include <complex>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+typedef struct {
+  std::vector<std::complex<short>> samps;   // the records back to back
+  std::vector<uint64_t> starts;             // first sample of every record
+} replay_track_t;
+
+/*!
+ * Recorded samples for the replay device, one track per RX channel. Every
+ * .dat/.bin/.sc8/.fc32 file is one record on both tracks; every pulse of a
+ * .cap capture is one record on the track of its channel. Captures that do
+ * not hold sc16 are converted, encoded ones decoded, all at load time so
+ * the replay itself never waits on the disk.
+ */
+typedef struct {
+  replay_track_t rx[2];     // by RADIO_CHAN_*
+  double rate;              // sample rate in the capture headers, 0 if only raw files were loaded
+} replay_recording_t;
+
+//! Append the records of the files to recording; throws std::runtime_error
+void load_replay_recording(replay_recording_t &recording, const std::vector<std::string> &fnames);
+
+//! Track the replay device plays on RX channel chan: its own, or the other one if chan has none
+const replay_track_t &replay_track(const replay_recording_t &recording, size_t chan);
+
+typedef struct {
+  double rate;           // sample rate of the device timeline
+  size_t spp;            // samples per packet returned by recv(one_packet)
+  bool paced;            // deliver samples in real time at rate, or as fast as recv() is called
+  bool loop;             // start a track over when it runs out instead of ending the stream
+  stream_formats_t formats;
+} replay_config_t;
+
+replay_config_t default_replay_config(double rate);
+
+typedef struct {
+  uint64_t samples;      // delivered by recv(), all channels
+  uint64_t records;      // records whose first sample was delivered
+  uint64_t loops;        // times a track started over
+  double secs;           // wall time from the first to the last delivered sample
+  double max_lag;        // paced: most seconds a recv() returned after its last sample was due
+} replay_stats_t;
+
+void print_replay_stats(std::ostream &os, const replay_stats_t &stats);
+
+class replay_source;
+
+/*!
+ * Radio device that plays a recording back as its RX samples, so captures
+ * of real hardware go through the same pulse train, stream capture, writer
+ * and analysis stages as a live run.
+ *
+ * The device time runs in real time like the loopback device. A timed
+ * stream command starts at the next record of the track, so recorded
+ * pulses stay whole when the commanded pulse length matches them; samples
+ * beyond a record run on into the next one. Every recv() is stamped with
+ * the device time the command asked for (has_time_spec, start_of_burst and
+ * end_of_burst as UHD sets them), not the recorded time.
+ *
+ * Paced, recv() waits for the device clock to pass the last requested
+ * sample and stream commands in the past are ERROR_CODE_LATE_COMMAND.
+ * Unpaced, samples are delivered at once and the device clock jumps ahead
+ * to the last of them, which measures how fast the pipeline itself runs.
+ * Without loop the last samples of a track end the burst (end_of_burst,
+ * also in continuous mode) and later commands time out. TX bursts are
+ * accepted and discarded; RX samples are delivered in the CPU format of
+ * config.formats, the wire format has no effect.
+ */
+class replay_device : public radio_device
+{
+public:
+    //! Throws std::runtime_error for an invalid config or an empty recording
+    static sptr make(const replay_config_t &config, boost::shared_ptr<const replay_recording_t> recording);
+
+    std::string get_name(void) const { return "replay"; }
+
+    double get_rate(void);
+    uhd::time_spec_t get_time_now(void);
+    uhd::time_spec_t get_time_last_pps(void);
+    void set_time_now(const uhd::time_spec_t &time_spec);
+    void set_time_next_pps(const uhd::time_spec_t &time_spec);
+    std::string get_time_source(void) { return "internal"; }
+    int get_gps_time(int &gps_time);
+
+    double get_freq(size_t chan);
+    void set_freq(size_t chan, double freq);
+    double get_rx_gain(size_t chan);
+    void set_rx_gain(size_t chan, double gain);
+    double get_tx_gain(size_t chan);
+    void set_tx_gain(size_t chan, double gain);
+    //! Settings are stored at once; a recording cannot be retuned anyway
+    void set_command_time(size_t, const uhd::time_spec_t &) {}
+    void clear_command_time(size_t) {}
+
+    uhd::rx_streamer::sptr get_rx_stream(size_t chan);
+    uhd::tx_streamer::sptr get_tx_stream(size_t chan);
+    stream_formats_t get_stream_formats(void);
+
+    replay_stats_t get_stats(void);
+
+private:
+    replay_device(void) : _freq(), _rx_gain(), _tx_gain() {}
+
+    boost::shared_ptr<replay_source> _source;
+    uhd::rx_streamer::sptr _rx_stream[2];
+    uhd::tx_streamer::sptr _tx_stream[2];
+    double _freq[2];
+    double _rx_gain[2];
+    double _tx_gain[2];
+};
+
+#endif /* INCLUDED_REPLAY_DEVICE_HPP */
@@ -0,0 +1,77 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_RX_WORKER_HPP
+#define INCLUDED_RX_WORKER_HPP
+
+#include "pulse_trace.hpp"
+#include "thread_sched.hpp"
+#include <uhd/stream.hpp>
+#include <uhd/types/metadata.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <boost/noncopyable.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+/*!
+ * RX drain thread of one channel. Receives are queued and run in order on
+ * a thread that lives as long as the worker, so a second channel is
+ * drained concurrently with the caller's without a thread being started
+ * for every pulse. The caller issues the stream command itself.
+ */
+class rx_worker : boost::noncopyable
+{
+public:
+    rx_worker(uhd::rx_streamer::sptr rx_stream, double rate, const thread_sched_t &sched);
+    ~rx_worker(void);
+
+    /*!
+     * Queue a recv() of nsamps samples into buff, which must stay valid
+     * until wait() has returned its result. time_spec is the time the
+     * stream command asked for; the trace records the RX time error
+     * against it under record pulse.
+     */
+    void recv(void *buff, size_t nsamps, const uhd::time_spec_t &time_spec, double timeout, size_t pulse = 0);
+
+    //! Wait for the oldest queued recv(); returns its sample count. Rethrows recv() errors
+    size_t wait(uhd::rx_metadata_t &md);
+
+    //! Time every recv() into trace under RX channel chan (NULL to stop)
+    void set_trace(pulse_trace *trace, size_t chan);
+
+private:
+    typedef struct {
+      void *buff;
+      size_t nsamps;
+      uhd::time_spec_t time_spec;
+      double timeout;
+      size_t pulse;
+    } rx_request_t;
+
+    typedef struct {
+      size_t nsamps;
+      uhd::rx_metadata_t md;
+      std::exception_ptr error;
+    } rx_result_t;
+
+    void run(void);
+
+    uhd::rx_streamer::sptr _rx_stream;
+    double _rate;
+    thread_sched_t _sched;
+    pulse_trace *_trace;
+    size_t _trace_chan;
+    std::deque<rx_request_t> _queue;
+    std::deque<rx_result_t> _results;
+    bool _done;
+    std::mutex _mutex;
+    std::condition_variable _queue_cond;
+    std::condition_variable _result_cond;
+    std::thread _thread;
+};
+
+#endif /* INCLUDED_RX_WORKER_HPP */
@@ -0,0 +1,143 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_SAMPLE_CONVERT_HPP
+#define INCLUDED_SAMPLE_CONVERT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+typedef std::complex<int8_t> sc8_t;
+
+/*!
+ * Sample formats of the streamers and captures. fc32 is kept in sc16
+ * counts, like the DDC output and range profiles, and sc8 holds the top
+ * byte of an sc16 sample, so converting between formats only rescales
+ * by a power of two.
+ */
+typedef enum {
+  SAMPLE_FORMAT_SC8,
+  SAMPLE_FORMAT_SC16,
+  SAMPLE_FORMAT_FC32
+} sample_format_t;
+
+//! "sc8", "sc16" or "fc32"; throws std::invalid_argument for anything else
+sample_format_t parse_sample_format(const std::string &name);
+const char *sample_format_name(sample_format_t format);
+size_t sample_size(sample_format_t format);
+
+/*!
+ * Sample files hold interleaved int16 pairs. RX captures (.dat, .ref) are
+ * stored I,Q while TX waveforms from wave2file.m (.bin) are stored Q,I, so
+ * the latter have to be swapped on load.
+ */
+bool file_iq_swapped(const std::string &fname);
+
+//! Sample format of a file: .sc8 and .fc32 files (I,Q order), sc16 otherwise
+sample_format_t file_sample_format(const std::string &fname);
+
+/*!
+ * Convert n sc16 samples to complex<T>, swapping I and Q if requested.
+ * This is the portable reference the vectorized overloads below must match
+ * bit for bit (int16 -> float/double conversion is exact).
+ */
+template<typename T>
+void convert_sc16_generic(const std::complex<short> *in, std::complex<T> *out, size_t n, bool swap_iq){
+    const short *src = reinterpret_cast<const short *>(in);
+    if (swap_iq){
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::complex<T>((T)src[2*i+1], (T)src[2*i]);
+    }
+    else {
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::complex<T>((T)src[2*i], (T)src[2*i+1]);
+    }
+}
+
+//! Vectorized (NEON / SSE2 / AVX2) conversions; in and out may be unaligned
+void convert_sc16(const std::complex<short> *in, std::complex<short> *out, size_t n, bool swap_iq);
+void convert_sc16(const std::complex<short> *in, std::complex<float> *out, size_t n, bool swap_iq);
+void convert_sc16(const std::complex<short> *in, std::complex<double> *out, size_t n, bool swap_iq);
+
+//! Any other output type goes through the generic loop
+template<typename T>
+void convert_sc16(const std::complex<short> *in, std::complex<T> *out, size_t n, bool swap_iq){
+    convert_sc16_generic(in, out, n, swap_iq);
+}
+
+/*!
+ * Compile time properties of a sample component type: scale() is one unit
+ * in sc16 counts, format the sample_format_t of std::complex<T> (only for
+ * the streamer formats).
+ */
+template<typename T> struct sample_traits;
+template<> struct sample_traits<int8_t> {
+    static const sample_format_t format = SAMPLE_FORMAT_SC8;
+    static double scale(void) { return 256.0; }
+};
+template<> struct sample_traits<short> {
+    static const sample_format_t format = SAMPLE_FORMAT_SC16;
+    static double scale(void) { return 1.0; }
+};
+template<> struct sample_traits<float> {
+    static const sample_format_t format = SAMPLE_FORMAT_FC32;
+    static double scale(void) { return 1.0; }
+};
+template<> struct sample_traits<double> {
+    static double scale(void) { return 1.0; }
+};
+
+//! x rounded to nearest (even) and saturated for integer T
+template<typename T> inline T round_sample(double x){
+    if (not std::numeric_limits<T>::is_integer)
+        return (T)x;
+    x = std::min(std::max(x, (double)std::numeric_limits<T>::min()), (double)std::numeric_limits<T>::max());
+    return (T)std::lrint(x);
+}
+
+/*!
+ * Convert n samples between any two component types, rescaled by their
+ * sample_traits. The reference the vectorized overloads below must match
+ * bit for bit.
+ */
+template<typename In, typename Out>
+void convert_samples_generic(const std::complex<In> *in, std::complex<Out> *out, size_t n){
+    const double k = sample_traits<In>::scale()/sample_traits<Out>::scale();
+    for (size_t i = 0; i < n; i++)
+        out[i] = std::complex<Out>(round_sample<Out>(in[i].real()*k), round_sample<Out>(in[i].imag()*k));
+}
+
+//! Vectorized (NEON / SSE2 / AVX2) conversions between the streamer formats
+void convert_samples(const sc8_t *in, std::complex<short> *out, size_t n);
+void convert_samples(const std::complex<short> *in, sc8_t *out, size_t n);
+void convert_samples(const std::complex<short> *in, std::complex<float> *out, size_t n);
+void convert_samples(const std::complex<float> *in, std::complex<short> *out, size_t n);
+
+//! Any other pair goes through the generic loop
+template<typename In, typename Out>
+void convert_samples(const std::complex<In> *in, std::complex<Out> *out, size_t n){
+    convert_samples_generic(in, out, n);
+}
+
+//! A format to itself is a copy
+template<typename T>
+void convert_samples(const std::complex<T> *in, std::complex<T> *out, size_t n){
+    if (in != out)
+        std::memmove(static_cast<void *>(out), in, n*sizeof(std::complex<T>));
+}
+
+/*!
+ * Convert between formats only known at run time: one switch per call
+ * picks the compile time specialized loop for the whole buffer, so there
+ * is no per-sample branching on the format.
+ */
+void convert_samples(sample_format_t in_format, const void *in, sample_format_t out_format, void *out, size_t n);
+
+#endif /* INCLUDED_SAMPLE_CONVERT_HPP */
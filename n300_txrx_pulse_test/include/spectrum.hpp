@@ -0,0 +1,77 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_SPECTRUM_HPP
+#define INCLUDED_SPECTRUM_HPP
+
+#include "fft.hpp"
+#include "window.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+typedef struct {
+  double rate;        // sample rate in Hz
+  size_t nfft;        // Welch segment length, a power of two
+  double overlap;     // segment overlap, 0 <= overlap < 1
+  window_t window;
+  double obw_percent; // occupied bandwidth power percentage (99 like MATLAB obw())
+} spectrum_config_t;
+
+spectrum_config_t default_spectrum_config(void);
+
+/*!
+ * Welch PSD estimator. Segments of nfft samples, stepping by
+ * nfft*(1-overlap), are windowed and transformed in batches through one FFT
+ * plan and their power averaged. The plan, window and batch buffer are made
+ * once, so an estimator can be reused for any number of signals; use one
+ * per thread.
+ */
+class welch_psd
+{
+public:
+    //! Throws std::invalid_argument for a bad nfft or overlap
+    welch_psd(const spectrum_config_t &config);
+
+    /*!
+     * Two-sided PSD of x (power per Hz in sc16 counts^2/Hz), fftshifted so
+     * bin k is at (k - nfft/2)*rate/nfft. Returns the number of segments
+     * averaged; a signal shorter than nfft is zero padded to one segment.
+     */
+    size_t compute(const fc32_t *x, size_t n, std::vector<double> &psd);
+
+    //! Frequency of PSD bin k
+    double bin_hz(size_t k) const;
+
+private:
+    static const size_t BATCH = 8;   // segments windowed and FFTed back to back
+
+    spectrum_config_t _config;
+    size_t _step;
+    fft_plan _plan;
+    std::vector<float, aligned_allocator<float>> _window_iq;
+    double _window_power;           // sum of w^2
+    fc32_buffer_t _batch;
+};
+
+typedef struct {
+  double power_db;      // total power, dB sc16 counts^2
+  double obw_hz;        // occupied bandwidth holding obw_percent of the power
+  double obw_lo_hz;     // its edges
+  double obw_hi_hz;
+  double centroid_hz;   // power weighted mean frequency
+  double lower_db;      // power below and above 0 Hz (DC bin excluded), dB
+  double upper_db;
+  double asymmetry_db;  // upper_db - lower_db
+} spectrum_stats_t;
+
+/*!
+ * Occupied bandwidth, centroid and sideband powers of a PSD from
+ * welch_psd. The OBW edges are where the cumulative power crosses
+ * (100-obw_percent)/2 % and (100+obw_percent)/2 %, interpolated within
+ * bins as MATLAB's obw() does.
+ */
+spectrum_stats_t analyze_psd(const std::vector<double> &psd, const spectrum_config_t &config);
+
+#endif /* INCLUDED_SPECTRUM_HPP */
@@ -0,0 +1,118 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_STREAM_CAPTURE_HPP
+#define INCLUDED_STREAM_CAPTURE_HPP
+
+#include "pulse_arena.hpp"
+#include "radio_device.hpp"
+#include <uhd/types/metadata.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <boost/noncopyable.hpp>
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+typedef struct {
+  uint64_t nsamps;       // samples to capture; 0 runs until stop()
+  size_t chunk_samps;    // samples per arena slot / written chunk
+  double timeout;        // recv() timeout once the stream is running
+  size_t max_gaps;       // gaps kept for the report; all of them are counted
+} stream_capture_config_t;
+
+typedef struct {
+  long long tick;        // device tick of the first missing sample
+  long long lost;        // samples missing according to the time specs
+  uint32_t error_code;   // rx_metadata_t error reported with the gap
+  bool out_of_sequence;  // the gap was a dropped packet, not an overflow
+} stream_gap_t;
+
+typedef struct {
+  uint64_t samples;        // samples received
+  uint64_t chunks;         // chunks handed to the handler, dropped ones included
+  size_t overflows;        // ERROR_CODE_OVERFLOW without out_of_sequence
+  size_t sequence_errors;  // ERROR_CODE_OVERFLOW with out_of_sequence
+  size_t gaps;             // discontinuities in the time specs
+  uint64_t lost_samps;     // samples missing across all gaps
+  size_t dropped;          // chunks the arena had no free slot for
+  size_t timeouts;         // recv() timeouts; the first one ends the capture
+  double wall_secs;        // host time from the stream command to the stop
+} stream_capture_stats_t;
+
+/*!
+ * Continuous RX capture. The channel is started with a timed
+ * STREAM_MODE_START_CONTINUOUS command and recv()d chunk by chunk straight
+ * into arena slots, which the handler passes on (normally to a
+ * pulse_writer), so the length of a capture is bounded by the disk rather
+ * than by RAM.
+ *
+ * Every chunk is contiguous on the device timeline. Overflows and sequence
+ * errors end the chunk being filled; the next chunk starts at the time spec
+ * the radio reports after the gap and carries the error code that reported
+ * it, so a reader can find every gap from the chunk index alone.
+ */
+class stream_capture : boost::noncopyable
+{
+public:
+    /*!
+     * Called for every chunk in order with the slot it was received into
+     * (index = chunk number, samples and metadata filled in). The handler
+     * owns the slot's reference. slot is NULL if the arena had no free slot
+     * and the chunk was dropped.
+     */
+    typedef std::function<void(size_t chunk, pulse_slot *slot)> chunk_handler_t;
+
+    stream_capture(radio_device::sptr device, size_t chan, const stream_capture_config_t &config);
+
+    /*!
+     * Stream from t0 until nsamps samples are in, stop() is called, a
+     * recv() times out or the device ends the burst (a replay_device at the
+     * end of its recording). Throws std::runtime_error if the arena slots are
+     * smaller than a chunk or the radio reports anything but a timeout or
+     * an overflow.
+     */
+    stream_capture_stats_t run(const uhd::time_spec_t &t0, pulse_arena::sptr arena, const chunk_handler_t &handler);
+
+    //! End a running capture after the chunk being received; safe from a signal handler
+    void stop(void) { _stop = true; }
+
+    //! The first max_gaps gaps of the last run
+    const std::vector<stream_gap_t> &gaps(void) const { return _gaps; }
+
+private:
+    typedef struct {
+      pulse_slot *slot;
+      char *buff;            // CPU format samples
+      size_t scratch;        // scratch buffer in use when slot is NULL
+      size_t want;
+      size_t n;
+      uhd::time_spec_t time_spec;
+      uint32_t error_code;
+    } chunk_t;
+
+    void begin_chunk(chunk_t &chunk, pulse_arena::sptr arena, uint64_t received, size_t scratch);
+    void finish_chunk(chunk_t &chunk, const chunk_handler_t &handler, stream_capture_stats_t &stats);
+    void add_gap(const stream_gap_t &gap, stream_capture_stats_t &stats);
+
+    radio_device::sptr _device;
+    size_t _chan;
+    stream_capture_config_t _config;
+    uhd::rx_streamer::sptr _rx_stream;
+    size_t _sample_bytes;                 // of the streamer's CPU format
+    double _rate;
+    std::atomic<bool> _stop;
+    std::vector<stream_gap_t> _gaps;
+    // drain buffers for dropped chunks; two, since a chunk split at a gap
+    // needs the next one before it is handed off
+    std::vector<std::complex<short>> _scratch[2];
+};
+
+//! Summary line plus the recorded gaps
+void print_stream_capture_stats(std::ostream &os, const stream_capture_stats_t &stats,
+                                const std::vector<stream_gap_t> &gaps, double rate);
+
+#endif /* INCLUDED_STREAM_CAPTURE_HPP */
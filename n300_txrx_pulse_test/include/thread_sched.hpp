@@ -0,0 +1,37 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_THREAD_SCHED_HPP
+#define INCLUDED_THREAD_SCHED_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+typedef struct {
+  int cpu;          // CPU to pin the thread to, -1 to leave it unpinned
+  float priority;   // 0..1 like uhd::set_thread_priority_safe(), < 0 leaves it alone
+} thread_sched_t;
+
+thread_sched_t default_thread_sched(void);
+
+/*!
+ * Apply a scheduling setup to the calling thread: name it (shows up in
+ * top/perf), pin it and give it a realtime priority. Failures (usually
+ * missing privileges) only print a warning, like UHD does.
+ */
+void apply_thread_sched(const thread_sched_t &sched, const std::string &name);
+
+//! Number of CPUs to spread host side processing over (at least 1)
+size_t default_thread_count(void);
+
+/*!
+ * Split [0, n) into nthreads contiguous ranges and call fn(begin, end) for
+ * each on a thread of its own (the calling thread takes the first range).
+ * nthreads 0 means default_thread_count(). The first exception thrown by
+ * fn is rethrown once every range is done.
+ */
+void parallel_for(size_t n, size_t nthreads, const std::function<void(size_t begin, size_t end)> &fn);
+
+#endif /* INCLUDED_THREAD_SCHED_HPP */
@@ -0,0 +1,79 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_TX_WORKER_HPP
+#define INCLUDED_TX_WORKER_HPP
+
+#include "aligned_buffer.hpp"
+#include "pulse_trace.hpp"
+#include "thread_sched.hpp"
+#include <uhd/stream.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <boost/noncopyable.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+typedef struct {
+  size_t bursts;        // bursts handed to send()
+  size_t short_sends;   // send() calls that returned fewer samples than the burst
+  size_t high_water;    // most bursts queued at once
+  double send_secs;     // time spent inside send()
+} tx_worker_stats_t;
+
+/*!
+ * TX thread. Bursts are queued with their device time and sent from a
+ * thread of their own, so a long waveform streams to the radio while the
+ * caller is already issuing the matching RX stream command. TX and RX are
+ * lined up by the burst timestamps, not by call order.
+ */
+class tx_worker : boost::noncopyable
+{
+public:
+    tx_worker(uhd::tx_streamer::sptr tx_stream, const thread_sched_t &sched);
+    ~tx_worker(void);
+
+    /*!
+     * Queue a timed burst. wave must stay valid until it has been sent.
+     * pulse is the record the send() is timed under in the trace.
+     * Rethrows the error of a failed earlier send().
+     */
+    void send(const sc16_buffer_t *wave, const uhd::time_spec_t &time_spec, size_t pulse = 0);
+
+    //! Time every send() into trace under TX channel chan (NULL to stop)
+    void set_trace(pulse_trace *trace, size_t chan);
+
+    //! Wait until every queued burst has been sent; rethrows send() errors
+    void flush(void);
+
+    tx_worker_stats_t get_stats(void);
+
+private:
+    typedef struct {
+      const sc16_buffer_t *wave;
+      uhd::time_spec_t time_spec;
+      size_t pulse;
+    } tx_burst_t;
+
+    void run(void);
+    void check_error(void);
+
+    uhd::tx_streamer::sptr _tx_stream;
+    thread_sched_t _sched;
+    pulse_trace *_trace;
+    size_t _trace_chan;
+    std::deque<tx_burst_t> _queue;
+    size_t _busy;
+    bool _done;
+    std::exception_ptr _error;
+    std::mutex _mutex;
+    std::condition_variable _queue_cond;
+    std::condition_variable _idle_cond;
+    tx_worker_stats_t _stats;
+    std::thread _thread;
+};
+
+#endif /* INCLUDED_TX_WORKER_HPP */
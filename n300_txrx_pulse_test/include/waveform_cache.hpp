@@ -0,0 +1,51 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_WAVEFORM_CACHE_HPP
+#define INCLUDED_WAVEFORM_CACHE_HPP
+
+#include "aligned_buffer.hpp"
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/*!
+ * TX waveforms loaded once, converted to sc16 and kept in aligned buffers
+ * for the whole run. Waveforms are looked up by name, so pulses can switch
+ * between them without touching the filesystem. References returned by
+ * get() stay valid until the waveform is removed or replaced.
+ */
+class waveform_cache
+{
+public:
+    typedef boost::shared_ptr<waveform_cache> sptr;
+
+    //! Load a .bin/.dat/.ref file under name (replaces an existing entry)
+    const sc16_buffer_t &load(const std::string &name, const std::string &fname);
+
+    //! Store an already converted waveform under name
+    const sc16_buffer_t &add(const std::string &name, const sc16_buffer_t &data);
+
+    void remove(const std::string &name);
+
+    bool has(const std::string &name) const;
+
+    //! Waveform stored under name; throws std::runtime_error if missing
+    const sc16_buffer_t &get(const std::string &name) const;
+
+    //! Names in the order they were first added
+    const std::vector<std::string> &names(void) const { return _names; }
+
+    size_t size(void) const { return _names.size(); }
+
+    //! Name a waveform file is stored under by default (its stem)
+    static std::string default_name(const std::string &fname);
+
+private:
+    std::map<std::string, boost::shared_ptr<sc16_buffer_t>> _waves;
+    std::vector<std::string> _names;
+};
+
+#endif /* INCLUDED_WAVEFORM_CACHE_HPP */
@@ -0,0 +1,68 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_WAVEFORM_SYNTH_HPP
+#define INCLUDED_WAVEFORM_SYNTH_HPP
+
+#include "aligned_buffer.hpp"
+#include "waveform_cache.hpp"
+#include <string>
+#include <vector>
+
+typedef enum {
+  WAVEFORM_LFM,     // linear FM chirp
+  WAVEFORM_TONE,
+  WAVEFORM_BARKER,  // binary phase code
+  WAVEFORM_CODE     // arbitrary phase code
+} waveform_type_t;
+
+typedef struct {
+  waveform_type_t type;
+  double bw;                  // LFM sweep, Hz; negative sweeps down
+  double freq;                // offset of the tone / chirp center / code carrier, Hz
+  size_t len;                 // samples of a tone or chirp (0: from dur)
+  double dur;                 // seconds of a tone or chirp if len is 0
+  size_t chip;                // samples per code chip
+  std::vector<double> phases; // code chip phases, degrees (a Barker code is 0/180)
+  size_t zeros;               // zero samples prepended
+  double scale;               // peak amplitude, fraction of full scale
+} waveform_spec_t;
+
+/*!
+ * Parses a synthesizer spec, the waveform type followed by colon separated
+ * options:
+ *
+ *   lfm:bw=100e6:len=1280:zeros=512
+ *   tone:freq=5e6:dur=10e-6
+ *   barker:n=13:chip=8
+ *   code:phases=0/90/180/270:chip=4
+ *
+ * Options are bw, freq, len, dur, chip, n (Barker length 2, 3, 4, 5, 7, 11
+ * or 13), phases (degrees, '/' separated), zeros, scale and the flag
+ * halfgain (scale 0.5, like the _halfgain waveform files). A bare "lfm" is
+ * the chirp of plot_usrp_samples_example.m: bw=100e6:len=1280:zeros=512.
+ * Throws std::invalid_argument for an unknown type or option.
+ */
+waveform_spec_t parse_waveform_spec(const std::string &spec);
+
+//! Whether a --wavefile entry is a synthesizer spec rather than a file name
+bool is_waveform_spec(const std::string &entry);
+
+/*!
+ * Synthesizes the waveform at the sample rate, straight to sc16. The LFM
+ * follows plot_usrp_samples_example.m: phase pi/2*bw/t_end*t^2 with t
+ * centered on the middle sample, so a chirp comes out within a count of
+ * the wave2file.m files. Every type runs the same phase accumulator and
+ * sine table kernel, instantiated per type so the inner loop has no
+ * branches on the type.
+ */
+void synthesize_waveform(sc16_buffer_t &data, const waveform_spec_t &spec, double rate);
+
+/*!
+ * The waveform of a --wavefile entry, synthesized or loaded into the cache
+ * once and stored under its name (the spec itself for synthesized ones).
+ */
+const sc16_buffer_t &cache_waveform(waveform_cache &cache, const std::string &entry, double rate);
+
+#endif /* INCLUDED_WAVEFORM_SYNTH_HPP */
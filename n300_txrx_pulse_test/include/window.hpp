@@ -0,0 +1,35 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef INCLUDED_WINDOW_HPP
+#define INCLUDED_WINDOW_HPP
+
+#include "fft.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+typedef enum {
+  WINDOW_RECT,
+  WINDOW_HANN,
+  WINDOW_HAMMING,
+  WINDOW_BLACKMAN
+} window_t;
+
+//! "rect", "hann", "hamming" or "blackman"; throws std::invalid_argument otherwise
+window_t parse_window(const std::string &name);
+
+//! n window coefficients (symmetric, peak 1)
+std::vector<float> make_window(window_t window, size_t n);
+
+/*!
+ * Window coefficients with every value doubled (w0,w0,w1,w1,...), so
+ * windowing interleaved complex samples is a plain float multiply.
+ */
+std::vector<float, aligned_allocator<float>> make_window_iq(const std::vector<float> &window);
+
+//! out[i] = in[i]*window[i] with window from make_window_iq(); out may alias in
+void window_multiply(const fc32_t *in, const float *window_iq, fc32_t *out, size_t n);
+
+#endif /* INCLUDED_WINDOW_HPP */
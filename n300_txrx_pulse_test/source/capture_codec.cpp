@@ -0,0 +1,378 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "capture_codec.hpp"
+#include "thread_sched.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+// zigzag residuals of an order 2 predictor stay below 2^18
+#define CODEC_RAW_BITS 18
+#define CODEC_MAX_RICE_K 17
+
+/***********************************************************************
+ * bit I/O, LSB first (the host and the file are little endian)
+ **********************************************************************/
+struct bit_writer {
+    uint8_t *p;
+    uint64_t acc;
+    unsigned n;             // bits in acc, < 8 between calls
+
+    // v must fit in bits (<= 56) bits; stores 8 bytes at p every time, so
+    // the output needs 8 bytes of slack
+    inline void put(uint64_t v, unsigned bits){
+        acc |= v << n;
+        n += bits;
+        std::memcpy(p, &acc, sizeof(acc));
+        p += n >> 3;
+        acc >>= n & ~7u;
+        n &= 7;
+    }
+
+    inline void finish(void){
+        if (n > 0)
+            *p++ = (uint8_t)acc;
+    }
+};
+
+struct bit_reader {
+    const uint8_t *start, *p, *end;
+    uint64_t acc;
+    unsigned n;
+
+    // keep at least 56 bits in acc while there are bytes left
+    inline void refill(void){
+        if (end - p >= 8){
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            acc |= word << n;
+            p += (63 - n) >> 3;
+            n |= 56;
+        }
+        else {
+            for (; n <= 56 and p < end; n += 8)
+                acc |= (uint64_t)*p++ << n;
+        }
+    }
+
+    inline uint32_t get(unsigned bits){
+        if (n < bits){
+            refill();
+            if (n < bits)
+                throw std::runtime_error("encoded capture block is truncated");
+        }
+        uint32_t v = (uint32_t)(acc & ((1ULL << bits) - 1));
+        acc >>= bits;
+        n -= bits;
+        return v;
+    }
+
+    // zero bits before the next one bit, at most max (<= 32) of them
+    inline unsigned zeros(unsigned max){
+        if (n < 32)
+            refill();
+        unsigned z = (acc == 0) ? 64 : (unsigned)__builtin_ctzll(acc);
+        if (z > max)
+            z = max;
+        if (z > n)
+            throw std::runtime_error("encoded capture block is truncated");
+        acc >>= z;
+        n -= z;
+        return z;
+    }
+
+    size_t consumed_bits(void) const { return (size_t)(p - start)*8 - n; }
+};
+
+/***********************************************************************
+ * block codec
+ **********************************************************************/
+static inline uint32_t zigzag(int32_t r){ return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31); }
+static inline int32_t unzigzag(uint32_t u){ return (int32_t)(u >> 1) ^ -(int32_t)(u & 1); }
+
+static inline unsigned bit_width(uint32_t v){ return v ? 32 - (unsigned)__builtin_clz(v) : 0; }
+
+// the order (0, 1 or 2) whose residuals have the smallest absolute sum;
+// x is one component, every other short
+static unsigned pick_order(const short *x, size_t n){
+    uint64_t sum[3] = {0, 0, 0};
+    int32_t x1 = 0, x2 = 0;
+    for (size_t i = 0; i < n; i++){
+        int32_t x0 = x[2*i];
+        sum[0] += (uint32_t)std::abs(x0);
+        sum[1] += (uint32_t)std::abs(x0 - x1);
+        sum[2] += (uint32_t)std::abs(x0 - 2*x1 + x2);
+        x2 = x1;
+        x1 = x0;
+    }
+    unsigned order = 0;
+    for (unsigned o = 1; o < 3; o++){
+        if (sum[o] < sum[order])
+            order = o;
+    }
+    return order;
+}
+
+static void encode_partition(bit_writer &bw, const uint32_t *u, size_t n){
+    uint32_t max = 0;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++){
+        max |= u[i];
+        sum += u[i];
+    }
+    unsigned width = bit_width(max);
+
+    // Rice parameter by its estimated length n*(k + 1) + sum/2^k, which is
+    // smallest within one of log2 of the mean (escapes make it a guess, but
+    // any k decodes)
+    unsigned k0 = bit_width((uint32_t)(sum/n));
+    k0 = (k0 > 0) ? k0 - 1 : 0;
+    unsigned best_k = 0;
+    uint64_t best = (uint64_t)-1;
+    for (unsigned k = (k0 > 0) ? k0 - 1 : 0; k <= std::min(k0 + 1, (unsigned)CODEC_MAX_RICE_K); k++){
+        uint64_t bits = n*(k + 1) + (sum >> k);
+        if (bits < best){
+            best = bits;
+            best_k = k;
+        }
+    }
+
+    // ties go to packing, which decodes faster
+    if (n*width <= best){
+        bw.put(width << 1, 6);
+        for (size_t i = 0; i < n; i++)
+            bw.put(u[i], width);
+        return;
+    }
+    bw.put((best_k << 1) | 1, 6);
+    uint32_t mask = (1u << best_k) - 1;
+    for (size_t i = 0; i < n; i++){
+        uint32_t q = u[i] >> best_k;
+        if (q < CODEC_RICE_ESCAPE)
+            bw.put(((uint64_t)(u[i] & mask) << (q + 1)) | (1u << q), q + 1 + best_k);
+        else {
+            bw.put(0, CODEC_RICE_ESCAPE);
+            bw.put(u[i], CODEC_RAW_BITS);
+        }
+    }
+}
+
+template<int order> static void encode_component(bit_writer &bw, const short *x, size_t n){
+    uint32_t u[CODEC_PARTITION];
+    int32_t x1 = 0, x2 = 0;
+    for (size_t i = 0; i < n; i += CODEC_PARTITION){
+        size_t m = std::min(CODEC_PARTITION, n - i);
+        for (size_t j = 0; j < m; j++){
+            int32_t x0 = x[2*(i + j)];
+            u[j] = zigzag((order == 0) ? x0 : (order == 1) ? x0 - x1 : x0 - 2*x1 + x2);
+            x2 = x1;
+            x1 = x0;
+        }
+        encode_partition(bw, u, m);
+    }
+}
+
+size_t codec_block_bound(size_t n){
+    size_t parts = (n + CODEC_PARTITION - 1)/CODEC_PARTITION;
+    return (2*(2 + parts*6 + n*CODEC_RAW_BITS) + 7)/8 + 8;
+}
+
+size_t encode_block(const std::complex<short> *in, size_t n, uint8_t *out){
+    bit_writer bw = {out, 0, 0};
+    const short *iq = reinterpret_cast<const short *>(in);
+    for (size_t c = 0; c < 2; c++){
+        const short *x = iq + c;
+        unsigned order = pick_order(x, n);
+        bw.put(order, 2);
+        switch (order){
+        case 0: encode_component<0>(bw, x, n); break;
+        case 1: encode_component<1>(bw, x, n); break;
+        default: encode_component<2>(bw, x, n); break;
+        }
+    }
+    bw.finish();
+    size_t nbytes = (size_t)(bw.p - out);
+    // noise that fills the sample range is stored as is
+    if (nbytes >= n*sizeof(std::complex<short>)){
+        nbytes = n*sizeof(std::complex<short>);
+        std::memcpy(out, in, nbytes);
+    }
+    return nbytes;
+}
+
+static void decode_component(bit_reader &br, short *x, size_t n){
+    unsigned order = br.get(2);
+    if (order > 2)
+        throw std::runtime_error("encoded capture block has a bad predictor");
+    int32_t x1 = 0, x2 = 0;
+    uint32_t u[CODEC_PARTITION];
+    for (size_t i = 0; i < n; i += CODEC_PARTITION){
+        size_t m = std::min(CODEC_PARTITION, n - i);
+        uint32_t hdr = br.get(6);
+        unsigned param = hdr >> 1;
+        if (hdr & 1){
+            if (param > CODEC_MAX_RICE_K)
+                throw std::runtime_error("encoded capture block has a bad Rice parameter");
+            for (size_t j = 0; j < m; j++){
+                unsigned q = br.zeros(CODEC_RICE_ESCAPE);
+                if (q == CODEC_RICE_ESCAPE)
+                    u[j] = br.get(CODEC_RAW_BITS);
+                else
+                    u[j] = ((uint32_t)q << param) | (br.get(param + 1) >> 1);
+            }
+        }
+        else {
+            if (param > CODEC_RAW_BITS)
+                throw std::runtime_error("encoded capture block has a bad width");
+            for (size_t j = 0; j < m; j++)
+                u[j] = br.get(param);
+        }
+        for (size_t j = 0; j < m; j++){
+            int32_t r = unzigzag(u[j]);
+            int32_t x0 = (order == 0) ? r : (order == 1) ? r + x1 : r + 2*x1 - x2;
+            x[2*(i + j)] = (short)x0;
+            x2 = x1;
+            x1 = x0;
+        }
+    }
+}
+
+void decode_block(const uint8_t *in, size_t nbytes, std::complex<short> *out, size_t n){
+    if (nbytes == n*sizeof(std::complex<short>)){
+        std::memcpy(out, in, nbytes);
+        return;
+    }
+    bit_reader br = {in, in, in + nbytes, 0, 0};
+    short *iq = reinterpret_cast<short *>(out);
+    decode_component(br, iq, n);
+    decode_component(br, iq + 1, n);
+    if ((br.consumed_bits() + 7)/8 != nbytes)
+        throw std::runtime_error("encoded capture block has trailing bytes");
+}
+
+/***********************************************************************
+ * pulses
+ **********************************************************************/
+static size_t codec_threads(size_t threads, size_t nblocks){
+    if (threads == 0)
+        threads = default_thread_count();
+    // at least 8 blocks per thread, or the thread start-up dominates
+    return std::max<size_t>(1, std::min(threads, nblocks/8));
+}
+
+capture_encoder::capture_encoder(size_t block_samps, size_t threads) :
+    _block_samps(block_samps),
+    _threads(threads)
+{
+    if (_block_samps == 0)
+        throw std::invalid_argument("codec block must hold at least one sample");
+    std::memset(&_stats, 0, sizeof(_stats));
+}
+
+size_t capture_encoder::encode(const std::complex<short> *in, size_t nsamps){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t nblocks = (nsamps + _block_samps - 1)/_block_samps;
+    size_t bound = codec_block_bound(_block_samps);
+    if (_scratch.size() < nblocks*bound)
+        _scratch.resize(nblocks*bound);
+    _sizes.resize(nblocks);
+
+    parallel_for(nblocks, codec_threads(_threads, nblocks), [&](size_t begin, size_t end){
+        for (size_t b = begin; b < end; b++){
+            size_t first = b*_block_samps;
+            size_t n = std::min(_block_samps, nsamps - first);
+            _sizes[b] = (uint32_t)encode_block(in + first, n, &_scratch[b*bound]);
+        }
+    });
+
+    size_t nbytes = nblocks*sizeof(uint32_t);
+    for (size_t b = 0; b < nblocks; b++)
+        nbytes += _sizes[b];
+    size_t padded = (nbytes + PAGE_SIZE_BYTES - 1)/PAGE_SIZE_BYTES*PAGE_SIZE_BYTES;
+    if (_out.size() < padded)
+        _out.resize(padded);
+    if (nblocks > 0)
+        std::memcpy(_out.data(), _sizes.data(), nblocks*sizeof(uint32_t));
+    uint8_t *p = _out.data() + nblocks*sizeof(uint32_t);
+    for (size_t b = 0; b < nblocks; b++){
+        std::memcpy(p, &_scratch[b*bound], _sizes[b]);
+        p += _sizes[b];
+    }
+    std::memset(p, 0, padded - nbytes);
+
+    _stats.pulses++;
+    _stats.samples += nsamps;
+    _stats.coded_bytes += nbytes;
+    _stats.secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nbytes;
+}
+
+double measure_encode_rate(size_t nsamps, size_t block_samps, size_t threads, double secs){
+    // receiver noise well above the ADC floor: it takes the widest partitions
+    // and the longest Rice codes a block that still shrinks gets
+    std::vector<std::complex<short>> in(std::max<size_t>(nsamps, 1));
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 1000.0f);
+    for (std::complex<short> &s : in)
+        s = std::complex<short>((short)std::lrint(noise(rng)), (short)std::lrint(noise(rng)));
+    capture_encoder encoder(block_samps, threads);
+    encoder.encode(in.data(), in.size());
+    const codec_stats_t &stats = encoder.get_stats();
+    uint64_t warm = stats.samples;
+    double warm_secs = stats.secs;
+    do
+        encoder.encode(in.data(), in.size());
+    while (stats.secs - warm_secs < secs or stats.pulses < 4);
+    return (stats.samples - warm)/(stats.secs - warm_secs);
+}
+
+size_t encoded_pulse_bytes(const uint8_t *data, size_t avail, size_t nsamps, size_t block_samps){
+    // nsamps and the block sizes come from the file: nothing here may wrap
+    size_t nblocks = nsamps/block_samps + (nsamps % block_samps != 0);
+    if (nblocks > avail/sizeof(uint32_t))
+        throw std::runtime_error("encoded pulse table runs past the sample region");
+    size_t nbytes = nblocks*sizeof(uint32_t);
+    for (size_t b = 0; b < nblocks; b++){
+        uint32_t size;
+        std::memcpy(&size, data + b*sizeof(uint32_t), sizeof(size));
+        if (size > avail - nbytes)
+            throw std::runtime_error("encoded pulse runs past the sample region");
+        nbytes += size;
+    }
+    return nbytes;
+}
+
+void decode_pulse(const uint8_t *data, size_t nbytes, size_t nsamps, size_t block_samps,
+                  std::complex<short> *out, size_t threads){
+    size_t nblocks = (nsamps + block_samps - 1)/block_samps;
+    if (encoded_pulse_bytes(data, nbytes, nsamps, block_samps) != nbytes)
+        throw std::runtime_error("encoded pulse has the wrong length");
+    std::vector<size_t> offsets(nblocks + 1, nblocks*sizeof(uint32_t));
+    for (size_t b = 0; b < nblocks; b++){
+        uint32_t size;
+        std::memcpy(&size, data + b*sizeof(uint32_t), sizeof(size));
+        offsets[b + 1] = offsets[b] + size;
+    }
+    parallel_for(nblocks, codec_threads(threads, nblocks), [&](size_t begin, size_t end){
+        for (size_t b = begin; b < end; b++){
+            size_t first = b*block_samps;
+            decode_block(data + offsets[b], offsets[b + 1] - offsets[b], out + first,
+                         std::min(block_samps, nsamps - first));
+        }
+    });
+}
+
+void print_codec_stats(std::ostream &os, const codec_stats_t &stats){
+    double raw = (double)stats.samples*sizeof(std::complex<short>);
+    os << boost::format("Codec: %d pulses, %d samples, %.1f MB -> %.1f MB (ratio %.2f), %f s (%f Msps)")
+        % stats.pulses % stats.samples % (raw/1e6) % (stats.coded_bytes/1e6)
+        % (stats.coded_bytes > 0 ? raw/stats.coded_bytes : 0.0) % stats.secs
+        % (stats.secs > 0.0 ? stats.samples/stats.secs/1e6 : 0.0) << std::endl;
+}
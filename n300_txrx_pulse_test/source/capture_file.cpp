@@ -0,0 +1,361 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "capture_file.hpp"
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+uint64_t capture_hash(const void *data, size_t nbytes, uint64_t seed){
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < nbytes; i++){
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t capture_waveform_hash(const std::vector<const sc16_buffer_t *> &waves){
+    uint64_t h = capture_hash(NULL, 0);
+    for (const sc16_buffer_t *wave : waves)
+        h = capture_hash(wave->data(), wave->size()*sizeof(std::complex<short>), h);
+    return h;
+}
+
+capture_header_t make_capture_header(void){
+    capture_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.header_bytes = sizeof(capture_header_t);
+    header.sample_format = CAPTURE_FORMAT_SC16;
+    header.bytes_per_sample = sizeof(std::complex<short>);
+    header.data_offset = CAPTURE_DATA_ALIGN;
+    return header;
+}
+
+void set_capture_format(capture_header_t &header, sample_format_t format){
+    switch (format){
+    case SAMPLE_FORMAT_SC8: header.sample_format = CAPTURE_FORMAT_SC8; break;
+    case SAMPLE_FORMAT_SC16: header.sample_format = CAPTURE_FORMAT_SC16; break;
+    case SAMPLE_FORMAT_FC32: header.sample_format = CAPTURE_FORMAT_FC32; break;
+    }
+    header.bytes_per_sample = (uint32_t)sample_size(format);
+}
+
+void set_capture_encoding(capture_header_t &header, uint32_t encoding, size_t block_samps){
+    if (encoding == CAPTURE_ENCODING_NONE){
+        header.encoding = CAPTURE_ENCODING_NONE;
+        header.block_samps = 0;
+        header.version = CAPTURE_VERSION;
+        return;
+    }
+    if (encoding != CAPTURE_ENCODING_LOSSLESS)
+        throw std::invalid_argument("unknown capture encoding");
+    if (header.sample_format != CAPTURE_FORMAT_SC16)
+        throw std::invalid_argument("only sc16 captures can be encoded");
+    header.encoding = encoding;
+    header.block_samps = (uint32_t)((block_samps > 0) ? block_samps : CODEC_DEFAULT_BLOCK);
+    header.version = CAPTURE_VERSION_ENCODED;
+}
+
+uint32_t parse_capture_encoding(const std::string &name){
+    if (name == "none")
+        return CAPTURE_ENCODING_NONE;
+    if (name == "lossless")
+        return CAPTURE_ENCODING_LOSSLESS;
+    throw std::invalid_argument("unknown capture encoding \"" + name + "\" (none or lossless)");
+}
+
+sample_format_t capture_sample_format(uint32_t capture_format){
+    switch (capture_format){
+    case CAPTURE_FORMAT_SC8: return SAMPLE_FORMAT_SC8;
+    case CAPTURE_FORMAT_SC16: return SAMPLE_FORMAT_SC16;
+    case CAPTURE_FORMAT_FC32: return SAMPLE_FORMAT_FC32;
+    }
+    throw std::runtime_error("unsupported capture sample format");
+}
+
+capture_file_sink::capture_file_sink(const std::string &fname, const capture_header_t &header, bool direct_io, bool preallocate,
+                                     uint64_t expected_bytes, size_t codec_threads) :
+    _fname(fname),
+    _header(header),
+    _direct_io(direct_io),
+    _fd(-1),
+    _offset(CAPTURE_DATA_ALIGN)
+{
+    _header.data_offset = CAPTURE_DATA_ALIGN;
+    _header.npulses = 0;
+    _header.index_offset = 0;
+    _header.tag_offset = 0;
+    _header.ntags = 0;
+    if (_header.encoding != CAPTURE_ENCODING_NONE){
+        set_capture_encoding(_header, _header.encoding, _header.block_samps);
+        _encoder.reset(new capture_encoder(_header.block_samps, codec_threads));
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (_direct_io){
+        _fd = open(fname.c_str(), flags | O_DIRECT, 0644);
+        if (_fd < 0 and errno == EINVAL){
+            std::cerr << "WARNING: O_DIRECT not supported for " << fname << ", using buffered writes" << std::endl;
+            _direct_io = false;
+        }
+    }
+    if (not _direct_io)
+        _fd = open(fname.c_str(), flags, 0644);
+    if (_fd < 0)
+        throw std::runtime_error("Could not open file " + fname + ": " + strerror(errno));
+
+    if (preallocate and expected_bytes > 0)
+        posix_fallocate(_fd, 0, CAPTURE_DATA_ALIGN + expected_bytes);
+
+    // header page; rewritten with the final pulse count on close()
+    sc16_page_buffer_t page(CAPTURE_DATA_ALIGN/sizeof(std::complex<short>));
+    std::memcpy((void *)page.data(), &_header, sizeof(_header));
+    write_at(page.data(), CAPTURE_DATA_ALIGN, 0);
+}
+
+capture_file_sink::~capture_file_sink(void){
+    try {
+        close();
+    }
+    catch (std::exception &e){
+        std::cerr << "Error: closing capture " << _fname << ": " << e.what() << std::endl;
+    }
+}
+
+void capture_file_sink::write_at(const void *data, size_t nbytes, uint64_t offset){
+    const char *p = static_cast<const char *>(data);
+    size_t done = 0;
+    while (done < nbytes){
+        ssize_t n = pwrite(_fd, p + done, nbytes - done, (off_t)(offset + done));
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Could not write file " + _fname + ": " + strerror(errno));
+        }
+        done += (size_t)n;
+    }
+}
+
+void capture_file_sink::write(const pulse_slot &slot){
+    // sc8 and fc32 slots hold their samples in the storage of samps
+    append(slot, slot.samps, slot.nsamps);
+}
+
+void capture_file_sink::append(const pulse_slot &slot, const void *data, size_t nsamps){
+    if (_fd < 0)
+        throw std::runtime_error("capture " + _fname + " is closed");
+    if (_encoder){
+        size_t nbytes = _encoder->encode(static_cast<const std::complex<short> *>(data), nsamps);
+        store(slot, _encoder->data(), nbytes, nsamps);
+    }
+    else
+        store(slot, data, nsamps*_header.bytes_per_sample, nsamps);
+}
+
+void capture_file_sink::store(const pulse_slot &slot, const void *data, size_t nbytes, size_t nsamps){
+    // O_DIRECT writes whole pages out of the page padded buffer
+    size_t wbytes = _direct_io ? (nbytes + CAPTURE_DATA_ALIGN - 1)/CAPTURE_DATA_ALIGN*CAPTURE_DATA_ALIGN : nbytes;
+    if (wbytes > 0)
+        write_at(data, wbytes, _offset);
+
+    capture_index_t entry;
+    entry.pulse = slot.index;
+    entry.offset = _offset;
+    entry.nsamps = nsamps;
+    entry.time_full_secs = slot.time_full_secs;
+    entry.time_frac_secs = slot.time_frac_secs;
+    entry.error_code = slot.error_code;
+    entry.flags = slot.has_time_spec ? CAPTURE_FLAG_HAS_TIME_SPEC : 0;
+    entry.flags |= ((uint32_t)slot.channel << CAPTURE_FLAG_CHANNEL_SHIFT) & CAPTURE_FLAG_CHANNEL_MASK;
+    _index.push_back(entry);
+    _offset += wbytes;
+}
+
+void capture_file_sink::add_tag(const capture_tag_t &tag){
+    _tags.push_back(tag);
+}
+
+void capture_file_sink::close(void){
+    if (_fd < 0)
+        return;
+    if (_direct_io)
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+
+    _header.npulses = _index.size();
+    _header.index_offset = _offset;
+    size_t index_bytes = _index.size()*sizeof(capture_index_t);
+    size_t tag_bytes = _tags.size()*sizeof(capture_tag_t);
+    _header.ntags = _tags.size();
+    _header.tag_offset = _tags.empty() ? 0 : _offset + index_bytes;
+    try {
+        if (index_bytes > 0)
+            write_at(&_index.front(), index_bytes, _offset);
+        if (tag_bytes > 0)
+            write_at(&_tags.front(), tag_bytes, _offset + index_bytes);
+        write_at(&_header, sizeof(_header), 0);
+    }
+    catch (...){
+        ::close(_fd);
+        _fd = -1;
+        throw;
+    }
+    // drop whatever was preallocated past the index
+    if (ftruncate(_fd, (off_t)(_offset + index_bytes + tag_bytes)) != 0)
+        std::cerr << "WARNING: could not truncate " << _fname << ": " << strerror(errno) << std::endl;
+    ::close(_fd);
+    _fd = -1;
+}
+
+capture_file_reader::capture_file_reader(const std::string &fname) :
+    _file(fname),
+    _header(NULL),
+    _format(SAMPLE_FORMAT_SC16),
+    _index(NULL),
+    _tags(NULL)
+{
+    if (_file.size() < sizeof(capture_header_t) or
+        std::memcmp(_file.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+        throw std::runtime_error(fname + " is not a capture file");
+    _header = _file.as<capture_header_t>();
+    if (_header->version != CAPTURE_VERSION and _header->version != CAPTURE_VERSION_ENCODED)
+        throw std::runtime_error(fname + ": unsupported capture version");
+    if ((_header->version == CAPTURE_VERSION_ENCODED) != (_header->encoding == CAPTURE_ENCODING_LOSSLESS) or
+        (encoded() and (_header->sample_format != CAPTURE_FORMAT_SC16 or _header->block_samps == 0)))
+        throw std::runtime_error(fname + ": unsupported capture encoding");
+    if (_header->sample_format != CAPTURE_FORMAT_SC8 and _header->sample_format != CAPTURE_FORMAT_SC16 and
+        _header->sample_format != CAPTURE_FORMAT_FC32)
+        throw std::runtime_error(fname + ": unsupported sample format");
+    _format = capture_sample_format(_header->sample_format);
+    if (_header->bytes_per_sample != sample_size(_format))
+        throw std::runtime_error(fname + ": sample size does not match the sample format");
+    if (_header->index_offset == 0)
+        throw std::runtime_error(fname + ": capture was not closed (no index)");
+    // every offset and count comes from the file, so compare by subtraction
+    // from bounds already checked, where nothing can wrap
+    const uint64_t file_size = _file.size();
+    if (_header->data_offset < sizeof(capture_header_t) or _header->data_offset > file_size)
+        throw std::runtime_error(fname + ": sample region starts outside the file");
+    if (_header->index_offset < _header->data_offset or _header->index_offset > file_size or
+        _header->npulses > (file_size - _header->index_offset)/sizeof(capture_index_t))
+        throw std::runtime_error(fname + ": index runs past the end of the file");
+    _index = _file.as<capture_index_t>(_header->index_offset);
+    for (size_t k = 0; k < _header->npulses; k++){
+        if (_index[k].offset < _header->data_offset or _index[k].offset > _header->index_offset)
+            throw std::runtime_error(fname + ": pulse lies outside the sample region");
+        const uint64_t avail = _header->index_offset - _index[k].offset;
+        if (encoded()){
+            // the block table of every pulse must stay within the sample region
+            try {
+                if (_index[k].nsamps > std::numeric_limits<size_t>::max())
+                    throw std::runtime_error("encoded pulse is too long");
+                _coded_bytes.push_back(encoded_pulse_bytes(_file.as<uint8_t>(_index[k].offset), (size_t)avail,
+                                                           (size_t)_index[k].nsamps, _header->block_samps));
+            }
+            catch (std::runtime_error &e){
+                throw std::runtime_error(fname + ": " + e.what());
+            }
+        }
+        else if (_index[k].nsamps > avail/_header->bytes_per_sample)
+            throw std::runtime_error(fname + ": pulse runs past the sample region");
+    }
+    if (_header->ntags > 0){
+        if (_header->tag_offset < _header->data_offset or _header->tag_offset > file_size or
+            _header->ntags > (file_size - _header->tag_offset)/sizeof(capture_tag_t))
+            throw std::runtime_error(fname + ": tags run past the end of the file");
+        _tags = _file.as<capture_tag_t>(_header->tag_offset);
+    }
+}
+
+const capture_index_t &capture_file_reader::index(size_t k) const {
+    if (k >= size())
+        throw std::out_of_range("capture pulse index out of range");
+    return _index[k];
+}
+
+const capture_tag_t &capture_file_reader::tag(size_t i) const {
+    if (i >= ntags())
+        throw std::out_of_range("capture tag index out of range");
+    return _tags[i];
+}
+
+const capture_tag_t *capture_file_reader::find_tag(uint64_t pulse) const {
+    for (size_t i = 0; i < ntags(); i++){
+        if (pulse >= _tags[i].first_pulse and pulse - _tags[i].first_pulse < _tags[i].npulses)
+            return &_tags[i];
+    }
+    return NULL;
+}
+
+const std::complex<short> *capture_file_reader::samples(size_t k) const {
+    if (_header->sample_format != CAPTURE_FORMAT_SC16)
+        throw std::runtime_error("capture does not hold sc16 samples");
+    return static_cast<const std::complex<short> *>(data(k));
+}
+
+const void *capture_file_reader::data(size_t k) const {
+    if (encoded())
+        throw std::runtime_error("capture is encoded, its pulses must be decoded");
+    return _file.as<char>(index(k).offset);
+}
+
+void capture_file_reader::decode(size_t k, std::complex<short> *out) const {
+    if (not encoded())
+        throw std::runtime_error("capture is not encoded");
+    const capture_index_t &entry = index(k);
+    // blocks of long stream chunks decode on every CPU
+    decode_pulse(_file.as<uint8_t>(entry.offset), _coded_bytes[k], (size_t)entry.nsamps, _header->block_samps, out, 0);
+}
+
+bool is_capture_file(const std::string &fname){
+    std::ifstream ifile(fname.c_str(), std::ios::binary);
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if (not ifile.read(magic, sizeof(magic)))
+        return false;
+    return std::memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+}
+
+// pulse k converted to std::complex<T>
+template<typename T> static void export_pulse(std::ofstream &file, const capture_file_reader &reader, size_t k,
+                                              std::vector<std::complex<T>> &buff){
+    size_t nsamps = (size_t)reader.index(k).nsamps;
+    if (nsamps == 0)
+        return;
+    buff.resize(nsamps);
+    reader.read(k, &buff.front());
+    file.write((const char*)&buff.front(), nsamps*sizeof(std::complex<T>));
+}
+
+void export_capture_pulses(const std::string &capture_fname, const std::string &fname){
+    capture_file_reader reader(capture_fname);
+    // pulses of a dual channel capture go to per channel files
+    bool dual = reader.header().rx_channels == 0x3;
+    size_t npulses = dual ? reader.size()/2 : reader.size();
+    bool fc32 = boost::filesystem::path(fname).extension() == ".fc32";
+    std::vector<std::complex<short>> wide;
+    std::vector<std::complex<float>> floats;
+    for (size_t k = 0; k < reader.size(); k++){
+        const capture_index_t &entry = reader.index(k);
+        std::string chanfname = dual ? channel_filename(fname, (entry.flags & CAPTURE_FLAG_CHANNEL_MASK) >> CAPTURE_FLAG_CHANNEL_SHIFT) : fname;
+        std::string newfname = pulse_filename(chanfname, entry.pulse, npulses);
+        std::ofstream file;
+        file.open(newfname.c_str(), std::ofstream::binary);
+        if (not file.is_open())
+            throw std::runtime_error("Could not open file " + newfname);
+        if (fc32)
+            export_pulse(file, reader, k, floats);
+        else
+            export_pulse(file, reader, k, wide);
+        file.close();
+    }
+}
@@ -0,0 +1,364 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "ddc.hpp"
+#include "sample_convert.hpp"
+#include "window.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+// taps are zero padded to a multiple of this, so the dot product has no tail
+#define DDC_TAP_BLOCK 16
+
+/***********************************************************************
+ * kernels
+ **********************************************************************/
+void mix_sc16(const std::complex<short> *in, const fc32_t *lo, fc32_t *out, size_t n){
+    const short *src = reinterpret_cast<const short *>(in);
+    const float *l = reinterpret_cast<const float *>(lo);
+    float *dst = reinterpret_cast<float *>(out);
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4){
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2*i))));
+        __m256 b = _mm256_loadu_ps(l + 2*i);
+        // (ar*br - ai*bi, ai*br + ar*bi)
+        __m256 p = _mm256_mul_ps(a, _mm256_moveldup_ps(b));
+        __m256 q = _mm256_mul_ps(_mm256_permute_ps(a, 0xb1), _mm256_movehdup_ps(b));
+        _mm256_storeu_ps(dst + 2*i, _mm256_addsub_ps(p, q));
+    }
+#elif defined(__SSE2__)
+    const __m128 neg_even = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+    for (; i + 2 <= n; i += 2){
+        __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 2*i));
+        __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 b = _mm_loadu_ps(l + 2*i);
+        __m128 p = _mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0)));
+        __m128 q = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1)));
+        _mm_storeu_ps(dst + 2*i, _mm_add_ps(p, _mm_xor_ps(q, neg_even)));
+    }
+#elif defined(HAVE_NEON)
+    for (; i + 4 <= n; i += 4){
+        int16x4x2_t x = vld2_s16(src + 2*i);
+        float32x4_t ar = vcvtq_f32_s32(vmovl_s16(x.val[0]));
+        float32x4_t ai = vcvtq_f32_s32(vmovl_s16(x.val[1]));
+        float32x4x2_t b = vld2q_f32(l + 2*i);
+        float32x4x2_t y;
+        y.val[0] = vmlsq_f32(vmulq_f32(ar, b.val[0]), ai, b.val[1]);
+        y.val[1] = vmlaq_f32(vmulq_f32(ar, b.val[1]), ai, b.val[0]);
+        vst2q_f32(dst + 2*i, y);
+    }
+#endif
+    for (; i < n; i++){
+        float ar = src[2*i], ai = src[2*i + 1];
+        dst[2*i] = ar*l[2*i] - ai*l[2*i + 1];
+        dst[2*i + 1] = ai*l[2*i] + ar*l[2*i + 1];
+    }
+}
+
+// sum of x[i]*taps[i] over n interleaved floats (n a multiple of
+// 2*DDC_TAP_BLOCK); the even lanes add up to I and the odd lanes to Q
+static inline fc32_t dot_taps(const float *x, const float *taps, size_t n){
+    size_t i = 0;
+#if defined(__AVX2__)
+    // four independent sums hide the latency of the adds
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+    for (; i < n; i += 32){
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_load_ps(taps + i)));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_loadu_ps(x + i + 8), _mm256_load_ps(taps + i + 8)));
+        a2 = _mm256_add_ps(a2, _mm256_mul_ps(_mm256_loadu_ps(x + i + 16), _mm256_load_ps(taps + i + 16)));
+        a3 = _mm256_add_ps(a3, _mm256_mul_ps(_mm256_loadu_ps(x + i + 24), _mm256_load_ps(taps + i + 24)));
+    }
+    __m256 a = _mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3));
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    float r[4];
+    _mm_storeu_ps(r, s);
+    return fc32_t(r[0], r[1]);
+#elif defined(__SSE2__)
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+    for (; i < n; i += 16){
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_load_ps(taps + i)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_load_ps(taps + i + 4)));
+        a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(x + i + 8), _mm_load_ps(taps + i + 8)));
+        a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(x + i + 12), _mm_load_ps(taps + i + 12)));
+    }
+    __m128 s = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    float r[4];
+    _mm_storeu_ps(r, s);
+    return fc32_t(r[0], r[1]);
+#elif defined(HAVE_NEON)
+    float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f), a2 = vdupq_n_f32(0.0f), a3 = vdupq_n_f32(0.0f);
+    for (; i < n; i += 16){
+        a0 = vmlaq_f32(a0, vld1q_f32(x + i), vld1q_f32(taps + i));
+        a1 = vmlaq_f32(a1, vld1q_f32(x + i + 4), vld1q_f32(taps + i + 4));
+        a2 = vmlaq_f32(a2, vld1q_f32(x + i + 8), vld1q_f32(taps + i + 8));
+        a3 = vmlaq_f32(a3, vld1q_f32(x + i + 12), vld1q_f32(taps + i + 12));
+    }
+    float32x4_t a = vaddq_f32(vaddq_f32(a0, a1), vaddq_f32(a2, a3));
+    float32x2_t s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    return fc32_t(vget_lane_f32(s, 0), vget_lane_f32(s, 1));
+#else
+    float re = 0.0f, im = 0.0f;
+    for (; i < n; i += 2){
+        re += x[i]*taps[i];
+        im += x[i + 1]*taps[i + 1];
+    }
+    return fc32_t(re, im);
+#endif
+}
+
+// a fraction of a turn in 64 bit fixed point, as the waveform synthesizer
+static uint64_t turns_to_phase(double turns){
+    double frac = turns - std::floor(turns);
+    double scaled = std::ldexp(frac, 64);
+    return (scaled >= 18446744073709551616.0) ? 0 : (uint64_t)scaled;
+}
+
+static fc32_t phase_to_phasor(uint64_t phase){
+    double a = 2.0*M_PI*std::ldexp((double)phase, -64);
+    return fc32_t((float)std::cos(a), (float)std::sin(a));
+}
+
+/***********************************************************************
+ * ddc_filter
+ **********************************************************************/
+ddc_config_t default_ddc_config(void){
+    ddc_config_t config;
+    config.decim = 1;
+    config.freq = 0.0;
+    config.bw = 0.0;
+    config.taps = 0;
+    config.fc32 = false;
+    return config;
+}
+
+ddc_filter::ddc_filter(const ddc_config_t &config, double rate) :
+    _rate(rate),
+    _decim(config.decim),
+    _mix(config.freq != 0.0),
+    _phase_step(0),
+    _fill(0),
+    _consumed(0),
+    _next_out(0),
+    _buf_start(0)
+{
+    if (_decim == 0)
+        throw std::invalid_argument("decimation must be at least 1");
+    if (rate <= 0.0)
+        throw std::invalid_argument("DDC needs a sample rate");
+    _phase_step = turns_to_phase(-config.freq/rate);
+    double out_rate = rate/_decim;
+    double bw = (config.bw > 0.0) ? config.bw : ((_decim > 1) ? 0.8*out_rate : rate);
+    if (bw > out_rate)
+        throw std::invalid_argument(str(boost::format("DDC bandwidth %f MHz is more than the output rate %f Msps") % (bw/1e6) % (out_rate/1e6)));
+    if (config.taps > 0)
+        _ntaps = config.taps;
+    else if (bw >= out_rate)
+        _ntaps = 1;   // a frequency shift only
+    else
+        _ntaps = (size_t)std::ceil(5.5*rate/(out_rate - bw)) | 1;
+    _padded = (_ntaps + DDC_TAP_BLOCK - 1)/DDC_TAP_BLOCK*DDC_TAP_BLOCK;
+    _lookahead = (_ntaps - 1)/2;
+
+    // windowed sinc with its -6 dB point at bw/2, unit gain at DC
+    std::vector<float> window = make_window(WINDOW_BLACKMAN, _ntaps);
+    std::vector<double> h(_ntaps);
+    double fc = 0.5*bw/rate, sum = 0.0;
+    for (size_t k = 0; k < _ntaps; k++){
+        double x = k - (_ntaps - 1)/2.0;
+        h[k] = ((x == 0.0) ? 2.0*fc : std::sin(2.0*M_PI*fc*x)/(M_PI*x))*window[k];
+        sum += h[k];
+    }
+    // reversed, so the window of inputs ending at the newest one is a plain
+    // dot product, and zero padded in front
+    _taps_iq.assign(2*_padded, 0.0f);
+    for (size_t j = 0; j < _ntaps; j++){
+        float t = (float)(h[_ntaps - 1 - j]/sum);
+        _taps_iq[2*(_padded - _ntaps + j)] = _taps_iq[2*(_padded - _ntaps + j) + 1] = t;
+    }
+    reset();
+}
+
+void ddc_filter::reset(void){
+    // the history before the first sample is zeros
+    if (_buf.size() < _padded - 1)
+        _buf.resize(_padded - 1);
+    std::fill(_buf.begin(), _buf.begin() + (_padded - 1), fc32_t(0.0f, 0.0f));
+    _fill = _padded - 1;
+    _buf_start = -(int64_t)(_padded - 1);
+    _consumed = 0;
+    _next_out = 0;
+}
+
+void ddc_filter::append(size_t n){
+    if (_buf.size() < _fill + n)
+        _buf.resize(_fill + n);
+}
+
+size_t ddc_filter::process(const std::complex<short> *in, size_t n, fc32_t *out){
+    append(n);
+    fc32_t *dst = &_buf[_fill];
+    if (_mix){
+        // the NCO table runs from phase 0; later calls rotate it to the
+        // exact phase of their first sample, so no error accumulates
+        for (size_t i = _lo.size(); i < n; i++)
+            _lo.push_back(phase_to_phasor((uint64_t)i*_phase_step));
+        const fc32_t *lo = &_lo[0];
+        if (_consumed > 0){
+            fc32_t c = phase_to_phasor(_consumed*_phase_step);
+            if (_lo_rot.size() < n)
+                _lo_rot.resize(n);
+            for (size_t i = 0; i < n; i++)
+                _lo_rot[i] = _lo[i]*c;
+            lo = &_lo_rot[0];
+        }
+        mix_sc16(in, lo, dst, n);
+    }
+    else
+        convert_sc16(in, dst, n, false);
+    _fill += n;
+    _consumed += n;
+    return drain(out);
+}
+
+size_t ddc_filter::flush(fc32_t *out){
+    append(_lookahead);
+    std::fill(_buf.begin() + _fill, _buf.begin() + _fill + _lookahead, fc32_t(0.0f, 0.0f));
+    _fill += _lookahead;
+    return drain(out);
+}
+
+size_t ddc_filter::decimate(const std::complex<short> *in, size_t n, fc32_t *out){
+    reset();
+    size_t produced = process(in, n, out);
+    return produced + flush(out + produced);
+}
+
+size_t ddc_filter::drain(fc32_t *out){
+    size_t produced = 0;
+    int64_t have = _buf_start + (int64_t)_fill;
+    const float *buf = reinterpret_cast<const float *>(&_buf[0]);
+    for (;;){
+        // output m is centered on input m*decim and needs inputs up to m*decim + lookahead
+        int64_t newest = (int64_t)(_next_out*_decim + _lookahead);
+        if (newest >= have)
+            break;
+        int64_t first = newest - (int64_t)(_padded - 1) - _buf_start;
+        // a frequency shift only has the single unit tap
+        out[produced++] = (_ntaps == 1) ? _buf[newest - _buf_start] : dot_taps(buf + 2*first, &_taps_iq[0], 2*_padded);
+        _next_out++;
+    }
+    // keep only the history the next output reaches back to
+    int64_t keep = (int64_t)(_next_out*_decim + _lookahead) - (int64_t)(_padded - 1);
+    size_t drop = (size_t)std::min<int64_t>(std::max<int64_t>(keep - _buf_start, 0), (int64_t)_fill);
+    if (drop > 0){
+        std::memmove(&_buf[0], &_buf[drop], (_fill - drop)*sizeof(fc32_t));
+        _fill -= drop;
+        _buf_start += (int64_t)drop;
+    }
+    return produced;
+}
+
+/***********************************************************************
+ * ddc_sink
+ **********************************************************************/
+ddc_sink::ddc_sink(const ddc_config_t &config, double rate, pulse_arena::sptr out_arena,
+                   boost::shared_ptr<pulse_writer> out, bool continuous) :
+    _filter(config, rate),
+    _fc32(config.fc32),
+    _arena(out_arena),
+    _out(out),
+    _continuous(continuous),
+    _started(false)
+{
+    std::memset(&_stats, 0, sizeof(_stats));
+    std::memset(&_last, 0, sizeof(_last));
+}
+
+size_t ddc_sink::out_capacity(const ddc_config_t &config, double rate, size_t n){
+    ddc_filter filter(config, rate);
+    size_t m = filter.max_output(n);
+    // an fc32 sample takes the room of two sc16 samples
+    return config.fc32 ? 2*m : m;
+}
+
+void ddc_sink::write(const pulse_slot &slot){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (_continuous and not _started){
+        _filter.reset();
+        _started = true;
+    }
+    // the first output of a stream chunk may be centered on a sample of the last chunk
+    int64_t shift = _continuous ? (int64_t)_filter.next_output() - (int64_t)_filter.consumed() : 0;
+    if (_work.size() < _filter.max_output(slot.nsamps))
+        _work.resize(_filter.max_output(slot.nsamps));
+    size_t n = _continuous ? _filter.process(slot.samps, slot.nsamps, &_work[0])
+                           : _filter.decimate(slot.samps, slot.nsamps, &_work[0]);
+    _last = slot;
+    _stats.pulses++;
+    _stats.samples_in += slot.nsamps;
+    _stats.dsp_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    submit(slot, n, shift);
+}
+
+void ddc_sink::submit(const pulse_slot &slot, size_t n, int64_t shift){
+    if (n == 0)
+        return;
+    pulse_slot *out = _arena->acquire();
+    if (out == NULL)
+        throw std::runtime_error("DDC output dropped");
+    if (_fc32)
+        std::memcpy(static_cast<void *>(out->samps), &_work[0], n*sizeof(fc32_t));
+    else
+        convert_samples(&_work[0], out->samps, n);
+    out->index = slot.index;
+    out->channel = slot.channel;
+    out->wave = slot.wave;
+    out->nsamps = n;
+    out->has_time_spec = slot.has_time_spec;
+    out->time_full_secs = slot.time_full_secs;
+    out->time_frac_secs = slot.time_frac_secs;
+    out->error_code = slot.error_code;
+    if (shift != 0){
+        double t = slot.time_frac_secs + shift/_filter.rate();
+        out->time_full_secs += (int64_t)std::floor(t);
+        out->time_frac_secs = t - std::floor(t);
+    }
+    _stats.samples_out += n;
+    _out->submit(out);
+}
+
+void ddc_sink::close(void){
+    // the end of a stream still has lookahead outputs to make
+    if (_continuous and _started){
+        int64_t shift = (int64_t)_filter.next_output() - (int64_t)_filter.consumed();
+        if (_work.size() < _filter.max_output(0))
+            _work.resize(_filter.max_output(0));
+        submit(_last, _filter.flush(&_work[0]), shift + (int64_t)_last.nsamps);
+        _started = false;
+    }
+    _out->close();
+}
+
+void print_ddc_stats(std::ostream &os, const ddc_stats_t &stats, size_t decim){
+    os << boost::format("DDC: %d pulses, %d samples in, %d out (decimation %d), %f s (%f Msps in)")
+        % stats.pulses % stats.samples_in % stats.samples_out % decim % stats.dsp_secs
+        % (stats.dsp_secs > 0.0 ? stats.samples_in/stats.dsp_secs/1e6 : 0.0) << std::endl;
+}
@@ -0,0 +1,192 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "fft.hpp"
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+size_t next_pow2(size_t n){
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+/***********************************************************************
+ * Complex multiply kernels on interleaved (re,im) floats
+ **********************************************************************/
+#if defined(__AVX2__)
+// four complex products a*b (conj_b: a*conj(b))
+static inline __m256 cmul_avx(__m256 a, __m256 b, bool conj_b){
+    __m256 br = _mm256_moveldup_ps(b);               // br br
+    __m256 bi = _mm256_movehdup_ps(b);               // bi bi
+    __m256 as = _mm256_permute_ps(a, 0xb1);          // ai ar
+    __m256 t1 = _mm256_mul_ps(a, br);                // ar*br ai*br
+    __m256 t2 = _mm256_mul_ps(as, bi);               // ai*bi ar*bi
+    if (conj_b)
+        return _mm256_permute_ps(_mm256_addsub_ps(_mm256_permute_ps(t1, 0xb1), _mm256_permute_ps(t2, 0xb1)), 0xb1);
+    return _mm256_addsub_ps(t1, t2);
+}
+#elif defined(__SSE2__)
+// two complex products a*b (conj_b: a*conj(b))
+static inline __m128 cmul_sse2(__m128 a, __m128 b, bool conj_b){
+    const __m128 even = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+    const __m128 odd = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+    __m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 bi = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 t1 = _mm_mul_ps(a, br);
+    __m128 t2 = _mm_mul_ps(as, bi);
+    return _mm_add_ps(t1, _mm_xor_ps(t2, conj_b ? odd : even));
+}
+#endif
+
+static inline void cmul_scalar(const fc32_t &a, const fc32_t &b, fc32_t &out, bool conj_b){
+    // spelled out: operator* on std::complex also handles inf/nan, slowly
+    float ar = a.real(), ai = a.imag(), br = b.real(), bi = conj_b ? -b.imag() : b.imag();
+    out = fc32_t(ar*br - ai*bi, ar*bi + ai*br);
+}
+
+static void complex_multiply_impl(const fc32_t *a, const fc32_t *b, fc32_t *out, size_t n, bool conj_b){
+    size_t i = 0;
+    const float *pa = reinterpret_cast<const float *>(a);
+    const float *pb = reinterpret_cast<const float *>(b);
+    float *po = reinterpret_cast<float *>(out);
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_ps(po + 2*i, cmul_avx(_mm256_loadu_ps(pa + 2*i), _mm256_loadu_ps(pb + 2*i), conj_b));
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_ps(po + 2*i, cmul_sse2(_mm_loadu_ps(pa + 2*i), _mm_loadu_ps(pb + 2*i), conj_b));
+#elif defined(HAVE_NEON)
+    for (; i + 4 <= n; i += 4){
+        float32x4x2_t x = vld2q_f32(pa + 2*i);
+        float32x4x2_t y = vld2q_f32(pb + 2*i);
+        if (conj_b)
+            y.val[1] = vnegq_f32(y.val[1]);
+        float32x4x2_t z;
+        z.val[0] = vmlsq_f32(vmulq_f32(x.val[0], y.val[0]), x.val[1], y.val[1]);
+        z.val[1] = vmlaq_f32(vmulq_f32(x.val[0], y.val[1]), x.val[1], y.val[0]);
+        vst2q_f32(po + 2*i, z);
+    }
+#endif
+    for (; i < n; i++)
+        cmul_scalar(a[i], b[i], out[i], conj_b);
+}
+
+void complex_multiply(const fc32_t *a, const fc32_t *b, fc32_t *out, size_t n){
+    complex_multiply_impl(a, b, out, n, false);
+}
+
+void complex_multiply_conj(const fc32_t *a, const fc32_t *b, fc32_t *out, size_t n){
+    complex_multiply_impl(a, b, out, n, true);
+}
+
+/***********************************************************************
+ * FFT plan
+ **********************************************************************/
+fft_plan::fft_plan(size_t n) :
+    _n(n)
+{
+    if (n < 2 or (n & (n - 1)) != 0)
+        throw std::invalid_argument("fft_plan: size must be a power of two");
+    size_t log2n = 0;
+    while (((size_t)1 << log2n) < n)
+        log2n++;
+    _bitrev.resize(n);
+    for (size_t i = 0; i < n; i++){
+        uint32_t r = 0;
+        for (size_t b = 0; b < log2n; b++)
+            r |= ((i >> b) & 1) << (log2n - 1 - b);
+        _bitrev[i] = r;
+    }
+    // stage with half size h uses exp(-2 pi i j / 2h), j < h, at offset h - 1
+    _twiddle.resize(n - 1);
+    _twiddle_inv.resize(n - 1);
+    for (size_t h = 1; h < n; h <<= 1){
+        for (size_t j = 0; j < h; j++){
+            double phase = -M_PI*(double)j/(double)h;
+            _twiddle[h - 1 + j] = fc32_t((float)std::cos(phase), (float)std::sin(phase));
+            _twiddle_inv[h - 1 + j] = std::conj(_twiddle[h - 1 + j]);
+        }
+    }
+}
+
+void fft_plan::transform(fc32_t *data, const fc32_t *twiddle) const {
+    for (size_t i = 0; i < _n; i++){
+        size_t r = _bitrev[i];
+        if (i < r)
+            std::swap(data[i], data[r]);
+    }
+    float *d = reinterpret_cast<float *>(data);
+    for (size_t h = 1; h < _n; h <<= 1){
+        const fc32_t *tw = twiddle + h - 1;
+        const float *ptw = reinterpret_cast<const float *>(tw);
+        for (size_t s = 0; s < _n; s += 2*h){
+            size_t j = 0;
+#if defined(__AVX2__)
+            for (; j + 4 <= h; j += 4){
+                float *pa = d + 2*(s + j), *pb = d + 2*(s + j + h);
+                __m256 a = _mm256_loadu_ps(pa);
+                __m256 b = cmul_avx(_mm256_loadu_ps(pb), _mm256_loadu_ps(ptw + 2*j), false);
+                _mm256_storeu_ps(pa, _mm256_add_ps(a, b));
+                _mm256_storeu_ps(pb, _mm256_sub_ps(a, b));
+            }
+#elif defined(__SSE2__)
+            for (; j + 2 <= h; j += 2){
+                float *pa = d + 2*(s + j), *pb = d + 2*(s + j + h);
+                __m128 a = _mm_loadu_ps(pa);
+                __m128 b = cmul_sse2(_mm_loadu_ps(pb), _mm_loadu_ps(ptw + 2*j), false);
+                _mm_storeu_ps(pa, _mm_add_ps(a, b));
+                _mm_storeu_ps(pb, _mm_sub_ps(a, b));
+            }
+#elif defined(HAVE_NEON)
+            for (; j + 4 <= h; j += 4){
+                float *pa = d + 2*(s + j), *pb = d + 2*(s + j + h);
+                float32x4x2_t a = vld2q_f32(pa);
+                float32x4x2_t x = vld2q_f32(pb);
+                float32x4x2_t w = vld2q_f32(ptw + 2*j);
+                float32x4_t br = vmlsq_f32(vmulq_f32(x.val[0], w.val[0]), x.val[1], w.val[1]);
+                float32x4_t bi = vmlaq_f32(vmulq_f32(x.val[0], w.val[1]), x.val[1], w.val[0]);
+                float32x4x2_t lo, hi;
+                lo.val[0] = vaddq_f32(a.val[0], br);
+                lo.val[1] = vaddq_f32(a.val[1], bi);
+                hi.val[0] = vsubq_f32(a.val[0], br);
+                hi.val[1] = vsubq_f32(a.val[1], bi);
+                vst2q_f32(pa, lo);
+                vst2q_f32(pb, hi);
+            }
+#endif
+            for (; j < h; j++){
+                fc32_t a = data[s + j];
+                fc32_t b;
+                cmul_scalar(data[s + j + h], tw[j], b, false);
+                data[s + j] = fc32_t(a.real() + b.real(), a.imag() + b.imag());
+                data[s + j + h] = fc32_t(a.real() - b.real(), a.imag() - b.imag());
+            }
+        }
+    }
+}
+
+void fft_plan::forward(fc32_t *data) const {
+    transform(data, &_twiddle.front());
+}
+
+void fft_plan::inverse(fc32_t *data) const {
+    transform(data, &_twiddle_inv.front());
+    const float scale = 1.0f/(float)_n;
+    float *d = reinterpret_cast<float *>(data);
+    for (size_t i = 0; i < 2*_n; i++)
+        d[i] *= scale;
+}
@@ -0,0 +1,380 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "impulse_detect.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+// I^2+Q^2 is summed exactly in 32 bits and rounded to float once, which the
+// vector paths below do as well, so all paths agree bit for bit
+static inline float magnitude(const std::complex<short> &x){
+    int32_t i = x.real(), q = x.imag();
+    return std::sqrt((float)((uint32_t)(i*i) + (uint32_t)(q*q)));
+}
+
+void magnitude_sc16(const std::complex<short> *in, float *out, size_t n){
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 wrap = _mm256_set1_ps(4294967296.0f);
+    for (; i + 8 <= n; i += 8){
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256 p = _mm256_cvtepi32_ps(_mm256_madd_epi16(x, x));
+        // (-32768,-32768) squares to 2^31, which madd wraps to -2^31
+        p = _mm256_add_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, _mm256_setzero_ps(), _CMP_LT_OQ), wrap));
+        _mm256_storeu_ps(out + i, _mm256_sqrt_ps(p));
+    }
+#elif defined(__SSE2__)
+    const __m128 wrap = _mm_set1_ps(4294967296.0f);
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128 p = _mm_cvtepi32_ps(_mm_madd_epi16(x, x));
+        p = _mm_add_ps(p, _mm_and_ps(_mm_cmplt_ps(p, _mm_setzero_ps()), wrap));
+        _mm_storeu_ps(out + i, _mm_sqrt_ps(p));
+    }
+#elif defined(HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4){
+        int16x8_t x = vld1q_s16(reinterpret_cast<const int16_t *>(in + i));
+        uint32x4_t lo = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+        uint32x4_t hi = vreinterpretq_u32_s32(vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+        vst1q_f32(out + i, vsqrtq_f32(vcvtq_f32_u32(vpaddq_u32(lo, hi))));
+    }
+#endif
+    // 32-bit ARM NEON has no vector square root; the scalar loop handles it
+    for (; i < n; i++)
+        out[i] = magnitude(in[i]);
+}
+
+float max_deviation(const float *x, size_t n, float center){
+    size_t i = 0;
+    float result = 0.0f;
+#if defined(__AVX2__)
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 c8 = _mm256_set1_ps(center);
+    __m256 m8 = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8)
+        m8 = _mm256_max_ps(m8, _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), c8), abs_mask));
+    float lanes[8];
+    _mm256_storeu_ps(lanes, m8);
+    for (float v : lanes)
+        result = std::max(result, v);
+#elif defined(__SSE2__)
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 c4 = _mm_set1_ps(center);
+    __m128 m4 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+        m4 = _mm_max_ps(m4, _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(x + i), c4), abs_mask));
+    float lanes[4];
+    _mm_storeu_ps(lanes, m4);
+    for (float v : lanes)
+        result = std::max(result, v);
+#elif defined(HAVE_NEON)
+    const float32x4_t c4 = vdupq_n_f32(center);
+    float32x4_t m4 = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4)
+        m4 = vmaxq_f32(m4, vabdq_f32(vld1q_f32(x + i), c4));
+    float lanes[4];
+    vst1q_f32(lanes, m4);
+    for (float v : lanes)
+        result = std::max(result, v);
+#endif
+    for (; i < n; i++)
+        result = std::max(result, std::fabs(x[i] - center));
+    return result;
+}
+
+impulse_config_t default_impulse_config(void){
+    impulse_config_t config;
+    config.block = 256;
+    config.estimate = 48;
+    config.threshold = 10.0;
+    config.min_deviation = 16.0;
+    config.merge = 8;
+    config.max_width = 16;
+    config.max_impulses = 65536;
+    return config;
+}
+
+impulse_detector::impulse_detector(const impulse_config_t &config) :
+    _config(config),
+    _mag(config.block),
+    _sorted((config.estimate and config.estimate < config.block) ? config.estimate : config.block)
+{
+    if (config.block < 16)
+        throw std::invalid_argument("impulse_detector: block must be at least 16 samples");
+    _impulses.reserve(config.max_impulses);
+    clear();
+    begin(0, 0);
+}
+
+void impulse_detector::clear(void){
+    _impulses.clear();
+    std::memset(&_stats, 0, sizeof(_stats));
+}
+
+void impulse_detector::begin(size_t pulse, size_t channel){
+    _pulse = pulse;
+    _channel = channel;
+    _fill = 0;
+    _offset = 0;
+    _hit = false;
+    _in_run = false;
+    _run_kept = false;
+    _run_first = _run_last = 0;
+    _run_step = _run_at_end = false;
+    _run_median = _run_limit = 0.0f;
+    _have_estimate = false;
+    _median = _sigma = 0.0f;
+}
+
+void impulse_detector::scan(const std::complex<short> *samps, size_t n){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _stats.samples += n;
+    while (n > 0){
+        size_t take = std::min(_config.block - _fill, n);
+        magnitude_sc16(samps, &_mag[_fill], take);
+        _fill += take;
+        samps += take;
+        n -= take;
+        if (_fill == _config.block){
+            scan_block(_fill);
+            _offset += _fill;
+            _fill = 0;
+        }
+    }
+    _stats.scan_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void impulse_detector::end(void){
+    if (_fill > 0){
+        scan_block(_fill);
+        _offset += _fill;
+        _fill = 0;
+    }
+    finish_run();
+    _stats.pulses++;
+    if (_hit)
+        _stats.pulses_hit++;
+}
+
+void impulse_detector::finish_run(void){
+    if (not _in_run)
+        return;
+    _in_run = false;
+    _run_at_end = false;
+    if (_run_step or _run_last - _run_first + 1 > _config.max_width){
+        _stats.steps++;
+        if (_run_kept)
+            _impulses.pop_back();
+        return;
+    }
+    _hit = true;
+    _stats.impulses++;
+    if (not _run_kept)
+        _stats.dropped++;
+}
+
+void impulse_detector::scan_block(size_t n){
+    const float *mag = &_mag.front();
+    const float prev_median = _median;
+    const bool had_estimate = _have_estimate;
+    float median = _median, sigma = _sigma;
+    // a short last block keeps the estimate of the block before it
+    if (n == _config.block or not _have_estimate){
+        // the selections dominate the cost, so they run on a subset
+        size_t m = std::min(_sorted.size(), n);
+        float *sorted = &_sorted.front();
+        for (size_t i = 0; i < m; i++)
+            sorted[i] = mag[i*n/m];
+        std::nth_element(sorted, sorted + m/2, sorted + m);
+        median = sorted[m/2];
+        for (size_t i = 0; i < m; i++)
+            sorted[i] = std::fabs(mag[i*n/m] - median);
+        std::nth_element(sorted, sorted + m/2, sorted + m);
+        sigma = 1.4826f*sorted[m/2];
+        if (n == _config.block){
+            _median = median;
+            _sigma = sigma;
+            _have_estimate = true;
+        }
+    }
+    _stats.blocks++;
+
+    const float limit = std::max((float)_config.threshold*sigma, (float)_config.min_deviation);
+    // a run at the end of the last block where the level changes between
+    // the blocks is the tail of a pulse edge
+    if (_run_at_end and std::fabs(median - _run_median) > _run_limit)
+        _run_step = true;
+    _run_at_end = false;
+    if (max_deviation(mag, n, median) <= limit)
+        return;
+    for (size_t i = 0; i < n; i++){
+        float dev = std::fabs(mag[i] - median);
+        if (dev <= limit)
+            continue;
+        uint64_t pos = _offset + i;
+        float score = dev/std::max(sigma, 1e-6f);
+        if (_in_run and pos - _run_last <= _config.merge){
+            if (_run_kept){
+                impulse_t &imp = _impulses.back();
+                imp.width = (uint32_t)(pos - imp.offset + 1);
+                if (mag[i] > imp.peak)
+                    imp.peak = mag[i];
+                imp.score = std::max(imp.score, score);
+            }
+            _run_last = pos;
+            continue;
+        }
+        finish_run();
+        _in_run = true;
+        _run_first = _run_last = pos;
+        _run_step = had_estimate and i <= _config.merge and std::fabs(median - prev_median) > limit;
+        _run_kept = _impulses.size() < _impulses.capacity();
+        if (not _run_kept)
+            continue;
+        impulse_t imp;
+        imp.pulse = _pulse;
+        imp.channel = _channel;
+        imp.offset = pos;
+        imp.width = 1;
+        imp.peak = mag[i];
+        imp.median = median;
+        imp.score = score;
+        _impulses.push_back(imp);
+    }
+    if (_in_run and _run_last + _config.merge >= _offset + n - 1){
+        _run_at_end = true;
+        _run_median = median;
+        _run_limit = limit;
+    }
+}
+
+// the value with the most of the sorted values within tolerance of it
+// (circular over period if that is not 0); returns their count and sets
+// center to it
+static size_t densest_window(const std::vector<uint64_t> &values, uint64_t tolerance, uint64_t period, uint64_t &center){
+    const size_t n = values.size();
+    // with a period the values are repeated one period below and above, so
+    // every window around a value of the middle copy sees its wrapped neighbors
+    std::vector<int64_t> ext;
+    const size_t copies = period ? 3 : 1;
+    for (size_t c = 0; c < copies; c++){
+        int64_t shift = period ? ((int64_t)c - 1)*(int64_t)period : 0;
+        for (uint64_t v : values)
+            ext.push_back((int64_t)v + shift);
+    }
+    const size_t first = period ? n : 0;
+    size_t best = 0;
+    center = 0;
+    for (size_t i = first; i < first + n; i++){
+        std::vector<int64_t>::const_iterator lo = std::lower_bound(ext.begin(), ext.end(), ext[i] - (int64_t)tolerance);
+        std::vector<int64_t>::const_iterator hi = std::upper_bound(ext.begin(), ext.end(), ext[i] + (int64_t)tolerance);
+        // a window wider than the period sees each value once
+        size_t count = std::min<size_t>(hi - lo, n);
+        if (count > best){
+            best = count;
+            center = values[i - first];
+        }
+    }
+    return best;
+}
+
+impulse_periodicity_t impulse_periodicity(const std::vector<impulse_t> &impulses, size_t spp, size_t tolerance){
+    impulse_periodicity_t result;
+    std::memset(&result, 0, sizeof(result));
+    result.impulses = impulses.size();
+    result.spp = spp;
+    result.tolerance = tolerance;
+    if (impulses.empty())
+        return result;
+
+    std::vector<uint64_t> spacings;
+    for (size_t i = 1; i < impulses.size(); i++){
+        const impulse_t &a = impulses[i - 1], &b = impulses[i];
+        if (a.pulse == b.pulse and a.channel == b.channel)
+            spacings.push_back(b.offset - a.offset);
+    }
+    if (not spacings.empty()){
+        std::sort(spacings.begin(), spacings.end());
+        size_t count = densest_window(spacings, tolerance, 0, result.spacing);
+        result.spacing_fraction = (double)count/spacings.size();
+    }
+
+    if (spp > 0){
+        std::vector<uint64_t> phases;
+        size_t boundary = 0;
+        for (const impulse_t &imp : impulses){
+            uint64_t r = imp.offset % spp;
+            phases.push_back(r);
+            if (std::min<uint64_t>(r, spp - r) <= tolerance)
+                boundary++;
+        }
+        std::sort(phases.begin(), phases.end());
+        uint64_t phase;
+        size_t count = densest_window(phases, tolerance, spp, phase);
+        result.phase = (size_t)phase;
+        result.phase_fraction = (double)count/phases.size();
+        result.boundary_fraction = (double)boundary/phases.size();
+    }
+    return result;
+}
+
+void print_impulse_report(std::ostream &os, const impulse_stats_t &stats, const impulse_periodicity_t &periodicity){
+    os << boost::format("Impulses: %d in %d of %d pulses, %d level steps ignored (%d samples, %f MS/s scanned)")
+        % stats.impulses % stats.pulses_hit % stats.pulses % stats.steps % stats.samples
+        % (stats.scan_secs > 0.0 ? stats.samples/stats.scan_secs/1e6 : 0.0) << std::endl;
+    if (stats.dropped)
+        os << boost::format("Impulses: only the first %d kept, %d more not analyzed") % periodicity.impulses % stats.dropped << std::endl;
+    if (periodicity.spacing)
+        os << boost::format("Impulse spacing: %d samples (%.1f%% of spacings within %d)%s")
+            % periodicity.spacing % (100.0*periodicity.spacing_fraction) % periodicity.tolerance
+            % (periodicity.spp ? str(boost::format(", %.3f x spp") % ((double)periodicity.spacing/periodicity.spp)) : std::string())
+            << std::endl;
+    if (periodicity.spp and periodicity.impulses)
+        os << boost::format("Impulse phase: %d mod spp %d (%.1f%% of impulses), %.1f%% within %d samples of a packet boundary")
+            % periodicity.phase % periodicity.spp % (100.0*periodicity.phase_fraction)
+            % (100.0*periodicity.boundary_fraction) % periodicity.tolerance << std::endl;
+}
+
+impulse_sink::impulse_sink(const impulse_config_t &config, pulse_sink::sptr next, bool continuous) :
+    _detector(config),
+    _next(next),
+    _continuous(continuous),
+    _started(false)
+{
+}
+
+void impulse_sink::write(const pulse_slot &slot){
+    if (not _continuous)
+        _detector.begin(slot.index, slot.channel);
+    else if (not _started)
+        _detector.begin(0, slot.channel);
+    _started = true;
+    _detector.scan(slot.samps, slot.nsamps);
+    if (not _continuous)
+        _detector.end();
+    if (_next)
+        _next->write(slot);
+}
+
+void impulse_sink::close(void){
+    if (_continuous and _started)
+        _detector.end();
+    _started = false;
+    if (_next)
+        _next->close();
+}
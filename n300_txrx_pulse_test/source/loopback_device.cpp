@@ -0,0 +1,551 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "loopback_device.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace {
+
+typedef std::complex<short> sc16_t;
+typedef std::chrono::steady_clock clock_type;
+
+static const size_t NOISE_TABLE_LEN = 1 << 16;
+static const size_t ASYNC_QUEUE_LEN = 1000;
+
+struct rx_cmd_t {
+    uhd::stream_cmd_t cmd;
+    bool late;   // time_spec was already in the past when the command was issued
+};
+
+struct burst_t {
+    long long start_tick;
+    boost::shared_ptr<std::vector<sc16_t>> samps;
+};
+
+inline short saturate(float x){
+    if (x > 32767.0f) return 32767;
+    if (x < -32768.0f) return -32768;
+    return (short)std::lrint(x);
+}
+
+// what is left of the samples after an sc8 transport
+void wire_quantize(sc16_t *samps, size_t n, std::vector<sc8_t> &wire){
+    wire.resize(n);
+    convert_samples(samps, &wire.front(), n);
+    convert_samples(&wire.front(), samps, n);
+}
+
+} // namespace
+
+/*!
+ * State shared by the loopback streamers: the simulated device clock and
+ * every TX burst still inside the RX history window.
+ */
+class loopback_air
+{
+public:
+    loopback_air(const loopback_config_t &config) :
+        config(config),
+        _origin(clock_type::now()),
+        _steady_ref(0.0),
+        _device_ref(0.0),
+        _pps_pending(false),
+        _pps_edge(0.0)
+    {
+        std::mt19937 gen(config.seed);
+        std::normal_distribution<float> dist(0.0f, (float)config.noise);
+        noise_table.resize(NOISE_TABLE_LEN);
+        for (size_t i = 0; i < noise_table.size(); i++){
+            if (config.noise > 0.0)
+                noise_table[i] = sc16_t(saturate(dist(gen)), saturate(dist(gen)));
+        }
+    }
+
+    double steady_secs(void) const {
+        return std::chrono::duration<double>(clock_type::now() - _origin).count();
+    }
+
+    // caller holds mutex
+    uhd::time_spec_t time_at(double steady){
+        if (_pps_pending and steady >= _pps_edge){
+            _steady_ref = _pps_edge;
+            _device_ref = _pps_time;
+            _pps_pending = false;
+        }
+        return _device_ref + uhd::time_spec_t(steady - _steady_ref);
+    }
+
+    uhd::time_spec_t time_now(void){
+        return time_at(steady_secs());
+    }
+
+    long long tick_now(void){
+        return time_now().to_ticks(config.rate);
+    }
+
+    // seconds of real time until the device clock reaches tick
+    double secs_until(long long tick){
+        uhd::time_spec_t t = uhd::time_spec_t::from_ticks(tick, config.rate);
+        return (t - time_now()).get_real_secs();
+    }
+
+    uhd::time_spec_t last_pps(void){
+        double edge = std::floor(steady_secs());
+        time_at(steady_secs());
+        return _device_ref + uhd::time_spec_t(edge - _steady_ref);
+    }
+
+    void set_time_now(const uhd::time_spec_t &time_spec){
+        _steady_ref = steady_secs();
+        _device_ref = time_spec;
+        _pps_pending = false;
+    }
+
+    void set_time_next_pps(const uhd::time_spec_t &time_spec){
+        double now = steady_secs();
+        time_at(now);
+        _pps_edge = std::floor(now) + 1.0;
+        _pps_time = time_spec;
+        _pps_pending = true;
+    }
+
+    void add_burst(long long start_tick, const sc16_t *samps, size_t nsamps){
+        burst_t b;
+        b.start_tick = start_tick;
+        b.samps.reset(new std::vector<sc16_t>(samps, samps + nsamps));
+        bursts.push_back(b);
+
+        // keep one second of history behind the device time
+        long long horizon = tick_now() - (long long)config.rate - (long long)config.delay;
+        while (not bursts.empty() and
+               bursts.front().start_tick + (long long)bursts.front().samps->size() < horizon){
+            bursts.pop_front();
+        }
+    }
+
+    // caller holds mutex
+    void overlapping(long long first, size_t nsamps, std::vector<burst_t> &out) const {
+        out.clear();
+        long long last = first + (long long)nsamps;
+        for (const burst_t &b : bursts){
+            long long bstart = b.start_tick + (long long)config.delay;
+            long long bend = bstart + (long long)b.samps->size();
+            if (bstart < last and bend > first)
+                out.push_back(b);
+        }
+    }
+
+    const loopback_config_t config;
+    std::vector<sc16_t> noise_table;
+    std::deque<burst_t> bursts;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+private:
+    clock_type::time_point _origin;
+    double _steady_ref;
+    uhd::time_spec_t _device_ref;
+    bool _pps_pending;
+    double _pps_edge;
+    uhd::time_spec_t _pps_time;
+};
+
+namespace {
+
+class loopback_tx_streamer : public uhd::tx_streamer
+{
+public:
+    loopback_tx_streamer(boost::shared_ptr<loopback_air> air, size_t chan) :
+        _air(air), _chan(chan), _in_burst(false), _dropping(false), _next_tick(0) {}
+
+    size_t get_num_channels(void) const { return 1; }
+    size_t get_max_num_samps(void) const { return _air->config.spp; }
+
+    size_t send(const buffs_type &buffs, const size_t nsamps_per_buff,
+                const uhd::tx_metadata_t &md, const double timeout){
+        std::unique_lock<std::mutex> lock(_air->mutex);
+        long long now = _air->tick_now();
+        long long tick;
+        if (md.has_time_spec){
+            tick = md.time_spec.to_ticks(_air->config.rate);
+            _dropping = (tick < now);
+            if (_dropping)
+                push_async(uhd::async_metadata_t::EVENT_CODE_TIME_ERROR, md.time_spec);
+        }
+        else if (_in_burst){
+            tick = _next_tick;
+            if (not _dropping and tick < now)
+                push_async(uhd::async_metadata_t::EVENT_CODE_UNDERFLOW,
+                           uhd::time_spec_t::from_ticks(now, _air->config.rate));
+            tick = std::max(tick, now);
+        }
+        else {
+            tick = now;
+            _dropping = false;
+        }
+
+        if (not _dropping and nsamps_per_buff > 0){
+            const sc16_t *samps = (const sc16_t *)buffs[0];
+            if (_air->config.formats.tx[_chan].wire == SAMPLE_FORMAT_SC8){
+                _quantized.assign(samps, samps + nsamps_per_buff);
+                wire_quantize(&_quantized.front(), nsamps_per_buff, _wire);
+                samps = &_quantized.front();
+            }
+            _air->add_burst(tick, samps, nsamps_per_buff);
+        }
+
+        _next_tick = tick + (long long)nsamps_per_buff;
+        _in_burst = not md.end_of_burst;
+        if (md.end_of_burst and not _dropping)
+            push_async(uhd::async_metadata_t::EVENT_CODE_BURST_ACK,
+                       uhd::time_spec_t::from_ticks(_next_tick, _air->config.rate));
+        lock.unlock();
+        _air->cond.notify_all();
+        return nsamps_per_buff;
+    }
+
+    bool recv_async_msg(uhd::async_metadata_t &async_md, double timeout){
+        std::unique_lock<std::mutex> lock(_air->mutex);
+        _air->cond.wait_for(lock, std::chrono::duration<double>(timeout),
+                            [this]{ return not _async.empty(); });
+        if (_async.empty())
+            return false;
+        async_md = _async.front();
+        _async.pop_front();
+        return true;
+    }
+
+private:
+    // caller holds mutex
+    void push_async(uhd::async_metadata_t::event_code_t code, const uhd::time_spec_t &time_spec){
+        uhd::async_metadata_t async_md;
+        async_md.channel = 0;
+        async_md.has_time_spec = true;
+        async_md.time_spec = time_spec;
+        async_md.event_code = code;
+        std::fill(async_md.user_payload, async_md.user_payload + 4, 0);
+        // like the UHD async fifo, drop the oldest messages nobody reads
+        if (_async.size() >= ASYNC_QUEUE_LEN)
+            _async.pop_front();
+        _async.push_back(async_md);
+    }
+
+    boost::shared_ptr<loopback_air> _air;
+    size_t _chan;
+    bool _in_burst, _dropping;
+    long long _next_tick;
+    std::deque<uhd::async_metadata_t> _async;
+    std::vector<sc16_t> _quantized;
+    std::vector<sc8_t> _wire;
+};
+
+class loopback_rx_streamer : public uhd::rx_streamer
+{
+public:
+    loopback_rx_streamer(boost::shared_ptr<loopback_air> air, size_t chan) :
+        _air(air),
+        _format(air->config.formats.rx[chan]),
+        _gen(air->config.seed + 1 + chan),
+        _active(false),
+        _continuous(false),
+        _first(false),
+        _pos(0),
+        _remaining(0),
+        _chain_tick(-1) {}
+
+    size_t get_num_channels(void) const { return 1; }
+    size_t get_max_num_samps(void) const { return _air->config.spp; }
+
+    void issue_stream_cmd(const uhd::stream_cmd_t &stream_cmd){
+        {
+            std::lock_guard<std::mutex> lock(_air->mutex);
+            if (stream_cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS){
+                _cmds.clear();
+                _active = false;
+                _chain_tick = -1;
+            }
+            else {
+                rx_cmd_t rx_cmd = {stream_cmd, false};
+                rx_cmd.late = not stream_cmd.stream_now and
+                    stream_cmd.time_spec.to_ticks(_air->config.rate) < _air->tick_now();
+                _cmds.push_back(rx_cmd);
+            }
+        }
+        _air->cond.notify_all();
+    }
+
+    size_t recv(const buffs_type &buffs, const size_t nsamps_per_buff,
+                uhd::rx_metadata_t &md, const double timeout, const bool one_packet){
+        md.reset();
+        const double rate = _air->config.rate;
+        const double deadline = _air->steady_secs() + timeout;
+        std::unique_lock<std::mutex> lock(_air->mutex);
+
+        if (not _active){
+            _air->cond.wait_for(lock, std::chrono::duration<double>(timeout),
+                                [this]{ return not _cmds.empty(); });
+            if (_cmds.empty()){
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+                return 0;
+            }
+            if (not start_next_cmd(md))
+                return 0;
+        }
+
+        size_t nsamps = nsamps_per_buff;
+        if (not _continuous)
+            nsamps = (size_t)std::min<unsigned long long>(nsamps, _remaining);
+        if (one_packet)
+            nsamps = std::min(nsamps, _air->config.spp);
+
+        // wait for the device clock to pass the last requested sample
+        const long long end_tick = _pos + (long long)nsamps;
+        long long now = _air->tick_now();
+        while (now < end_tick and _active){
+            double wait = std::min(_air->secs_until(end_tick), deadline - _air->steady_secs());
+            if (wait <= 0.0)
+                break;
+            _air->cond.wait_for(lock, std::chrono::duration<double>(wait));
+            now = _air->tick_now();
+        }
+        if (not _active){
+            // stopped while waiting
+            md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+        nsamps = (size_t)std::max<long long>(0, std::min<long long>(now - _pos, (long long)nsamps));
+        if (nsamps == 0){
+            md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+
+        if (_air->config.overflow_prob > 0.0 and _uniform(_gen) < _air->config.overflow_prob){
+            // the samples of one packet are lost on the way to the host
+            size_t lost = std::min(nsamps, _air->config.spp);
+            advance(lost);
+            md.error_code = uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+            md.has_time_spec = true;
+            md.time_spec = uhd::time_spec_t::from_ticks(_pos, rate);
+            return 0;
+        }
+
+        const long long first = _pos;
+        std::vector<burst_t> &bursts = _scratch;
+        _air->overlapping(first, nsamps, bursts);
+        md.has_time_spec = true;
+        md.time_spec = uhd::time_spec_t::from_ticks(first, rate);
+        md.start_of_burst = _first;
+        _first = false;
+        advance(nsamps);
+        md.end_of_burst = not _active and _chain_tick < 0;
+        size_t noise_offset = _gen() & (NOISE_TABLE_LEN - 1);
+        lock.unlock();
+
+        if (_format.cpu == SAMPLE_FORMAT_SC16 and _format.wire == SAMPLE_FORMAT_SC16){
+            fill((sc16_t *)buffs[0], first, nsamps, bursts, noise_offset);
+            return nsamps;
+        }
+        // the samples cross the wire in its format and are converted to the CPU one
+        _samps.resize(nsamps);
+        fill(&_samps.front(), first, nsamps, bursts, noise_offset);
+        if (_format.wire == SAMPLE_FORMAT_SC8)
+            wire_quantize(&_samps.front(), nsamps, _wire);
+        convert_samples(SAMPLE_FORMAT_SC16, &_samps.front(), _format.cpu, buffs[0], nsamps);
+        return nsamps;
+    }
+
+private:
+    // caller holds mutex; returns false with md.error_code set on failure
+    bool start_next_cmd(uhd::rx_metadata_t &md){
+        uhd::stream_cmd_t cmd = _cmds.front().cmd;
+        bool late = _cmds.front().late;
+        _cmds.pop_front();
+        if (cmd.stream_now){
+            _pos = (_chain_tick >= 0) ? _chain_tick : _air->tick_now();
+        }
+        else {
+            // samples of a timed window that already passed are still
+            // buffered, only commands issued too late are rejected
+            _pos = cmd.time_spec.to_ticks(_air->config.rate);
+            if (late){
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND;
+                md.has_time_spec = true;
+                md.time_spec = cmd.time_spec;
+                _chain_tick = -1;
+                return false;
+            }
+        }
+        _continuous = (cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+        _remaining = cmd.num_samps;
+        _chain_tick = (cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE) ? 0 : -1;
+        _first = true;
+        _active = _continuous or _remaining > 0;
+        return true;
+    }
+
+    // caller holds mutex
+    void advance(size_t nsamps){
+        _pos += (long long)nsamps;
+        if (_continuous)
+            return;
+        _remaining -= std::min<unsigned long long>(_remaining, nsamps);
+        if (_remaining == 0){
+            _active = false;
+            _chain_tick = (_chain_tick >= 0) ? _pos : -1;
+        }
+    }
+
+    void fill(sc16_t *out, long long first, size_t nsamps,
+              const std::vector<burst_t> &bursts, size_t noise_offset) const {
+        const std::vector<sc16_t> &noise = _air->noise_table;
+        if (_air->config.noise > 0.0){
+            for (size_t i = 0; i < nsamps; i++)
+                out[i] = noise[(noise_offset + i) & (NOISE_TABLE_LEN - 1)];
+        }
+        else {
+            std::fill(out, out + nsamps, sc16_t(0, 0));
+        }
+
+        const float gain = (float)_air->config.gain;
+        const long long last = first + (long long)nsamps;
+        for (const burst_t &b : bursts){
+            long long bstart = b.start_tick + (long long)_air->config.delay;
+            long long lo = std::max(bstart, first);
+            long long hi = std::min(bstart + (long long)b.samps->size(), last);
+            const sc16_t *src = &b.samps->front() + (lo - bstart);
+            sc16_t *dst = out + (lo - first);
+            for (long long i = 0; i < hi - lo; i++){
+                dst[i] = sc16_t(saturate(dst[i].real() + gain*src[i].real()),
+                                saturate(dst[i].imag() + gain*src[i].imag()));
+            }
+        }
+    }
+
+    boost::shared_ptr<loopback_air> _air;
+    stream_format_t _format;
+    std::mt19937 _gen;
+    std::uniform_real_distribution<double> _uniform;
+    std::deque<rx_cmd_t> _cmds;
+    bool _active, _continuous, _first;
+    long long _pos;
+    unsigned long long _remaining;
+    long long _chain_tick;
+    std::vector<burst_t> _scratch;
+    std::vector<sc16_t> _samps;
+    std::vector<sc8_t> _wire;
+};
+
+} // namespace
+
+loopback_config_t default_loopback_config(double rate){
+    loopback_config_t config;
+    config.rate = rate;
+    config.spp = 2000;
+    config.delay = 0;
+    config.gain = 1.0;
+    config.noise = 0.0;
+    config.overflow_prob = 0.0;
+    config.seed = 0;
+    config.formats = parse_stream_formats("sc16", "sc16");
+    return config;
+}
+
+radio_device::sptr loopback_device::make(const loopback_config_t &config){
+    if (config.rate <= 0.0)
+        throw std::runtime_error("loopback_device: invalid sample rate");
+    if (config.spp == 0)
+        throw std::runtime_error("loopback_device: spp must be non-zero");
+    boost::shared_ptr<loopback_device> dev(new loopback_device());
+    dev->_air.reset(new loopback_air(config));
+    for (size_t chan = RADIO_CHAN_MAIN; chan <= RADIO_CHAN_CALIB; chan++){
+        dev->_rx_stream[chan].reset(new loopback_rx_streamer(dev->_air, chan));
+        dev->_tx_stream[chan].reset(new loopback_tx_streamer(dev->_air, chan));
+    }
+    return dev;
+}
+
+stream_formats_t loopback_device::get_stream_formats(void){
+    return _air->config.formats;
+}
+
+double loopback_device::get_rate(void){
+    return _air->config.rate;
+}
+
+uhd::time_spec_t loopback_device::get_time_now(void){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    return _air->time_now();
+}
+
+uhd::time_spec_t loopback_device::get_time_last_pps(void){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    return _air->last_pps();
+}
+
+void loopback_device::set_time_now(const uhd::time_spec_t &time_spec){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    _air->set_time_now(time_spec);
+}
+
+void loopback_device::set_time_next_pps(const uhd::time_spec_t &time_spec){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    _air->set_time_next_pps(time_spec);
+}
+
+int loopback_device::get_gps_time(int &gps_time){
+    // no GPSDO; report the device time so gpsdo-style syncing still works
+    gps_time = (int)get_time_now().get_full_secs();
+    return 0;
+}
+
+double loopback_device::get_freq(size_t chan){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    return _freq[chan % 2];
+}
+
+void loopback_device::set_freq(size_t chan, double freq){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    _freq[chan % 2] = freq;
+}
+
+double loopback_device::get_rx_gain(size_t chan){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    return _rx_gain[chan % 2];
+}
+
+void loopback_device::set_rx_gain(size_t chan, double gain){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    _rx_gain[chan % 2] = gain;
+}
+
+double loopback_device::get_tx_gain(size_t chan){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    return _tx_gain[chan % 2];
+}
+
+void loopback_device::set_tx_gain(size_t chan, double gain){
+    std::lock_guard<std::mutex> lock(_air->mutex);
+    _tx_gain[chan % 2] = gain;
+}
+
+uhd::rx_streamer::sptr loopback_device::get_rx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::rx_streamer::sptr();
+    return _rx_stream[chan];
+}
+
+uhd::tx_streamer::sptr loopback_device::get_tx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::tx_streamer::sptr();
+    return _tx_stream[chan];
+}
@@ -0,0 +1,41 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "mapped_file.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdexcept>
+
+mapped_file::mapped_file(const std::string &fname) :
+    _data(NULL),
+    _size(0)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw(std::runtime_error("Could not open file"));
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        throw(std::runtime_error("Could not stat file"));
+    }
+    _size = (size_t)st.st_size;
+    if (_size > 0){
+        void *p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (p == MAP_FAILED){
+            close(fd);
+            throw(std::runtime_error("Could not map file"));
+        }
+        madvise(p, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const uint8_t *>(p);
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+mapped_file::~mapped_file(void){
+    if (_data != NULL)
+        munmap(const_cast<uint8_t *>(_data), _size);
+}
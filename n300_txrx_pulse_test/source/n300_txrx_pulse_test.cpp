@@ -14,20 +14,38 @@
 #include <boost/format.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <complex>
+#include <cstdlib>
 #include <iostream>
+#include <map>
+
+#include "radio_device.hpp"
+#include "loopback_device.hpp"
+#include "replay_device.hpp"
+#include "waveform_cache.hpp"
+#include "waveform_synth.hpp"
+#include "pulse_train.hpp"
+#include "pulse_writer.hpp"
+#include "thread_sched.hpp"
+#include "rx_worker.hpp"
+#include "tx_worker.hpp"
+#include "pulse_trace.hpp"
+#include "pulse_server.hpp"
+#include "capture_file.hpp"
+#include "ddc.hpp"
+#include "stream_capture.hpp"
+#include "pulse_compress.hpp"
+#include "range_doppler.hpp"
+#include "impulse_detect.hpp"
+#include "param_sweep.hpp"
 
 #define USE_MULTI_USRP 0
 
 namespace po = boost::program_options;
 
-typedef struct {
-  int rx0;
-  int rx1;
-  int tx0;
-  int tx1;
-} ch_select_t;
-
 uhd::rfnoc::radio_ctrl::sptr _radio_ctrl;
 uhd::device3::sptr _usrp;
 uhd::usrp::multi_usrp::sptr _multiusrp;
@@ -35,100 +53,74 @@ uhd::rx_streamer::sptr _rx_stream;
 uhd::rx_streamer::sptr _rx_cal_stream;
 uhd::tx_streamer::sptr _tx_stream;
 uhd::tx_streamer::sptr _tx_cal_stream;
+radio_device::sptr _device;
+stream_capture *_stream_capture = NULL;
 
-template<typename data_type> void file2wave(std::vector<std::complex<data_type>> &data, const std::string &fname){
-    // read complex data files with extension .dat
-    boost::filesystem::path p(fname);
-    std::ifstream ifile;
-    ifile.open(fname.c_str(), std::ios::binary);
-    std::vector<uint32_t> datavec;
-    if (ifile.is_open())
-    {
-        ifile.seekg(0,ifile.end);
-        int flen = ifile.tellg();
-        ifile.seekg(0,ifile.beg);
-        datavec.resize(flen/sizeof(uint32_t));
-        data.reserve(datavec.size());
-        ifile.read((char*)&datavec.front(), datavec.size()*sizeof(uint32_t));
-        ifile.close();
-         for(size_t i=0; i< datavec.size() ;i++){
-            int16_t tempU,tempL;
-            std::complex<data_type> temp;
-            tempL = (int16_t)(datavec[i] & 0x0000FFFF);
-            tempU = (int16_t)((datavec[i] & 0xFFFF0000)>>16);
-            if ((p.extension().string()==".dat") or (p.extension().string()==".ref"))
-                temp = std::complex<data_type>((data_type)tempL,(data_type)tempU);
-            else
-                temp = std::complex<data_type>((data_type)tempU,(data_type)tempL);
-             data.push_back(temp);
-         }
-        return;
-    }
-    throw(std::runtime_error("Could not open file"));
+void stop_stream_capture(int){
+    if (_stream_capture)
+        _stream_capture->stop();
 }
 
 int sync_pps(double &time_set,double time_req){
-    double rate = _radio_ctrl->get_rate();
-    std::string timesrc = _radio_ctrl->get_time_source();
+    double rate = _device->get_rate();
+    std::string timesrc = _device->get_time_source();
     // time_req ignored for gpsdo
     time_set = 0.0;
     if (timesrc == "gpsdo"){
-        uhd::property_tree::sptr tree = _usrp->get_tree();
-        uhd::fs_path path;
-        std::vector<std::string> mboard_names = tree->list("/mboards");
-        path = "/mboards/" + mboard_names[0];
-
-        std::vector<std::string> sensor_names = tree->list(path / "sensors");
-        //Check for 10 MHz lock
         int gps_time=0;
-        if(std::find(sensor_names.begin(), sensor_names.end(), "gps_time") != sensor_names.end()) {
-            gps_time = tree->access<uhd::sensor_value_t>(path / "sensors" / "gps_time").get().to_int();
-        }
-        else if(std::find(sensor_names.begin(), sensor_names.end(), "get_gps_time_sensor") != sensor_names.end()) {
-            try{
-                gps_time = tree->access<uhd::sensor_value_t>(path / "sensors" / "get_gps_time_sensor").get().to_int();
-            }
-            catch (std::exception &e) {
-                std::cout<<"Error caught exception while accessing get_gps_time_sensor: "<<e.what()<<std::endl;
-                return -1;
-            }
-        }
-        else{
-            std::cerr<< "[usrp_controller::sync_pps] Error: gps_time sensor field not found"<<std::endl;
+        if (_device->get_gps_time(gps_time) != 0){
+            std::cerr<< "[usrp_controller::sync_pps] Error: could not read gps time"<<std::endl;
             return -1;
         }
-        uint64_t last_pps = _radio_ctrl->get_time_last_pps().to_ticks(rate);
+        uint64_t last_pps = _device->get_time_last_pps().to_ticks(rate);
         uint64_t curr_pps = last_pps;
         while (curr_pps ==last_pps){
-            curr_pps = _radio_ctrl->get_time_last_pps().to_ticks(rate);
+            curr_pps = _device->get_time_last_pps().to_ticks(rate);
             boost::this_thread::sleep(boost::posix_time::milliseconds(20));
         }
         double gps_time_next_d = (double)gps_time+2.0;
         uhd::time_spec_t new_gps_time = uhd::time_spec_t(gps_time_next_d);
-        _radio_ctrl->set_time_next_pps(new_gps_time);
+        _device->set_time_next_pps(new_gps_time);
         time_set = gps_time_next_d;
         return(0);
     }
     else{
-        uint64_t last_pps = _radio_ctrl->get_time_last_pps().to_ticks(rate);
+        uint64_t last_pps = _device->get_time_last_pps().to_ticks(rate);
         uint64_t curr_pps = last_pps;
         while (curr_pps ==last_pps){
-            curr_pps = _radio_ctrl->get_time_last_pps().to_ticks(rate);
+            curr_pps = _device->get_time_last_pps().to_ticks(rate);
             boost::this_thread::sleep(boost::posix_time::milliseconds(20));
         }
         if (time_req >=0.0){
-          _radio_ctrl->set_time_next_pps(uhd::time_spec_t(time_req));
+          _device->set_time_next_pps(uhd::time_spec_t(time_req));
           time_set = time_req;
       }
       else{
-        double time_set_next = _radio_ctrl->get_time_last_pps().get_real_secs()+1.0;
-        _radio_ctrl->set_time_next_pps(uhd::time_spec_t(time_set_next));
+        // a whole second, so pulse offsets from it line up across units
+        double time_set_next = std::floor(_device->get_time_last_pps().get_real_secs()+0.5)+1.0;
+        _device->set_time_next_pps(uhd::time_spec_t(time_set_next));
         time_set = time_set_next;
       }
         return(0);
     }
 }
 
+/*!
+ * Wait for the PPS edge that loads the time set by sync_pps, so the device
+ * timeline is on the new epoch before anything is scheduled against it.
+ */
+int wait_pps_epoch(double time_set, double timeout){
+    double rate = _device->get_rate();
+    long long epoch = uhd::time_spec_t(time_set).to_ticks(rate);
+    for (double waited = 0.0; waited < timeout; waited += 0.02){
+        if (_device->get_time_last_pps().to_ticks(rate) >= epoch)
+            return(0);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    }
+    std::cerr<< "[wait_pps_epoch] Error: no PPS edge loaded time "<<time_set<<std::endl;
+    return -1;
+}
+
 void pretty_print_flow_graph(std::vector<std::string> blocks)  {
     std::string sep_str = "==>";
     std::cout << std::endl;
@@ -176,19 +168,17 @@ void pretty_print_flow_graph(std::vector<std::string> blocks)  {
     std::cout << std::endl << std::endl;
 }
 
-void pulseStream(std::vector<std::complex<short>> &pulseVector,std::vector<uhd::rx_metadata_t> & md_vec, unsigned long num_rx ,double seconds_in_future, double timestart, std::string &current_wavefile, ch_select_t ch_select){
-
-    std::vector<std::complex<short>> data;
-    file2wave<short>(data,current_wavefile);
-    if (data.size()>num_rx){
-      std::cout<<"WARNING: TX waveform is longer ("<<data.size()<<" samples) than requested RX nsamps ("<<num_rx<<")"<<std::endl;
-    }
-    // std::vector<std::complex<short>> buff(data.size()+num_rx_extra);
-    std::vector<std::complex<short>> buff(num_rx);
+// receives channel c (RADIO_CHAN_*) straight into buffs[c], which must hold
+// num_rx samples, or skips it if buffs[c] is NULL. Both channels get the same
+// timed stream command; with a cal_rx worker the calib channel is drained on
+// its thread while this one drains the main channel.
+// With a tx_worker the burst is sent from its thread while the RX command is issued.
+// With a trace every stage is timed under record `pulse`
+void pulseStream(std::complex<short> *buffs[2], size_t num_rx_samps[2], uhd::rx_metadata_t md_rx[2], unsigned long num_rx ,double seconds_in_future, double timestart, const sc16_buffer_t &data, ch_select_t ch_select, tx_worker *tx, rx_worker *cal_rx, pulse_trace *trace, size_t pulse){
 
     uhd::time_spec_t timenow;
     if (timestart < 0.0){
-      timenow =  _radio_ctrl->get_time_now();
+      timenow =  _device->get_time_now();
     }
     else{
         timenow = uhd::time_spec_t(timestart);
@@ -203,39 +193,199 @@ void pulseStream(std::vector<std::complex<short>> &pulseVector,std::vector<uhd::
     md_tx.time_spec = time_spec;
 
     //setup streaming
-    uhd::rx_metadata_t md_rx;
     uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
-    stream_cmd.num_samps = buff.size();
+    stream_cmd.num_samps = num_rx;
     stream_cmd.time_spec = time_spec;
     stream_cmd.stream_now = false;
 
-    if (ch_select.tx0==1)
-      _tx_stream->send(&data.front(), data.size(), md_tx);
-    else if (ch_select.tx1==1)
-      _tx_cal_stream->send(&data.front(), data.size(), md_tx);
+    size_t tx_chan = (ch_select.tx0==1) ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB;
+    if (tx != NULL)
+      tx->send(&data, time_spec, pulse);
+    else if (ch_select.tx0==1 or ch_select.tx1==1){
+      int64_t start = trace ? trace->now_ns() : 0;
+      _device->get_tx_stream(tx_chan)->send(&data.front(), data.size(), md_tx);
+      if (trace) trace->stage(pulse, tx_chan, TRACE_SEND, start);
+    }
 
-    size_t num_rx_samps;
     double rx_timeout = 3.0;
-    if (ch_select.rx0==1){
-        _rx_stream ->issue_stream_cmd(stream_cmd);
-        num_rx_samps = _rx_stream->recv(&buff.front(), buff.size(), md_rx, rx_timeout);
+    uhd::rx_streamer::sptr rx_streams[2];
+    for (size_t c = 0; c < 2; c++){
+        md_rx[c].reset();
+        num_rx_samps[c] = 0;
+        if (buffs[c] == NULL)
+          continue;
+        rx_streams[c] = _device->get_rx_stream(c);
+        int64_t start = trace ? trace->now_ns() : 0;
+        rx_streams[c]->issue_stream_cmd(stream_cmd);
+        if (trace) trace->stage(pulse, c, TRACE_STREAM_CMD, start);
+    }
+    auto recv_chan = [&](size_t c){
+        int64_t start = trace ? trace->now_ns() : 0;
+        num_rx_samps[c] = rx_streams[c]->recv(buffs[c], num_rx, md_rx[c], rx_timeout);
+        if (trace){
+            double rate = _device->get_rate();
+            trace->stage(pulse, c, TRACE_RECV, start);
+            trace->rx_result(pulse, c, md_rx[c].error_code, md_rx[c].has_time_spec,
+                             md_rx[c].time_spec.to_ticks(rate) - time_spec.to_ticks(rate));
+        }
+    };
+    bool cal_async = cal_rx != NULL and rx_streams[RADIO_CHAN_CALIB] and rx_streams[RADIO_CHAN_MAIN];
+    if (cal_async)
+        cal_rx->recv(buffs[RADIO_CHAN_CALIB], num_rx, time_spec, rx_timeout, pulse);
+    else if (rx_streams[RADIO_CHAN_CALIB])
+        recv_chan(RADIO_CHAN_CALIB);
+    if (rx_streams[RADIO_CHAN_MAIN])
+        recv_chan(RADIO_CHAN_MAIN);
+    if (cal_async)
+        num_rx_samps[RADIO_CHAN_CALIB] = cal_rx->wait(md_rx[RADIO_CHAN_CALIB]);
+    if (tx != NULL)
+      tx->flush();
+}
+
+// Print the property tree: sensors, time/clock sources, dboard frontends,
+// antennas, AGC modes and LOs. Diagnostic only, nothing is changed.
+void printDeviceInfo(uhd::property_tree::sptr tree, size_t radio_chan, size_t calib_chan){
+    uhd::fs_path path;
+
+    std::string device_name = tree->access<std::string>("/name").get();
+    std::cout << "Device: " << device_name << std::endl;
+
+    std::vector<std::string> mboard_names = tree->list("/mboards");
+
+    for(auto name : mboard_names){
+        path =  "/mboards/" + name;
+        std::cout <<"Sensors: "<<std::endl;
+        if (tree->exists(path / "sensors")){
+          size_t count = 0;
+          std::vector<std::string> prop_names = tree->list(path / "sensors");
+          for(const std::string &prop_name:  prop_names){
+              try{
+                  std::cout << prop_name<<": "<< tree->access<uhd::sensor_value_t>(path / "sensors" / prop_name).get().value << "\n";
+              }
+              catch (std::exception &e) {
+                  std::cout<<"Error caught exception while accessing sensor "<<prop_name<<": "<<e.what()<<std::endl;
+              }
+          }
       }
-    else if (ch_select.rx1==1){
-        _rx_cal_stream ->issue_stream_cmd(stream_cmd);
-        num_rx_samps = _rx_cal_stream->recv(&buff.front(), buff.size(), md_rx, rx_timeout);
-     }
-     else {
-       num_rx_samps = 0;
-       return;
-     }
-    pulseVector.insert(pulseVector.end(),buff.begin(),buff.begin()+num_rx_samps);
+    }
+    path = "/mboards/" + mboard_names[0];
 
-    md_vec.push_back(md_rx);
+    std::vector<std::string> timesrcs = tree->access<std::vector<std::string>>(path / "time_source" / "options").get();
+    std::cout<<"Time Sources:"<<std::endl;
+
+    for (auto i : timesrcs){
+      std::cout<<i<<std::endl;
+    }
+    std::cout<<std::endl;
+
+    std::vector<std::string> time_srcs = _radio_ctrl->get_time_sources();
+    std::cout<<"Radio Time Sources:\n";
+    for (auto i : time_srcs){
+      std::cout<<"\t"<<i<<"\n";
+    }
+    std::vector<std::string> clk_srcs = _radio_ctrl->get_clock_sources();
+    std::cout<<"Radio Clock Sources:\n";
+    for (auto i : clk_srcs)
+      std::cout<<"\t"<<i<<"\n";
+
+
+    std::vector<std::string> dboard_names = tree->list(path / "dboards");
+    for (auto i : dboard_names){
+        std::cout<<"Daughter board " <<i<<" frontends: "<<std::endl;
+        uhd::fs_path dpath = path + "/dboards/" + i;
+        std::vector<std::string> rx_frontend_names = tree->list(dpath / "rx_frontends");
+        for (auto j : rx_frontend_names){
+            std::cout<<j<<std::endl;
+            std::vector<std::string> rxantennas = tree->access<std::vector<std::string>>(dpath / "rx_frontends" / j / "antenna/options").get();
+            std::cout<<"\tRX Antennas"<<std::endl;
+            for (auto jj : rxantennas)
+                std::cout<<"\t"<<jj<<std::endl;
+            std::list<std::string> agcmodes;
+            try {
+                agcmodes = tree->access<std::list<std::string>>(dpath / "rx_frontends" / j / "gain/agc/mode/options").get();
+                std::cout<<"\tRX AGC Modes"<<std::endl;
+                for (auto jj : agcmodes)
+                    std::cout<<"\t"<<jj<<std::endl;
+            } catch (std::exception &) {}
+        }
+        std::vector<std::string> tx_frontend_names = tree->list(dpath / "tx_frontends");
+        for (auto j : tx_frontend_names){
+            std::cout<<j<<std::endl;
+            std::vector<std::string> txantennas = tree->access<std::vector<std::string>>(dpath / "tx_frontends" / j / "antenna/options").get();
+            std::cout<<"\tTX Antennas"<<std::endl;
+            for (auto jj : txantennas)
+                std::cout<<"\t"<<jj<<std::endl;
+        }
+
+    }
+
+    // Display the LO names and frequency ranges
+    std::vector<std::string> lo_names = _radio_ctrl->get_rx_lo_names(radio_chan);
+    std::cout<<"LO Names\n";
+    for (auto i : lo_names){
+      std::cout<<i<<":\n";
+      std::vector<std::string> lo_srcs = _radio_ctrl->get_rx_lo_sources(i,radio_chan);
+      uhd::freq_range_t fr_rng = _radio_ctrl->get_rx_lo_freq_range(i,radio_chan);
+      for (auto j : lo_srcs){
+        std::cout<<"\t"<<j<<"\n";
+      }
+      std::cout<<"\tFreq range: "<<fr_rng.start()<<" - "<<fr_rng.stop()<<"\n";
+    }
+
+    std::vector<std::string> cal_lo_names = _radio_ctrl->get_rx_lo_names(calib_chan);
+    std::cout<<"Calib CH. LO Names\n";
+    for (auto i : cal_lo_names){
+      std::cout<<i<<":\n";
+      std::vector<std::string> lo_srcs = _radio_ctrl->get_rx_lo_sources(i,calib_chan);
+      uhd::freq_range_t fr_rng = _radio_ctrl->get_rx_lo_freq_range(i,calib_chan);
+
+      for (auto j : lo_srcs){
+        std::cout<<"\t"<<j<<"\n";
+      }
+      std::cout<<"\tCalib CH. Freq range: "<<fr_rng.start()<<" - "<<fr_rng.stop()<<"\n";
+    }
+}
+
+// Poll a boolean sensor every poll seconds until it reads true. Returns
+// false on timeout or if the sensor never becomes readable.
+bool waitForSensor(uhd::property_tree::sptr tree, const uhd::fs_path &sensor, double timeout, double poll = 0.01){
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(timeout*1e6));
+    while (true){
+        try {
+            if (tree->access<uhd::sensor_value_t>(sensor).get().to_bool())
+                return true;
+        } catch (std::exception &) {}
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        boost::this_thread::sleep(boost::posix_time::microseconds((long)(poll*1e6)));
+    }
 }
 
-int usrpInit(const std::string & inargs,const std::string &timesource, double rate, double freq, double rxgain, double txgain) {
+// lo_locked sensors of every daughter board frontend of a motherboard
+std::vector<uhd::fs_path> loLockedSensors(uhd::property_tree::sptr tree, const uhd::fs_path &path){
+    std::vector<uhd::fs_path> sensors;
+    if (not tree->exists(path / "dboards"))
+        return sensors;
+    for (const std::string &db : tree->list(path / "dboards")){
+        uhd::fs_path dpath = path / "dboards" / db;
+        for (const std::string &dir : {std::string("rx_frontends"), std::string("tx_frontends")}){
+            if (not tree->exists(dpath / dir))
+                continue;
+            for (const std::string &fe : tree->list(dpath / dir)){
+                uhd::fs_path sensor = dpath / dir / fe / "sensors" / "lo_locked";
+                if (tree->exists(sensor))
+                    sensors.push_back(sensor);
+            }
+        }
+    }
+    return sensors;
+}
+
+// fast_start replaces the fixed setup sleeps with readiness checks (lock
+// sensors) and polls faster; enumerate prints the property tree; with
+// skip_matching settings that already have the requested value are not set again
+int usrpInit(const std::string & inargs,const std::string &timesource, double rate, double freq, double rxgain, double txgain, bool fast_start, bool enumerate, bool skip_matching, const stream_formats_t &formats) {
     uhd::set_thread_priority_safe();
-    std::string format = "sc16";
     //std::string args = "fpga=/usr/share/uhd/images/usrp_e310_fpga_rfnoc.bit";
     std::string args = inargs; // "skip_sram" //"send_buff_size=131072,max_send_window=32";
 
@@ -249,6 +399,12 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     size_t calib_chan = 1;
 
     double setup_time = 1.0;
+    // sensor poll interval
+    size_t poll_ms = fast_start ? 10 : 100;
+    // true if a setting has to be (re)applied
+    auto differs = [&](double actual, double wanted, double tol){
+        return not skip_matching or std::abs(actual - wanted) > tol;
+    };
 
      std::string tx_blockid1, rx_blockid1, rx_blockid2;
 
@@ -308,37 +464,20 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
         return EXIT_FAILURE;
     }
     std::cout << boost::format("Setting RX Rate: %f Msps...") % (rate/1e6) << std::endl;
-    _radio_ctrl->set_rate(rate);
+    if (differs(_radio_ctrl->get_rate(), rate, 1e-3))
+        _radio_ctrl->set_rate(rate);
     std::cout << boost::format("Actual RX Rate: %f Msps...") % (_radio_ctrl->get_rate()/1e6) << std::endl << std::endl;
 
 
     uhd::property_tree::sptr tree = _usrp->get_tree();
     uhd::fs_path path;
 
-    std::string device_name = tree->access<std::string>("/name").get();
-    std::cout << "Device: " << device_name << std::endl;
+    if (enumerate)
+        printDeviceInfo(tree, radio_chan, calib_chan);
 
     std::vector<std::string> mboard_names = tree->list("/mboards");
-
-    for(auto name : mboard_names){
-        path =  "/mboards/" + name;
-        std::cout <<"Sensors: "<<std::endl;
-        if (tree->exists(path / "sensors")){
-          size_t count = 0;
-          std::vector<std::string> prop_names = tree->list(path / "sensors");
-          for(const std::string &prop_name:  prop_names){
-              try{
-                  std::cout << prop_name<<": "<< tree->access<uhd::sensor_value_t>(path / "sensors" / prop_name).get().value << "\n";
-              }
-              catch (std::exception &e) {
-                  std::cout<<"Error caught exception while accessing sensor "<<prop_name<<": "<<e.what()<<std::endl;
-              }
-          }
-      }
-    }
     path = "/mboards/" + mboard_names[0];
 
-
     std::vector<std::string> sensor_names = tree->list(path / "sensors");
 
 
@@ -346,8 +485,8 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     if(std::find(sensor_names.begin(), sensor_names.end(), "ref_locked") != sensor_names.end()) {
         try{
             uhd::sensor_value_t ref_locked = tree->access<uhd::sensor_value_t>(path / "sensors" / "ref_locked").get();
-            for (size_t i = 0; not ref_locked.to_bool() and i < 100; i++) {
-                boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+            for (size_t i = 0; not ref_locked.to_bool() and i < 10000/poll_ms; i++) {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(poll_ms));
                 ref_locked = tree->access<uhd::sensor_value_t>(path / "sensors" / "ref_locked").get();
             }
             if(not ref_locked.to_bool()) {
@@ -365,81 +504,19 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
         std::cout << boost::format("ref_locked sensor not present on this board.\n");
     }
 
-    std::vector<std::string> timesrcs = tree->access<std::vector<std::string>>(path / "time_source" / "options").get();
-    std::cout<<"Time Sources:"<<std::endl;
-
-    for (auto i : timesrcs){
-      std::cout<<i<<std::endl;
-    }
-    std::cout<<std::endl;
-
-    std::vector<std::string> time_srcs = _radio_ctrl->get_time_sources();
-    std::cout<<"Radio Time Sources:\n";
-    for (auto i : time_srcs){
-      std::cout<<"\t"<<i<<"\n";
-    }
-    std::vector<std::string> clk_srcs = _radio_ctrl->get_clock_sources();
-    std::cout<<"Radio Clock Sources:\n";
-    for (auto i : clk_srcs)
-      std::cout<<"\t"<<i<<"\n";
-
-
+    // the RX frontends run with the fast AGC
     std::vector<std::string> dboard_names = tree->list(path / "dboards");
     for (auto i : dboard_names){
-        std::cout<<"Daughter board " <<i<<" frontends: "<<std::endl;
         uhd::fs_path dpath = path + "/dboards/" + i;
-        std::vector<std::string> rx_frontend_names = tree->list(dpath / "rx_frontends");
-        for (auto j : rx_frontend_names){
-            std::cout<<j<<std::endl;
-            std::vector<std::string> rxantennas = tree->access<std::vector<std::string>>(dpath / "rx_frontends" / j / "antenna/options").get();
-            std::cout<<"\tRX Antennas"<<std::endl;
-            for (auto jj : rxantennas)
-                std::cout<<"\t"<<jj<<std::endl;
-            std::list<std::string> agcmodes;
+        for (auto j : tree->list(dpath / "rx_frontends")){
             try {
-                agcmodes = tree->access<std::list<std::string>>(dpath / "rx_frontends" / j / "gain/agc/mode/options").get();
-                std::cout<<"\tRX AGC Modes"<<std::endl;
-                for (auto jj : agcmodes)
-                    std::cout<<"\t"<<jj<<std::endl;
+                uhd::fs_path agc = dpath / "rx_frontends" / j / "gain/agc/mode/value";
+                if (skip_matching and tree->access<std::string>(agc).get() == "fast")
+                    continue;
                 std::cout<<"Setting AGC Mode to fast"<<std::endl;
-                tree->access<std::string>(dpath / "rx_frontends" / j / "gain/agc/mode/value").set("fast");
+                tree->access<std::string>(agc).set("fast");
             } catch (std::exception &) {}
         }
-        std::vector<std::string> tx_frontend_names = tree->list(dpath / "tx_frontends");
-        for (auto j : tx_frontend_names){
-            std::cout<<j<<std::endl;
-            std::vector<std::string> txantennas = tree->access<std::vector<std::string>>(dpath / "tx_frontends" / j / "antenna/options").get();
-            std::cout<<"\tTX Antennas"<<std::endl;
-            for (auto jj : txantennas)
-                std::cout<<"\t"<<jj<<std::endl;
-        }
-
-    }
-
-    // Display the LO names and frequency ranges
-    std::vector<std::string> lo_names = _radio_ctrl->get_rx_lo_names(radio_chan);
-    std::cout<<"LO Names\n";
-    for (auto i : lo_names){
-      std::cout<<i<<":\n";
-      std::vector<std::string> lo_srcs = _radio_ctrl->get_rx_lo_sources(i,radio_chan);
-      uhd::freq_range_t fr_rng = _radio_ctrl->get_rx_lo_freq_range(i,radio_chan);
-      for (auto j : lo_srcs){
-        std::cout<<"\t"<<j<<"\n";
-      }
-      std::cout<<"\tFreq range: "<<fr_rng.start()<<" - "<<fr_rng.stop()<<"\n";
-    }
-
-    std::vector<std::string> cal_lo_names = _radio_ctrl->get_rx_lo_names(calib_chan);
-    std::cout<<"Calib CH. LO Names\n";
-    for (auto i : cal_lo_names){
-      std::cout<<i<<":\n";
-      std::vector<std::string> lo_srcs = _radio_ctrl->get_rx_lo_sources(i,calib_chan);
-      uhd::freq_range_t fr_rng = _radio_ctrl->get_rx_lo_freq_range(i,calib_chan);
-
-      for (auto j : lo_srcs){
-        std::cout<<"\t"<<j<<"\n";
-      }
-      std::cout<<"\tCalib CH. Freq range: "<<fr_rng.start()<<" - "<<fr_rng.stop()<<"\n";
     }
 
     std::cout << std::endl << "Time source is first set to " << _radio_ctrl->get_time_source() << std::endl;
@@ -447,7 +524,8 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
 
 //    Explicitly set time source to gpsdo
     try {
-        _radio_ctrl->set_time_source("gpsdo");
+        if (not skip_matching or _radio_ctrl->get_time_source() != "gpsdo")
+            _radio_ctrl->set_time_source("gpsdo");
     } catch (uhd::key_error &e) {
         std::cout << "could not set the time source to \"gpsdo\"; error was:" <<e.what()<<std::endl;
         std::cout << e.what() << std::endl;
@@ -466,16 +544,18 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     }
     std::cout << std::endl << "Time source is now " << _radio_ctrl->get_time_source() << std::endl;
 
-    boost::this_thread::sleep(boost::posix_time::seconds(setup_time));
+    // with fast_start the GPSDO poll below is the readiness check
+    if (not fast_start)
+        boost::this_thread::sleep(boost::posix_time::milliseconds((long)(setup_time*1000)));
 
     // The TCXO has a long warm up time, so wait up to 30 seconds for sensor data to show up
     std::cout << "Waiting for the GPSDO to warm up..." << std::endl;
-    for (size_t i = 0; i < 300; i++) {
+    for (size_t i = 0; i < 30000/poll_ms; i++) {
         try {
             tree->access<uhd::sensor_value_t>(path / "sensors" / "gps_locked").get().value;
             break;
         } catch (std::exception &) {}
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        boost::this_thread::sleep(boost::posix_time::milliseconds(poll_ms));
     }
     try {
         tree->access<uhd::sensor_value_t>(path / "sensors" / "gps_locked").get().value;
@@ -497,7 +577,8 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     if(not timesource.empty()){
     //    Explicitly set time source to gpsdo
         try {
-            _radio_ctrl->set_time_source(timesource);
+            if (not skip_matching or _radio_ctrl->get_time_source() != timesource)
+                _radio_ctrl->set_time_source(timesource);
         } catch (uhd::key_error &e) {
             std::cout << "could not set the time source to \""<<timesource<<"\"; error was:" <<e.what()<<std::endl;
         }
@@ -506,7 +587,11 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
         }
         std::cout << std::endl << "Time source is now " << _radio_ctrl->get_time_source() << std::endl;
 
-        boost::this_thread::sleep(boost::posix_time::seconds(setup_time));
+        // ready once the reference is locked again
+        if (fast_start and std::find(sensor_names.begin(), sensor_names.end(), "ref_locked") != sensor_names.end())
+            waitForSensor(tree, path / "sensors" / "ref_locked", setup_time);
+        else if (not fast_start)
+            boost::this_thread::sleep(boost::posix_time::milliseconds((long)(setup_time*1000)));
     }
 
 
@@ -536,52 +621,64 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     //    if (vm.count("int-n")) {
     //        //tune_request.args = uhd::device_addr_t("mode_n=integer"); TODO
     //    }
-    _radio_ctrl->set_rx_frequency(freq, radio_chan);
+    if (differs(_radio_ctrl->get_rx_frequency(radio_chan), freq, 1.0))
+        _radio_ctrl->set_rx_frequency(freq, radio_chan);
     std::cout << boost::format("Actual RX Freq: %f MHz...") % (_radio_ctrl->get_rx_frequency(radio_chan)/1e6) << std::endl << std::endl;
-    _radio_ctrl->set_tx_frequency(freq, radio_chan);
+    if (differs(_radio_ctrl->get_tx_frequency(radio_chan), freq, 1.0))
+        _radio_ctrl->set_tx_frequency(freq, radio_chan);
     std::cout << boost::format("Actual TX Freq: %f MHz...") % (_radio_ctrl->get_tx_frequency(radio_chan)/1e6) << std::endl << std::endl;
 
-    _radio_ctrl->set_rx_frequency(freq, calib_chan);
+    if (differs(_radio_ctrl->get_rx_frequency(calib_chan), freq, 1.0))
+        _radio_ctrl->set_rx_frequency(freq, calib_chan);
     std::cout << boost::format("Actual Calib CH. RX Freq: %f MHz...") % (_radio_ctrl->get_rx_frequency(calib_chan)/1e6) << std::endl << std::endl;
-    _radio_ctrl->set_tx_frequency(freq, calib_chan);
+    if (differs(_radio_ctrl->get_tx_frequency(calib_chan), freq, 1.0))
+        _radio_ctrl->set_tx_frequency(freq, calib_chan);
     std::cout << boost::format("Actual Calib CH. TX Freq: %f MHz...") % (_radio_ctrl->get_tx_frequency(calib_chan)/1e6) << std::endl << std::endl;
 
 
     //set the rf gain
     std::cout << boost::format("Setting RX Gain: %f dB...") % rxgain << std::endl;
-    _radio_ctrl->set_rx_gain(rxgain, radio_chan);
+    if (differs(_radio_ctrl->get_rx_gain(radio_chan), rxgain, 1e-3))
+        _radio_ctrl->set_rx_gain(rxgain, radio_chan);
     std::cout << boost::format("Actual RX Gain: %f dB...") % _radio_ctrl->get_rx_gain(radio_chan) << std::endl << std::endl;
 
     //set the rf gain
     std::cout << boost::format("Setting TX Gain: %f dB...") % txgain << std::endl;
-    _radio_ctrl->set_tx_gain(txgain, radio_chan);
+    if (differs(_radio_ctrl->get_tx_gain(radio_chan), txgain, 1e-3))
+        _radio_ctrl->set_tx_gain(txgain, radio_chan);
     std::cout << boost::format("Actual TX Gain: %f dB...") % _radio_ctrl->get_tx_gain(radio_chan) << std::endl << std::endl;
 
     std::cout << boost::format("Setting Calib Ch. RX Gain: %f dB...") % rxgain << std::endl;
-    _radio_ctrl->set_rx_gain(rxgain, calib_chan);
+    if (differs(_radio_ctrl->get_rx_gain(calib_chan), rxgain, 1e-3))
+        _radio_ctrl->set_rx_gain(rxgain, calib_chan);
     std::cout << boost::format("Actual Calib Ch. RX Gain: %f dB...") % _radio_ctrl->get_rx_gain(calib_chan) << std::endl << std::endl;
 
     //set the rf gain
     std::cout << boost::format("Setting Calib Ch. TX Gain: %f dB...") % txgain << std::endl;
-    _radio_ctrl->set_tx_gain(0.0, calib_chan);
+    if (differs(_radio_ctrl->get_tx_gain(calib_chan), 0.0, 1e-3))
+        _radio_ctrl->set_tx_gain(0.0, calib_chan);
     std::cout << boost::format("Actual Calib Ch. TX Gain: %f dB...") % _radio_ctrl->get_tx_gain(calib_chan) << std::endl << std::endl;
 
      std::string antRX("RX2");
      std::cout << boost::format("Setting RX Antenna: %s") % antRX << std::endl;
-     _radio_ctrl->set_rx_antenna(antRX,radio_chan);
+     if (not skip_matching or _radio_ctrl->get_rx_antenna(radio_chan) != antRX)
+         _radio_ctrl->set_rx_antenna(antRX,radio_chan);
      std::cout << boost::format("Actual RX Antenna: %s") % _radio_ctrl->get_rx_antenna(radio_chan) << std::endl << std::endl;
     //
      std::string antTX("TX/RX");
      std::cout << boost::format("Setting TX Antenna: %s") % antTX << std::endl;
-     _radio_ctrl->set_tx_antenna(antTX,radio_chan);
+     if (not skip_matching or _radio_ctrl->get_tx_antenna(radio_chan) != antTX)
+         _radio_ctrl->set_tx_antenna(antTX,radio_chan);
      std::cout << boost::format("Actual TX Antenna: %s") % _radio_ctrl->get_tx_antenna(radio_chan) << std::endl << std::endl;
 
      std::cout << boost::format("Setting Calib Ch. RX Antenna: %s") % antRX << std::endl;
-     _radio_ctrl->set_rx_antenna(antRX,calib_chan);
+     if (not skip_matching or _radio_ctrl->get_rx_antenna(calib_chan) != antRX)
+         _radio_ctrl->set_rx_antenna(antRX,calib_chan);
      std::cout << boost::format("Actual Calib Ch. RX Antenna: %s") % _radio_ctrl->get_rx_antenna(calib_chan) << std::endl << std::endl;
     //
      std::cout << boost::format("Setting Calib Ch. TX Antenna: %s") % antTX << std::endl;
-     _radio_ctrl->set_tx_antenna(antTX,calib_chan);
+     if (not skip_matching or _radio_ctrl->get_tx_antenna(calib_chan) != antTX)
+         _radio_ctrl->set_tx_antenna(antTX,calib_chan);
      std::cout << boost::format("Actual Calib Ch. TX Antenna: %s") % _radio_ctrl->get_tx_antenna(calib_chan) << std::endl << std::endl;
 
      double rx_bw = _radio_ctrl->get_rx_bandwidth(radio_chan); // const ;
@@ -590,15 +687,25 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
      double cal_rx_bw = _radio_ctrl->get_rx_bandwidth(calib_chan); // const;
      std::cout<<"Calib CH. RX BW: "<<cal_rx_bw<<"\n";
 
-     _radio_ctrl->set_tx_bandwidth(rx_bw, radio_chan);
+     if (differs(_radio_ctrl->get_tx_bandwidth(radio_chan), rx_bw, 1.0))
+         _radio_ctrl->set_tx_bandwidth(rx_bw, radio_chan);
      double tx_bw = _radio_ctrl->get_tx_bandwidth(radio_chan); // const ;
      std::cout<<"TX BW: "<<tx_bw<<"\n";
 
-     _radio_ctrl->set_tx_bandwidth(cal_rx_bw, calib_chan);
+     if (differs(_radio_ctrl->get_tx_bandwidth(calib_chan), cal_rx_bw, 1.0))
+         _radio_ctrl->set_tx_bandwidth(cal_rx_bw, calib_chan);
      double cal_tx_bw = _radio_ctrl->get_tx_bandwidth(calib_chan); // const;
      std::cout<<"Calib CH. TX BW: "<<cal_tx_bw<<"\n";
 
-    boost::this_thread::sleep(boost::posix_time::seconds(setup_time)); //allow for some setup time
+    if (fast_start){
+        // settled once every LO reports lock
+        for (const uhd::fs_path &sensor : loLockedSensors(tree, path)){
+            if (not waitForSensor(tree, sensor, setup_time))
+                std::cout << "WARNING: " << sensor << " not locked after " << setup_time << " s" << std::endl;
+        }
+    }
+    else
+        boost::this_thread::sleep(boost::posix_time::milliseconds((long)(setup_time*1000))); //allow for some setup time
 
 
     size_t spp = _radio_ctrl->get_arg<int>("spp");
@@ -707,14 +814,14 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     //////// 6. Spawn receiver //////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////////
     UHD_LOGGER_INFO("RFNOC") << "Samples per packet: " << spp;
-    uhd::stream_args_t rx_stream_args(format, "sc16");
+    uhd::stream_args_t rx_stream_args = make_stream_args(formats.rx[RADIO_CHAN_MAIN]);
     rx_stream_args.args = rx_streamer_args;
     rx_stream_args.args["spp"] = boost::lexical_cast<std::string>(spp);
     UHD_LOGGER_INFO("RFNOC") << "Using RX streamer args: " << rx_stream_args.args.to_string();
 
     _rx_stream = _usrp->get_rx_stream(rx_stream_args);
 
-    uhd::stream_args_t rx_cal_stream_args(format, "sc16");
+    uhd::stream_args_t rx_cal_stream_args = make_stream_args(formats.rx[RADIO_CHAN_CALIB]);
 
     rx_cal_stream_args.args = rx_cal_streamer_args;
     rx_cal_stream_args.args["spp"] = boost::lexical_cast<std::string>(spp);
@@ -723,14 +830,14 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     _rx_cal_stream = _usrp->get_rx_stream(rx_cal_stream_args);
 
 
-    uhd::stream_args_t tx_stream_args(format, "sc16");
+    uhd::stream_args_t tx_stream_args = make_stream_args(formats.tx[RADIO_CHAN_MAIN]);
     tx_stream_args.args = tx_streamer_args;
     tx_stream_args.args["spp"] = boost::lexical_cast<std::string>(spp);
     UHD_LOGGER_INFO("RFNOC") << "Using TX streamer args: " << tx_stream_args.args.to_string();
 
     _tx_stream = _usrp->get_tx_stream(tx_stream_args);
 
-    uhd::stream_args_t tx_cal_stream_args(format, "sc16");
+    uhd::stream_args_t tx_cal_stream_args = make_stream_args(formats.tx[RADIO_CHAN_CALIB]);
     tx_cal_stream_args.args = tx_cal_streamer_args;
     tx_cal_stream_args.args["spp"] = boost::lexical_cast<std::string>(spp);
     UHD_LOGGER_INFO("RFNOC") << "Using TX CAL streamer args: " << tx_cal_stream_args.args.to_string();
@@ -741,25 +848,107 @@ int usrpInit(const std::string & inargs,const std::string &timesource, double ra
     // set time to zero at next pps
     _radio_ctrl->set_time_now(uhd::time_spec_t(0.0));
 
-    boost::this_thread::sleep(boost::posix_time::seconds(setup_time)); //allow for some setup time
+    if (not fast_start)
+        boost::this_thread::sleep(boost::posix_time::milliseconds((long)(setup_time*1000))); //allow for some setup time
 
 
     return EXIT_SUCCESS;
 }
 
+/*!
+ * Stack the pulses of every channel of a capture into a data cube and write
+ * its range-Doppler map next to fname (<stem>-rd.dat, -rd-chN.dat for a
+ * dual channel capture).
+ */
+int rangeDopplerMaps(const std::string &capfname, const std::string &fname, const range_doppler_config_t &config){
+    try{
+        capture_file_reader reader(capfname);
+        std::vector<size_t> channels = capture_channels(reader);
+        boost::filesystem::path p(fname);
+        std::string mapfname = (p.parent_path() / (p.stem().string() + "-rd.dat")).string();
+        for (size_t chan : channels){
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            double prf = 0.0;
+            data_cube::sptr cube = load_data_cube(reader,chan,prf);
+            range_doppler_map_t map = range_doppler(*cube,config,prf);
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::string chanfname = (channels.size() > 1) ? channel_filename(mapfname,chan) : mapfname;
+            write_range_doppler_map(chanfname,map);
+            std::cout << boost::format("Range-Doppler: rx%d, %d pulses x %d range bins -> %d Doppler bins (PRF %f Hz) in %f ms")
+                % chan % cube->npulses() % map.nbins % map.nfft % map.prf % (secs*1e3) << std::endl;
+            std::cout << boost::format("Range-Doppler: peak %f dB at range bin %d, %f Hz (%f dB over the median); wrote %s")
+                % map.peak_db % map.peak_bin % doppler_hz(map,map.peak_doppler) % (map.peak_db - map.median_db) % chanfname << std::endl;
+        }
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error: range-Doppler processing of "<<capfname<<": "<<e.what()<<std::endl;
+        return 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * Report the impulses found by scan, with their offsets compared to the
+ * packet boundaries of the chan RX stream (decimated by decim).
+ */
+void impulseReport(const impulse_sink &scan, size_t chan, size_t decim){
+    // with the host DDC a packet is spp/decim stored samples
+    size_t spp = _device->get_rx_stream(chan)->get_max_num_samps()/decim;
+    const impulse_detector &detector = scan.detector();
+    print_impulse_report(std::cout,detector.get_stats(),impulse_periodicity(detector.impulses(),spp));
+}
+
+/*!
+ * Refuse a lossless capture of need_sps samples per second, in pulses (or
+ * chunks) of nsamps, that codec_threads threads cannot encode: the writer
+ * would fall behind and the run stall or drop pulses. Warns when there is
+ * little headroom left for the RX threads sharing the CPUs.
+ */
+int checkCodecRate(double need_sps, size_t nsamps, size_t codec_threads){
+    double sps = measure_encode_rate(nsamps,CODEC_DEFAULT_BLOCK,codec_threads);
+    std::string threads = codec_threads ? str(boost::format("--codec_threads %d") % codec_threads) : "one codec thread per CPU";
+    if (need_sps > sps){
+        std::cerr << boost::format("Error: --capture_codec lossless encodes %f Msps here with %s, the capture needs %f Msps; "
+                                   "raise --codec_threads, lower the rate or leave the capture uncoded") % (sps/1e6) % threads % (need_sps/1e6) << std::endl;
+        return 1;
+    }
+    std::cout << boost::format("Lossless codec: %f Msps needed, %f Msps measured with %s") % (need_sps/1e6) % (sps/1e6) % threads << std::endl;
+    if (need_sps > 0.75*sps)
+        std::cerr << "Warning: the lossless codec has less than 25% headroom and may fall behind the capture" << std::endl;
+    return EXIT_SUCCESS;
+}
+
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
     uhd::set_thread_priority_safe();
 
     // variables to be set by po
-    std::string args,timesrc;
+    std::string args,timesrc,device;
     std::string wire;
-    double seconds_in_future;
-    size_t total_num_samps, npulses;
+    double seconds_in_future, pri, stream_secs;
+    size_t total_num_samps, npulses, depth, write_slots, chunk_samps;
     double rate,freq,txgain,rxgain;
     int ch_tx, ch_rx;
-    std::string current_wavefile, fname;
-    bool syncpps;
+    std::string current_wavefile, wavefiles, fname, outfmt, export_fname, schedule_fname, compress;
+    std::string doppler_in, doppler_window;
+    std::string sweep_freq, sweep_txgain, sweep_rxgain;
+    double sweep_settle;
+    bool doppler, impulses;
+    impulse_config_t impulse_config = default_impulse_config();
+    range_doppler_config_t doppler_config = default_range_doppler_config();
+    ddc_config_t ddc_config = default_ddc_config();
+    std::string ddc_format;
+    std::string cpu_format, wire_format;
+    std::string capture_codec;
+    size_t codec_threads;
+    bool syncpps, write_drop, direct_io, preallocate, txrx_threads, timing;
+    bool fast_start, enumerate, skip_matching, serve;
+    std::string socket_path, request;
+    std::string trace_fname;
+    thread_sched_t tx_sched = default_thread_sched(), rx_sched = default_thread_sched();
+    loopback_config_t lb_config = default_loopback_config(0.0);
+    replay_config_t replay_config = default_replay_config(0.0);
+    std::string replay_files;
 
     // setup the program options
     po::options_description desc("Allowed options");
@@ -767,25 +956,83 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     desc.add_options()
         ("help", "help message")
         ("args", po::value<std::string>(&args)->default_value(""), "single uhd device address args")
+        ("device", po::value<std::string>(&device)->default_value("uhd"), "radio backend (uhd, loopback or replay)")
+        ("lb_delay", po::value<size_t>(&lb_config.delay)->default_value(0), "loopback device TX->RX delay in samples")
+        ("lb_gain", po::value<double>(&lb_config.gain)->default_value(1.0), "loopback device linear TX->RX gain")
+        ("lb_noise", po::value<double>(&lb_config.noise)->default_value(0.0), "loopback device RX noise std dev (sc16 counts)")
+        ("lb_overflow", po::value<double>(&lb_config.overflow_prob)->default_value(0.0), "loopback device overflow probability per recv call")
+        ("replay", po::value<std::string>(&replay_files)->default_value(""), "replay device recording: comma separated .dat/.bin/.sc8/.fc32 files (one pulse each) or .cap captures; sets --rate, --npulses and --nsamps unless given")
+        ("replay_pace", po::value<bool>(&replay_config.paced)->default_value(true), "replay device: deliver the samples in real time at --rate (0 for as fast as the pipeline takes them)")
+        ("replay_loop", po::value<bool>(&replay_config.loop)->default_value(false), "replay device: start the recording over when it runs out instead of ending the stream")
+        ("serve", po::value<bool>(&serve)->default_value(false), "initialize the radio once and serve pulse jobs on --socket until a client sends quit")
+        ("socket", po::value<std::string>(&socket_path)->default_value("/tmp/n300_txrx_pulse_test.sock"), "Unix domain socket of the pulse server")
+        ("request", po::value<std::string>(&request)->default_value(""), "send this job line (key=value ...) to the server on --socket, write returned samples to --file and exit")
+        ("fast_start", po::value<bool>(&fast_start)->default_value(false), "replace the fixed setup sleeps with lock sensor checks; implies --enumerate 0 --skip_matching 1 unless given")
+        ("enumerate", po::value<bool>(&enumerate)->default_value(true), "print sensors, frontends, antennas and LOs of the device during init")
+        ("skip_matching", po::value<bool>(&skip_matching)->default_value(false), "do not re-apply settings the radio already has")
         ("timesrc", po::value<std::string>(&timesrc)->default_value(""), "single uhd device address args")
         ("freq", po::value<double>(&freq)->default_value(1e9), "tuning frequency")
         ("txgain", po::value<double>(&txgain)->default_value(0), "TX gain")
         ("rxgain", po::value<double>(&rxgain)->default_value(0), "RX gain")
         ("ch_tx", po::value<int>(&ch_tx)->default_value(0), "TX channel select (-1 (none), 0 or 1)")
-        ("ch_rx", po::value<int>(&ch_rx)->default_value(0), "RX channel select (-1 (none), 0 or 1)")
-        ("wavefile", po::value<std::string>(&current_wavefile)->default_value("waveform_data.bin"), "path to waveform file")
+        ("ch_rx", po::value<int>(&ch_rx)->default_value(0), "RX channel select (-1 (none), 0, 1 or 2 (rx0 and rx1 together))")
+        ("wavefile", po::value<std::string>(&current_wavefile)->default_value("waveform_data.bin"), "path to waveform file, or a waveform to synthesize (lfm, tone, barker, code; e.g. lfm:bw=100e6:len=1280:zeros=512, see README)")
+        ("wavefiles", po::value<std::string>(&wavefiles)->default_value(""), "comma separated waveform files or specs to cycle through pulse by pulse (overrides wavefile)")
         ("file", po::value<std::string>(&fname)->default_value("usrp_samples.dat"), "output data file")
+        ("outfmt", po::value<std::string>(&outfmt)->default_value("auto"), "output format: dat (one file per pulse), capture (one .cap container) or auto (capture when npulses > 1)")
+        ("compress", po::value<std::string>(&compress)->default_value("none"), "pulse compression against the TX waveform: none, both (raw pulses and range profiles) or only (range profiles only); profiles go to <file>-range.cap")
+        ("doppler", po::value<bool>(&doppler)->default_value(false), "after the run, stack the pulses (range profiles with --compress) into a data cube and write a range-Doppler map to <file>-rd.dat")
+        ("doppler_in", po::value<std::string>(&doppler_in)->default_value(""), "write the range-Doppler map of this capture container named after --file and exit")
+        ("window", po::value<std::string>(&doppler_window)->default_value("hann"), "slow-time window of the range-Doppler map: rect, hann, hamming or blackman")
+        ("doppler_nfft", po::value<size_t>(&doppler_config.nfft)->default_value(0), "Doppler bins of the range-Doppler map (0 for the next power of two >= the pulses)")
+        ("doppler_threads", po::value<size_t>(&doppler_config.threads)->default_value(0), "threads for range-Doppler processing (0 for one per CPU)")
+        ("impulses", po::value<bool>(&impulses)->default_value(false), "scan every pulse (or the stream) for impulses on the writer thread and report their periodicity relative to the packet size")
+        ("impulse_threshold", po::value<double>(&impulse_config.threshold)->default_value(impulse_config.threshold), "impulse detection threshold in sigmas (1.4826*MAD) of the local magnitude")
+        ("ddc_decim", po::value<size_t>(&ddc_config.decim)->default_value(1), "host DDC: decimate the received samples by this integer factor before storage (1 keeps the full rate)")
+        ("ddc_freq", po::value<double>(&ddc_config.freq)->default_value(0.0), "host DDC: offset from --freq moved to 0 Hz by the NCO, Hz")
+        ("ddc_bw", po::value<double>(&ddc_config.bw)->default_value(0.0), "host DDC: bandwidth kept by the FIR, Hz (0 for 0.8 of the output rate)")
+        ("ddc_taps", po::value<size_t>(&ddc_config.taps)->default_value(0), "host DDC: FIR length (0 picks one from the transition band)")
+        ("ddc_format", po::value<std::string>(&ddc_format)->default_value("sc16"), "host DDC output: sc16, or fc32 (raw capture only)")
+        ("cpu_format", po::value<std::string>(&cpu_format)->default_value("sc16"), "RX streamer CPU format (sc8, sc16 or fc32), or a list like rx0=fc32,rx1=fc32; non-sc16 RX only writes a raw capture")
+        ("wire_format", po::value<std::string>(&wire_format)->default_value("sc16"), "streamer wire format (sc8 or sc16), or a list like rx=sc8,tx0=sc16")
+        ("capture_codec", po::value<std::string>(&capture_codec)->default_value("none"), "compress the raw sc16 capture: none or lossless (read back by --doppler_in, decoded to .dat files by --export)")
+        ("codec_threads", po::value<size_t>(&codec_threads)->default_value(0), "threads encoding the blocks of a long pulse or stream chunk (0 for one per CPU)")
+        ("export", po::value<std::string>(&export_fname)->default_value(""), "write the pulses of this capture container to per-pulse .dat files (sc16) or .fc32 files, named after --file, and exit")
         ("secs", po::value<double>(&seconds_in_future)->default_value(.1), "number of seconds in the future to receive")
         ("nsamps", po::value<size_t>(&total_num_samps)->default_value(4096), "total number of samples to receive")
         ("rate", po::value<double>(&rate)->default_value(125e6), "rate of incoming samples")
         ("syncpps",po::value<bool>(&syncpps)->default_value(false), "specify to sync pulse time to pps edge")
         ("dilv", "specify to disable inner-loop verbose")
         ("npulses", po::value<size_t>(&npulses)->default_value(1), "total number of pulses to receive")
+        ("pri", po::value<double>(&pri)->default_value(0.0), "pulse repetition interval in seconds; > 0 runs a hardware-timed pulse train")
+        ("schedule", po::value<std::string>(&schedule_fname)->default_value(""), "file of pulse start times in seconds, one per line; runs a hardware-timed pulse train with those pulses instead of a fixed PRI")
+        ("sweep_freq", po::value<std::string>(&sweep_freq)->default_value(""), "frequencies to sweep, a list (1e9,2e9) or a range start:stop:step; the pulse train runs at every combination of the sweep values in one session")
+        ("sweep_txgain", po::value<std::string>(&sweep_txgain)->default_value(""), "TX gains to sweep, a list or a range start:stop:step")
+        ("sweep_rxgain", po::value<std::string>(&sweep_rxgain)->default_value(""), "RX gains to sweep, a list or a range start:stop:step")
+        ("sweep_settle", po::value<double>(&sweep_settle)->default_value(0.01), "seconds from the timed retune of a sweep point to its first pulse")
+        ("depth", po::value<size_t>(&depth)->default_value(4), "pulses scheduled ahead on the device in pulse train mode")
+        ("txrx_threads", po::value<bool>(&txrx_threads)->default_value(true), "send TX bursts and receive on separate threads instead of send-then-recv")
+        ("tx_cpu", po::value<int>(&tx_sched.cpu)->default_value(-1), "CPU to pin the TX thread to (-1 for none)")
+        ("rx_cpu", po::value<int>(&rx_sched.cpu)->default_value(-1), "CPU to pin the RX thread to (-1 for none)")
+        ("tx_prio", po::value<float>(&tx_sched.priority)->default_value(0.5), "TX thread realtime priority 0..1 (< 0 to leave unchanged)")
+        ("rx_prio", po::value<float>(&rx_sched.priority)->default_value(0.5), "RX thread realtime priority 0..1 (< 0 to leave unchanged)")
+        ("timing", po::value<bool>(&timing)->default_value(false), "time send/stream command/recv/write of every pulse and print p50/p99/max at the end")
+        ("trace", po::value<std::string>(&trace_fname)->default_value(""), "write the per pulse timing to this CSV (or .json) file; implies --timing")
+        ("write_slots", po::value<size_t>(&write_slots)->default_value(8), "pulse arena slots: pulses received but not yet written")
+        ("write_drop", po::value<bool>(&write_drop)->default_value(false), "drop pulses instead of waiting when the writer falls behind")
+        ("direct_io", po::value<bool>(&direct_io)->default_value(false), "write output files with O_DIRECT")
+        ("preallocate", po::value<bool>(&preallocate)->default_value(false), "fallocate output files before writing")
+        ("stream_secs", po::value<double>(&stream_secs)->default_value(0.0), "capture rx continuously for this many seconds into a capture container instead of pulsing (< 0 runs until Ctrl-C)")
+        ("chunk", po::value<size_t>(&chunk_samps)->default_value(1048576), "samples per written chunk in stream mode")
     ;
     // clang-format on
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
+    if (fast_start){
+        if (vm["enumerate"].defaulted()) enumerate = false;
+        if (vm["skip_matching"].defaulted()) skip_matching = true;
+    }
 
     // print the help message
     if (vm.count("help")) {
@@ -793,64 +1040,686 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         return ~0;
     }
 
-    ch_select_t ch_select = {0x0};
-    if (vm.count("ch_rx")){
-      if (ch_rx == 0){
-        ch_select.rx0 = 1;
-      }
-      else if (ch_rx == 1){
-        ch_select.rx1 = 1;
-      }
+    if (not request.empty()){
+        try{
+            std::string reply = pulse_server_request(socket_path,request,fname);
+            std::cout<<reply<<std::endl;
+            return boost::algorithm::starts_with(reply,"OK") ? EXIT_SUCCESS : 1;
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error: request failed: "<<e.what()<<std::endl;
+            return 1;
+        }
     }
-    if (vm.count("ch_tx")){
-      if (ch_tx == 0){
-        ch_select.tx0 = 1;
-      }
-      else if (ch_tx == 1){
-        ch_select.tx1 = 1;
-      }
+
+    try{
+        doppler_config.window = parse_window(doppler_window);
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    if (not doppler_in.empty())
+        return rangeDopplerMaps(doppler_in,fname,doppler_config);
+
+    if (not export_fname.empty()){
+        try{
+            export_capture_pulses(export_fname,fname);
+            capture_file_reader reader(export_fname);
+            for (size_t i = 0; i < reader.ntags(); i++){
+                const capture_tag_t &tag = reader.tag(i);
+                std::cout << boost::format("Tag %d: pulses %d-%d, freq %f MHz, txgain %.2f dB, rxgain %.2f dB, first pulse at %f")
+                    % i % tag.first_pulse % (tag.first_pulse + tag.npulses - 1) % (tag.freq/1e6) % tag.txgain % tag.rxgain
+                    % (tag.time_full_secs + tag.time_frac_secs) << std::endl;
+            }
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error exporting "<<export_fname<<": "<<e.what()<<std::endl;
+            return 1;
+        }
+        std::cout<<"Exported "<<export_fname<<" to "<<fname<<std::endl;
+        return EXIT_SUCCESS;
+    }
+    // the replay device plays recorded samples back through the same pipeline
+    boost::shared_ptr<replay_recording_t> recording;
+    if (device == "replay"){
+        if (replay_files.empty()){
+            std::cerr<<"Error: --device replay needs a --replay recording"<<std::endl;
+            return 1;
+        }
+        std::vector<std::string> replay_fnames;
+        boost::split(replay_fnames, replay_files, boost::is_any_of(","), boost::token_compress_on);
+        recording.reset(new replay_recording_t());
+        recording->rate = 0.0;
+        try{
+            load_replay_recording(*recording,replay_fnames);
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error loading replay: "<<e.what()<<std::endl;
+            return 1;
+        }
+        // run the recording as it was taken unless told otherwise
+        const replay_track_t &track = replay_track(*recording,(ch_rx == 1) ? RADIO_CHAN_CALIB : RADIO_CHAN_MAIN);
+        if (vm["rate"].defaulted() and recording->rate > 0.0)
+            rate = recording->rate;
+        if (vm["npulses"].defaulted())
+            npulses = track.starts.size();
+        if (vm["nsamps"].defaulted()){
+            total_num_samps = 0;
+            for (size_t i = 0; i < track.starts.size(); i++){
+                uint64_t end = (i + 1 < track.starts.size()) ? track.starts[i+1] : track.samps.size();
+                total_num_samps = std::max<size_t>(total_num_samps, (size_t)(end - track.starts[i]));
+            }
+        }
+    }
+    std::vector<double> schedule;
+    if (not schedule_fname.empty()){
+        try{
+            schedule = load_pulse_schedule(schedule_fname);
+        }
+        catch(std::runtime_error &e){
+            std::cerr<<"Error loading schedule: "<<e.what()<<std::endl;
+            return 1;
+        }
+        if (schedule.empty()){
+            std::cerr<<"Error: schedule "<<schedule_fname<<" has no pulses"<<std::endl;
+            return 1;
+        }
+        if (vm["npulses"].defaulted() or npulses > schedule.size())
+            npulses = schedule.size();
+    }
+    std::vector<sweep_point_t> sweep;
+    if (not sweep_freq.empty() or not sweep_txgain.empty() or not sweep_rxgain.empty()){
+        try{
+            sweep = make_sweep_points(
+                sweep_freq.empty() ? std::vector<double>(1,freq) : parse_sweep_values(sweep_freq),
+                sweep_txgain.empty() ? std::vector<double>(1,txgain) : parse_sweep_values(sweep_txgain),
+                sweep_rxgain.empty() ? std::vector<double>(1,rxgain) : parse_sweep_values(sweep_rxgain));
+        }
+        catch(std::invalid_argument &e){
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+        // all points go into one capture, tagged with their settings
+        outfmt = "capture";
+    }
+    // pulses of the whole run, all sweep points together
+    size_t run_pulses = npulses*std::max<size_t>(1,sweep.size());
+    if (outfmt == "auto")
+        outfmt = (npulses > 1) ? "capture" : "dat";
+    if (outfmt != "capture" and outfmt != "dat"){
+        std::cerr<<"Unknown output format \""<<outfmt<<"\" (expected dat, capture or auto)"<<std::endl;
+        return 1;
+    }
+    if (compress != "none" and compress != "both" and compress != "only"){
+        std::cerr<<"Unknown compression mode \""<<compress<<"\" (expected none, both or only)"<<std::endl;
+        return 1;
+    }
+    // the host DDC runs between recv() and storage when it changes anything
+    bool ddc = ddc_config.decim != 1 or ddc_config.freq != 0.0;
+    if (ddc){
+        if (ddc_format != "sc16" and ddc_format != "fc32"){
+            std::cerr<<"Unknown DDC output format \""<<ddc_format<<"\" (expected sc16 or fc32)"<<std::endl;
+            return 1;
+        }
+        ddc_config.fc32 = ddc_format == "fc32";
+        try{
+            ddc_filter check(ddc_config,rate);
+        }
+        catch(std::invalid_argument &e){
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+        if (serve){
+            std::cerr<<"Error: the pulse server does not run the DDC"<<std::endl;
+            return 1;
+        }
+        // the other outputs and analyses take sc16 pulses
+        if (ddc_config.fc32 and ((stream_secs == 0.0 and outfmt != "capture") or compress != "none" or impulses)){
+            std::cerr<<"Error: --ddc_format fc32 only writes a raw capture (--outfmt capture, no --compress or --impulses)"<<std::endl;
+            return 1;
+        }
+    }
+
+    ch_select_t ch_select = make_ch_select(ch_rx, ch_tx);
+
+    stream_formats_t formats;
+    try{
+        formats = parse_stream_formats(cpu_format,wire_format);
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    // pulses are stored in the CPU format of the RX streamers
+    sample_format_t rx_format = formats.rx[(ch_select.rx0==1) ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB].cpu;
+    if (ch_select.rx0==1 and ch_select.rx1==1 and formats.rx[RADIO_CHAN_CALIB].cpu != rx_format){
+        std::cerr<<"Error: both RX channels go to one capture and need the same CPU format"<<std::endl;
+        return 1;
+    }
+    // the other outputs and analyses take sc16 pulses
+    if (rx_format != SAMPLE_FORMAT_SC16 and (serve or ddc or (stream_secs == 0.0 and outfmt != "capture") or compress != "none" or impulses)){
+        std::cerr<<"Error: an "<<sample_format_name(rx_format)<<" RX CPU format only writes a raw capture (--outfmt capture, no --compress, --impulses, --ddc_* or --serve)"<<std::endl;
+        return 1;
+    }
+    uint32_t capture_encoding = CAPTURE_ENCODING_NONE;
+    try{
+        capture_encoding = parse_capture_encoding(capture_codec);
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    if (capture_encoding != CAPTURE_ENCODING_NONE and
+        (rx_format != SAMPLE_FORMAT_SC16 or ddc_config.fc32 or serve or (stream_secs == 0.0 and (outfmt != "capture" or compress == "only")))){
+        std::cerr<<"Error: --capture_codec encodes a raw sc16 capture (--outfmt capture, sc16 RX and DDC output)"<<std::endl;
+        return 1;
+    }
+
+    // load every TX waveform once up front; pulses only reference the cache
+    waveform_cache waves;
+    std::vector<const sc16_buffer_t *> wave_sequence;
+    std::vector<std::string> wave_files;
+    if (wavefiles.empty())
+        wave_files.push_back(current_wavefile);
+    else
+        boost::split(wave_files, wavefiles, boost::is_any_of(","), boost::token_compress_on);
+    // the server loads the waveforms of each job itself
+    if (not serve and stream_secs == 0.0) try{
+        for (const std::string &wf : wave_files){
+            // a waveform file or a synthesizer spec such as lfm:bw=100e6:len=1280
+            const sc16_buffer_t &wave = cache_waveform(waves, wf, rate);
+            if (wave.size()>total_num_samps){
+                std::cout<<"WARNING: TX waveform "<<wf<<" is longer ("<<wave.size()<<" samples) than requested RX nsamps ("<<total_num_samps<<")"<<std::endl;
+            }
+            wave_sequence.push_back(&wave);
+        }
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error loading waveforms: "<<e.what()<<std::endl;
+        return 1;
     }
 
-    int err = usrpInit(args,timesrc,rate,freq,rxgain,txgain);
-    if (err == EXIT_SUCCESS)
-        std::cout<<"usrpInit completed successfully"<<std::endl;
+    int err;
+    if (device == "loopback"){
+        lb_config.rate = rate;
+        lb_config.formats = formats;
+        std::cout << boost::format("Creating loopback device at %f Msps (delay %d samples, noise %f, overflow prob %f)...")
+            % (rate/1e6) % lb_config.delay % lb_config.noise % lb_config.overflow_prob << std::endl;
+        try {
+            _device = loopback_device::make(lb_config);
+        }
+        catch(const std::exception &e) {
+            std::cerr << "Could not create loopback device: " << e.what() << std::endl;
+            return 1;
+        }
+        _device->set_time_now(uhd::time_spec_t(0.0));
+    }
+    else if (device == "replay"){
+        replay_config.rate = rate;
+        replay_config.formats = formats;
+        const replay_track_t &track = replay_track(*recording,(ch_select.rx1==1 and ch_select.rx0==0) ? RADIO_CHAN_CALIB : RADIO_CHAN_MAIN);
+        std::cout << boost::format("Creating replay device at %f Msps (%d records, %d samples, %s)...")
+            % (rate/1e6) % track.starts.size() % track.samps.size()
+            % (replay_config.paced ? "paced" : "unpaced") << std::endl;
+        try {
+            _device = replay_device::make(replay_config,recording);
+        }
+        catch(const std::exception &e) {
+            std::cerr << "Could not create replay device: " << e.what() << std::endl;
+            return 1;
+        }
+        _device->set_time_now(uhd::time_spec_t(0.0));
+    }
+    else if (device == "uhd"){
+        err = usrpInit(args,timesrc,rate,freq,rxgain,txgain,fast_start,enumerate,skip_matching,formats);
+        if (err == EXIT_SUCCESS)
+            std::cout<<"usrpInit completed successfully"<<std::endl;
+        else{
+            std::cerr<<"usrpInit returned error...Exiting"<<std::endl;
+            return 1;
+        }
+        _device = uhd_radio_device::make(_usrp,_radio_ctrl,_rx_stream,_rx_cal_stream,_tx_stream,_tx_cal_stream,formats);
+    }
     else{
-        std::cerr<<"usrpInit returned error...Exiting"<<std::endl;
+        std::cerr<<"Unknown device \""<<device<<"\" (expected uhd, loopback or replay)"<<std::endl;
         return 1;
     }
-    boost::filesystem::path p(fname.c_str());
-    std::string base = p.stem().string();
+    if (serve){
+        pulse_job_t defaults;
+        defaults.freq = freq;
+        defaults.txgain = txgain;
+        defaults.rxgain = rxgain;
+        defaults.ch_rx = ch_rx;
+        defaults.ch_tx = ch_tx;
+        defaults.wavefiles = wave_files;
+        defaults.nsamps = total_num_samps;
+        defaults.npulses = npulses;
+        defaults.pri = pri;
+        defaults.depth = depth;
+        defaults.secs = seconds_in_future;
+        pulse_server_config_t server_config;
+        server_config.socket_path = socket_path;
+        server_config.slots = write_slots;
+        server_config.train.rx_timeout = 1.0;
+        server_config.train.threaded = txrx_threads;
+        server_config.train.tx_sched = tx_sched;
+        server_config.train.rx_sched = rx_sched;
+        try{
+            pulse_server server(_device,server_config,defaults);
+            server.run();
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error: pulse server: "<<e.what()<<std::endl;
+            return 1;
+        }
+        return EXIT_SUCCESS;
+    }
 
-    for (int i = 0; i < npulses; i++){
+    if (stream_secs != 0.0){
+        if (ch_select.rx0 + ch_select.rx1 != 1){
+            std::cerr<<"Error: stream mode records one RX channel (--ch_rx 0 or 1)"<<std::endl;
+            return 1;
+        }
+        size_t chan = (ch_select.rx0==1) ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB;
+        stream_capture_config_t stream_config;
+        stream_config.nsamps = (stream_secs > 0.0) ? (uint64_t)std::llround(stream_secs*rate) : 0;
+        stream_config.chunk_samps = chunk_samps;
+        stream_config.timeout = 1.0;
+        stream_config.max_gaps = 20;
+        // the ring of chunks between recv() and the writer thread
+        pulse_arena::sptr arena(new pulse_arena(std::max<size_t>(write_slots,2),slot_samps(chunk_samps,sample_size(rx_format)),write_drop));
+        pulse_sink::sptr sink;
+        impulse_sink::sptr impulse_scan;
+        ddc_sink::sptr downconverter;
+        pulse_arena::sptr ddc_arena;
+        boost::shared_ptr<pulse_writer> storage;
+        boost::shared_ptr<capture_file_sink> capture_out;
+        std::string capfname = boost::filesystem::path(fname).replace_extension(".cap").string();
+        // a stream never waits for the writer: the codec has to keep up with it
+        if (capture_encoding != CAPTURE_ENCODING_NONE and
+            checkCodecRate(rate/ddc_config.decim,std::max<size_t>(chunk_samps/ddc_config.decim,1),codec_threads) != EXIT_SUCCESS)
+            return 1;
+        try{
+            capture_header_t header = make_capture_header();
+            header.rate = rate/ddc_config.decim;
+            header.freq = freq + ddc_config.freq;
+            header.rxgain = rxgain;
+            header.rx_channels = 1 << chan;
+            set_capture_format(header,ddc_config.fc32 ? SAMPLE_FORMAT_FC32 : rx_format);
+            set_capture_encoding(header,capture_encoding);
+            capture_out.reset(new capture_file_sink(capfname,header,direct_io,preallocate,
+                                                    stream_config.nsamps/ddc_config.decim*header.bytes_per_sample,codec_threads));
+            sink = capture_out;
+            if (impulses){
+                impulse_scan.reset(new impulse_sink(impulse_config,sink,true));
+                sink = impulse_scan;
+            }
+            if (ddc){
+                // the writer thread runs the DDC and the storage writer gets a thread of its own
+                ddc_arena.reset(new pulse_arena(arena->size(),ddc_sink::out_capacity(ddc_config,rate,chunk_samps),false));
+                storage.reset(new pulse_writer(sink,ddc_arena));
+                downconverter.reset(new ddc_sink(ddc_config,rate,ddc_arena,storage,true));
+                sink = downconverter;
+            }
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error opening output: "<<e.what()<<std::endl;
+            return 1;
+        }
+        pulse_writer writer(sink,arena);
+        stream_capture_stats_t stats;
+        try{
+            stream_capture capture(_device,chan,stream_config);
+            if (stream_secs > 0.0)
+                std::cout<<"Streaming "<<stream_secs<<" s of rx"<<chan<<" to capture "<<capfname<<std::endl;
+            else
+                std::cout<<"Streaming rx"<<chan<<" to capture "<<capfname<<" until Ctrl-C"<<std::endl;
+            apply_thread_sched(rx_sched,"n300-rx");
+            _stream_capture = &capture;
+            std::signal(SIGINT,&stop_stream_capture);
+            stats = capture.run(_device->get_time_now()+uhd::time_spec_t(seconds_in_future),arena,
+                [&](size_t, pulse_slot *slot){
+                    if (slot != NULL)
+                        writer.submit(slot);
+                });
+            std::signal(SIGINT,SIG_DFL);
+            _stream_capture = NULL;
+            print_stream_capture_stats(std::cout,stats,capture.gaps(),rate);
+        }
+        catch(std::runtime_error &e){
+            std::signal(SIGINT,SIG_DFL);
+            _stream_capture = NULL;
+            std::cerr<<std::endl<<"Error: stream_capture threw "<<e.what()<<std::endl;
+            writer.close();
+            return 1;
+        }
+        writer.close();
+        print_writer_stats(writer.get_stats(),arena->get_stats(),arena->size());
+        if (downconverter){
+            print_ddc_stats(std::cout,downconverter->get_stats(),ddc_config.decim);
+            print_writer_stats(storage->get_stats(),ddc_arena->get_stats(),ddc_arena->size());
+        }
+        if (capture_out->encoded())
+            print_codec_stats(std::cout,capture_out->get_codec_stats());
+        if (impulse_scan)
+            impulseReport(*impulse_scan,chan,ddc_config.decim);
+        if (recording)
+            print_replay_stats(std::cout,boost::static_pointer_cast<replay_device>(_device)->get_stats());
+        std::cout << std::endl << "Done!" << std::endl << std::endl;
+        return (stats.timeouts == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // pulses are received straight into arena slots; all file output
+    // happens on the writer thread, which hands the slots back
+    // a dual channel pulse holds one slot per channel
+    size_t nrx = std::max(1, ch_select.rx0 + ch_select.rx1);
+    pulse_arena::sptr arena(new pulse_arena(std::max(write_slots,nrx),slot_samps(total_num_samps,sample_size(rx_format)),write_drop));
+    pulse_sink::sptr sink;
+    compress_sink::sptr compressor;
+    impulse_sink::sptr impulse_scan;
+    ddc_sink::sptr downconverter;
+    pulse_arena::sptr ddc_arena;
+    boost::shared_ptr<pulse_writer> storage;
+    std::vector<boost::shared_ptr<capture_file_sink>> captures;   // tagged with the sweep points
+    std::string doppler_source;   // capture the range-Doppler map is made from
+    // samples stored per pulse
+    size_t out_samps = ddc ? ddc_filter(ddc_config,rate).pulse_output(total_num_samps) : total_num_samps;
+    if (capture_encoding != CAPTURE_ENCODING_NONE and compress != "only" and outfmt == "capture"){
+        // pulses of a hardware-timed train or sweep come at the device's pace
+        double train_secs = 0.0;
+        if (not schedule.empty())
+            train_secs = (schedule.back() + total_num_samps/rate)/schedule.size();
+        else if (pri > 0.0)
+            train_secs = pri;
+        else if (not sweep.empty()){
+            size_t longest = total_num_samps;
+            for (const sc16_buffer_t *w : wave_sequence)
+                longest = std::max(longest, w->size());
+            train_secs = longest/rate + 100e-6;
+        }
+        if (train_secs > 0.0 and checkCodecRate(nrx*out_samps/train_secs,std::max<size_t>(out_samps,1),codec_threads) != EXIT_SUCCESS)
+            return 1;
+    }
+    try{
+        capture_header_t header = make_capture_header();
+        header.rate = rate/ddc_config.decim;
+        header.freq = freq + ddc_config.freq;
+        header.txgain = txgain;
+        header.rxgain = rxgain;
+        header.rx_channels = (ch_select.rx0 ? 0x1 : 0) | (ch_select.rx1 ? 0x2 : 0);
+        header.tx_channels = (ch_select.tx0 ? 0x1 : 0) | (ch_select.tx1 ? 0x2 : 0);
+        header.waveform_hash = capture_waveform_hash(wave_sequence);
+        set_capture_format(header,ddc_config.fc32 ? SAMPLE_FORMAT_FC32 : rx_format);
+        set_capture_encoding(header,capture_encoding);
+        // with --compress only there is no raw output
+        if (compress != "only" and outfmt == "capture"){
+            std::string capfname = boost::filesystem::path(fname).replace_extension(".cap").string();
+            std::cout<<"Writing "<<run_pulses<<" pulses to capture "<<capfname<<std::endl;
+            captures.push_back(boost::shared_ptr<capture_file_sink>(new capture_file_sink(capfname,header,direct_io,preallocate,
+                                                                    (uint64_t)run_pulses*nrx*out_samps*header.bytes_per_sample,codec_threads)));
+            sink = captures.back();
+            doppler_source = capfname;
+        }
+        else if (compress != "only"){
+            sink.reset(new pulse_file_sink(fname,npulses,direct_io,preallocate,ch_select.rx0==1 and ch_select.rx1==1));
+        }
+        if (compress != "none"){
+            // range profiles are stored as complex float, one per pulse and channel
+            set_capture_format(header,SAMPLE_FORMAT_FC32);
+            set_capture_encoding(header,CAPTURE_ENCODING_NONE);
+            boost::filesystem::path p(fname);
+            std::string rangefname = (p.parent_path() / (p.stem().string() + "-range.cap")).string();
+            std::cout<<"Writing "<<run_pulses<<" range profiles to capture "<<rangefname<<std::endl;
+            boost::shared_ptr<capture_file_sink> profiles(new capture_file_sink(rangefname,header,direct_io,preallocate,
+                                                          (uint64_t)run_pulses*nrx*out_samps*sizeof(fc32_t)));
+            captures.push_back(profiles);
+            // the received pulses are downconverted first, so the references must be too
+            std::map<const sc16_buffer_t *, sc16_buffer_t> ddc_waves;
+            std::vector<const sc16_buffer_t *> references = wave_sequence;
+            if (ddc){
+                ddc_filter filter(ddc_config,rate);
+                fc32_buffer_t work;
+                for (const sc16_buffer_t *&w : references){
+                    sc16_buffer_t &ref = ddc_waves[w];
+                    if (ref.empty()){
+                        work.resize(filter.pulse_output(w->size()));
+                        ref.resize(filter.decimate(w->data(),w->size(),work.data()));
+                        convert_samples(work.data(),ref.data(),ref.size());
+                    }
+                    w = &ref;
+                }
+            }
+            compressor.reset(new compress_sink(references,out_samps,sink,profiles));
+            doppler_source = rangefname;
+            sink = compressor;
+        }
+        if (impulses){
+            impulse_scan.reset(new impulse_sink(impulse_config,sink));
+            sink = impulse_scan;
+        }
+        if (ddc){
+            // the writer thread runs the DDC and the storage writer gets a thread of its own
+            ddc_arena.reset(new pulse_arena(arena->size(),ddc_sink::out_capacity(ddc_config,rate,total_num_samps),false));
+            storage.reset(new pulse_writer(sink,ddc_arena));
+            downconverter.reset(new ddc_sink(ddc_config,rate,ddc_arena,storage));
+            sink = downconverter;
+        }
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error opening output: "<<e.what()<<std::endl;
+        return 1;
+    }
+    pulse_writer writer(sink,arena);
+    std::unique_ptr<pulse_trace> trace;
+    if (timing or not trace_fname.empty()){
+        trace.reset(new pulse_trace(run_pulses));
+        writer.set_trace(trace.get());
+    }
+
+    if (not sweep.empty()){
+      sweep_config_t sweep_config;
+      sweep_config.train.pri = pri;
+      sweep_config.train.depth = depth;
+      sweep_config.train.npulses = npulses;
+      sweep_config.train.nsamps = total_num_samps;
+      sweep_config.train.rx_timeout = 1.0;
+      sweep_config.train.threaded = txrx_threads;
+      sweep_config.train.tx_sched = tx_sched;
+      sweep_config.train.rx_sched = rx_sched;
+      sweep_config.train.offsets = schedule;
+      if (pri <= 0.0 and schedule.empty()){
+        // back to back pulses, like a pulse server job without a PRI
+        size_t longest = total_num_samps;
+        for (const sc16_buffer_t *w : wave_sequence)
+          longest = std::max(longest, w->size());
+        sweep_config.train.pri = longest/rate + 100e-6;
+      }
+      sweep_config.lead = 0.005;
+      sweep_config.settle = std::max(sweep_settle,sweep_config.lead);
+      std::cout << boost::format("Sweeping %d points of %d pulses (PRI %f ms, settle %f ms)")
+          % sweep.size() % npulses % (sweep_config.train.pri*1e3) % (sweep_config.settle*1e3) << std::endl;
+      std::vector<sweep_result_t> results;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      try{
+          param_sweep sweeper(_device,sweep_config,ch_select);
+          results = sweeper.run(sweep,wave_sequence,arena,
+              [&](size_t, pulse_slot *slot){
+                  if (slot != NULL)
+                      writer.submit(slot);
+              });
+      }
+      catch(std::runtime_error &e){
+          std::cerr<<std::endl<<"Error: param_sweep threw "<<e.what()<<std::endl;
+          return 1;
+      }
+      double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      // the writer is still busy; the tags go in when the captures close
+      for (const capture_tag_t &tag : capture_tags(results,npulses))
+        for (boost::shared_ptr<capture_file_sink> &capture : captures)
+          capture->add_tag(tag);
+      print_sweep_results(std::cout,results,secs);
+    }
+    else if (pri > 0.0 or not schedule.empty()){
       double time_set = -1.0;
       if (syncpps){
+        // one PPS sync anchors the whole train; every pulse time is an
+        // exact offset from that epoch, so the PRF is free of the 1 Hz PPS
         err = sync_pps(time_set,-1.0);
+        if (err == 0)
+          err = wait_pps_epoch(time_set,3.0);
         if (err != 0) std::cerr << "Error: sync_pps returned: " << err << ". time_set: "<<time_set<<std::endl;
-        // time_set-=.6;
+        else std::cout << boost::format("Pulse train anchored to PPS epoch %f, first pulse at %f") % time_set % (time_set+seconds_in_future) << std::endl;
       }
-      std::vector<std::complex<short>> pulseVector;
-      std::vector<uhd::rx_metadata_t> md_vec;
-      unsigned long num_rx = total_num_samps;
+      uhd::time_spec_t timenow = (time_set < 0.0) ? _device->get_time_now() : uhd::time_spec_t(time_set);
+      pulse_train_config_t train_config;
+      train_config.pri = pri;
+      train_config.depth = depth;
+      train_config.npulses = npulses;
+      train_config.nsamps = total_num_samps;
+      train_config.rx_timeout = 1.0;
+      train_config.threaded = txrx_threads;
+      train_config.tx_sched = tx_sched;
+      train_config.rx_sched = rx_sched;
+      train_config.offsets = schedule;
+      pulse_train train(_device,train_config,ch_select);
+      train.set_trace(trace.get());
+      pulse_train_stats_t stats;
       try{
-            pulseStream(pulseVector,md_vec,num_rx,seconds_in_future,time_set,current_wavefile,ch_select);
+          stats = train.run(timenow+uhd::time_spec_t(seconds_in_future),wave_sequence,arena,
+              [&](size_t, pulse_slot *slot){
+                  if (slot != NULL)
+                      writer.submit(slot);
+              });
       }
       catch(std::runtime_error &e){
-          std::cerr<<std::endl<<"Error: PulseStream threw "<<e.what()<<std::endl;
+          std::cerr<<std::endl<<"Error: pulse_train threw "<<e.what()<<std::endl;
           return 1;
       }
-      std::string newfname;
-      if (npulses>1){
-        std::string basen = base + "-" + boost::lexical_cast<std::string>(i);
-        boost::filesystem::path newpath = p.parent_path() / boost::filesystem::path(basen + p.extension().string());
-        newfname = newpath.string();
+      std::cout << boost::format("Pulse train: %d pulses at %s, %d errors, %d short, %f s wall (%f pulses/s)")
+          % stats.pulses % (schedule.empty() ? str(boost::format("PRI %f ms") % (pri*1e3)) : "schedule " + schedule_fname) % stats.errors % stats.short_pulses % stats.wall_secs
+          % (stats.wall_secs > 0.0 ? stats.pulses/stats.wall_secs : 0.0) << std::endl;
+      if (ch_select.rx0==1 and ch_select.rx1==1)
+        std::cout << boost::format("Dual RX: %d of %d pulses misaligned between rx0 and rx1 (max skew %d samples)")
+            % stats.misaligned % npulses % stats.max_skew << std::endl;
+    }
+    else {
+      // the main thread receives; TX bursts go out from the TX thread
+      std::unique_ptr<tx_worker> tx;
+      if (txrx_threads){
+        apply_thread_sched(rx_sched,"n300-rx");
+        uhd::tx_streamer::sptr tx_stream;
+        if (ch_select.tx0==1)
+          tx_stream = _device->get_tx_stream(RADIO_CHAN_MAIN);
+        else if (ch_select.tx1==1)
+          tx_stream = _device->get_tx_stream(RADIO_CHAN_CALIB);
+        if (tx_stream){
+          tx.reset(new tx_worker(tx_stream,tx_sched));
+          tx->set_trace(trace.get(),(ch_select.tx0==1) ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB);
+        }
+      }
+      // dual RX drains the calib channel on a thread of its own for the whole run;
+      // it is not pinned so it never shares a CPU with this one
+      std::unique_ptr<rx_worker> cal_rx;
+      if (ch_select.rx0==1 and ch_select.rx1==1){
+        thread_sched_t cal_sched = rx_sched;
+        cal_sched.cpu = -1;
+        cal_rx.reset(new rx_worker(_device->get_rx_stream(RADIO_CHAN_CALIB),rate,cal_sched));
+        cal_rx->set_trace(trace.get(),RADIO_CHAN_CALIB);
       }
-      else{
-        newfname = fname;
+      size_t misaligned = 0;
+      long long max_skew = 0;
+      for (size_t i = 0; i < npulses; i++){
+        double time_set = -1.0;
+        if (syncpps){
+          err = sync_pps(time_set,-1.0);
+          if (err != 0) std::cerr << "Error: sync_pps returned: " << err << ". time_set: "<<time_set<<std::endl;
+          // time_set-=.6;
+        }
+        // one slot per received channel; a TX only run still writes an empty pulse
+        bool chan_on[2] = {ch_select.rx0==1, ch_select.rx1==1};
+        pulse_slot *slots[2] = {NULL, NULL};
+        std::complex<short> *buffs[2] = {NULL, NULL};
+        bool dropped = false;
+        for (size_t c = 0; c < 2; c++){
+          if (not chan_on[c] and not (c == 0 and not chan_on[1]))
+            continue;
+          slots[c] = arena->acquire();
+          if (slots[c] == NULL)
+            dropped = true;
+          else if (chan_on[c])
+            buffs[c] = slots[c]->samps;
+        }
+        if (dropped){
+          for (size_t c = 0; c < 2; c++)
+            if (slots[c] != NULL) arena->release(slots[c]);
+          continue;
+        }
+        unsigned long num_rx = total_num_samps;
+        size_t num_rx_samps[2];
+        uhd::rx_metadata_t md_rx[2];
+        try{
+              pulseStream(buffs,num_rx_samps,md_rx,num_rx,seconds_in_future,time_set,*wave_sequence[i % wave_sequence.size()],ch_select,tx.get(),cal_rx.get(),trace.get(),i);
+        }
+        catch(std::runtime_error &e){
+            std::cerr<<std::endl<<"Error: PulseStream threw "<<e.what()<<std::endl;
+            for (size_t c = 0; c < 2; c++)
+              if (slots[c] != NULL) arena->release(slots[c]);
+            return 1;
+        }
+        if (chan_on[0] and chan_on[1]){
+          long long skew = md_rx[RADIO_CHAN_CALIB].time_spec.to_ticks(rate) - md_rx[RADIO_CHAN_MAIN].time_spec.to_ticks(rate);
+          if (skew != 0){
+            misaligned++;
+            max_skew = std::max(max_skew, std::llabs(skew));
+          }
+        }
+        for (size_t c = 0; c < 2; c++){
+          if (slots[c] == NULL)
+            continue;
+          slots[c]->index = i;
+          slots[c]->channel = c;
+          slots[c]->wave = i % wave_sequence.size();
+          slots[c]->nsamps = num_rx_samps[c];
+          set_slot_metadata(*slots[c],md_rx[c]);
+          writer.submit(slots[c]);
+        }
       }
-      std::ofstream file;
-      file.open(newfname.c_str(), std::ofstream::binary);
-      file.write((const char*)&pulseVector.front(), pulseVector.size()*sizeof(std::complex<short>));
-      file.close();
+      if (ch_select.rx0==1 and ch_select.rx1==1)
+        std::cout << boost::format("Dual RX: %d of %d pulses misaligned between rx0 and rx1 (max skew %d samples)")
+            % misaligned % npulses % max_skew << std::endl;
+    }
+    writer.close();
+    print_writer_stats(writer.get_stats(),arena->get_stats(),arena->size());
+    if (downconverter){
+        print_ddc_stats(std::cout,downconverter->get_stats(),ddc_config.decim);
+        print_writer_stats(storage->get_stats(),ddc_arena->get_stats(),ddc_arena->size());
+    }
+    if (not captures.empty() and captures.front()->encoded())
+        print_codec_stats(std::cout,captures.front()->get_codec_stats());
+    if (compressor)
+        print_compress_stats(std::cout,compressor->get_stats());
+    if (impulse_scan)
+        impulseReport(*impulse_scan,(ch_select.rx0==1) ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB,ddc_config.decim);
+    if (doppler){
+        if (doppler_source.empty())
+            std::cerr<<"Error: --doppler needs a capture (--outfmt capture or --compress)"<<std::endl;
+        else if (rangeDopplerMaps(doppler_source,fname,doppler_config) != EXIT_SUCCESS)
+            return 1;
+    }
+    if (recording)
+        print_replay_stats(std::cout,boost::static_pointer_cast<replay_device>(_device)->get_stats());
+    if (trace){
+        trace->report(std::cout);
+        if (not trace_fname.empty()){
+            try{
+                trace->write(trace_fname);
+                std::cout<<"Wrote pulse timing trace to "<<trace_fname<<std::endl;
+            }
+            catch(std::exception &e){
+                std::cerr<<"Error writing trace: "<<e.what()<<std::endl;
+            }
+        }
     }
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
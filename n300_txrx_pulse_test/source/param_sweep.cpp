@@ -0,0 +1,172 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "param_sweep.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+static double parse_sweep_value(const std::string &value, const std::string &spec){
+    try {
+        return boost::lexical_cast<double>(boost::algorithm::trim_copy(value));
+    }
+    catch (boost::bad_lexical_cast &){
+        throw std::invalid_argument("bad value \"" + value + "\" in sweep \"" + spec + "\"");
+    }
+}
+
+std::vector<double> parse_sweep_values(const std::string &spec){
+    std::vector<double> values;
+    std::vector<std::string> tokens;
+    if (spec.find(':') != std::string::npos){
+        boost::split(tokens, spec, boost::is_any_of(":"));
+        if (tokens.size() != 3)
+            throw std::invalid_argument("sweep range \"" + spec + "\" is not start:stop:step");
+        double start = parse_sweep_value(tokens[0], spec);
+        double stop = parse_sweep_value(tokens[1], spec);
+        double step = parse_sweep_value(tokens[2], spec);
+        if (step == 0.0 or (stop - start)*step < 0.0)
+            throw std::invalid_argument("sweep range \"" + spec + "\" never reaches its stop value");
+        // stop is included even when rounding leaves it a hair past the last step
+        size_t n = (size_t)std::floor((stop - start)/step + 1e-9) + 1;
+        for (size_t i = 0; i < n; i++)
+            values.push_back(start + i*step);
+        return values;
+    }
+    boost::split(tokens, spec, boost::is_any_of(","), boost::token_compress_on);
+    for (const std::string &token : tokens){
+        if (not boost::algorithm::trim_copy(token).empty())
+            values.push_back(parse_sweep_value(token, spec));
+    }
+    if (values.empty())
+        throw std::invalid_argument("empty sweep \"" + spec + "\"");
+    return values;
+}
+
+std::vector<sweep_point_t> make_sweep_points(const std::vector<double> &freqs,
+                                             const std::vector<double> &txgains,
+                                             const std::vector<double> &rxgains){
+    std::vector<sweep_point_t> points;
+    for (double freq : freqs){
+        for (double rxgain : rxgains){
+            for (double txgain : txgains){
+                sweep_point_t point;
+                point.freq = freq;
+                point.txgain = txgain;
+                point.rxgain = rxgain;
+                points.push_back(point);
+            }
+        }
+    }
+    return points;
+}
+
+param_sweep::param_sweep(radio_device::sptr device, const sweep_config_t &config, ch_select_t ch_select) :
+    _device(device),
+    _config(config),
+    _ch_select(ch_select),
+    _train(device, config.train, ch_select)
+{
+}
+
+void param_sweep::retune(const sweep_point_t &point, const sweep_point_t *last, const uhd::time_spec_t &time_spec){
+    for (size_t c = RADIO_CHAN_MAIN; c <= RADIO_CHAN_CALIB; c++){
+        bool rx = (c == RADIO_CHAN_MAIN) ? _ch_select.rx0 : _ch_select.rx1;
+        bool tx = (c == RADIO_CHAN_MAIN) ? _ch_select.tx0 : _ch_select.tx1;
+        if (not rx and not tx)
+            continue;
+        _device->set_command_time(c, time_spec);
+        if (last == NULL or last->freq != point.freq)
+            _device->set_freq(c, point.freq);
+        if (rx and (last == NULL or last->rxgain != point.rxgain))
+            _device->set_rx_gain(c, point.rxgain);
+        if (tx and (last == NULL or last->txgain != point.txgain))
+            _device->set_tx_gain(c, point.txgain);
+        _device->clear_command_time(c);
+    }
+}
+
+sweep_point_t param_sweep::read_back(const sweep_point_t &requested){
+    sweep_point_t point = requested;
+    size_t rx_chan = _ch_select.rx0 ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB;
+    size_t tx_chan = _ch_select.tx0 ? RADIO_CHAN_MAIN : RADIO_CHAN_CALIB;
+    if (_ch_select.rx0 or _ch_select.rx1){
+        point.freq = _device->get_freq(rx_chan);
+        point.rxgain = _device->get_rx_gain(rx_chan);
+    }
+    else if (_ch_select.tx0 or _ch_select.tx1){
+        point.freq = _device->get_freq(tx_chan);
+    }
+    if (_ch_select.tx0 or _ch_select.tx1)
+        point.txgain = _device->get_tx_gain(tx_chan);
+    return point;
+}
+
+std::vector<sweep_result_t> param_sweep::run(const std::vector<sweep_point_t> &points,
+                                             const std::vector<const sc16_buffer_t *> &waves,
+                                             pulse_arena::sptr arena,
+                                             const pulse_handler_t &handler){
+    std::vector<sweep_result_t> results;
+    const size_t npulses = _config.train.npulses;
+    for (size_t i = 0; i < points.size(); i++){
+        sweep_result_t result;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // the last train has been received but may still be being written;
+        // the new settings apply at a device time just ahead of now
+        uhd::time_spec_t command_time = _device->get_time_now() + uhd::time_spec_t(_config.lead);
+        retune(points[i], (i > 0) ? &points[i - 1] : NULL, command_time);
+        result.retune_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        result.first_pulse = (uint64_t)i*npulses;
+        result.t0 = command_time + uhd::time_spec_t(_config.settle);
+        // untimed settings (e.g. the N300 LO, tuned over RPC) can take longer
+        // than the settle time to send; the train must not start in the past
+        uhd::time_spec_t earliest = _device->get_time_now() + uhd::time_spec_t(_config.lead);
+        if (result.t0 < earliest)
+            result.t0 = earliest;
+        const uint64_t base = result.first_pulse;
+        result.train = _train.run(result.t0, waves, arena,
+            [&](size_t, pulse_slot *slot){
+                if (slot != NULL)
+                    slot->index += base;
+                handler(i, slot);
+            });
+        result.point = read_back(points[i]);
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::vector<capture_tag_t> capture_tags(const std::vector<sweep_result_t> &results, size_t npulses){
+    std::vector<capture_tag_t> tags;
+    for (const sweep_result_t &result : results){
+        capture_tag_t tag;
+        tag.first_pulse = result.first_pulse;
+        tag.npulses = npulses;
+        tag.freq = result.point.freq;
+        tag.txgain = result.point.txgain;
+        tag.rxgain = result.point.rxgain;
+        tag.time_full_secs = result.t0.get_full_secs();
+        tag.time_frac_secs = result.t0.get_frac_secs();
+        tags.push_back(tag);
+    }
+    return tags;
+}
+
+void print_sweep_results(std::ostream &os, const std::vector<sweep_result_t> &results, double wall_secs){
+    size_t pulses = 0, errors = 0;
+    for (size_t i = 0; i < results.size(); i++){
+        const sweep_result_t &r = results[i];
+        os << boost::format("Sweep point %d: freq %f MHz, txgain %.2f dB, rxgain %.2f dB: %d pulses, %d errors, retune %.3f ms, first pulse at %f")
+            % i % (r.point.freq/1e6) % r.point.txgain % r.point.rxgain % r.train.pulses % r.train.errors
+            % (r.retune_secs*1e3) % r.t0.get_real_secs() << std::endl;
+        pulses += r.train.pulses;
+        errors += r.train.errors;
+    }
+    os << boost::format("Sweep: %d points, %d pulses, %d errors in %f s (%f s per point)")
+        % results.size() % pulses % errors % wall_secs % (results.empty() ? 0.0 : wall_secs/results.size()) << std::endl;
+}
@@ -0,0 +1,83 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_arena.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+pulse_arena::pulse_arena(size_t nslots, size_t slot_samps, bool drop) :
+    _capacity(0),
+    _drop(drop)
+{
+    if (nslots == 0)
+        nslots = 1;
+    std::memset(&_stats, 0, sizeof(_stats));
+
+    // whole pages per slot so every slot starts page aligned and can be
+    // written with O_DIRECT as is; resize() also faults the pages in now
+    size_t per_page = PAGE_SIZE_BYTES/sizeof(std::complex<short>);
+    _capacity = std::max<size_t>(1, (slot_samps + per_page - 1)/per_page)*per_page;
+    _storage.resize(nslots*_capacity);
+
+    _slots.resize(nslots);
+    for (size_t i = 0; i < nslots; i++){
+        pulse_slot &slot = _slots[i];
+        slot.index = 0;
+        slot.channel = 0;
+        slot.wave = 0;
+        slot.nsamps = 0;
+        slot.samps = &_storage[i*_capacity];
+        slot.capacity = _capacity;
+        slot.has_time_spec = false;
+        slot.time_full_secs = 0;
+        slot.time_frac_secs = 0.0;
+        slot.error_code = 0;
+        slot.refs = 0;
+        _free.push_back(&slot);
+    }
+}
+
+pulse_slot *pulse_arena::acquire(void){
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_free.empty()){
+        if (_drop){
+            _stats.dropped++;
+            return NULL;
+        }
+        _stats.blocked++;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _free_cond.wait(lock, [this]{ return not _free.empty(); });
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        _stats.max_block_secs = std::max(_stats.max_block_secs, secs);
+    }
+    pulse_slot *slot = _free.back();
+    _free.pop_back();
+    slot->refs = 1;
+    slot->nsamps = 0;
+    return slot;
+}
+
+void pulse_arena::retain(pulse_slot *slot, size_t refs){
+    std::lock_guard<std::mutex> lock(_mutex);
+    slot->refs += refs;
+}
+
+void pulse_arena::release(pulse_slot *slot){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (slot->refs == 0)
+            throw std::logic_error("pulse_arena: slot released too often");
+        if (--slot->refs > 0)
+            return;
+        _free.push_back(slot);
+    }
+    _free_cond.notify_one();
+}
+
+pulse_arena_stats_t pulse_arena::get_stats(void){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
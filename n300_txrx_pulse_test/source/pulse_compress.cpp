@@ -0,0 +1,124 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_compress.hpp"
+#include "sample_convert.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+static size_t default_fft_size(size_t ref_size, size_t nsamps){
+    return next_pow2(std::max<size_t>(2, std::min(4*ref_size, nsamps + ref_size - 1)));
+}
+
+pulse_compressor::pulse_compressor(const sc16_buffer_t &ref, size_t nsamps, size_t fft_size) :
+    _ref_size(ref.size()),
+    _plan(fft_size ? fft_size : default_fft_size(ref.size(), nsamps))
+{
+    if (ref.empty())
+        throw std::invalid_argument("pulse_compressor: empty waveform");
+    if (_plan.size() < _ref_size)
+        throw std::invalid_argument("pulse_compressor: FFT shorter than the waveform");
+    size_t m = _plan.size();
+    _ref_spectrum.assign(m, fc32_t(0.0f, 0.0f));
+    convert_sc16(&ref.front(), &_ref_spectrum.front(), _ref_size, false);
+    double energy = 0.0;
+    for (size_t i = 0; i < _ref_size; i++)
+        energy += std::norm(std::complex<double>(_ref_spectrum[i]));
+    if (energy == 0.0)
+        throw std::invalid_argument("pulse_compressor: all-zero waveform");
+    _plan.forward(&_ref_spectrum.front());
+    const float scale = (float)(1.0/energy);
+    for (fc32_t &v : _ref_spectrum)
+        v *= scale;
+    _work.resize(m);
+}
+
+void pulse_compressor::compress(const std::complex<short> *in, size_t n, fc32_t *out){
+    const size_t m = _plan.size();
+    // circular correlation lags 0..m-ref_size don't wrap around
+    const size_t step = m - _ref_size + 1;
+    fc32_t *work = &_work.front();
+    for (size_t s = 0; s < n; s += step){
+        size_t len = std::min(m, n - s);
+        convert_sc16(in + s, work, len, false);
+        if (len < m)
+            std::fill(work + len, work + m, fc32_t(0.0f, 0.0f));
+        _plan.forward(work);
+        complex_multiply_conj(work, &_ref_spectrum.front(), work, m);
+        _plan.inverse(work);
+        std::memcpy((void *)(out + s), work, std::min(step, n - s)*sizeof(fc32_t));
+    }
+}
+
+compress_sink::compress_sink(const std::vector<const sc16_buffer_t *> &waves, size_t nsamps,
+                             pulse_sink::sptr raw, boost::shared_ptr<capture_file_sink> profiles) :
+    _raw(raw),
+    _profiles(profiles)
+{
+    if (waves.empty())
+        throw std::runtime_error("compress_sink: no TX waveform");
+    // the same waveform sent on several pulses shares one reference spectrum
+    for (size_t i = 0; i < waves.size(); i++){
+        size_t same = std::find(waves.begin(), waves.end(), waves[i]) - waves.begin();
+        if (same < i)
+            _compressors.push_back(_compressors[same]);
+        else
+            _compressors.push_back(boost::shared_ptr<pulse_compressor>(new pulse_compressor(*waves[i], nsamps)));
+    }
+    // page padded, so the profile capture can be written with O_DIRECT
+    size_t page_samps = PAGE_SIZE_BYTES/sizeof(fc32_t);
+    _profile.resize((nsamps + page_samps - 1)/page_samps*page_samps);
+    std::memset(&_stats, 0, sizeof(_stats));
+    _stats.peak_db_min = std::numeric_limits<double>::infinity();
+    _stats.peak_db_max = -std::numeric_limits<double>::infinity();
+}
+
+void compress_sink::write(const pulse_slot &slot){
+    if (_raw)
+        _raw->write(slot);
+    size_t n = std::min(slot.nsamps, _profile.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _compressors[slot.wave % _compressors.size()]->compress(slot.samps, n, &_profile.front());
+    _stats.compress_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (n > 0){
+        size_t peak = 0;
+        float peak_pow = 0.0f;
+        for (size_t k = 0; k < n; k++){
+            float p = std::norm(_profile[k]);
+            if (p > peak_pow){
+                peak_pow = p;
+                peak = k;
+            }
+        }
+        double peak_db = 10.0*std::log10(std::max(peak_pow, 1e-30f));
+        _stats.peak_db_min = std::min(_stats.peak_db_min, peak_db);
+        _stats.peak_db_max = std::max(_stats.peak_db_max, peak_db);
+        _stats.peak_db_sum += peak_db;
+        _stats.last_peak_bin = peak;
+        _stats.pulses++;
+    }
+    _profiles->append(slot, &_profile.front(), n);
+}
+
+void compress_sink::close(void){
+    if (_raw)
+        _raw->close();
+    _profiles->close();
+}
+
+void print_compress_stats(std::ostream &os, const pulse_compress_stats_t &stats){
+    if (stats.pulses == 0){
+        os << "Pulse compression: no pulses" << std::endl;
+        return;
+    }
+    os << boost::format("Pulse compression: %d pulses in %f ms each, peak %f dB (min %f, max %f) rel. TX waveform, last peak in range bin %d")
+        % stats.pulses % (stats.compress_secs/stats.pulses*1e3) % (stats.peak_db_sum/stats.pulses)
+        % stats.peak_db_min % stats.peak_db_max % stats.last_peak_bin << std::endl;
+}
@@ -0,0 +1,372 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_server.hpp"
+#include "capture_file.hpp"
+#include "pulse_writer.hpp"
+#include "waveform_synth.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+// longest job or reply line accepted
+static const size_t MAX_LINE_LEN = 65536;
+
+template <typename T>
+static T parse_value(const std::string &key, const std::string &value){
+    try {
+        return boost::lexical_cast<T>(value);
+    }
+    catch (boost::bad_lexical_cast &){
+        throw std::invalid_argument("bad value \"" + value + "\" for " + key);
+    }
+}
+
+pulse_job_t parse_pulse_job(const std::string &line, const pulse_job_t &defaults){
+    pulse_job_t job = defaults;
+    std::vector<std::string> tokens;
+    std::string trimmed = boost::algorithm::trim_copy(line);
+    if (trimmed.empty())
+        return job;
+    boost::split(tokens, trimmed, boost::is_any_of(" \t"), boost::token_compress_on);
+    for (const std::string &token : tokens){
+        size_t eq = token.find('=');
+        if (eq == std::string::npos)
+            throw std::invalid_argument("expected key=value, got \"" + token + "\"");
+        std::string key = token.substr(0, eq), value = token.substr(eq + 1);
+        if (key == "freq") job.freq = parse_value<double>(key, value);
+        else if (key == "txgain") job.txgain = parse_value<double>(key, value);
+        else if (key == "rxgain") job.rxgain = parse_value<double>(key, value);
+        else if (key == "ch_rx") job.ch_rx = parse_value<int>(key, value);
+        else if (key == "ch_tx") job.ch_tx = parse_value<int>(key, value);
+        else if (key == "nsamps") job.nsamps = parse_value<size_t>(key, value);
+        else if (key == "npulses") job.npulses = parse_value<size_t>(key, value);
+        else if (key == "pri") job.pri = parse_value<double>(key, value);
+        else if (key == "depth") job.depth = parse_value<size_t>(key, value);
+        else if (key == "secs") job.secs = parse_value<double>(key, value);
+        else if (key == "file") job.file = value;
+        else if (key == "wavefile"){
+            job.wavefiles.clear();
+            boost::split(job.wavefiles, value, boost::is_any_of(","), boost::token_compress_on);
+        }
+        else
+            throw std::invalid_argument("unknown job key \"" + key + "\"");
+    }
+    if (job.ch_rx < -1 or job.ch_rx > 2 or job.ch_tx < -1 or job.ch_tx > 1)
+        throw std::invalid_argument("bad channel select");
+    if (job.nsamps == 0 or job.npulses == 0)
+        throw std::invalid_argument("nsamps and npulses must be non-zero");
+    if (job.wavefiles.empty())
+        throw std::invalid_argument("no wavefile");
+    return job;
+}
+
+/***********************************************************************
+ * socket helpers
+ **********************************************************************/
+static void send_all(int fd, const void *data, size_t nbytes){
+    const char *p = static_cast<const char *>(data);
+    while (nbytes > 0){
+        ssize_t n = ::send(fd, p, nbytes, MSG_NOSIGNAL);
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::string("socket send failed: ") + strerror(errno));
+        }
+        p += n;
+        nbytes -= (size_t)n;
+    }
+}
+
+static void send_line(int fd, const std::string &line){
+    std::string out = line + "\n";
+    send_all(fd, out.data(), out.size());
+}
+
+// returns false if the peer closed the connection before a full line
+static bool read_line(int fd, std::string &line){
+    line.clear();
+    char c;
+    while (line.size() < MAX_LINE_LEN){
+        ssize_t n = ::recv(fd, &c, 1, 0);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        if (c == '\n')
+            return true;
+        line.push_back(c);
+    }
+    throw std::runtime_error("line too long");
+}
+
+static sockaddr_un socket_address(const std::string &path){
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path too long: " + path);
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+/***********************************************************************
+ * samples sent back over the socket
+ **********************************************************************/
+class memory_sink : public pulse_sink
+{
+public:
+    memory_sink(size_t npulses, const ch_select_t &ch_select, size_t nsamps) :
+        _nchans(ch_select.rx0 + ch_select.rx1),
+        _nsamps(nsamps)
+    {
+        // rx1 comes second when both channels are received
+        _chan_pos[RADIO_CHAN_MAIN] = 0;
+        _chan_pos[RADIO_CHAN_CALIB] = ch_select.rx0 ? 1 : 0;
+        _samps.resize(npulses*_nchans*nsamps);
+    }
+
+    void write(const pulse_slot &slot){
+        size_t pos = (slot.index*_nchans + _chan_pos[slot.channel % 2])*_nsamps;
+        if (pos + _nsamps > _samps.size())
+            throw std::runtime_error("memory_sink: pulse out of range");
+        std::copy(slot.samps, slot.samps + std::min(slot.nsamps, _nsamps), _samps.begin() + pos);
+    }
+
+    size_t nchans(void) const { return _nchans; }
+    const std::vector<std::complex<short>> &samps(void) const { return _samps; }
+
+private:
+    size_t _nchans;
+    size_t _nsamps;
+    size_t _chan_pos[2];
+    std::vector<std::complex<short>> _samps;
+};
+
+/***********************************************************************
+ * pulse_server
+ **********************************************************************/
+pulse_server::pulse_server(radio_device::sptr device, const pulse_server_config_t &config, const pulse_job_t &defaults) :
+    _device(device),
+    _config(config),
+    _defaults(defaults),
+    _listen_fd(-1)
+{
+    // the settings usrpInit() leaves the radio with
+    for (size_t c = 0; c < 2; c++){
+        _freq[c] = defaults.freq;
+        _rx_gain[c] = defaults.rxgain;
+        _tx_gain[c] = (c == RADIO_CHAN_MAIN) ? defaults.txgain : 0.0;
+    }
+
+    sockaddr_un addr = socket_address(config.socket_path);
+    // replace a stale socket of an earlier run, but never anything else
+    struct stat st;
+    if (lstat(config.socket_path.c_str(), &st) == 0){
+        if (not S_ISSOCK(st.st_mode))
+            throw std::runtime_error(config.socket_path + " exists and is not a socket");
+        unlink(config.socket_path.c_str());
+    }
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listen_fd < 0)
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    if (bind(_listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 or listen(_listen_fd, 4) != 0){
+        int e = errno;
+        ::close(_listen_fd);
+        throw std::runtime_error("could not listen on " + config.socket_path + ": " + strerror(e));
+    }
+}
+
+pulse_server::~pulse_server(void){
+    if (_listen_fd >= 0){
+        ::close(_listen_fd);
+        unlink(_config.socket_path.c_str());
+    }
+}
+
+void pulse_server::apply_settings(const pulse_job_t &job, const ch_select_t &ch_select){
+    for (size_t c = 0; c < 2; c++){
+        if (_freq[c] != job.freq){
+            _device->set_freq(c, job.freq);
+            _freq[c] = job.freq;
+        }
+        bool rx = (c == RADIO_CHAN_MAIN) ? ch_select.rx0 : ch_select.rx1;
+        bool tx = (c == RADIO_CHAN_MAIN) ? ch_select.tx0 : ch_select.tx1;
+        if (rx and _rx_gain[c] != job.rxgain){
+            _device->set_rx_gain(c, job.rxgain);
+            _rx_gain[c] = job.rxgain;
+        }
+        if (tx and _tx_gain[c] != job.txgain){
+            _device->set_tx_gain(c, job.txgain);
+            _tx_gain[c] = job.txgain;
+        }
+    }
+}
+
+void pulse_server::run_job(int fd, const pulse_job_t &job){
+    ch_select_t ch_select = make_ch_select(job.ch_rx, job.ch_tx);
+    apply_settings(job, ch_select);
+
+    std::vector<const sc16_buffer_t *> wave_sequence;
+    for (const std::string &wf : job.wavefiles)
+        wave_sequence.push_back(&cache_waveform(_waves, wf, _device->get_rate()));
+
+    double rate = _device->get_rate();
+    pulse_train_config_t train_config = _config.train;
+    train_config.npulses = job.npulses;
+    train_config.nsamps = job.nsamps;
+    train_config.depth = job.depth;
+    train_config.pri = job.pri;
+    if (train_config.pri <= 0.0){
+        size_t longest = job.nsamps;
+        for (const sc16_buffer_t *w : wave_sequence)
+            longest = std::max(longest, w->size());
+        train_config.pri = longest/rate + 100e-6;
+    }
+
+    size_t nrx = std::max(1, ch_select.rx0 + ch_select.rx1);
+    pulse_arena::sptr arena(new pulse_arena(std::max(_config.slots, nrx), job.nsamps, false));
+    pulse_sink::sptr sink;
+    boost::shared_ptr<memory_sink> samples;
+    if (not job.file.empty()){
+        capture_header_t header = make_capture_header();
+        header.rate = rate;
+        header.freq = job.freq;
+        header.txgain = job.txgain;
+        header.rxgain = job.rxgain;
+        header.rx_channels = (ch_select.rx0 ? 0x1 : 0) | (ch_select.rx1 ? 0x2 : 0);
+        header.tx_channels = (ch_select.tx0 ? 0x1 : 0) | (ch_select.tx1 ? 0x2 : 0);
+        header.waveform_hash = capture_waveform_hash(wave_sequence);
+        sink.reset(new capture_file_sink(job.file, header, false, false, 0));
+    }
+    else {
+        samples.reset(new memory_sink(job.npulses, ch_select, job.nsamps));
+        sink = samples;
+    }
+
+    pulse_writer writer(sink, arena);
+    pulse_train train(_device, train_config, ch_select);
+    pulse_train_stats_t stats = train.run(_device->get_time_now() + uhd::time_spec_t(job.secs), wave_sequence, arena,
+        [&](size_t, pulse_slot *slot){
+            if (slot != NULL)
+                writer.submit(slot);
+        });
+    writer.close();
+    pulse_writer_stats_t wstats = writer.get_stats();
+    if (wstats.write_errors > 0)
+        throw std::runtime_error(str(boost::format("%d pulses could not be written") % wstats.write_errors));
+
+    std::cout << boost::format("Job done: %d pulses, %d errors, %f s") % stats.pulses % stats.errors % stats.wall_secs << std::endl;
+    if (samples){
+        size_t nbytes = samples->samps().size()*sizeof(std::complex<short>);
+        send_line(fd, str(boost::format("OK npulses=%d nchans=%d nsamps=%d errors=%d bytes=%d")
+            % job.npulses % samples->nchans() % job.nsamps % stats.errors % nbytes));
+        if (nbytes > 0)
+            send_all(fd, samples->samps().data(), nbytes);
+    }
+    else {
+        send_line(fd, str(boost::format("OK file=%s npulses=%d errors=%d") % job.file % job.npulses % stats.errors));
+    }
+}
+
+void pulse_server::serve_client(int fd, bool &quit){
+    std::string line;
+    if (not read_line(fd, line))
+        return;
+    boost::algorithm::trim(line);
+    if (line == "quit"){
+        send_line(fd, "OK");
+        quit = true;
+        return;
+    }
+    if (line == "ping"){
+        send_line(fd, "OK");
+        return;
+    }
+    std::cout << "Job: " << line << std::endl;
+    try {
+        run_job(fd, parse_pulse_job(line, _defaults));
+    }
+    catch (std::exception &e){
+        std::cerr << "Job failed: " << e.what() << std::endl;
+        send_line(fd, std::string("ERROR ") + e.what());
+    }
+}
+
+void pulse_server::run(void){
+    std::cout << "Serving pulse jobs on " << _config.socket_path << std::endl;
+    bool quit = false;
+    while (not quit){
+        int fd = accept(_listen_fd, NULL, NULL);
+        if (fd < 0){
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::string("accept: ") + strerror(errno));
+        }
+        try {
+            serve_client(fd, quit);
+        }
+        catch (std::exception &e){
+            // the client went away; keep serving
+            std::cerr << "Client error: " << e.what() << std::endl;
+        }
+        ::close(fd);
+    }
+    std::cout << "Server stopped" << std::endl;
+}
+
+/***********************************************************************
+ * client
+ **********************************************************************/
+std::string pulse_server_request(const std::string &socket_path, const std::string &job, const std::string &fname){
+    sockaddr_un addr = socket_address(socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    try {
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+            throw std::runtime_error("could not connect to " + socket_path + ": " + strerror(errno));
+        send_line(fd, job);
+        std::string reply;
+        if (not read_line(fd, reply))
+            throw std::runtime_error("server closed the connection");
+
+        size_t nbytes = 0;
+        size_t pos = reply.find(" bytes=");
+        if (boost::algorithm::starts_with(reply, "OK") and pos != std::string::npos)
+            nbytes = boost::lexical_cast<size_t>(reply.substr(pos + 7));
+        if (nbytes > 0){
+            std::ofstream file(fname.c_str(), std::ofstream::binary);
+            if (not file.is_open())
+                throw std::runtime_error("Could not open file " + fname);
+            std::vector<char> buff(1 << 16);
+            while (nbytes > 0){
+                ssize_t n = ::recv(fd, buff.data(), std::min(nbytes, buff.size()), 0);
+                if (n < 0 and errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error("server closed the connection mid reply");
+                file.write(buff.data(), n);
+                nbytes -= (size_t)n;
+            }
+        }
+        ::close(fd);
+        return reply;
+    }
+    catch (...){
+        ::close(fd);
+        throw;
+    }
+}
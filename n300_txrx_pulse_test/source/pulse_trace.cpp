@@ -0,0 +1,178 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_trace.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+static const char *STAGE_NAMES[TRACE_NUM_STAGES] = {"send", "stream_cmd", "recv", "write"};
+
+// uhd::rx_metadata_t::error_code_t values, spelled out so the host side
+// code (and the benchmarks) build without UHD
+static std::string error_name(uint32_t error_code){
+    switch (error_code){
+    case 0x0: return "none";
+    case 0x1: return "timeout";
+    case 0x2: return "late_command";
+    case 0x4: return "broken_chain";
+    case 0x8: return "overflow";
+    case 0xc: return "alignment";
+    case 0xf: return "bad_packet";
+    default: return str(boost::format("0x%x") % error_code);
+    }
+}
+
+pulse_trace::pulse_trace(size_t npulses) :
+    _origin(std::chrono::steady_clock::now()),
+    _npulses(npulses)
+{
+    pulse_trace_record_t empty;
+    std::fill(empty.start_ns, empty.start_ns + TRACE_NUM_STAGES, 0);
+    std::fill(empty.dur_ns, empty.dur_ns + TRACE_NUM_STAGES, -1);
+    empty.received = false;
+    empty.has_time_error = false;
+    empty.time_error = 0;
+    empty.error_code = 0;
+    _records.assign(npulses*TRACE_MAX_CHANS, empty);
+}
+
+pulse_trace_record_t *pulse_trace::record(size_t pulse, size_t chan){
+    if (pulse >= _npulses or chan >= TRACE_MAX_CHANS)
+        return NULL;
+    return &_records[pulse*TRACE_MAX_CHANS + chan];
+}
+
+void pulse_trace::stage(size_t pulse, size_t chan, trace_stage_t stage, int64_t start_ns){
+    int64_t end_ns = now_ns();
+    pulse_trace_record_t *r = record(pulse, chan);
+    if (r == NULL)
+        return;
+    r->start_ns[stage] = start_ns;
+    r->dur_ns[stage] = end_ns - start_ns;
+}
+
+void pulse_trace::rx_result(size_t pulse, size_t chan, uint32_t error_code, bool has_time_error, int64_t time_error){
+    pulse_trace_record_t *r = record(pulse, chan);
+    if (r == NULL)
+        return;
+    r->received = true;
+    r->error_code = error_code;
+    r->has_time_error = has_time_error;
+    r->time_error = time_error;
+}
+
+// value at quantile q of sorted values
+static int64_t quantile(const std::vector<int64_t> &sorted, double q){
+    size_t i = (size_t)(q*(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void pulse_trace::report(std::ostream &out) const {
+    out << "Pulse timing (us):" << std::endl;
+    for (size_t s = 0; s < TRACE_NUM_STAGES; s++){
+        std::vector<int64_t> durs;
+        for (const pulse_trace_record_t &r : _records)
+            if (r.dur_ns[s] >= 0)
+                durs.push_back(r.dur_ns[s]);
+        if (durs.empty())
+            continue;
+        std::sort(durs.begin(), durs.end());
+        out << boost::format("  %-10s n=%-7d p50 %10.1f  p99 %10.1f  max %10.1f")
+            % STAGE_NAMES[s] % durs.size() % (quantile(durs, 0.5)/1e3)
+            % (quantile(durs, 0.99)/1e3) % (durs.back()/1e3) << std::endl;
+
+        // log2 buckets in us: [0,1) [1,2) [2,4) ...
+        std::map<int, size_t> buckets;
+        for (int64_t d : durs){
+            int b = 0;
+            for (int64_t us = d/1000; us > 0; us >>= 1)
+                b++;
+            buckets[b]++;
+        }
+        std::string hist;
+        for (const std::pair<const int, size_t> &b : buckets)
+            hist += str(boost::format(" <%dus:%d") % (1LL << b.first) % b.second);
+        out << "            " << hist << std::endl;
+    }
+
+    std::vector<int64_t> errs;
+    std::map<uint32_t, size_t> codes;
+    for (const pulse_trace_record_t &r : _records){
+        if (not r.received)
+            continue;
+        codes[r.error_code]++;
+        if (r.has_time_error)
+            errs.push_back(std::llabs(r.time_error));
+    }
+    if (not errs.empty()){
+        std::sort(errs.begin(), errs.end());
+        out << boost::format("  |RX time - requested time| (samples): p50 %d  p99 %d  max %d")
+            % quantile(errs, 0.5) % quantile(errs, 0.99) % errs.back() << std::endl;
+    }
+    if (not codes.empty()){
+        out << "  RX error codes:";
+        for (const std::pair<const uint32_t, size_t> &c : codes)
+            out << " " << error_name(c.first) << "=" << c.second;
+        out << std::endl;
+    }
+}
+
+void pulse_trace::write(const std::string &fname) const {
+    std::ofstream file(fname.c_str());
+    if (not file.is_open())
+        throw std::runtime_error("Could not open file " + fname);
+    bool json = boost::algorithm::iends_with(fname, ".json");
+    if (json)
+        file << "[" << std::endl;
+    else {
+        file << "pulse,channel";
+        for (size_t s = 0; s < TRACE_NUM_STAGES; s++)
+            file << "," << STAGE_NAMES[s] << "_start_ns," << STAGE_NAMES[s] << "_ns";
+        file << ",time_error,error" << std::endl;
+    }
+    bool first = true;
+    for (size_t i = 0; i < _records.size(); i++){
+        const pulse_trace_record_t &r = _records[i];
+        bool used = r.received;
+        for (size_t s = 0; s < TRACE_NUM_STAGES; s++)
+            used = used or r.dur_ns[s] >= 0;
+        if (not used)
+            continue;
+        size_t pulse = i/TRACE_MAX_CHANS, chan = i % TRACE_MAX_CHANS;
+        if (json){
+            file << (first ? "" : ",\n") << "  {\"pulse\": " << pulse << ", \"channel\": " << chan;
+            for (size_t s = 0; s < TRACE_NUM_STAGES; s++){
+                if (r.dur_ns[s] >= 0)
+                    file << ", \"" << STAGE_NAMES[s] << "_start_ns\": " << r.start_ns[s]
+                         << ", \"" << STAGE_NAMES[s] << "_ns\": " << r.dur_ns[s];
+            }
+            if (r.has_time_error)
+                file << ", \"time_error\": " << r.time_error;
+            if (r.received)
+                file << ", \"error\": \"" << error_name(r.error_code) << "\"";
+            file << "}";
+        }
+        else {
+            file << pulse << "," << chan;
+            for (size_t s = 0; s < TRACE_NUM_STAGES; s++){
+                if (r.dur_ns[s] >= 0)
+                    file << "," << r.start_ns[s] << "," << r.dur_ns[s];
+                else
+                    file << ",,";
+            }
+            file << ",";
+            if (r.has_time_error)
+                file << r.time_error;
+            file << "," << (r.received ? error_name(r.error_code) : "") << std::endl;
+        }
+        first = false;
+    }
+    if (json)
+        file << std::endl << "]" << std::endl;
+}
@@ -0,0 +1,377 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_train.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <thread>
+#include <stdexcept>
+
+pulse_train::pulse_train(radio_device::sptr device, const pulse_train_config_t &config, ch_select_t ch_select) :
+    _device(device),
+    _config(config),
+    _tx_chan(RADIO_CHAN_MAIN),
+    _trace(NULL),
+    _rate(device->get_rate()),
+    _t0_ticks(0),
+    _max_gap(0.0),
+    _first_timeout(0.0),
+    _abort(false),
+    _scheduled(0)
+{
+    if (ch_select.tx1==1 and ch_select.tx0!=1)
+        _tx_chan = RADIO_CHAN_CALIB;
+    if (ch_select.tx0==1 or ch_select.tx1==1)
+        _tx_stream = _device->get_tx_stream(_tx_chan);
+    if (ch_select.rx0==1)
+        _rx_chans.push_back(RADIO_CHAN_MAIN);
+    if (ch_select.rx1==1)
+        _rx_chans.push_back(RADIO_CHAN_CALIB);
+    stream_formats_t formats = _device->get_stream_formats();
+    for (size_t chan : _rx_chans){
+        _rx_sample_bytes.push_back(sample_size(formats.rx[chan].cpu));
+        _rx_streams.push_back(_device->get_rx_stream(chan));
+        if (not _rx_streams.back())
+            throw std::runtime_error(str(boost::format("pulse_train: device has no RX channel %d") % chan));
+    }
+    if (_config.depth == 0)
+        _config.depth = 1;
+}
+
+std::vector<double> load_pulse_schedule(const std::string &fname){
+    std::ifstream file(fname.c_str());
+    if (not file.is_open())
+        throw std::runtime_error("Could not open schedule " + fname);
+    std::vector<double> offsets;
+    std::string line;
+    for (size_t lineno = 1; std::getline(file, line); lineno++){
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        boost::algorithm::trim(line);
+        if (line.empty())
+            continue;
+        double offset;
+        try {
+            offset = boost::lexical_cast<double>(line);
+        }
+        catch (boost::bad_lexical_cast &){
+            throw std::runtime_error(str(boost::format("%s:%d: \"%s\" is not a time in seconds") % fname % lineno % line));
+        }
+        if (offset < 0.0 or (not offsets.empty() and offset <= offsets.back()))
+            throw std::runtime_error(str(boost::format("%s:%d: pulse times must be increasing from 0") % fname % lineno));
+        offsets.push_back(offset);
+    }
+    return offsets;
+}
+
+void set_slot_metadata(pulse_slot &slot, const uhd::rx_metadata_t &md){
+    slot.has_time_spec = md.has_time_spec;
+    slot.time_full_secs = md.time_spec.get_full_secs();
+    slot.time_frac_secs = md.time_spec.get_frac_secs();
+    slot.error_code = md.error_code;
+}
+
+size_t recv_pulse(uhd::rx_streamer::sptr rx_stream, void *buff, size_t nsamps, size_t sample_bytes,
+                  long long start_tick, double rate, uhd::rx_metadata_t &md, double timeout,
+                  rx_carry_t &carry){
+    md.reset();
+    char *out = static_cast<char *>(buff);
+    const long long end_tick = start_tick + (long long)nsamps;
+    long long next_tick = start_tick;
+    size_t num_rx_samps = 0;
+    // once samples are lost the rest of the burst is drained, never stored
+    bool broken = false;
+    bool done = false;
+    carry.samps.resize(nsamps*sample_bytes);
+    while (not done and (broken or num_rx_samps < nsamps)){
+        uhd::rx_metadata_t md_chunk;
+        char *chunk;
+        size_t n;
+        bool carried = carry.pending;
+        if (carried){
+            chunk = &carry.samps.front();
+            n = carry.nsamps;
+            md_chunk = carry.md;
+            carry.pending = false;
+        }
+        else {
+            chunk = broken ? &carry.samps.front() : out + num_rx_samps*sample_bytes;
+            n = rx_stream->recv(chunk, broken ? nsamps : nsamps - num_rx_samps, md_chunk, timeout);
+        }
+
+        if (md_chunk.has_time_spec){
+            long long tick = md_chunk.time_spec.to_ticks(rate);
+            // an overflow is stamped with the time the samples resume at,
+            // so it belongs with the last sample lost
+            if (n == 0 and md_chunk.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW)
+                tick--;
+            if (tick >= end_tick){
+                // the burst ended early: these samples (or this error) are a later pulse's
+                if (chunk != &carry.samps.front())
+                    std::memcpy(&carry.samps.front(), chunk, n*sample_bytes);
+                carry.nsamps = n;
+                carry.md = md_chunk;
+                carry.pending = true;
+                break;
+            }
+            if (tick < start_tick and tick + (long long)n <= start_tick){
+                // the late tail of an earlier pulse
+                continue;
+            }
+            if (n > 0 and tick != next_tick)
+                broken = true;
+        }
+        if (n > 0 and not broken){
+            if (carried)
+                std::memcpy(out + num_rx_samps*sample_bytes, chunk, n*sample_bytes);
+            if (num_rx_samps == 0){
+                md.has_time_spec = md_chunk.has_time_spec;
+                md.time_spec = md_chunk.time_spec;
+                md.start_of_burst = md_chunk.start_of_burst;
+            }
+            num_rx_samps += n;
+            next_tick += (long long)n;
+        }
+        if (md_chunk.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_NONE)
+                md.error_code = md_chunk.error_code;
+            switch (md_chunk.error_code){
+            case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT:
+            case uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND:
+                // nothing more is coming for this command; samples that
+                // still turn up are dropped by their time by the next pulse
+                done = true;
+                break;
+            default:
+                broken = true;
+            }
+        }
+        if (md_chunk.end_of_burst){
+            md.end_of_burst = true;
+            done = true;
+        }
+    }
+    return num_rx_samps;
+}
+
+uhd::time_spec_t pulse_train::pulse_time(size_t k) const {
+    double offset = _config.offsets.empty() ? k*_config.pri : _config.offsets[k];
+    return uhd::time_spec_t::from_ticks(_t0_ticks + std::llround(offset*_rate), _rate);
+}
+
+void pulse_train::schedule(size_t k, const std::vector<const sc16_buffer_t *> &waves){
+    uhd::time_spec_t time_spec = pulse_time(k);
+    if (_tx_worker){
+        _tx_worker->send(waves[k % waves.size()], time_spec, k);
+    }
+    else if (_tx_stream){
+        const sc16_buffer_t &wave = *waves[k % waves.size()];
+        uhd::tx_metadata_t md_tx;
+        md_tx.start_of_burst = true;
+        md_tx.end_of_burst = true;
+        md_tx.has_time_spec = true;
+        md_tx.time_spec = time_spec;
+        int64_t start = _trace ? _trace->now_ns() : 0;
+        _tx_stream->send(&wave.front(), wave.size(), md_tx);
+        if (_trace)
+            _trace->stage(k, _tx_chan, TRACE_SEND, start);
+    }
+    // the same timed command on every channel keeps them sample aligned
+    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
+    stream_cmd.num_samps = _config.nsamps;
+    stream_cmd.time_spec = time_spec;
+    stream_cmd.stream_now = false;
+    for (size_t c = 0; c < _rx_streams.size(); c++){
+        int64_t start = _trace ? _trace->now_ns() : 0;
+        _rx_streams[c]->issue_stream_cmd(stream_cmd);
+        if (_trace)
+            _trace->stage(k, _rx_chans[c], TRACE_STREAM_CMD, start);
+    }
+}
+
+void pulse_train::pulse_received(size_t k, size_t num_rx_samps, const uhd::rx_metadata_t &md,
+                                 const std::vector<const sc16_buffer_t *> &waves,
+                                 pulse_train_stats_t &stats){
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // no channel can get more than depth pulses ahead of another, since
+    // pulse k + depth is only scheduled once every channel has pulse k
+    size_t ring = k % _config.depth;
+    long long tick = md.has_time_spec ? md.time_spec.to_ticks(_rate) : -1;
+    if (_arrived[ring] == 0){
+        _first_tick[ring] = tick;
+        _failed[ring] = false;
+        _short[ring] = false;
+    }
+    else if (tick >= 0 and _first_tick[ring] >= 0 and tick != _first_tick[ring]){
+        long long skew = std::llabs(tick - _first_tick[ring]);
+        if (_arrived[ring] == 1)
+            stats.misaligned++;
+        stats.max_skew = std::max(stats.max_skew, skew);
+    }
+    _failed[ring] = _failed[ring] or md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE;
+    _short[ring] = _short[ring] or num_rx_samps < _config.nsamps;
+    if (++_arrived[ring] < _rx_streams.size())
+        return;
+    _arrived[ring] = 0;
+    // a pulse counts once, when every channel has it
+    stats.pulses++;
+    if (_failed[ring])
+        stats.errors++;
+    if (_short[ring])
+        stats.short_pulses++;
+    if (_scheduled < _config.npulses)
+        schedule(_scheduled++, waves);
+}
+
+void pulse_train::receive_pulses(size_t chan_idx, const std::vector<const sc16_buffer_t *> &waves,
+                                 pulse_arena::sptr arena, const pulse_handler_t &handler,
+                                 pulse_train_stats_t &stats){
+    uhd::rx_streamer::sptr rx_stream = _rx_streams[chan_idx];
+    size_t sample_bytes = _rx_sample_bytes[chan_idx];
+    double timeout = _first_timeout;
+    // only used to drain the stream when the arena drops a pulse
+    std::vector<std::complex<short>> scratch;
+    rx_carry_t carry;
+    carry.pending = false;
+    for (size_t k = 0; k < _config.npulses and not _abort; k++){
+        pulse_slot *slot = arena->acquire();
+        std::complex<short> *buff = slot ? slot->samps : NULL;
+        if (slot == NULL){
+            scratch.resize(slot_samps(_config.nsamps, sample_bytes));
+            buff = &scratch.front();
+        }
+        uhd::rx_metadata_t md;
+        int64_t start = _trace ? _trace->now_ns() : 0;
+        size_t num_rx_samps = recv_pulse(rx_stream, buff, _config.nsamps, sample_bytes,
+                                         pulse_time(k).to_ticks(_rate), _rate, md, timeout, carry);
+        if (_trace){
+            _trace->stage(k, _rx_chans[chan_idx], TRACE_RECV, start);
+            _trace->rx_result(k, _rx_chans[chan_idx], md.error_code, md.has_time_spec,
+                              md.time_spec.to_ticks(_rate) - pulse_time(k).to_ticks(_rate));
+        }
+        // refill the queue before handing the pulse off
+        pulse_received(k, num_rx_samps, md, waves, stats);
+        // after the first pulse the queue ahead is what bounds the wait
+        timeout = _config.depth*_max_gap + _config.nsamps/_rate + _config.rx_timeout;
+
+        if (slot){
+            slot->index = k;
+            slot->channel = _rx_chans[chan_idx];
+            slot->wave = k % waves.size();
+            slot->nsamps = num_rx_samps;
+            set_slot_metadata(*slot, md);
+        }
+        handler(k, slot);
+    }
+}
+
+pulse_train_stats_t pulse_train::run(const uhd::time_spec_t &t0,
+                                     const std::vector<const sc16_buffer_t *> &waves,
+                                     pulse_arena::sptr arena,
+                                     const pulse_handler_t &handler){
+    pulse_train_stats_t stats = {0, 0, 0, 0, 0, 0.0};
+    if (waves.empty())
+        throw std::runtime_error("pulse_train: no TX waveform");
+    size_t longest = 0;
+    for (const sc16_buffer_t *w : waves)
+        longest = std::max(longest, w->size());
+    if (not _config.offsets.empty() and _config.offsets.size() < _config.npulses)
+        throw std::runtime_error(str(boost::format("pulse_train: schedule has %d pulses, %d requested")
+            % _config.offsets.size() % _config.npulses));
+    // the shortest gap between pulses, in ticks, has to fit a whole pulse
+    long long min_gap = std::llround(_config.pri*_rate);
+    _max_gap = _config.pri;
+    if (not _config.offsets.empty()){
+        min_gap = -1;
+        _max_gap = 0.0;
+        for (size_t k = 1; k < _config.npulses; k++){
+            long long gap = std::llround(_config.offsets[k]*_rate) - std::llround(_config.offsets[k-1]*_rate);
+            if (min_gap < 0 or gap < min_gap)
+                min_gap = gap;
+            _max_gap = std::max(_max_gap, _config.offsets[k] - _config.offsets[k-1]);
+        }
+    }
+    if (min_gap >= 0 and min_gap < (long long)std::max(_config.nsamps, longest)){
+        throw std::runtime_error(str(boost::format(
+            "pulse_train: %s of %d samples is shorter than the pulse (%d RX, %d TX samples)")
+            % (_config.offsets.empty() ? "PRI" : "schedule gap") % min_gap % _config.nsamps % longest));
+    }
+    for (size_t sample_bytes : _rx_sample_bytes){
+        if (arena->slot_capacity() < slot_samps(_config.nsamps, sample_bytes))
+            throw std::runtime_error("pulse_train: arena slots are smaller than a pulse");
+    }
+
+    _t0_ticks = t0.to_ticks(_rate);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // the radio may need to wait for the whole queue ahead of a pulse
+    double lead = (pulse_time(0) - _device->get_time_now()).get_real_secs();
+    _first_timeout = std::max(lead, 0.0) + _config.depth*_max_gap + _config.nsamps/_rate + _config.rx_timeout;
+
+    if (_config.threaded and _tx_stream){
+        _tx_worker.reset(new tx_worker(_tx_stream, _config.tx_sched));
+        _tx_worker->set_trace(_trace, _tx_chan);
+    }
+    _arrived.assign(_config.depth, 0);
+    _first_tick.assign(_config.depth, -1);
+    _failed.assign(_config.depth, false);
+    _short.assign(_config.depth, false);
+    _scheduled = 0;
+    _abort = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (_scheduled < _config.npulses and _scheduled < _config.depth)
+            schedule(_scheduled++, waves);
+    }
+
+    if (_rx_streams.size() > 1 or (_rx_streams.size() == 1 and _config.threaded)){
+        // one RX thread per channel
+        std::vector<std::exception_ptr> errors(_rx_streams.size());
+        std::vector<std::thread> rx_threads;
+        for (size_t c = 0; c < _rx_streams.size(); c++){
+            rx_threads.push_back(std::thread([&, c]{
+                apply_thread_sched(_config.rx_sched, str(boost::format("n300-rx%d") % _rx_chans[c]));
+                try {
+                    receive_pulses(c, waves, arena, handler, stats);
+                }
+                catch (...){
+                    errors[c] = std::current_exception();
+                    _abort = true;
+                }
+            }));
+        }
+        for (std::thread &t : rx_threads)
+            t.join();
+        for (std::exception_ptr &error : errors){
+            if (error){
+                _tx_worker.reset();
+                std::rethrow_exception(error);
+            }
+        }
+    }
+    else if (_rx_streams.size() == 1){
+        receive_pulses(0, waves, arena, handler, stats);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (_scheduled < _config.npulses)
+            schedule(_scheduled++, waves);
+    }
+    if (_tx_worker){
+        _tx_worker->flush();
+        _tx_worker.reset();
+    }
+    stats.wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,172 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "pulse_writer.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+std::string pulse_filename(const std::string &fname, size_t pulse, size_t npulses){
+    if (npulses<=1)
+        return fname;
+    boost::filesystem::path p(fname.c_str());
+    std::string basen = p.stem().string() + "-" + boost::lexical_cast<std::string>(pulse);
+    boost::filesystem::path newpath = p.parent_path() / boost::filesystem::path(basen + p.extension().string());
+    return newpath.string();
+}
+
+std::string channel_filename(const std::string &fname, size_t channel){
+    boost::filesystem::path p(fname.c_str());
+    std::string basen = p.stem().string() + "-ch" + boost::lexical_cast<std::string>(channel);
+    boost::filesystem::path newpath = p.parent_path() / boost::filesystem::path(basen + p.extension().string());
+    return newpath.string();
+}
+
+pulse_file_sink::pulse_file_sink(const std::string &fname, size_t npulses, bool direct_io, bool preallocate, bool per_channel) :
+    _fname(fname),
+    _npulses(npulses),
+    _direct_io(direct_io),
+    _preallocate(preallocate),
+    _per_channel(per_channel)
+{
+}
+
+void pulse_file_sink::write(const pulse_slot &slot){
+    std::string chanfname = _per_channel ? channel_filename(_fname, slot.channel) : _fname;
+    std::string newfname = pulse_filename(chanfname, slot.index, _npulses);
+    size_t nbytes = slot.nsamps*sizeof(std::complex<short>);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+    bool direct = _direct_io;
+    if (direct){
+        fd = open(newfname.c_str(), flags | O_DIRECT, 0644);
+        if (fd < 0 and errno == EINVAL){
+            std::cerr << "WARNING: O_DIRECT not supported for " << newfname << ", using buffered writes" << std::endl;
+            _direct_io = direct = false;
+        }
+    }
+    if (not direct)
+        fd = open(newfname.c_str(), flags, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file " + newfname + ": " + strerror(errno));
+
+    // O_DIRECT needs block sized writes; the slot buffer is page aligned
+    // and page padded, the file is cut back to size afterwards
+    size_t wbytes = direct ? (nbytes + PAGE_SIZE_BYTES - 1)/PAGE_SIZE_BYTES*PAGE_SIZE_BYTES : nbytes;
+    if (_preallocate and wbytes > 0)
+        posix_fallocate(fd, 0, wbytes);
+
+    const char *p = (const char *)slot.samps;
+    size_t done = 0;
+    while (done < wbytes){
+        ssize_t n = ::write(fd, p + done, wbytes - done);
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            int e = errno;
+            ::close(fd);
+            throw std::runtime_error("Could not write file " + newfname + ": " + strerror(e));
+        }
+        done += (size_t)n;
+    }
+    if (wbytes != nbytes and ftruncate(fd, nbytes) != 0){
+        int e = errno;
+        ::close(fd);
+        throw std::runtime_error("Could not truncate file " + newfname + ": " + strerror(e));
+    }
+    ::close(fd);
+}
+
+pulse_writer::pulse_writer(pulse_sink::sptr sink, pulse_arena::sptr arena) :
+    _sink(sink),
+    _arena(arena),
+    _trace(NULL),
+    _done(false)
+{
+    std::memset(&_stats, 0, sizeof(_stats));
+    _thread = std::thread(&pulse_writer::run, this);
+}
+
+pulse_writer::~pulse_writer(void){
+    close();
+}
+
+void pulse_writer::submit(pulse_slot *slot){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(slot);
+        _stats.high_water = std::max(_stats.high_water, _queue.size());
+    }
+    _queue_cond.notify_one();
+}
+
+void pulse_writer::run(void){
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true){
+        _queue_cond.wait(lock, [this]{ return _done or not _queue.empty(); });
+        if (_queue.empty())
+            break;
+        pulse_slot *slot = _queue.front();
+        _queue.pop_front();
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int64_t trace_start = _trace ? _trace->now_ns() : 0;
+        bool ok = true;
+        try {
+            _sink->write(*slot);
+        }
+        catch (std::exception &e){
+            std::cerr << "Error: pulse writer: " << e.what() << std::endl;
+            ok = false;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (_trace)
+            _trace->stage(slot->index, slot->channel, TRACE_WRITE, trace_start);
+        size_t nbytes = slot->nsamps*sizeof(std::complex<short>);
+        _arena->release(slot);
+
+        lock.lock();
+        _stats.write_secs += secs;
+        if (ok){
+            _stats.written++;
+            _stats.bytes += nbytes;
+        }
+        else {
+            _stats.write_errors++;
+        }
+    }
+}
+
+void pulse_writer::close(void){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_done)
+            return;
+        _done = true;
+    }
+    _queue_cond.notify_one();
+    if (_thread.joinable())
+        _thread.join();
+    _sink->close();
+}
+
+pulse_writer_stats_t pulse_writer::get_stats(void){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void print_writer_stats(const pulse_writer_stats_t &stats, const pulse_arena_stats_t &arena_stats, size_t nslots){
+    std::cout << boost::format("Writer: %d pulses (%f MB) written in %f s, queue high water %d/%d, %d blocked (max %f ms), %d dropped, %d write errors")
+        % stats.written % (stats.bytes/1e6) % stats.write_secs % stats.high_water % nslots
+        % arena_stats.blocked % (arena_stats.max_block_secs*1e3) % arena_stats.dropped % stats.write_errors << std::endl;
+}
@@ -0,0 +1,192 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "radio_device.hpp"
+#include <uhd/property_tree.hpp>
+#include <uhd/types/sensors.hpp>
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+ch_select_t make_ch_select(int ch_rx, int ch_tx){
+    ch_select_t ch_select = {0x0};
+    if (ch_rx == 0 or ch_rx == 2)
+        ch_select.rx0 = 1;
+    if (ch_rx == 1 or ch_rx == 2)
+        ch_select.rx1 = 1;
+    if (ch_tx == 0)
+        ch_select.tx0 = 1;
+    else if (ch_tx == 1)
+        ch_select.tx1 = 1;
+    return ch_select;
+}
+
+// apply one --cpu_format/--wire_format spec to the format field of every
+// streamer it names; a bare format skips the TX streamers unless tx_too
+static void apply_format_spec(stream_formats_t &formats, sample_format_t stream_format_t::*field,
+                              const std::string &spec, bool tx_too){
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","), boost::token_compress_on);
+    for (const std::string &item : items){
+        size_t eq = item.find('=');
+        std::string name = (eq == std::string::npos) ? "" : item.substr(0, eq);
+        sample_format_t format = parse_sample_format(item.substr(eq == std::string::npos ? 0 : eq + 1));
+        bool all = name.empty();
+        bool matched = all;
+        for (size_t chan = RADIO_CHAN_MAIN; chan <= RADIO_CHAN_CALIB; chan++){
+            std::string n = std::to_string(chan);
+            if (all or name == "rx" or name == "rx" + n){
+                formats.rx[chan].*field = format;
+                matched = true;
+            }
+            if ((all and tx_too) or name == "tx" or name == "tx" + n){
+                formats.tx[chan].*field = format;
+                matched = true;
+            }
+        }
+        if (not matched)
+            throw std::invalid_argument("unknown streamer \"" + name + "\" (expected rx, tx, rx0, rx1, tx0 or tx1)");
+    }
+}
+
+stream_formats_t parse_stream_formats(const std::string &cpu, const std::string &wire){
+    stream_formats_t formats;
+    stream_format_t sc16 = {SAMPLE_FORMAT_SC16, SAMPLE_FORMAT_SC16};
+    for (size_t chan = RADIO_CHAN_MAIN; chan <= RADIO_CHAN_CALIB; chan++)
+        formats.rx[chan] = formats.tx[chan] = sc16;
+    apply_format_spec(formats, &stream_format_t::cpu, cpu, false);
+    apply_format_spec(formats, &stream_format_t::wire, wire, true);
+    for (size_t chan = RADIO_CHAN_MAIN; chan <= RADIO_CHAN_CALIB; chan++){
+        if (formats.tx[chan].cpu != SAMPLE_FORMAT_SC16)
+            throw std::invalid_argument("TX streamers send sc16 waveforms; only their wire format can change");
+        if (formats.rx[chan].wire == SAMPLE_FORMAT_FC32 or formats.tx[chan].wire == SAMPLE_FORMAT_FC32)
+            throw std::invalid_argument("the wire format is sc8 or sc16");
+    }
+    return formats;
+}
+
+uhd::stream_args_t make_stream_args(const stream_format_t &format){
+    uhd::stream_args_t args(sample_format_name(format.cpu), sample_format_name(format.wire));
+    // the rest of the program keeps fc32 in sc16 counts
+    if (format.cpu == SAMPLE_FORMAT_FC32)
+        args.args["fullscale"] = "32767";
+    return args;
+}
+
+radio_device::sptr uhd_radio_device::make(
+    uhd::device3::sptr usrp,
+    uhd::rfnoc::radio_ctrl::sptr radio_ctrl,
+    uhd::rx_streamer::sptr rx_stream,
+    uhd::rx_streamer::sptr rx_cal_stream,
+    uhd::tx_streamer::sptr tx_stream,
+    uhd::tx_streamer::sptr tx_cal_stream,
+    const stream_formats_t &formats
+){
+    boost::shared_ptr<uhd_radio_device> dev(new uhd_radio_device());
+    dev->_usrp = usrp;
+    dev->_radio_ctrl = radio_ctrl;
+    dev->_rx_stream[RADIO_CHAN_MAIN] = rx_stream;
+    dev->_rx_stream[RADIO_CHAN_CALIB] = rx_cal_stream;
+    dev->_tx_stream[RADIO_CHAN_MAIN] = tx_stream;
+    dev->_tx_stream[RADIO_CHAN_CALIB] = tx_cal_stream;
+    dev->_formats = formats;
+    return dev;
+}
+
+double uhd_radio_device::get_rate(void){
+    return _radio_ctrl->get_rate();
+}
+
+uhd::time_spec_t uhd_radio_device::get_time_now(void){
+    return _radio_ctrl->get_time_now();
+}
+
+uhd::time_spec_t uhd_radio_device::get_time_last_pps(void){
+    return _radio_ctrl->get_time_last_pps();
+}
+
+void uhd_radio_device::set_time_now(const uhd::time_spec_t &time_spec){
+    _radio_ctrl->set_time_now(time_spec);
+}
+
+void uhd_radio_device::set_time_next_pps(const uhd::time_spec_t &time_spec){
+    _radio_ctrl->set_time_next_pps(time_spec);
+}
+
+std::string uhd_radio_device::get_time_source(void){
+    return _radio_ctrl->get_time_source();
+}
+
+int uhd_radio_device::get_gps_time(int &gps_time){
+    uhd::property_tree::sptr tree = _usrp->get_tree();
+    std::vector<std::string> mboard_names = tree->list("/mboards");
+    uhd::fs_path path = "/mboards/" + mboard_names[0];
+
+    std::vector<std::string> sensor_names = tree->list(path / "sensors");
+    gps_time = 0;
+    if(std::find(sensor_names.begin(), sensor_names.end(), "gps_time") != sensor_names.end()) {
+        gps_time = tree->access<uhd::sensor_value_t>(path / "sensors" / "gps_time").get().to_int();
+    }
+    else if(std::find(sensor_names.begin(), sensor_names.end(), "get_gps_time_sensor") != sensor_names.end()) {
+        try{
+            gps_time = tree->access<uhd::sensor_value_t>(path / "sensors" / "get_gps_time_sensor").get().to_int();
+        }
+        catch (std::exception &e) {
+            std::cout<<"Error caught exception while accessing get_gps_time_sensor: "<<e.what()<<std::endl;
+            return -1;
+        }
+    }
+    else{
+        std::cerr<< "[uhd_radio_device::get_gps_time] Error: gps_time sensor field not found"<<std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+double uhd_radio_device::get_freq(size_t chan){
+    return _radio_ctrl->get_rx_frequency(chan);
+}
+
+void uhd_radio_device::set_freq(size_t chan, double freq){
+    _radio_ctrl->set_rx_frequency(freq, chan);
+    _radio_ctrl->set_tx_frequency(freq, chan);
+}
+
+double uhd_radio_device::get_rx_gain(size_t chan){
+    return _radio_ctrl->get_rx_gain(chan);
+}
+
+void uhd_radio_device::set_rx_gain(size_t chan, double gain){
+    _radio_ctrl->set_rx_gain(gain, chan);
+}
+
+double uhd_radio_device::get_tx_gain(size_t chan){
+    return _radio_ctrl->get_tx_gain(chan);
+}
+
+void uhd_radio_device::set_tx_gain(size_t chan, double gain){
+    _radio_ctrl->set_tx_gain(gain, chan);
+}
+
+void uhd_radio_device::set_command_time(size_t chan, const uhd::time_spec_t &time_spec){
+    _radio_ctrl->set_command_time(time_spec, chan);
+}
+
+void uhd_radio_device::clear_command_time(size_t chan){
+    _radio_ctrl->clear_command_time(chan);
+}
+
+uhd::rx_streamer::sptr uhd_radio_device::get_rx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::rx_streamer::sptr();
+    return _rx_stream[chan];
+}
+
+uhd::tx_streamer::sptr uhd_radio_device::get_tx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::tx_streamer::sptr();
+    return _tx_stream[chan];
+}
@@ -0,0 +1,149 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "range_doppler.hpp"
+#include "sample_convert.hpp"
+#include "thread_sched.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+void transpose_blocked(const fc32_t *in, fc32_t *out, size_t rows, size_t cols,
+                       size_t col_begin, size_t col_end, size_t block){
+    for (size_t cb = col_begin; cb < col_end; cb += block){
+        size_t ce = std::min(cb + block, col_end);
+        for (size_t rb = 0; rb < rows; rb += block){
+            size_t re = std::min(rb + block, rows);
+            for (size_t c = cb; c < ce; c++){
+                const fc32_t *src = in + c;
+                fc32_t *dst = out + c*rows;
+                for (size_t r = rb; r < re; r++)
+                    dst[r] = src[r*cols];
+            }
+        }
+    }
+}
+
+data_cube::data_cube(size_t npulses, size_t nbins) :
+    _npulses(npulses),
+    _nbins(nbins),
+    _data(npulses*nbins, fc32_t(0.0f, 0.0f))
+{
+    if (npulses == 0 or nbins == 0)
+        throw std::invalid_argument("data_cube: empty cube");
+}
+
+static size_t entry_channel(const capture_index_t &entry){
+    return (entry.flags & CAPTURE_FLAG_CHANNEL_MASK) >> CAPTURE_FLAG_CHANNEL_SHIFT;
+}
+
+std::vector<size_t> capture_channels(const capture_file_reader &reader){
+    std::vector<size_t> channels;
+    for (size_t k = 0; k < reader.size(); k++){
+        size_t chan = entry_channel(reader.index(k));
+        if (std::find(channels.begin(), channels.end(), chan) == channels.end())
+            channels.push_back(chan);
+    }
+    std::sort(channels.begin(), channels.end());
+    return channels;
+}
+
+data_cube::sptr load_data_cube(const capture_file_reader &reader, size_t channel, double &prf){
+    std::vector<size_t> pulses;
+    size_t nbins = 0;
+    for (size_t k = 0; k < reader.size(); k++){
+        if (entry_channel(reader.index(k)) != channel)
+            continue;
+        pulses.push_back(k);
+        nbins = std::max<size_t>(nbins, reader.index(k).nsamps);
+    }
+    if (pulses.empty() or nbins == 0)
+        throw std::runtime_error(str(boost::format("capture has no pulses on channel %d") % channel));
+
+    data_cube::sptr cube(new data_cube(pulses.size(), nbins));
+    for (size_t p = 0; p < pulses.size(); p++)
+        reader.read(pulses[p], cube->pulse(p));
+
+    prf = 0.0;
+    const capture_index_t &first = reader.index(pulses.front());
+    const capture_index_t &last = reader.index(pulses.back());
+    if (pulses.size() > 1 and (first.flags & CAPTURE_FLAG_HAS_TIME_SPEC) and (last.flags & CAPTURE_FLAG_HAS_TIME_SPEC)){
+        double span = (double)(last.time_full_secs - first.time_full_secs) + (last.time_frac_secs - first.time_frac_secs);
+        if (span > 0.0)
+            prf = (double)(pulses.size() - 1)/span;
+    }
+    return cube;
+}
+
+range_doppler_config_t default_range_doppler_config(void){
+    range_doppler_config_t config;
+    config.window = WINDOW_HANN;
+    config.nfft = 0;
+    config.threads = 0;
+    return config;
+}
+
+range_doppler_map_t range_doppler(const data_cube &cube, const range_doppler_config_t &config, double prf){
+    const size_t npulses = cube.npulses();
+    const size_t nbins = cube.nbins();
+    range_doppler_map_t map;
+    map.nbins = nbins;
+    map.nfft = config.nfft ? config.nfft : next_pow2(std::max<size_t>(npulses, 2));
+    map.prf = prf;
+    if (map.nfft < npulses)
+        throw std::invalid_argument("range_doppler: fewer Doppler bins than pulses");
+    const fft_plan plan(map.nfft);
+    const size_t nfft = map.nfft;
+    map.power_db.resize(nbins*nfft);
+
+    // unit gain window, so a constant echo of amplitude a peaks at 20*log10(a)
+    std::vector<float> window = make_window(config.window, npulses);
+    double wsum = 0.0;
+    for (float w : window)
+        wsum += w;
+    for (float &w : window)
+        w = (float)(w/wsum);
+
+    fc32_buffer_t slow_time(nbins*npulses);
+    parallel_for(nbins, config.threads, [&](size_t begin, size_t end){
+        // this thread's range bins, slow time made contiguous
+        transpose_blocked(cube.data(), &slow_time.front(), npulses, nbins, begin, end);
+        fc32_buffer_t work(nfft);
+        for (size_t b = begin; b < end; b++){
+            const fc32_t *x = &slow_time[b*npulses];
+            for (size_t p = 0; p < npulses; p++)
+                work[p] = x[p]*window[p];
+            std::fill(work.begin() + npulses, work.end(), fc32_t(0.0f, 0.0f));
+            plan.forward(&work.front());
+            float *row = &map.power_db[b*nfft];
+            for (size_t d = 0; d < nfft; d++)
+                row[d] = 10.0f*std::log10(std::norm(work[(d + nfft/2) % nfft]) + 1e-30f);
+        }
+    });
+
+    size_t peak = (size_t)(std::max_element(map.power_db.begin(), map.power_db.end()) - map.power_db.begin());
+    map.peak_bin = peak/nfft;
+    map.peak_doppler = peak % nfft;
+    map.peak_db = map.power_db[peak];
+    std::vector<float> sorted(map.power_db);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    map.median_db = sorted[sorted.size()/2];
+    return map;
+}
+
+void write_range_doppler_map(const std::string &fname, const range_doppler_map_t &map){
+    std::ofstream file(fname.c_str(), std::ofstream::binary);
+    if (not file.is_open())
+        throw std::runtime_error("Could not open file " + fname);
+    file.write((const char *)&map.power_db.front(), map.power_db.size()*sizeof(float));
+    if (not file)
+        throw std::runtime_error("Could not write file " + fname);
+}
+
+double doppler_hz(const range_doppler_map_t &map, size_t d){
+    return ((double)d - (double)(map.nfft/2))*map.prf/(double)map.nfft;
+}
@@ -0,0 +1,544 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "replay_device.hpp"
+#include "capture_file.hpp"
+#include "file2wave.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+typedef std::complex<short> sc16_t;
+typedef std::chrono::steady_clock clock_type;
+
+struct rx_cmd_t {
+    uhd::stream_cmd_t cmd;
+    bool late;   // time_spec was already in the past when the command was issued
+};
+
+void add_record(replay_track_t &track, const std::vector<sc16_t> &samps){
+    track.starts.push_back(track.samps.size());
+    track.samps.insert(track.samps.end(), samps.begin(), samps.end());
+}
+
+void load_capture(replay_recording_t &recording, const std::string &fname){
+    capture_file_reader reader(fname);
+    const capture_header_t &header = reader.header();
+    if (reader.size() == 0)
+        throw std::runtime_error(fname + ": capture holds no pulses");
+    if (header.rate > 0.0){
+        if (recording.rate > 0.0 and header.rate != recording.rate)
+            throw std::runtime_error(str(boost::format("%s: recorded at %f Msps, the files before it at %f Msps")
+                % fname % (header.rate/1e6) % (recording.rate/1e6)));
+        recording.rate = header.rate;
+    }
+    for (size_t k = 0; k < reader.size(); k++){
+        const capture_index_t &entry = reader.index(k);
+        size_t chan = (entry.flags & CAPTURE_FLAG_CHANNEL_MASK) >> CAPTURE_FLAG_CHANNEL_SHIFT;
+        if (chan > RADIO_CHAN_CALIB)
+            throw std::runtime_error(str(boost::format("%s: pulse %d is from rx%d") % fname % k % chan));
+        // decoded or converted straight into the track
+        replay_track_t &track = recording.rx[chan];
+        size_t offset = track.samps.size();
+        track.starts.push_back(offset);
+        track.samps.resize(offset + (size_t)entry.nsamps);
+        if (entry.nsamps > 0)
+            reader.read(k, &track.samps[offset]);
+    }
+}
+
+} // namespace
+
+void load_replay_recording(replay_recording_t &recording, const std::vector<std::string> &fnames){
+    for (const std::string &fname : fnames){
+        if (is_capture_file(fname)){
+            load_capture(recording, fname);
+            continue;
+        }
+        std::vector<sc16_t> samps;
+        try {
+            file2wave(samps, fname);
+        }
+        catch (std::runtime_error &e){
+            throw std::runtime_error(fname + ": " + e.what());
+        }
+        if (samps.empty())
+            throw std::runtime_error(fname + " holds no samples");
+        add_record(recording.rx[RADIO_CHAN_MAIN], samps);
+        add_record(recording.rx[RADIO_CHAN_CALIB], samps);
+    }
+}
+
+const replay_track_t &replay_track(const replay_recording_t &recording, size_t chan){
+    const replay_track_t &own = recording.rx[chan % 2];
+    return own.starts.empty() ? recording.rx[(chan + 1) % 2] : own;
+}
+
+/*!
+ * State shared by the replay streamers: the recording, the simulated
+ * device clock and the delivery statistics.
+ */
+class replay_source
+{
+public:
+    replay_source(const replay_config_t &config, boost::shared_ptr<const replay_recording_t> recording) :
+        config(config),
+        recording(recording),
+        _origin(clock_type::now()),
+        _steady_ref(0.0),
+        _device_ref(0.0),
+        _pps_pending(false),
+        _pps_edge(0.0),
+        _first_secs(-1.0),
+        _last_secs(0.0)
+    {
+        _stats.samples = 0;
+        _stats.records = 0;
+        _stats.loops = 0;
+        _stats.secs = 0.0;
+        _stats.max_lag = 0.0;
+    }
+
+    double steady_secs(void) const {
+        return std::chrono::duration<double>(clock_type::now() - _origin).count();
+    }
+
+    // caller holds mutex
+    uhd::time_spec_t time_at(double steady){
+        if (_pps_pending and steady >= _pps_edge){
+            _steady_ref = _pps_edge;
+            _device_ref = _pps_time;
+            _pps_pending = false;
+        }
+        return _device_ref + uhd::time_spec_t(steady - _steady_ref);
+    }
+
+    uhd::time_spec_t time_now(void){
+        return time_at(steady_secs());
+    }
+
+    long long tick_now(void){
+        return time_now().to_ticks(config.rate);
+    }
+
+    // seconds of real time until the device clock reaches tick
+    double secs_until(long long tick){
+        uhd::time_spec_t t = uhd::time_spec_t::from_ticks(tick, config.rate);
+        return (t - time_now()).get_real_secs();
+    }
+
+    // unpaced delivery moves the device clock ahead to the delivered samples
+    void follow(long long tick){
+        if (tick > tick_now()){
+            _steady_ref = steady_secs();
+            _device_ref = uhd::time_spec_t::from_ticks(tick, config.rate);
+        }
+    }
+
+    uhd::time_spec_t last_pps(void){
+        double edge = std::floor(steady_secs());
+        time_at(steady_secs());
+        return _device_ref + uhd::time_spec_t(edge - _steady_ref);
+    }
+
+    void set_time_now(const uhd::time_spec_t &time_spec){
+        _steady_ref = steady_secs();
+        _device_ref = time_spec;
+        _pps_pending = false;
+    }
+
+    void set_time_next_pps(const uhd::time_spec_t &time_spec){
+        double now = steady_secs();
+        time_at(now);
+        _pps_edge = std::floor(now) + 1.0;
+        _pps_time = time_spec;
+        _pps_pending = true;
+    }
+
+    // caller holds mutex
+    void delivered(size_t nsamps, size_t records, size_t loops, double lag){
+        double now = steady_secs();
+        if (_first_secs < 0.0)
+            _first_secs = now;
+        _last_secs = now;
+        _stats.samples += nsamps;
+        _stats.records += records;
+        _stats.loops += loops;
+        _stats.max_lag = std::max(_stats.max_lag, lag);
+    }
+
+    replay_stats_t stats(void) const {
+        replay_stats_t stats = _stats;
+        stats.secs = (_first_secs < 0.0) ? 0.0 : _last_secs - _first_secs;
+        return stats;
+    }
+
+    const replay_config_t config;
+    const boost::shared_ptr<const replay_recording_t> recording;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+private:
+    clock_type::time_point _origin;
+    double _steady_ref;
+    uhd::time_spec_t _device_ref;
+    bool _pps_pending;
+    double _pps_edge;
+    uhd::time_spec_t _pps_time;
+    double _first_secs, _last_secs;
+    replay_stats_t _stats;
+};
+
+namespace {
+
+class replay_tx_streamer : public uhd::tx_streamer
+{
+public:
+    replay_tx_streamer(size_t spp) : _spp(spp) {}
+
+    size_t get_num_channels(void) const { return 1; }
+    size_t get_max_num_samps(void) const { return _spp; }
+
+    size_t send(const buffs_type &, const size_t nsamps_per_buff,
+                const uhd::tx_metadata_t &, const double){
+        return nsamps_per_buff;
+    }
+
+    // nothing is transmitted, so there is nothing to report
+    bool recv_async_msg(uhd::async_metadata_t &, double timeout){
+        std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+        return false;
+    }
+
+private:
+    size_t _spp;
+};
+
+class replay_rx_streamer : public uhd::rx_streamer
+{
+public:
+    replay_rx_streamer(boost::shared_ptr<replay_source> source, size_t chan) :
+        _source(source),
+        _track(replay_track(*source->recording, chan)),
+        _format(source->config.formats.rx[chan]),
+        _active(false),
+        _continuous(false),
+        _first(false),
+        _pos(0),
+        _remaining(0),
+        _chain_tick(-1),
+        _cursor(0) {}
+
+    size_t get_num_channels(void) const { return 1; }
+    size_t get_max_num_samps(void) const { return _source->config.spp; }
+
+    void issue_stream_cmd(const uhd::stream_cmd_t &stream_cmd){
+        {
+            std::lock_guard<std::mutex> lock(_source->mutex);
+            if (stream_cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS){
+                _cmds.clear();
+                _active = false;
+                _chain_tick = -1;
+            }
+            else {
+                rx_cmd_t rx_cmd = {stream_cmd, false};
+                rx_cmd.late = _source->config.paced and not stream_cmd.stream_now and
+                    stream_cmd.time_spec.to_ticks(_source->config.rate) < _source->tick_now();
+                _cmds.push_back(rx_cmd);
+            }
+        }
+        _source->cond.notify_all();
+    }
+
+    size_t recv(const buffs_type &buffs, const size_t nsamps_per_buff,
+                uhd::rx_metadata_t &md, const double timeout, const bool one_packet){
+        md.reset();
+        const replay_config_t &config = _source->config;
+        const double deadline = _source->steady_secs() + timeout;
+        std::unique_lock<std::mutex> lock(_source->mutex);
+
+        if (not _active){
+            _source->cond.wait_for(lock, std::chrono::duration<double>(timeout),
+                                   [this]{ return not _cmds.empty(); });
+            if (_cmds.empty()){
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+                return 0;
+            }
+            if (not start_next_cmd(md))
+                return 0;
+        }
+
+        size_t nsamps = nsamps_per_buff;
+        if (not _continuous)
+            nsamps = (size_t)std::min<unsigned long long>(nsamps, _remaining);
+        if (one_packet)
+            nsamps = std::min(nsamps, config.spp);
+        if (not config.loop)
+            nsamps = (size_t)std::min<uint64_t>(nsamps, _track.samps.size() - _cursor);
+        if (nsamps == 0){
+            // the track ran out before this command
+            _active = false;
+            _chain_tick = -1;
+            md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+
+        const long long end_tick = _pos + (long long)nsamps;
+        double lag = 0.0;
+        if (config.paced){
+            // wait for the device clock to pass the last requested sample
+            long long now = _source->tick_now();
+            while (now < end_tick and _active){
+                double wait = std::min(_source->secs_until(end_tick), deadline - _source->steady_secs());
+                if (wait <= 0.0)
+                    break;
+                _source->cond.wait_for(lock, std::chrono::duration<double>(wait));
+                now = _source->tick_now();
+            }
+            if (not _active){
+                // stopped while waiting
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+                return 0;
+            }
+            nsamps = (size_t)std::max<long long>(0, std::min<long long>(now - _pos, (long long)nsamps));
+            if (nsamps == 0){
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+                return 0;
+            }
+            lag = std::max(0.0, (now - end_tick)/config.rate);
+        }
+        else {
+            _source->follow(end_tick);
+        }
+
+        const long long first = _pos;
+        const uint64_t cursor = _cursor;
+        md.has_time_spec = true;
+        md.time_spec = uhd::time_spec_t::from_ticks(first, config.rate);
+        md.start_of_burst = _first;
+        _first = false;
+        size_t loops = 0;
+        size_t records = advance(nsamps, loops);
+        md.end_of_burst = not _active and _chain_tick < 0;
+        _source->delivered(nsamps, records, loops, lag);
+        lock.unlock();
+
+        // the track never changes, so it is copied out without the lock
+        char *out = static_cast<char *>(buffs[0]);
+        const size_t out_bytes = sample_size(_format.cpu);
+        uint64_t src = cursor;
+        for (size_t done = 0; done < nsamps; ){
+            if (src == _track.samps.size())
+                src = 0;
+            size_t n = (size_t)std::min<uint64_t>(nsamps - done, _track.samps.size() - src);
+            convert_samples(SAMPLE_FORMAT_SC16, &_track.samps[src], _format.cpu, out + done*out_bytes, n);
+            src += n;
+            done += n;
+        }
+        return nsamps;
+    }
+
+private:
+    // caller holds mutex; returns false with md.error_code set on failure
+    bool start_next_cmd(uhd::rx_metadata_t &md){
+        uhd::stream_cmd_t cmd = _cmds.front().cmd;
+        bool late = _cmds.front().late;
+        _cmds.pop_front();
+        bool chained = cmd.stream_now and _chain_tick >= 0;
+        if (cmd.stream_now){
+            _pos = chained ? _chain_tick : _source->tick_now();
+        }
+        else {
+            _pos = cmd.time_spec.to_ticks(_source->config.rate);
+            if (late){
+                md.error_code = uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND;
+                md.has_time_spec = true;
+                md.time_spec = cmd.time_spec;
+                _chain_tick = -1;
+                return false;
+            }
+        }
+        // a new burst starts at the next record, a chained one carries on
+        if (not chained){
+            const std::vector<uint64_t> &starts = _track.starts;
+            std::vector<uint64_t>::const_iterator it = std::lower_bound(starts.begin(), starts.end(), _cursor);
+            _cursor = (it == starts.end()) ? _track.samps.size() : *it;
+            if (_cursor == _track.samps.size() and _source->config.loop){
+                _cursor = 0;
+                _source->delivered(0, 0, 1, 0.0);
+            }
+        }
+        _continuous = (cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+        _remaining = cmd.num_samps;
+        _chain_tick = (cmd.stream_mode == uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE) ? 0 : -1;
+        _first = true;
+        _active = _continuous or _remaining > 0;
+        return true;
+    }
+
+    // caller holds mutex; returns the records started within the samples
+    size_t advance(size_t nsamps, size_t &loops){
+        const std::vector<uint64_t> &starts = _track.starts;
+        const uint64_t size = _track.samps.size();
+        size_t records = 0;
+        _pos += (long long)nsamps;
+        for (size_t left = nsamps; left > 0; ){
+            if (_cursor == size){
+                _cursor = 0;
+                loops++;
+            }
+            uint64_t end = std::min<uint64_t>(size, _cursor + left);
+            records += std::lower_bound(starts.begin(), starts.end(), end) -
+                       std::lower_bound(starts.begin(), starts.end(), _cursor);
+            left -= (size_t)(end - _cursor);
+            _cursor = end;
+        }
+        if (not _continuous){
+            _remaining -= std::min<unsigned long long>(_remaining, nsamps);
+            if (_remaining == 0){
+                _active = false;
+                _chain_tick = (_chain_tick >= 0) ? _pos : -1;
+            }
+        }
+        if (not _source->config.loop and _cursor == size){
+            // the recording ends the burst
+            _active = false;
+            _chain_tick = -1;
+        }
+        return records;
+    }
+
+    boost::shared_ptr<replay_source> _source;
+    const replay_track_t &_track;
+    stream_format_t _format;
+    std::deque<rx_cmd_t> _cmds;
+    bool _active, _continuous, _first;
+    long long _pos;
+    unsigned long long _remaining;
+    long long _chain_tick;
+    uint64_t _cursor;   // next sample of the track
+};
+
+} // namespace
+
+replay_config_t default_replay_config(double rate){
+    replay_config_t config;
+    config.rate = rate;
+    config.spp = 2000;
+    config.paced = true;
+    config.loop = false;
+    config.formats = parse_stream_formats("sc16", "sc16");
+    return config;
+}
+
+void print_replay_stats(std::ostream &os, const replay_stats_t &stats){
+    os << boost::format("Replay: %d samples from %d records (%d loops) in %f s (%f Msps), max lag %f ms")
+        % stats.samples % stats.records % stats.loops % stats.secs
+        % (stats.secs > 0.0 ? stats.samples/stats.secs/1e6 : 0.0) % (stats.max_lag*1e3) << std::endl;
+}
+
+radio_device::sptr replay_device::make(const replay_config_t &config, boost::shared_ptr<const replay_recording_t> recording){
+    if (config.rate <= 0.0)
+        throw std::runtime_error("replay_device: invalid sample rate");
+    if (config.spp == 0)
+        throw std::runtime_error("replay_device: spp must be non-zero");
+    if (not recording or (recording->rx[RADIO_CHAN_MAIN].samps.empty() and recording->rx[RADIO_CHAN_CALIB].samps.empty()))
+        throw std::runtime_error("replay_device: the recording holds no samples");
+    boost::shared_ptr<replay_device> dev(new replay_device());
+    dev->_source.reset(new replay_source(config, recording));
+    for (size_t chan = RADIO_CHAN_MAIN; chan <= RADIO_CHAN_CALIB; chan++){
+        dev->_rx_stream[chan].reset(new replay_rx_streamer(dev->_source, chan));
+        dev->_tx_stream[chan].reset(new replay_tx_streamer(config.spp));
+    }
+    return dev;
+}
+
+stream_formats_t replay_device::get_stream_formats(void){
+    return _source->config.formats;
+}
+
+double replay_device::get_rate(void){
+    return _source->config.rate;
+}
+
+uhd::time_spec_t replay_device::get_time_now(void){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _source->time_now();
+}
+
+uhd::time_spec_t replay_device::get_time_last_pps(void){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _source->last_pps();
+}
+
+void replay_device::set_time_now(const uhd::time_spec_t &time_spec){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    _source->set_time_now(time_spec);
+}
+
+void replay_device::set_time_next_pps(const uhd::time_spec_t &time_spec){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    _source->set_time_next_pps(time_spec);
+}
+
+int replay_device::get_gps_time(int &gps_time){
+    // no GPSDO; report the device time so gpsdo-style syncing still works
+    gps_time = (int)get_time_now().get_full_secs();
+    return 0;
+}
+
+double replay_device::get_freq(size_t chan){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _freq[chan % 2];
+}
+
+void replay_device::set_freq(size_t chan, double freq){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    _freq[chan % 2] = freq;
+}
+
+double replay_device::get_rx_gain(size_t chan){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _rx_gain[chan % 2];
+}
+
+void replay_device::set_rx_gain(size_t chan, double gain){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    _rx_gain[chan % 2] = gain;
+}
+
+double replay_device::get_tx_gain(size_t chan){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _tx_gain[chan % 2];
+}
+
+void replay_device::set_tx_gain(size_t chan, double gain){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    _tx_gain[chan % 2] = gain;
+}
+
+uhd::rx_streamer::sptr replay_device::get_rx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::rx_streamer::sptr();
+    return _rx_stream[chan];
+}
+
+uhd::tx_streamer::sptr replay_device::get_tx_stream(size_t chan){
+    if (chan > RADIO_CHAN_CALIB)
+        return uhd::tx_streamer::sptr();
+    return _tx_stream[chan];
+}
+
+replay_stats_t replay_device::get_stats(void){
+    std::lock_guard<std::mutex> lock(_source->mutex);
+    return _source->stats();
+}
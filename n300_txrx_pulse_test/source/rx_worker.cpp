@@ -0,0 +1,86 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "rx_worker.hpp"
+
+rx_worker::rx_worker(uhd::rx_streamer::sptr rx_stream, double rate, const thread_sched_t &sched) :
+    _rx_stream(rx_stream),
+    _rate(rate),
+    _sched(sched),
+    _trace(NULL),
+    _trace_chan(0),
+    _done(false)
+{
+    _thread = std::thread(&rx_worker::run, this);
+}
+
+rx_worker::~rx_worker(void){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _queue_cond.notify_one();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void rx_worker::set_trace(pulse_trace *trace, size_t chan){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _trace = trace;
+    _trace_chan = chan;
+}
+
+void rx_worker::recv(void *buff, size_t nsamps, const uhd::time_spec_t &time_spec, double timeout, size_t pulse){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        rx_request_t request = {buff, nsamps, time_spec, timeout, pulse};
+        _queue.push_back(request);
+    }
+    _queue_cond.notify_one();
+}
+
+size_t rx_worker::wait(uhd::rx_metadata_t &md){
+    std::unique_lock<std::mutex> lock(_mutex);
+    _result_cond.wait(lock, [this]{ return not _results.empty(); });
+    rx_result_t result = _results.front();
+    _results.pop_front();
+    if (result.error)
+        std::rethrow_exception(result.error);
+    md = result.md;
+    return result.nsamps;
+}
+
+void rx_worker::run(void){
+    apply_thread_sched(_sched, "n300-rx-drain");
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true){
+        _queue_cond.wait(lock, [this]{ return _done or not _queue.empty(); });
+        if (_queue.empty())
+            break;
+        rx_request_t request = _queue.front();
+        _queue.pop_front();
+        pulse_trace *trace = _trace;
+        size_t trace_chan = _trace_chan;
+        lock.unlock();
+
+        rx_result_t result;
+        result.nsamps = 0;
+        int64_t trace_start = trace ? trace->now_ns() : 0;
+        try {
+            result.nsamps = _rx_stream->recv(request.buff, request.nsamps, result.md, request.timeout);
+        }
+        catch (...){
+            result.error = std::current_exception();
+        }
+        if (trace){
+            trace->stage(request.pulse, trace_chan, TRACE_RECV, trace_start);
+            trace->rx_result(request.pulse, trace_chan, result.md.error_code, result.md.has_time_spec,
+                             result.md.time_spec.to_ticks(_rate) - request.time_spec.to_ticks(_rate));
+        }
+
+        lock.lock();
+        _results.push_back(result);
+        _result_cond.notify_all();
+    }
+}
@@ -0,0 +1,288 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "sample_convert.hpp"
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+bool file_iq_swapped(const std::string &fname){
+    std::string ext = boost::filesystem::path(fname).extension().string();
+    return not ((ext == ".dat") or (ext == ".ref"));
+}
+
+sample_format_t file_sample_format(const std::string &fname){
+    std::string ext = boost::filesystem::path(fname).extension().string();
+    if (ext == ".sc8")
+        return SAMPLE_FORMAT_SC8;
+    if (ext == ".fc32")
+        return SAMPLE_FORMAT_FC32;
+    return SAMPLE_FORMAT_SC16;
+}
+
+sample_format_t parse_sample_format(const std::string &name){
+    if (name == "sc8")
+        return SAMPLE_FORMAT_SC8;
+    if (name == "sc16")
+        return SAMPLE_FORMAT_SC16;
+    if (name == "fc32")
+        return SAMPLE_FORMAT_FC32;
+    throw std::invalid_argument("unknown sample format \"" + name + "\" (expected sc8, sc16 or fc32)");
+}
+
+const char *sample_format_name(sample_format_t format){
+    switch (format){
+    case SAMPLE_FORMAT_SC8: return "sc8";
+    case SAMPLE_FORMAT_SC16: return "sc16";
+    case SAMPLE_FORMAT_FC32: return "fc32";
+    }
+    return "unknown";
+}
+
+size_t sample_size(sample_format_t format){
+    switch (format){
+    case SAMPLE_FORMAT_SC8: return sizeof(sc8_t);
+    case SAMPLE_FORMAT_SC16: return sizeof(std::complex<short>);
+    case SAMPLE_FORMAT_FC32: return sizeof(std::complex<float>);
+    }
+    return 0;
+}
+
+#if defined(__SSE2__)
+// swap the two int16 halves of every 32-bit lane
+static inline __m128i swap_iq_sse2(__m128i x){
+    return _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+}
+#endif
+
+void convert_sc16(const std::complex<short> *in, std::complex<short> *out, size_t n, bool swap_iq){
+    if (not swap_iq){
+        if (in != out)
+            std::memmove(out, in, n*sizeof(std::complex<short>));
+        return;
+    }
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8){
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        x = _mm256_or_si256(_mm256_slli_epi32(x, 16), _mm256_srli_epi32(x, 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), x);
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), swap_iq_sse2(x));
+    }
+#elif defined(HAVE_NEON)
+    for (; i + 4 <= n; i += 4){
+        int16x8_t x = vld1q_s16(reinterpret_cast<const int16_t *>(in + i));
+        vst1q_s16(reinterpret_cast<int16_t *>(out + i), vrev32q_s16(x));
+    }
+#endif
+    convert_sc16_generic(in + i, out + i, n - i, swap_iq);
+}
+
+void convert_sc16(const std::complex<short> *in, std::complex<float> *out, size_t n, bool swap_iq){
+    size_t i = 0;
+    float *dst = reinterpret_cast<float *>(out);
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        if (swap_iq)
+            x = swap_iq_sse2(x);
+        _mm256_storeu_ps(dst + 2*i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        if (swap_iq)
+            x = swap_iq_sse2(x);
+        // sign extend int16 -> int32 by duplicating and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst + 2*i, _mm_cvtepi32_ps(lo));
+        _mm_storeu_ps(dst + 2*i + 4, _mm_cvtepi32_ps(hi));
+    }
+#elif defined(HAVE_NEON)
+    for (; i + 4 <= n; i += 4){
+        int16x8_t x = vld1q_s16(reinterpret_cast<const int16_t *>(in + i));
+        if (swap_iq)
+            x = vrev32q_s16(x);
+        vst1q_f32(dst + 2*i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))));
+        vst1q_f32(dst + 2*i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))));
+    }
+#endif
+    convert_sc16_generic(in + i, out + i, n - i, swap_iq);
+}
+
+void convert_sc16(const std::complex<short> *in, std::complex<double> *out, size_t n, bool swap_iq){
+    size_t i = 0;
+    double *dst = reinterpret_cast<double *>(out);
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        if (swap_iq)
+            x = swap_iq_sse2(x);
+        __m256i x32 = _mm256_cvtepi16_epi32(x);
+        _mm256_storeu_pd(dst + 2*i, _mm256_cvtepi32_pd(_mm256_castsi256_si128(x32)));
+        _mm256_storeu_pd(dst + 2*i + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(x32, 1)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        if (swap_iq)
+            x = swap_iq_sse2(x);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_pd(dst + 2*i, _mm_cvtepi32_pd(lo));
+        _mm_storeu_pd(dst + 2*i + 2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)));
+        _mm_storeu_pd(dst + 2*i + 4, _mm_cvtepi32_pd(hi));
+        _mm_storeu_pd(dst + 2*i + 6, _mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)));
+    }
+#elif defined(HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4){
+        int16x8_t x = vld1q_s16(reinterpret_cast<const int16_t *>(in + i));
+        if (swap_iq)
+            x = vrev32q_s16(x);
+        int32x4_t lo = vmovl_s16(vget_low_s16(x));
+        int32x4_t hi = vmovl_s16(vget_high_s16(x));
+        vst1q_f64(dst + 2*i, vcvtq_f64_s64(vmovl_s32(vget_low_s32(lo))));
+        vst1q_f64(dst + 2*i + 2, vcvtq_f64_s64(vmovl_s32(vget_high_s32(lo))));
+        vst1q_f64(dst + 2*i + 4, vcvtq_f64_s64(vmovl_s32(vget_low_s32(hi))));
+        vst1q_f64(dst + 2*i + 6, vcvtq_f64_s64(vmovl_s32(vget_high_s32(hi))));
+    }
+#endif
+    // 32-bit ARM NEON has no double lanes; the generic loop handles it
+    convert_sc16_generic(in + i, out + i, n - i, swap_iq);
+}
+
+void convert_samples(const sc8_t *in, std::complex<short> *out, size_t n){
+    const int8_t *src = reinterpret_cast<const int8_t *>(in);
+    short *dst = reinterpret_cast<short *>(out);
+    size_t i = 0;
+    n *= 2;
+#if defined(__AVX2__)
+    for (; i + 16 <= n; i += 16){
+        __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_slli_epi16(x, 8));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16){
+        // the byte in the high half of each int16 is x*256
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(_mm_setzero_si128(), x));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(_mm_setzero_si128(), x));
+    }
+#elif defined(HAVE_NEON)
+    for (; i + 16 <= n; i += 16){
+        int8x16_t x = vld1q_s8(src + i);
+        vst1q_s16(dst + i, vshll_n_s8(vget_low_s8(x), 8));
+        vst1q_s16(dst + i + 8, vshll_n_s8(vget_high_s8(x), 8));
+    }
+#endif
+    convert_samples_generic(in + i/2, out + i/2, (n - i)/2);
+}
+
+void convert_samples(const std::complex<short> *in, sc8_t *out, size_t n){
+    const short *src = reinterpret_cast<const short *>(in);
+    int8_t *dst = reinterpret_cast<int8_t *>(out);
+    size_t i = 0;
+    n *= 2;
+#if defined(__SSE2__)
+    // x/256 is exact in float, so cvtps rounds it like lrint()
+    const __m128 k = _mm_set1_ps(1.0f/256.0f);
+    for (; i + 16 <= n; i += 16){
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        __m128i r[4];
+        r[0] = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+        r[1] = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+        r[2] = _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16);
+        r[3] = _mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16);
+        for (size_t j = 0; j < 4; j++)
+            r[j] = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(r[j]), k));
+        __m128i lo = _mm_packs_epi32(r[0], r[1]);
+        __m128i hi = _mm_packs_epi32(r[2], r[3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi16(lo, hi));
+    }
+#elif defined(HAVE_NEON) && defined(__aarch64__)
+    const float32x4_t k = vdupq_n_f32(1.0f/256.0f);
+    for (; i + 16 <= n; i += 16){
+        int16x8_t a = vld1q_s16(src + i);
+        int16x8_t b = vld1q_s16(src + i + 8);
+        int32x4_t r0 = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(a))), k));
+        int32x4_t r1 = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(a))), k));
+        int32x4_t r2 = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(b))), k));
+        int32x4_t r3 = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(b))), k));
+        int16x8_t lo = vcombine_s16(vqmovn_s32(r0), vqmovn_s32(r1));
+        int16x8_t hi = vcombine_s16(vqmovn_s32(r2), vqmovn_s32(r3));
+        vst1q_s8(dst + i, vcombine_s8(vqmovn_s16(lo), vqmovn_s16(hi)));
+    }
+#endif
+    convert_samples_generic(in + i/2, out + i/2, (n - i)/2);
+}
+
+void convert_samples(const std::complex<short> *in, std::complex<float> *out, size_t n){
+    convert_sc16(in, out, n, false);
+}
+
+void convert_samples(const std::complex<float> *in, std::complex<short> *out, size_t n){
+    const float *src = reinterpret_cast<const float *>(in);
+    short *dst = reinterpret_cast<short *>(out);
+    size_t i = 0;
+    n *= 2;
+#if defined(__SSE2__)
+    const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= n; i += 8){
+        __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi));
+        __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), lo), hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(HAVE_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8){
+        int32x4_t a = vcvtnq_s32_f32(vld1q_f32(src + i));
+        int32x4_t b = vcvtnq_s32_f32(vld1q_f32(src + i + 4));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+#endif
+    convert_samples_generic(in + i/2, out + i/2, (n - i)/2);
+}
+
+template<typename In> static void convert_from(const In *in, sample_format_t out_format, void *out, size_t n){
+    switch (out_format){
+    case SAMPLE_FORMAT_SC8:
+        convert_samples(in, static_cast<sc8_t *>(out), n);
+        break;
+    case SAMPLE_FORMAT_SC16:
+        convert_samples(in, static_cast<std::complex<short> *>(out), n);
+        break;
+    case SAMPLE_FORMAT_FC32:
+        convert_samples(in, static_cast<std::complex<float> *>(out), n);
+        break;
+    }
+}
+
+void convert_samples(sample_format_t in_format, const void *in, sample_format_t out_format, void *out, size_t n){
+    switch (in_format){
+    case SAMPLE_FORMAT_SC8:
+        convert_from(static_cast<const sc8_t *>(in), out_format, out, n);
+        break;
+    case SAMPLE_FORMAT_SC16:
+        convert_from(static_cast<const std::complex<short> *>(in), out_format, out, n);
+        break;
+    case SAMPLE_FORMAT_FC32:
+        convert_from(static_cast<const std::complex<float> *>(in), out_format, out, n);
+        break;
+    }
+}
@@ -0,0 +1,121 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "spectrum.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+spectrum_config_t default_spectrum_config(void){
+    spectrum_config_t config;
+    config.rate = 125e6;
+    config.nfft = 1024;
+    config.overlap = 0.5;
+    config.window = WINDOW_HANN;
+    config.obw_percent = 99.0;
+    return config;
+}
+
+// std::min() binds it by reference, so it needs a definition in unoptimized builds
+const size_t welch_psd::BATCH;
+
+welch_psd::welch_psd(const spectrum_config_t &config) :
+    _config(config),
+    _step(0),
+    _plan(config.nfft)
+{
+    if (config.overlap < 0.0 or config.overlap >= 1.0)
+        throw std::invalid_argument("welch_psd: overlap must be in [0, 1)");
+    _step = std::max<size_t>(1, (size_t)std::llround(config.nfft*(1.0 - config.overlap)));
+    std::vector<float> window = make_window(config.window, config.nfft);
+    _window_iq = make_window_iq(window);
+    _window_power = 0.0;
+    for (float w : window)
+        _window_power += (double)w*w;
+    _batch.resize(BATCH*config.nfft);
+}
+
+size_t welch_psd::compute(const fc32_t *x, size_t n, std::vector<double> &psd){
+    const size_t nfft = _config.nfft;
+    psd.assign(nfft, 0.0);
+    size_t nseg = (n < nfft) ? 1 : 1 + (n - nfft)/_step;
+    for (size_t seg = 0; seg < nseg; seg += BATCH){
+        size_t batch = std::min(BATCH, nseg - seg);
+        // window the whole batch first, then run the FFTs back to back
+        for (size_t b = 0; b < batch; b++){
+            fc32_t *dst = &_batch[b*nfft];
+            size_t start = (seg + b)*_step;
+            size_t len = std::min(nfft, n - start);
+            if (len < nfft){
+                std::copy(x + start, x + start + len, dst);
+                std::fill(dst + len, dst + nfft, fc32_t(0.0f, 0.0f));
+                window_multiply(dst, &_window_iq.front(), dst, nfft);
+            }
+            else {
+                window_multiply(x + start, &_window_iq.front(), dst, nfft);
+            }
+        }
+        for (size_t b = 0; b < batch; b++)
+            _plan.forward(&_batch[b*nfft]);
+        for (size_t b = 0; b < batch; b++){
+            const fc32_t *X = &_batch[b*nfft];
+            // fftshift while accumulating: negative frequencies first
+            for (size_t k = 0; k < nfft; k++)
+                psd[k] += std::norm(X[(k + nfft/2) % nfft]);
+        }
+    }
+    const double scale = 1.0/((double)nseg*_config.rate*_window_power);
+    for (double &p : psd)
+        p *= scale;
+    return nseg;
+}
+
+double welch_psd::bin_hz(size_t k) const {
+    return ((double)k - (double)(_config.nfft/2))*_config.rate/(double)_config.nfft;
+}
+
+// frequency where the cumulative power of the bins crosses target
+static double crossing_hz(const std::vector<double> &cum, double target, double df, size_t nfft){
+    size_t k = std::lower_bound(cum.begin(), cum.end(), target) - cum.begin();
+    k = std::min(k, cum.size() - 1);
+    double below = (k > 0) ? cum[k - 1] : 0.0;
+    double frac = (cum[k] > below) ? (target - below)/(cum[k] - below) : 0.5;
+    // bin k spans [f_k - df/2, f_k + df/2]
+    return ((double)k - (double)(nfft/2) - 0.5 + frac)*df;
+}
+
+spectrum_stats_t analyze_psd(const std::vector<double> &psd, const spectrum_config_t &config){
+    const size_t nfft = psd.size();
+    const double df = config.rate/(double)nfft;
+    spectrum_stats_t stats;
+    std::vector<double> cum(nfft);
+    double total = 0.0, lower = 0.0, upper = 0.0, moment = 0.0;
+    for (size_t k = 0; k < nfft; k++){
+        double p = psd[k]*df;
+        double f = ((double)k - (double)(nfft/2))*df;
+        total += p;
+        cum[k] = total;
+        moment += p*f;
+        if (k < nfft/2)
+            lower += p;
+        else if (k > nfft/2)
+            upper += p;
+    }
+    const double tiny = 1e-30;
+    stats.power_db = 10.0*std::log10(total + tiny);
+    stats.lower_db = 10.0*std::log10(lower + tiny);
+    stats.upper_db = 10.0*std::log10(upper + tiny);
+    stats.asymmetry_db = stats.upper_db - stats.lower_db;
+    stats.centroid_hz = (total > 0.0) ? moment/total : 0.0;
+    if (total > 0.0){
+        double out = (100.0 - config.obw_percent)/200.0;
+        stats.obw_lo_hz = crossing_hz(cum, out*total, df, nfft);
+        stats.obw_hi_hz = crossing_hz(cum, (1.0 - out)*total, df, nfft);
+    }
+    else {
+        stats.obw_lo_hz = stats.obw_hi_hz = 0.0;
+    }
+    stats.obw_hz = stats.obw_hi_hz - stats.obw_lo_hz;
+    return stats;
+}
@@ -0,0 +1,203 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "stream_capture.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+stream_capture::stream_capture(radio_device::sptr device, size_t chan, const stream_capture_config_t &config) :
+    _device(device),
+    _chan(chan),
+    _config(config),
+    _rate(device->get_rate()),
+    _stop(false)
+{
+    _rx_stream = _device->get_rx_stream(chan);
+    _sample_bytes = sample_size(_device->get_stream_formats().rx[chan].cpu);
+    if (not _rx_stream)
+        throw std::runtime_error(str(boost::format("stream_capture: device has no RX channel %d") % chan));
+    if (_config.chunk_samps == 0)
+        throw std::runtime_error("stream_capture: chunk size is 0");
+}
+
+void stream_capture::begin_chunk(chunk_t &chunk, pulse_arena::sptr arena, uint64_t received, size_t scratch){
+    chunk.want = _config.chunk_samps;
+    if (_config.nsamps > 0)
+        chunk.want = (size_t)std::min<uint64_t>(chunk.want, _config.nsamps - received);
+    chunk.slot = arena->acquire();
+    chunk.scratch = scratch;
+    if (chunk.slot){
+        chunk.buff = reinterpret_cast<char *>(chunk.slot->samps);
+    }
+    else {
+        // a dropped chunk is still drained, or the radio would overflow
+        _scratch[scratch].resize(slot_samps(_config.chunk_samps, _sample_bytes));
+        chunk.buff = reinterpret_cast<char *>(&_scratch[scratch].front());
+    }
+    chunk.n = 0;
+    chunk.time_spec = uhd::time_spec_t(0.0);
+    chunk.error_code = uhd::rx_metadata_t::ERROR_CODE_NONE;
+}
+
+void stream_capture::finish_chunk(chunk_t &chunk, const chunk_handler_t &handler, stream_capture_stats_t &stats){
+    size_t index = stats.chunks++;
+    stats.samples += chunk.n;
+    if (chunk.slot){
+        chunk.slot->index = index;
+        chunk.slot->channel = _chan;
+        chunk.slot->wave = 0;
+        chunk.slot->nsamps = chunk.n;
+        chunk.slot->has_time_spec = true;
+        chunk.slot->time_full_secs = chunk.time_spec.get_full_secs();
+        chunk.slot->time_frac_secs = chunk.time_spec.get_frac_secs();
+        chunk.slot->error_code = chunk.error_code;
+    }
+    else {
+        stats.dropped++;
+    }
+    handler(index, chunk.slot);
+    chunk.slot = NULL;
+    chunk.buff = NULL;
+}
+
+void stream_capture::add_gap(const stream_gap_t &gap, stream_capture_stats_t &stats){
+    stats.gaps++;
+    stats.lost_samps += (uint64_t)std::max(gap.lost, 0LL);
+    if (_gaps.size() < _config.max_gaps)
+        _gaps.push_back(gap);
+}
+
+stream_capture_stats_t stream_capture::run(const uhd::time_spec_t &t0, pulse_arena::sptr arena, const chunk_handler_t &handler){
+    stream_capture_stats_t stats;
+    std::memset(&stats, 0, sizeof(stats));
+    if (arena->slot_capacity() < slot_samps(_config.chunk_samps, _sample_bytes))
+        throw std::runtime_error("stream_capture: arena slots are smaller than a chunk");
+    if (arena->size() < 2)
+        throw std::runtime_error("stream_capture: needs at least two arena slots");
+    _gaps.clear();
+    _stop = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+    stream_cmd.stream_now = false;
+    stream_cmd.time_spec = t0;
+    _rx_stream->issue_stream_cmd(stream_cmd);
+    double lead = (t0 - _device->get_time_now()).get_real_secs();
+    double timeout = std::max(lead, 0.0) + _config.timeout;
+
+    long long next_tick = t0.to_ticks(_rate);   // tick the next sample should have
+    uint32_t pending_error = uhd::rx_metadata_t::ERROR_CODE_NONE;
+    bool pending_oos = false;
+    chunk_t chunk;
+    begin_chunk(chunk, arena, 0, 0);
+    try {
+        while (not _stop and (_config.nsamps == 0 or stats.samples < _config.nsamps)){
+            uhd::rx_metadata_t md;
+            size_t got = _rx_stream->recv(chunk.buff + chunk.n*_sample_bytes, chunk.want - chunk.n, md, timeout);
+            timeout = _config.timeout;
+
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT){
+                stats.timeouts++;
+                break;
+            }
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW){
+                if (md.out_of_sequence)
+                    stats.sequence_errors++;
+                else
+                    stats.overflows++;
+            }
+            else if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
+                throw std::runtime_error("stream_capture: " + md.strerror());
+            }
+
+            if (got > 0){
+                long long tick = md.has_time_spec ? md.time_spec.to_ticks(_rate) : next_tick;
+                if (tick != next_tick){
+                    stream_gap_t gap = {next_tick, tick - next_tick, pending_error, pending_oos};
+                    add_gap(gap, stats);
+                    if (chunk.n > 0){
+                        // the chunk ends at the gap; what came after it starts the next one
+                        chunk_t next;
+                        begin_chunk(next, arena, stats.samples + chunk.n, chunk.scratch ^ 1);
+                        size_t moved = std::min(got, next.want);
+                        std::memcpy(next.buff, chunk.buff + chunk.n*_sample_bytes, moved*_sample_bytes);
+                        finish_chunk(chunk, handler, stats);
+                        chunk = next;
+                        got = moved;
+                    }
+                }
+                if (chunk.n == 0){
+                    chunk.time_spec = uhd::time_spec_t::from_ticks(tick, _rate);
+                    chunk.error_code = pending_error;
+                    pending_error = uhd::rx_metadata_t::ERROR_CODE_NONE;
+                    pending_oos = false;
+                }
+                chunk.n += got;
+                next_tick = tick + (long long)got;
+            }
+
+            // samples returned with an overflow came before it; the chunk
+            // after it is the one marked
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW){
+                pending_error = md.error_code;
+                pending_oos = md.out_of_sequence;
+            }
+
+            // an overflow ends the chunk, so every chunk is contiguous
+            bool full = chunk.n == chunk.want;
+            if (full or (chunk.n > 0 and md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE)){
+                finish_chunk(chunk, handler, stats);
+                if (_config.nsamps == 0 or stats.samples < _config.nsamps)
+                    begin_chunk(chunk, arena, stats.samples, 0);
+            }
+            // a replayed recording ends the stream with its last sample
+            if (md.end_of_burst)
+                break;
+        }
+    }
+    catch (...){
+        _rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+        if (chunk.slot)
+            arena->release(chunk.slot);
+        throw;
+    }
+    _rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+    // keep what was received before the stop
+    if (chunk.buff and chunk.n > 0)
+        finish_chunk(chunk, handler, stats);
+    else if (chunk.slot)
+        arena->release(chunk.slot);
+
+    // drain what was in flight when the stream stopped
+    size_t spp = _rx_stream->get_max_num_samps();
+    std::vector<std::complex<short>> drain(slot_samps(spp, _sample_bytes));
+    for (size_t i = 0; i < 10000; i++){
+        uhd::rx_metadata_t md;
+        if (_rx_stream->recv(&drain.front(), spp, md, 0.1) == 0 and
+            md.error_code != uhd::rx_metadata_t::ERROR_CODE_OVERFLOW)
+            break;
+    }
+    stats.wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void print_stream_capture_stats(std::ostream &os, const stream_capture_stats_t &stats,
+                                const std::vector<stream_gap_t> &gaps, double rate){
+    os << boost::format("Stream: %d samples (%f s) in %d chunks, %f s wall (%f Msps)")
+        % stats.samples % (stats.samples/rate) % stats.chunks % stats.wall_secs
+        % (stats.wall_secs > 0.0 ? stats.samples/stats.wall_secs/1e6 : 0.0) << std::endl;
+    os << boost::format("Stream: %d overflows, %d sequence errors, %d gaps (%d samples lost), %d chunks dropped, %d timeouts")
+        % stats.overflows % stats.sequence_errors % stats.gaps % stats.lost_samps % stats.dropped % stats.timeouts << std::endl;
+    for (const stream_gap_t &gap : gaps){
+        os << boost::format("  gap at %f s: %d samples lost (%s)")
+            % uhd::time_spec_t::from_ticks(gap.tick, rate).get_real_secs() % gap.lost
+            % (gap.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW
+               ? (gap.out_of_sequence ? "sequence error" : "overflow") : "no error reported") << std::endl;
+    }
+    if (stats.gaps > gaps.size())
+        os << boost::format("  ... %d more gaps") % (stats.gaps - gaps.size()) << std::endl;
+}
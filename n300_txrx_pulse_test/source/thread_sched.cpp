@@ -0,0 +1,85 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "thread_sched.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+thread_sched_t default_thread_sched(void){
+    thread_sched_t sched;
+    sched.cpu = -1;
+    sched.priority = 0.5;
+    return sched;
+}
+
+void apply_thread_sched(const thread_sched_t &sched, const std::string &name){
+    pthread_t self = pthread_self();
+    // thread names are limited to 15 characters
+    pthread_setname_np(self, name.substr(0, 15).c_str());
+
+    if (sched.cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(sched.cpu, &cpus);
+        int ret = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+        if (ret != 0)
+            std::cerr << "WARNING: could not pin " << name << " to CPU " << sched.cpu << ": " << strerror(ret) << std::endl;
+    }
+
+    if (sched.priority >= 0.0){
+        // same mapping as uhd::set_thread_priority_safe()
+        int min_pri = sched_get_priority_min(SCHED_RR);
+        int max_pri = sched_get_priority_max(SCHED_RR);
+        float priority = std::min(sched.priority, 1.0f);
+        struct sched_param sp;
+        sp.sched_priority = (int)std::lround(priority*(max_pri - min_pri)) + min_pri;
+        int ret = pthread_setschedparam(self, SCHED_RR, &sp);
+        if (ret != 0)
+            std::cerr << "WARNING: could not set the priority of " << name << ": " << strerror(ret) << std::endl;
+    }
+}
+
+size_t default_thread_count(void){
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void parallel_for(size_t n, size_t nthreads, const std::function<void(size_t begin, size_t end)> &fn){
+    if (nthreads == 0)
+        nthreads = default_thread_count();
+    nthreads = std::max<size_t>(1, std::min(nthreads, n));
+    if (n == 0)
+        return;
+    std::vector<std::exception_ptr> errors(nthreads);
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; t++){
+        threads.push_back(std::thread([&, t]{
+            try {
+                fn(n*t/nthreads, n*(t + 1)/nthreads);
+            }
+            catch (...){
+                errors[t] = std::current_exception();
+            }
+        }));
+    }
+    try {
+        fn(0, n/nthreads);
+    }
+    catch (...){
+        errors[0] = std::current_exception();
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (std::exception_ptr &error : errors){
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
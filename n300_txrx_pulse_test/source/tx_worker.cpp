@@ -0,0 +1,113 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "tx_worker.hpp"
+#include <uhd/types/metadata.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+tx_worker::tx_worker(uhd::tx_streamer::sptr tx_stream, const thread_sched_t &sched) :
+    _tx_stream(tx_stream),
+    _sched(sched),
+    _trace(NULL),
+    _trace_chan(0),
+    _busy(0),
+    _done(false)
+{
+    std::memset(&_stats, 0, sizeof(_stats));
+    _thread = std::thread(&tx_worker::run, this);
+}
+
+tx_worker::~tx_worker(void){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _queue_cond.notify_one();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void tx_worker::check_error(void){
+    if (_error){
+        std::exception_ptr error = _error;
+        _error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+void tx_worker::set_trace(pulse_trace *trace, size_t chan){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _trace = trace;
+    _trace_chan = chan;
+}
+
+void tx_worker::send(const sc16_buffer_t *wave, const uhd::time_spec_t &time_spec, size_t pulse){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        check_error();
+        tx_burst_t burst = {wave, time_spec, pulse};
+        _queue.push_back(burst);
+        _stats.high_water = std::max(_stats.high_water, _queue.size());
+    }
+    _queue_cond.notify_one();
+}
+
+void tx_worker::flush(void){
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle_cond.wait(lock, [this]{ return _queue.empty() and _busy == 0; });
+    check_error();
+}
+
+void tx_worker::run(void){
+    apply_thread_sched(_sched, "n300-tx");
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true){
+        _queue_cond.wait(lock, [this]{ return _done or not _queue.empty(); });
+        if (_queue.empty())
+            break;
+        tx_burst_t burst = _queue.front();
+        _queue.pop_front();
+        _busy++;
+        pulse_trace *trace = _trace;
+        size_t trace_chan = _trace_chan;
+        lock.unlock();
+
+        uhd::tx_metadata_t md_tx;
+        md_tx.start_of_burst = true;
+        md_tx.end_of_burst = true;
+        md_tx.has_time_spec = true;
+        md_tx.time_spec = burst.time_spec;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int64_t trace_start = trace ? trace->now_ns() : 0;
+        size_t nsent = 0;
+        std::exception_ptr error;
+        try {
+            nsent = _tx_stream->send(&burst.wave->front(), burst.wave->size(), md_tx);
+        }
+        catch (...){
+            error = std::current_exception();
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (trace)
+            trace->stage(burst.pulse, trace_chan, TRACE_SEND, trace_start);
+
+        lock.lock();
+        _busy--;
+        _stats.bursts++;
+        _stats.send_secs += secs;
+        if (nsent < burst.wave->size())
+            _stats.short_sends++;
+        if (error and not _error)
+            _error = error;
+        if (_queue.empty())
+            _idle_cond.notify_all();
+    }
+}
+
+tx_worker_stats_t tx_worker::get_stats(void){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
@@ -0,0 +1,48 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "waveform_cache.hpp"
+#include "file2wave.hpp"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+const sc16_buffer_t &waveform_cache::load(const std::string &name, const std::string &fname){
+    boost::shared_ptr<sc16_buffer_t> wave(new sc16_buffer_t());
+    file2wave<short>(*wave, fname);
+    if (wave->empty())
+        throw std::runtime_error("Waveform file " + fname + " is empty");
+    if (_waves.find(name) == _waves.end())
+        _names.push_back(name);
+    _waves[name] = wave;
+    return *wave;
+}
+
+const sc16_buffer_t &waveform_cache::add(const std::string &name, const sc16_buffer_t &data){
+    boost::shared_ptr<sc16_buffer_t> wave(new sc16_buffer_t(data));
+    if (_waves.find(name) == _waves.end())
+        _names.push_back(name);
+    _waves[name] = wave;
+    return *wave;
+}
+
+void waveform_cache::remove(const std::string &name){
+    if (_waves.erase(name) > 0)
+        _names.erase(std::find(_names.begin(), _names.end(), name));
+}
+
+bool waveform_cache::has(const std::string &name) const {
+    return _waves.find(name) != _waves.end();
+}
+
+const sc16_buffer_t &waveform_cache::get(const std::string &name) const {
+    std::map<std::string, boost::shared_ptr<sc16_buffer_t>>::const_iterator it = _waves.find(name);
+    if (it == _waves.end())
+        throw std::runtime_error("No waveform named " + name + " in cache");
+    return *it->second;
+}
+
+std::string waveform_cache::default_name(const std::string &fname){
+    return boost::filesystem::path(fname).stem().string();
+}
@@ -0,0 +1,252 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "waveform_synth.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+/***********************************************************************
+ * spec parsing
+ **********************************************************************/
+template<typename T> static T parse_option(const std::string &key, const std::string &value){
+    try {
+        return boost::lexical_cast<T>(value);
+    }
+    catch (boost::bad_lexical_cast &){
+        throw std::invalid_argument("bad value \"" + value + "\" for waveform option " + key);
+    }
+}
+
+static std::vector<double> barker_phases(size_t n){
+    static const char *codes[] = {NULL, NULL, "+-", "++-", "++-+", "+++-+", NULL, "+++--+-",
+                                  NULL, NULL, NULL, "+++---+--+-", NULL, "+++++--++-+-+"};
+    if (n >= sizeof(codes)/sizeof(codes[0]) or codes[n] == NULL)
+        throw std::invalid_argument("no Barker code of length " + boost::lexical_cast<std::string>(n));
+    std::vector<double> phases;
+    for (const char *c = codes[n]; *c; c++)
+        phases.push_back((*c == '+') ? 0.0 : 180.0);
+    return phases;
+}
+
+waveform_spec_t parse_waveform_spec(const std::string &spec){
+    std::vector<std::string> tokens;
+    boost::split(tokens, spec, boost::is_any_of(":"));
+    waveform_spec_t w;
+    w.bw = 100e6;
+    w.freq = 0.0;
+    w.len = 0;
+    w.dur = 0.0;
+    w.chip = 1;
+    w.zeros = 0;
+    w.scale = 1.0;
+    size_t barker = 13;
+    if (tokens[0] == "lfm"){
+        w.type = WAVEFORM_LFM;
+        w.len = 1280;
+        w.zeros = 512;
+    }
+    else if (tokens[0] == "tone")
+        w.type = WAVEFORM_TONE;
+    else if (tokens[0] == "barker")
+        w.type = WAVEFORM_BARKER;
+    else if (tokens[0] == "code")
+        w.type = WAVEFORM_CODE;
+    else
+        throw std::invalid_argument("unknown waveform type \"" + tokens[0] + "\"");
+
+    for (size_t i = 1; i < tokens.size(); i++){
+        size_t eq = tokens[i].find('=');
+        std::string key = tokens[i].substr(0, eq);
+        std::string value = (eq == std::string::npos) ? "" : tokens[i].substr(eq + 1);
+        if (key == "halfgain" and eq == std::string::npos) w.scale = 0.5;
+        else if (eq == std::string::npos)
+            throw std::invalid_argument("expected key=value in waveform spec, got \"" + tokens[i] + "\"");
+        else if (key == "bw") w.bw = parse_option<double>(key, value);
+        else if (key == "freq") w.freq = parse_option<double>(key, value);
+        // a duration replaces the default length and the other way around
+        else if (key == "len"){ w.len = parse_option<size_t>(key, value); w.dur = 0.0; }
+        else if (key == "dur"){ w.dur = parse_option<double>(key, value); w.len = 0; }
+        else if (key == "chip") w.chip = parse_option<size_t>(key, value);
+        else if (key == "n") barker = parse_option<size_t>(key, value);
+        else if (key == "zeros") w.zeros = parse_option<size_t>(key, value);
+        else if (key == "scale") w.scale = parse_option<double>(key, value);
+        else if (key == "phases"){
+            std::vector<std::string> phases;
+            boost::split(phases, value, boost::is_any_of("/"), boost::token_compress_on);
+            for (const std::string &p : phases)
+                w.phases.push_back(parse_option<double>(key, p));
+        }
+        else
+            throw std::invalid_argument("unknown waveform option \"" + key + "\"");
+    }
+    if (w.type == WAVEFORM_BARKER)
+        w.phases = barker_phases(barker);
+    if (w.type == WAVEFORM_CODE and w.phases.empty())
+        throw std::invalid_argument("phase code without phases");
+    if ((w.type == WAVEFORM_LFM or w.type == WAVEFORM_TONE) and w.len == 0 and w.dur <= 0.0)
+        throw std::invalid_argument("waveform needs len or dur");
+    if (w.chip == 0)
+        throw std::invalid_argument("chip must be at least one sample");
+    if (w.scale <= 0.0 or w.scale > 1.0)
+        throw std::invalid_argument("waveform scale must be in (0, 1]");
+    return w;
+}
+
+bool is_waveform_spec(const std::string &entry){
+    std::string type = entry.substr(0, entry.find(':'));
+    return type == "lfm" or type == "tone" or type == "barker" or type == "code";
+}
+
+/***********************************************************************
+ * phase accumulator kernel
+ **********************************************************************/
+// Phases are fractions of a turn in 64 bit fixed point, so they wrap for
+// free and a chirp's accumulated phase stays exact over any length.
+static uint64_t turns_to_phase(double turns){
+    double frac = turns - std::floor(turns);
+    double scaled = std::ldexp(frac, 64);
+    return (scaled >= 18446744073709551616.0) ? 0 : (uint64_t)scaled;
+}
+
+#define SINE_TABLE_BITS 10
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+
+// cos/sin of a turn in SINE_TABLE_SIZE steps and the step to the next
+// entry; linear interpolation keeps the error under 5e-6 of full scale
+typedef struct {
+  float cos[SINE_TABLE_SIZE], sin[SINE_TABLE_SIZE];
+  float dcos[SINE_TABLE_SIZE], dsin[SINE_TABLE_SIZE];
+} sine_table_t;
+
+static const sine_table_t &sine_table(void){
+    static sine_table_t table;
+    static bool init = [](){
+        for (size_t i = 0; i < SINE_TABLE_SIZE; i++){
+            double a = 2.0*M_PI*i/SINE_TABLE_SIZE, b = 2.0*M_PI*(i + 1)/SINE_TABLE_SIZE;
+            table.cos[i] = (float)std::cos(a);
+            table.sin[i] = (float)std::sin(a);
+            table.dcos[i] = (float)(std::cos(b) - std::cos(a));
+            table.dsin[i] = (float)(std::sin(b) - std::sin(a));
+        }
+        return true;
+    }();
+    (void)init;
+    return table;
+}
+
+struct tone_phase {
+    uint64_t phase, step;
+    inline uint64_t next(void){ uint64_t p = phase; phase += step; return p; }
+};
+
+// quadratic phase: the step itself grows by accel every sample
+struct chirp_phase {
+    uint64_t phase, step, accel;
+    inline uint64_t next(void){ uint64_t p = phase; phase += step; step += accel; return p; }
+};
+
+// carrier plus the phase of the current chip
+struct code_phase {
+    tone_phase carrier;
+    const uint64_t *chips;
+    size_t chip_len, count;
+    inline uint64_t next(void){
+        uint64_t p = carrier.next() + *chips;
+        if (++count == chip_len){
+            count = 0;
+            chips++;
+        }
+        return p;
+    }
+};
+
+// rounds half away from zero, like MATLAB's int16()
+static inline short round_sc16(float x){
+    return (short)(x + ((x < 0.0f) ? -0.5f : 0.5f));
+}
+
+template<typename phase_gen> static void render_sc16(phase_gen gen, std::complex<short> *out, size_t n, float amplitude){
+    const sine_table_t &t = sine_table();
+    const float frac_scale = 1.0f/(float)(1 << 24);
+    for (size_t i = 0; i < n; i++){
+        uint64_t p = gen.next();
+        size_t k = (size_t)(p >> (64 - SINE_TABLE_BITS));
+        float frac = (float)((p >> (40 - SINE_TABLE_BITS)) & 0xffffff)*frac_scale;
+        float re = t.cos[k] + frac*t.dcos[k];
+        float im = t.sin[k] + frac*t.dsin[k];
+        out[i] = std::complex<short>(round_sc16(amplitude*re), round_sc16(amplitude*im));
+    }
+}
+
+void synthesize_waveform(sc16_buffer_t &data, const waveform_spec_t &spec, double rate){
+    if (rate <= 0.0)
+        throw std::invalid_argument("waveform needs a sample rate");
+    size_t n = spec.len;
+    if (spec.type == WAVEFORM_BARKER or spec.type == WAVEFORM_CODE)
+        n = spec.phases.size()*spec.chip;
+    else if (n == 0)
+        n = (size_t)std::llround(spec.dur*rate);
+    if (spec.type == WAVEFORM_LFM and n < 3)
+        throw std::invalid_argument("chirp must be at least 3 samples");
+    if (n == 0)
+        throw std::invalid_argument("waveform is empty");
+
+    data.assign(spec.zeros + n, std::complex<short>(0, 0));
+    std::complex<short> *out = &data[spec.zeros];
+    // 32767*0.5 for halfgain, as wave2file.m is called with
+    float amplitude = (float)(32767.0*spec.scale);
+    double offset = spec.freq/rate;  // turns per sample
+    switch (spec.type){
+    case WAVEFORM_LFM: {
+        // turns B*(k - c)^2 + offset*k, with t_end = (n - 1 - c)/rate
+        double c = n/2.0;
+        double b = 0.25*spec.bw/((n - 1 - c)*rate);
+        chirp_phase gen;
+        gen.phase = turns_to_phase(b*c*c);
+        gen.step = turns_to_phase(b*(1.0 - 2.0*c) + offset);
+        gen.accel = turns_to_phase(2.0*b);
+        render_sc16(gen, out, n, amplitude);
+        break;
+    }
+    case WAVEFORM_TONE: {
+        tone_phase gen;
+        gen.phase = 0;
+        gen.step = turns_to_phase(offset);
+        render_sc16(gen, out, n, amplitude);
+        break;
+    }
+    case WAVEFORM_BARKER:
+    case WAVEFORM_CODE: {
+        std::vector<uint64_t> chips;
+        for (double deg : spec.phases)
+            chips.push_back(turns_to_phase(deg/360.0));
+        code_phase gen;
+        gen.carrier.phase = 0;
+        gen.carrier.step = turns_to_phase(offset);
+        gen.chips = chips.data();
+        gen.chip_len = spec.chip;
+        gen.count = 0;
+        render_sc16(gen, out, n, amplitude);
+        break;
+    }
+    }
+}
+
+const sc16_buffer_t &cache_waveform(waveform_cache &cache, const std::string &entry, double rate){
+    if (not is_waveform_spec(entry)){
+        std::string name = waveform_cache::default_name(entry);
+        if (not cache.has(name))
+            cache.load(name, entry);
+        return cache.get(name);
+    }
+    if (not cache.has(entry)){
+        sc16_buffer_t wave;
+        synthesize_waveform(wave, parse_waveform_spec(entry), rate);
+        cache.add(entry, wave);
+    }
+    return cache.get(entry);
+}
@@ -0,0 +1,78 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "window.hpp"
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+window_t parse_window(const std::string &name){
+    if (name == "rect")
+        return WINDOW_RECT;
+    if (name == "hann")
+        return WINDOW_HANN;
+    if (name == "hamming")
+        return WINDOW_HAMMING;
+    if (name == "blackman")
+        return WINDOW_BLACKMAN;
+    throw std::invalid_argument("unknown window \"" + name + "\" (expected rect, hann, hamming or blackman)");
+}
+
+std::vector<float> make_window(window_t window, size_t n){
+    std::vector<float> w(n, 1.0f);
+    if (n < 2)
+        return w;
+    for (size_t i = 0; i < n; i++){
+        double x = 2.0*M_PI*(double)i/(double)(n - 1);
+        switch (window){
+        case WINDOW_HANN:
+            w[i] = (float)(0.5 - 0.5*std::cos(x));
+            break;
+        case WINDOW_HAMMING:
+            w[i] = (float)(0.54 - 0.46*std::cos(x));
+            break;
+        case WINDOW_BLACKMAN:
+            w[i] = (float)(0.42 - 0.5*std::cos(x) + 0.08*std::cos(2.0*x));
+            break;
+        default:
+            break;
+        }
+    }
+    return w;
+}
+
+std::vector<float, aligned_allocator<float>> make_window_iq(const std::vector<float> &window){
+    std::vector<float, aligned_allocator<float>> w(2*window.size());
+    for (size_t i = 0; i < window.size(); i++)
+        w[2*i] = w[2*i + 1] = window[i];
+    return w;
+}
+
+void window_multiply(const fc32_t *in, const float *window_iq, fc32_t *out, size_t n){
+    const float *src = reinterpret_cast<const float *>(in);
+    float *dst = reinterpret_cast<float *>(out);
+    size_t i = 0;
+    n *= 2;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), _mm256_loadu_ps(window_iq + i)));
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(window_iq + i)));
+#elif defined(HAVE_NEON)
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), vld1q_f32(window_iq + i)));
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i]*window_iq[i];
+}
@@ -0,0 +1,116 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Loopback checks of the pulse train receive path: with overflows injected
+// on both RX channels every pulse that is stored has to start at its
+// scheduled tick and hold the echo of its own burst from there on, so lost
+// samples can only leave a pulse short, never shift it or a later pulse.
+// Exits non-zero if any check fails. Needs no radio.
+//
+
+#include "loopback_device.hpp"
+#include "pulse_arena.hpp"
+#include "pulse_train.hpp"
+#include <boost/format.hpp>
+#include <complex>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static size_t checks = 0, failures = 0;
+
+static void check(bool ok, const std::string &what){
+    checks++;
+    if (ok)
+        return;
+    if (failures++ < 20)
+        std::cerr << "FAIL: " << what << std::endl;
+}
+
+// runs a train with overflows of spp samples injected at overflow_prob per recv() call
+static void check_overflow_train(double overflow_prob, size_t spp, bool threaded){
+    const double rate = 1e6;
+    const size_t nsamps = 1000, npulses = 300;
+    std::string what = str(boost::format("overflow %g spp %d%s") % overflow_prob % spp % (threaded ? " threaded" : ""));
+
+    loopback_config_t lb_config = default_loopback_config(rate);
+    lb_config.spp = spp;
+    lb_config.overflow_prob = overflow_prob;
+    lb_config.seed = 7;
+    radio_device::sptr device = loopback_device::make(lb_config);
+
+    // a ramp, so every sample tells where in the burst it came from
+    sc16_buffer_t wave(nsamps);
+    for (size_t i = 0; i < nsamps; i++)
+        wave[i] = std::complex<short>((short)i, (short)(-(int)i));
+    std::vector<const sc16_buffer_t *> waves(1, &wave);
+
+    pulse_train_config_t config;
+    config.pri = 2e-3;
+    config.depth = 8;
+    config.npulses = npulses;
+    config.nsamps = nsamps;
+    config.rx_timeout = 1.0;
+    config.threaded = threaded;
+    config.tx_sched = default_thread_sched();
+    config.rx_sched = default_thread_sched();
+    pulse_train train(device, config, make_ch_select(2, 0));
+    pulse_arena::sptr arena(new pulse_arena(16, nsamps, false));
+
+    std::mutex mutex;
+    size_t stored[2] = {0, 0}, full = 0, lost = 0;
+    pulse_train_stats_t stats;
+    try {
+        stats = train.run(device->get_time_now() + uhd::time_spec_t(0.1), waves, arena,
+            [&](size_t k, pulse_slot *slot){
+                if (slot == NULL)
+                    return;
+                std::lock_guard<std::mutex> lock(mutex);
+                stored[slot->channel]++;
+                std::string pulse = str(boost::format("%s: pulse %d rx%d") % what % k % slot->channel);
+                check(slot->index == k, pulse + " index");
+                if (slot->nsamps == 0){
+                    lost++;
+                }
+                else {
+                    long long tick = uhd::time_spec_t(slot->time_full_secs, slot->time_frac_secs).to_ticks(rate);
+                    check(slot->has_time_spec and tick == train.pulse_time(k).to_ticks(rate),
+                          str(boost::format("%s starts at tick %d, scheduled at %d") % pulse % tick % train.pulse_time(k).to_ticks(rate)));
+                    size_t bad = 0;
+                    for (size_t i = 0; i < slot->nsamps; i++)
+                        bad += (slot->samps[i] != wave[i]);
+                    check(bad == 0, str(boost::format("%s: %d of %d samples are not the burst's") % pulse % bad % slot->nsamps));
+                    if (slot->nsamps == nsamps)
+                        full++;
+                }
+                arena->release(slot);
+            });
+    }
+    catch (std::exception &e){
+        check(false, what + ": " + e.what());
+        return;
+    }
+    check(stored[0] == npulses and stored[1] == npulses, what + ": every pulse handed off on both channels");
+    check(stats.pulses == npulses, what + ": pulse count");
+    if (overflow_prob > 0.0){
+        // the injected overflows have to show up, on the pulses they cut short,
+        // and not take every pulse
+        check(stats.errors > 0 and stats.short_pulses == stats.errors, what + ": overflows reported");
+        check(lost > 0 and full > 0, what + ": some pulses lost, some whole");
+    }
+    else {
+        check(stats.errors == 0 and full == 2*npulses, what + ": every pulse whole");
+    }
+}
+
+int main(void){
+    check_overflow_train(0.0, 100, false);
+    check_overflow_train(0.2, 100, false);
+    check_overflow_train(0.2, 100, true);
+    // an overflow takes whole pulses, and is stamped past their end
+    check_overflow_train(0.2, 1000, false);
+
+    std::cout << boost::format("pulse_train_test: %d checks, %d failed") % checks % failures << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,413 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Checks of the sample format conversions: every convert_samples() pair
+// against its generic reference and within the quantization error of the
+// narrower format, the vectorized kernels against the generic loops over
+// unaligned lengths and offsets, file2wave() on .sc8/.fc32/.dat/.bin files
+// and capture_file_reader::read<T>() and export_capture_pulses() on
+// captures of every sample format, and that the reader refuses corrupt
+// captures.
+// Exits non-zero if any check fails. Needs no radio (or UHD).
+//
+
+#include "capture_file.hpp"
+#include "file2wave.hpp"
+#include "sample_convert.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+static size_t checks = 0, failures = 0;
+
+static void check(bool ok, const std::string &what){
+    checks++;
+    if (ok)
+        return;
+    // the first few failures say enough
+    if (failures++ < 20)
+        std::cerr << "FAIL: " << what << std::endl;
+}
+
+static const char *type_name(int8_t) { return "sc8"; }
+static const char *type_name(short) { return "sc16"; }
+static const char *type_name(float) { return "fc32"; }
+
+template<typename T> static bool same_bits(const std::complex<T> *a, const std::complex<T> *b, size_t n){
+    return n == 0 or std::memcmp(a, b, n*sizeof(std::complex<T>)) == 0;
+}
+
+/***********************************************************************
+ * Test signals, in every format, with the rounding and saturation cases
+ **********************************************************************/
+struct test_signals {
+    std::vector<std::complex<int8_t>> sc8;
+    std::vector<std::complex<short>> sc16;
+    std::vector<std::complex<float>> fc32;
+
+    test_signals(size_t n){
+        std::mt19937 gen(1);
+        std::uniform_int_distribution<int> byte(-128, 127), word(-32768, 32767);
+        std::uniform_real_distribution<float> real(-33000.0f, 33000.0f);
+        // ties (x.5 units of the narrower format) and both ends of every range
+        const short edges16[] = {-32768, 32767, 0, 1, -1, 127, 128, -128, -129, 383, 384, -384, 640, 32640, 32639, -32640, -32641};
+        const float edges32[] = {0.5f, -0.5f, 1.5f, 2.5f, -2.5f, 32767.4f, 32767.5f, -32768.5f, -32769.0f, 40000.0f, -40000.0f, 127.5f*256, 1e9f, -1e9f};
+        for (short x : edges16)
+            sc16.push_back(std::complex<short>(x, -x - 1));
+        for (float x : edges32)
+            fc32.push_back(std::complex<float>(x, -x));
+        sc8.push_back(std::complex<int8_t>(-128, 127));
+        sc8.push_back(std::complex<int8_t>(127, -128));
+        while (sc16.size() < n)
+            sc16.push_back(std::complex<short>(word(gen), word(gen)));
+        while (fc32.size() < n)
+            fc32.push_back(std::complex<float>(real(gen), real(gen)));
+        while (sc8.size() < n)
+            sc8.push_back(std::complex<int8_t>(byte(gen), byte(gen)));
+    }
+
+    const std::vector<std::complex<int8_t>> &get(int8_t) const { return sc8; }
+    const std::vector<std::complex<short>> &get(short) const { return sc16; }
+    const std::vector<std::complex<float>> &get(float) const { return fc32; }
+};
+
+/***********************************************************************
+ * Every format pair: the run time dispatcher matches the generic
+ * reference bit for bit and stays within bound sc16 counts of the input
+ * (clamped to what Out can hold)
+ **********************************************************************/
+template<typename In, typename Out> static void check_pair(const test_signals &signals, double bound){
+    const std::vector<std::complex<In>> &in = signals.get(In());
+    const size_t n = in.size();
+    std::vector<std::complex<Out>> out(n), ref(n);
+    convert_samples(sample_traits<In>::format, in.data(), sample_traits<Out>::format, out.data(), n);
+    convert_samples_generic(in.data(), ref.data(), n);
+    std::string pair = str(boost::format("%s -> %s") % type_name(In()) % type_name(Out()));
+    check(same_bits(out.data(), ref.data(), n), pair + ": differs from convert_samples_generic");
+
+    const double kin = sample_traits<In>::scale(), kout = sample_traits<Out>::scale();
+    double lo = -1e300, hi = 1e300;
+    if (std::numeric_limits<Out>::is_integer){
+        lo = std::numeric_limits<Out>::min()*kout;
+        hi = std::numeric_limits<Out>::max()*kout;
+    }
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++){
+        const double x[2] = {in[i].real()*kin, in[i].imag()*kin};
+        const double y[2] = {out[i].real()*kout, out[i].imag()*kout};
+        for (size_t j = 0; j < 2; j++)
+            worst = std::max(worst, std::fabs(y[j] - std::min(std::max(x[j], lo), hi)));
+    }
+    check(worst <= bound, str(boost::format("%s: error %f counts, bound %f") % pair % worst % bound));
+}
+
+template<typename A, typename B> static void check_round_trip(const test_signals &signals, double bound){
+    const std::vector<std::complex<A>> &in = signals.get(A());
+    const size_t n = in.size();
+    std::vector<std::complex<B>> mid(n);
+    std::vector<std::complex<A>> back(n);
+    convert_samples(sample_traits<A>::format, in.data(), sample_traits<B>::format, mid.data(), n);
+    convert_samples(sample_traits<B>::format, mid.data(), sample_traits<A>::format, back.data(), n);
+    const double k = sample_traits<A>::scale();
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++){
+        worst = std::max(worst, std::fabs((double)back[i].real() - in[i].real())*k);
+        worst = std::max(worst, std::fabs((double)back[i].imag() - in[i].imag())*k);
+    }
+    check(worst <= bound, str(boost::format("%s -> %s -> %s: error %f counts, bound %f")
+        % type_name(A()) % type_name(B()) % type_name(A()) % worst % bound));
+}
+
+static void check_pairs(void){
+    test_signals signals(4099);
+    // widening and same format pairs are exact
+    check_pair<int8_t, int8_t>(signals, 0.0);
+    check_pair<int8_t, short>(signals, 0.0);
+    check_pair<int8_t, float>(signals, 0.0);
+    check_pair<short, short>(signals, 0.0);
+    check_pair<short, float>(signals, 0.0);
+    check_pair<float, float>(signals, 0.0);
+    // narrowing rounds to the nearest step of the output
+    check_pair<short, int8_t>(signals, 128.0);
+    check_pair<float, int8_t>(signals, 128.0);
+    check_pair<float, short>(signals, 0.5);
+
+    check_round_trip<int8_t, short>(signals, 0.0);
+    check_round_trip<int8_t, float>(signals, 0.0);
+    check_round_trip<short, float>(signals, 0.0);
+    // 32767 saturates to 127 in sc8, 255 counts short of it
+    check_round_trip<short, int8_t>(signals, 255.0);
+}
+
+/***********************************************************************
+ * Vectorized kernels against the generic loops: every length up to a
+ * few vectors, at every misalignment of in and out, without touching
+ * anything past the output
+ **********************************************************************/
+static const size_t MAX_OFFSET = 4;
+static const size_t GUARD = 16;
+
+template<typename In, typename Out, typename Fn, typename Ref>
+static void check_kernel(const std::string &name, const std::vector<std::complex<In>> &pool, Fn kernel, Ref reference){
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 70; n++)
+        lengths.push_back(n);
+    lengths.push_back(1021);
+    lengths.push_back(4096);
+    size_t bad = 0;
+    std::vector<std::complex<Out>> out, ref;
+    for (size_t n : lengths){
+        for (size_t in_off = 0; in_off < MAX_OFFSET; in_off++){
+            for (size_t out_off = 0; out_off < MAX_OFFSET; out_off++){
+                const std::complex<In> *src = pool.data() + in_off;
+                out.assign(out_off + n + GUARD, std::complex<Out>(Out(77), Out(-77)));
+                ref = out;
+                kernel(src, out.data() + out_off, n);
+                reference(src, ref.data() + out_off, n);
+                if (not same_bits(out.data(), ref.data(), out.size()))
+                    bad++;
+            }
+        }
+    }
+    check(bad == 0, str(boost::format("%s: %d of %d length/offset cases differ from the generic loop")
+        % name % bad % (lengths.size()*MAX_OFFSET*MAX_OFFSET)));
+}
+
+static void check_kernels(void){
+    test_signals signals(4096 + MAX_OFFSET);
+    for (int swap = 0; swap < 2; swap++){
+        const std::string s = swap ? " (I/Q swapped)" : "";
+        check_kernel<short, short>("convert_sc16 sc16" + s, signals.sc16,
+            [&](const std::complex<short> *in, std::complex<short> *out, size_t n){ convert_sc16(in, out, n, swap != 0); },
+            [&](const std::complex<short> *in, std::complex<short> *out, size_t n){ convert_sc16_generic(in, out, n, swap != 0); });
+        check_kernel<short, float>("convert_sc16 fc32" + s, signals.sc16,
+            [&](const std::complex<short> *in, std::complex<float> *out, size_t n){ convert_sc16(in, out, n, swap != 0); },
+            [&](const std::complex<short> *in, std::complex<float> *out, size_t n){ convert_sc16_generic(in, out, n, swap != 0); });
+        check_kernel<short, double>("convert_sc16 fc64" + s, signals.sc16,
+            [&](const std::complex<short> *in, std::complex<double> *out, size_t n){ convert_sc16(in, out, n, swap != 0); },
+            [&](const std::complex<short> *in, std::complex<double> *out, size_t n){ convert_sc16_generic(in, out, n, swap != 0); });
+    }
+    check_kernel<int8_t, short>("convert_samples sc8 -> sc16", signals.sc8,
+        [](const sc8_t *in, std::complex<short> *out, size_t n){ convert_samples(in, out, n); },
+        [](const sc8_t *in, std::complex<short> *out, size_t n){ convert_samples_generic(in, out, n); });
+    check_kernel<short, int8_t>("convert_samples sc16 -> sc8", signals.sc16,
+        [](const std::complex<short> *in, sc8_t *out, size_t n){ convert_samples(in, out, n); },
+        [](const std::complex<short> *in, sc8_t *out, size_t n){ convert_samples_generic(in, out, n); });
+    check_kernel<short, float>("convert_samples sc16 -> fc32", signals.sc16,
+        [](const std::complex<short> *in, std::complex<float> *out, size_t n){ convert_samples(in, out, n); },
+        [](const std::complex<short> *in, std::complex<float> *out, size_t n){ convert_samples_generic(in, out, n); });
+    check_kernel<float, short>("convert_samples fc32 -> sc16", signals.fc32,
+        [](const std::complex<float> *in, std::complex<short> *out, size_t n){ convert_samples(in, out, n); },
+        [](const std::complex<float> *in, std::complex<short> *out, size_t n){ convert_samples_generic(in, out, n); });
+}
+
+/***********************************************************************
+ * Files: file2wave() and captures of every sample format
+ **********************************************************************/
+template<typename T> static std::string write_raw(const fs::path &dir, const std::string &name, const std::vector<T> &data){
+    std::string fname = (dir / name).string();
+    std::ofstream out(fname.c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size()*sizeof(T));
+    return fname;
+}
+
+template<typename In, typename T> static void check_file2wave(const std::string &fname, const std::vector<std::complex<In>> &expected_in){
+    std::vector<std::complex<T>> wave, ref(expected_in.size());
+    convert_samples_generic(expected_in.data(), ref.data(), ref.size());
+    file2wave(wave, fname);
+    check(wave.size() == ref.size() and same_bits(wave.data(), ref.data(), ref.size()),
+          str(boost::format("file2wave %s into %s") % fs::path(fname).filename().string() % type_name(T())));
+}
+
+static void check_files(const fs::path &dir){
+    test_signals signals(1003);
+    std::string sc8 = write_raw(dir, "wave.sc8", signals.sc8);
+    std::string fc32 = write_raw(dir, "wave.fc32", signals.fc32);
+    std::string dat = write_raw(dir, "wave.dat", signals.sc16);
+    std::string bin = write_raw(dir, "wave.bin", signals.sc16);
+    std::vector<std::complex<short>> swapped(signals.sc16.size());
+    convert_sc16_generic(signals.sc16.data(), swapped.data(), swapped.size(), true);
+
+    check_file2wave<int8_t, short>(sc8, signals.sc8);
+    check_file2wave<int8_t, float>(sc8, signals.sc8);
+    check_file2wave<float, short>(fc32, signals.fc32);
+    check_file2wave<float, float>(fc32, signals.fc32);
+    check_file2wave<short, short>(dat, signals.sc16);
+    check_file2wave<short, float>(dat, signals.sc16);
+    // .bin waveforms are stored Q,I
+    check_file2wave<short, short>(bin, swapped);
+    check_file2wave<short, float>(bin, swapped);
+
+    // file2wave appends
+    std::vector<std::complex<short>> twice;
+    file2wave(twice, dat);
+    file2wave(twice, dat);
+    check(twice.size() == 2*signals.sc16.size() and
+          same_bits(twice.data() + signals.sc16.size(), signals.sc16.data(), signals.sc16.size()),
+          "file2wave appends to the samples already loaded");
+}
+
+template<typename S, typename T> static void check_capture_read(const capture_file_reader &reader,
+                                                                const std::vector<std::vector<std::complex<S>>> &pulses,
+                                                                const std::string &what){
+    for (size_t k = 0; k < pulses.size(); k++){
+        std::vector<std::complex<T>> out(pulses[k].size()), ref(pulses[k].size());
+        convert_samples_generic(pulses[k].data(), ref.data(), ref.size());
+        reader.read(k, out.data());
+        check(same_bits(out.data(), ref.data(), ref.size()),
+              str(boost::format("%s capture: read<%s> of pulse %d") % what % type_name(T()) % k));
+    }
+}
+
+// export_capture_pulses() to files ending in ext, read back as std::complex<T>
+template<typename S, typename T> static void check_capture_export(const std::string &capture_fname,
+                                                                  const std::vector<std::vector<std::complex<S>>> &pulses,
+                                                                  const fs::path &dir, const std::string &ext, const std::string &what){
+    std::string fname = (dir / ("export-" + what + ext)).string();
+    try {
+        export_capture_pulses(capture_fname, fname);
+    }
+    catch (std::exception &e){
+        check(false, what + " capture: export to " + ext + ": " + e.what());
+        return;
+    }
+    for (size_t k = 0; k < pulses.size(); k++){
+        std::vector<std::complex<T>> ref(pulses[k].size());
+        convert_samples_generic(pulses[k].data(), ref.data(), ref.size());
+        std::string pulse_fname = pulse_filename(fname, k, pulses.size());
+        std::ifstream file(pulse_fname.c_str(), std::ifstream::binary);
+        std::vector<std::complex<T>> out(ref.size() + 1);
+        file.read((char *)out.data(), out.size()*sizeof(std::complex<T>));
+        check(file.is_open() and (size_t)file.gcount() == ref.size()*sizeof(std::complex<T>) and
+              same_bits(out.data(), ref.data(), ref.size()),
+              str(boost::format("%s capture: export of pulse %d to %s") % what % k % ext));
+    }
+}
+
+template<typename S> static void check_capture(const fs::path &dir, uint32_t encoding){
+    test_signals signals(9000);
+    const std::vector<std::complex<S>> &signal = signals.get(S());
+    std::string what = std::string(type_name(S())) + (encoding == CAPTURE_ENCODING_LOSSLESS ? " lossless" : "");
+    std::string fname = (dir / ("capture-" + what + ".cap")).string();
+    // pulses of odd lengths, one longer than a codec block, one empty
+    const size_t lengths[] = {1, 333, 4097, 0, 2000};
+    std::vector<std::vector<std::complex<S>>> pulses;
+    try {
+        capture_header_t header = make_capture_header();
+        header.rate = 1e6;
+        set_capture_format(header, sample_traits<S>::format);
+        set_capture_encoding(header, encoding);
+        capture_file_sink sink(fname, header, false, false);
+        size_t offset = 0;
+        for (size_t k = 0; k < sizeof(lengths)/sizeof(lengths[0]); k++){
+            pulses.push_back(std::vector<std::complex<S>>(signal.begin() + offset, signal.begin() + offset + lengths[k]));
+            offset += lengths[k];
+            pulse_slot slot;
+            std::memset(&slot, 0, sizeof(slot));
+            slot.index = k;
+            slot.nsamps = lengths[k];
+            sink.append(slot, pulses.back().data(), lengths[k]);
+        }
+        sink.close();
+
+        capture_file_reader reader(fname);
+        check(reader.size() == pulses.size(), what + " capture: pulse count");
+        check(reader.encoded() == (encoding != CAPTURE_ENCODING_NONE), what + " capture: encoding");
+        for (size_t k = 0; k < reader.size() and k < pulses.size(); k++)
+            check(reader.index(k).nsamps == pulses[k].size(), str(boost::format("%s capture: length of pulse %d") % what % k));
+        if (reader.size() != pulses.size())
+            return;
+        check_capture_read<S, int8_t>(reader, pulses, what);
+        check_capture_read<S, short>(reader, pulses, what);
+        check_capture_read<S, float>(reader, pulses, what);
+        check_capture_export<S, short>(fname, pulses, dir, ".dat", what);
+        check_capture_export<S, float>(fname, pulses, dir, ".fc32", what);
+    }
+    catch (std::exception &e){
+        check(false, what + " capture: " + e.what());
+    }
+}
+
+// a copy of capture fname with its header and first index entry patched by
+// patch() must be refused by capture_file_reader, and not read out of bounds
+template<typename F> static void check_corrupt_capture(const fs::path &dir, const std::string &fname,
+                                                       const std::string &what, F patch){
+    std::ifstream in(fname.c_str(), std::ifstream::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    capture_header_t header;
+    capture_index_t entry;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    std::memcpy(&entry, bytes.data() + header.index_offset, sizeof(entry));
+    patch(header, entry);
+    std::memcpy(bytes.data() + header.index_offset, &entry, sizeof(entry));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::string corrupt_fname = (dir / "corrupt.cap").string();
+    std::ofstream(corrupt_fname.c_str(), std::ofstream::binary).write(bytes.data(), bytes.size());
+    bool refused = false;
+    try {
+        capture_file_reader reader(corrupt_fname);
+    }
+    catch (std::runtime_error &){
+        refused = true;
+    }
+    check(refused, "corrupt capture refused: " + what);
+}
+
+static void check_corrupt_captures(const fs::path &dir){
+    const uint64_t huge = std::numeric_limits<uint64_t>::max();
+    std::string fnames[] = {(dir / "capture-sc16.cap").string(), (dir / "capture-sc16 lossless.cap").string()};
+    for (const std::string &fname : fnames){
+        // offsets and counts whose sums and products wrap around to small values
+        check_corrupt_capture(dir, fname, "data_offset past the file", [](capture_header_t &h, capture_index_t &){
+            h.data_offset = huge - 8;
+        });
+        check_corrupt_capture(dir, fname, "npulses overflows", [](capture_header_t &h, capture_index_t &){
+            h.npulses = huge/sizeof(capture_index_t) + 2;
+        });
+        check_corrupt_capture(dir, fname, "pulse before the sample region", [](capture_header_t &, capture_index_t &e){
+            e.offset = 0;
+        });
+        check_corrupt_capture(dir, fname, "pulse past the index", [](capture_header_t &h, capture_index_t &e){
+            e.offset = h.index_offset + 1;
+        });
+        check_corrupt_capture(dir, fname, "nsamps overflows", [](capture_header_t &, capture_index_t &e){
+            e.nsamps = huge/4 + 2;
+        });
+        check_corrupt_capture(dir, fname, "tags past the file", [](capture_header_t &h, capture_index_t &){
+            h.ntags = 1;
+            h.tag_offset = huge - 8;
+        });
+    }
+    check_corrupt_capture(dir, fnames[0], "sample size", [](capture_header_t &h, capture_index_t &){
+        h.bytes_per_sample = 1;
+    });
+}
+
+int main(void){
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("sample_convert_test-%%%%%%%%");
+    fs::create_directories(dir);
+
+    check_pairs();
+    check_kernels();
+    check_files(dir);
+    check_capture<int8_t>(dir, CAPTURE_ENCODING_NONE);
+    check_capture<short>(dir, CAPTURE_ENCODING_NONE);
+    check_capture<float>(dir, CAPTURE_ENCODING_NONE);
+    check_capture<short>(dir, CAPTURE_ENCODING_LOSSLESS);
+    check_corrupt_captures(dir);
+
+    fs::remove_all(dir);
+    std::cout << boost::format("sample_convert_test: %d checks, %d failed") % checks % failures << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Microbenchmarks of the host side hot paths: waveform loading and I/Q
+// swapping, sample conversion, the per-pulse buffer copy, file output and
+// the DSP kernels. No radio (or UHD) is needed. Every benchmark runs over
+// a buffer of each requested size; throughput is reported in Msps and in
+// GB/s of the equivalent sc16 samples (4 bytes each), so rates of stages
+// with different sample types compare directly. --out writes the results
+// as CSV or JSON for tracking regressions between releases.
+//
+
+#include "capture_codec.hpp"
+#include "capture_file.hpp"
+#include "ddc.hpp"
+#include "file2wave.hpp"
+#include "impulse_detect.hpp"
+#include "pulse_arena.hpp"
+#include "pulse_compress.hpp"
+#include "pulse_writer.hpp"
+#include "sample_convert.hpp"
+#include "thread_sched.hpp"
+#include "waveform_synth.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+static const double BENCH_RATE = 125e6;
+// capture files are started over past this size, so long runs of small
+// pulses do not fill the disk
+static const uint64_t BENCH_MAX_CAPTURE_BYTES = 1ULL << 30;
+
+typedef struct {
+  const sc16_buffer_t *samps;   // test signal of nsamps samples
+  const sc16_buffer_t *ref;     // the LFM chirp echoed in it
+  std::string dir;              // directory of the file benchmarks
+  size_t threads;               // codec threads
+} bench_env_t;
+
+//! One benchmark at one size: run() processes all nsamps samples once
+typedef struct {
+  std::function<void(void)> run;
+  std::function<void(void)> done;   // removes files; may be empty
+} bench_case_t;
+
+typedef struct {
+  const char *name;
+  const char *what;
+  std::function<bench_case_t(const bench_env_t &env, size_t nsamps)> make;
+} bench_t;
+
+typedef struct {
+  std::string bench;
+  size_t nsamps;
+  size_t reps;
+  double min_secs;
+  double median_secs;
+  double msps;       // at the median time
+  double gbps;       // ... of sc16 samples
+} bench_result_t;
+
+/***********************************************************************
+ * test signal
+ **********************************************************************/
+// noise of 20 counts rms with a chirp echo every 8192 samples, tiled from
+// a short pattern so even 100M samples are generated in a moment
+static void make_signal(sc16_buffer_t &samps, const sc16_buffer_t &ref, size_t nsamps){
+    const size_t period = 8192, npattern = 16*period;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 20.0f);
+    std::vector<std::complex<float>> pattern(npattern);
+    for (std::complex<float> &s : pattern)
+        s = std::complex<float>(noise(rng), noise(rng));
+    for (size_t start = 1000; start + ref.size() <= npattern; start += period){
+        for (size_t i = 0; i < ref.size(); i++)
+            pattern[start + i] += std::complex<float>(ref[i].real(), ref[i].imag())*0.25f;
+    }
+    sc16_buffer_t tile(npattern);
+    convert_samples(pattern.data(), tile.data(), npattern);
+    samps.resize(nsamps);
+    for (size_t i = 0; i < nsamps; i += npattern)
+        std::memcpy(&samps[i], tile.data(), std::min(npattern, nsamps - i)*sizeof(std::complex<short>));
+}
+
+static pulse_slot make_slot(std::complex<short> *samps, size_t nsamps){
+    pulse_slot slot;
+    std::memset(&slot, 0, sizeof(slot));
+    slot.samps = samps;
+    slot.nsamps = nsamps;
+    slot.capacity = nsamps;
+    return slot;
+}
+
+//! The first n samples of the test signal in a page aligned buffer padded to whole pages, as O_DIRECT wants
+static boost::shared_ptr<sc16_page_buffer_t> page_buffer(const bench_env_t &env, size_t n){
+    size_t page_samps = PAGE_SIZE_BYTES/sizeof(std::complex<short>);
+    boost::shared_ptr<sc16_page_buffer_t> buf(new sc16_page_buffer_t((n + page_samps - 1)/page_samps*page_samps));
+    std::memcpy(buf->data(), env.samps->data(), n*sizeof(std::complex<short>));
+    return buf;
+}
+
+static std::string bench_fname(const bench_env_t &env, const std::string &name){
+    return (boost::filesystem::path(env.dir) / ("n300_bench-" + name)).string();
+}
+
+/***********************************************************************
+ * benchmarks
+ **********************************************************************/
+// in -> out conversion through the vectorized converters
+template<typename In, typename Out> static bench_case_t convert_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<std::vector<std::complex<In>>> in(new std::vector<std::complex<In>>(n));
+    boost::shared_ptr<std::vector<std::complex<Out>>> out(new std::vector<std::complex<Out>>(n));
+    convert_samples(env.samps->data(), in->data(), n);
+    bench_case_t c;
+    c.run = [in, out, n](){ convert_samples(in->data(), out->data(), n); };
+    return c;
+}
+
+static bench_case_t file2wave_case(const bench_env_t &env, size_t n){
+    std::string fname = bench_fname(env, "wave.bin");
+    std::ofstream file(fname.c_str(), std::ofstream::binary);
+    file.write((const char *)env.samps->data(), n*sizeof(std::complex<short>));
+    file.close();
+    if (not file)
+        throw std::runtime_error("Could not write " + fname);
+    bench_case_t c;
+    c.run = [fname](){
+        sc16_buffer_t data;
+        file2wave(data, fname);
+    };
+    c.done = [fname](){ boost::filesystem::remove(fname); };
+    return c;
+}
+
+static bench_case_t iq_swap_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<sc16_buffer_t> out(new sc16_buffer_t(n));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, out, n](){ convert_sc16(in, out->data(), n, true); };
+    return c;
+}
+
+// what pulseStream() used to do per pulse: a zeroed receive buffer, the
+// samples received into it, then appended to the pulse vector
+static bench_case_t pulse_vector_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<std::vector<std::complex<short>>> pulses(new std::vector<std::complex<short>>());
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, pulses, n](){
+        std::vector<std::complex<short>> buff(n);
+        std::memcpy(&buff.front(), in, n*sizeof(std::complex<short>));
+        pulses->clear();
+        pulses->insert(pulses->end(), buff.begin(), buff.end());
+    };
+    return c;
+}
+
+// the arena slot a pulse is received into instead
+static bench_case_t pulse_arena_case(const bench_env_t &env, size_t n){
+    pulse_arena::sptr arena(new pulse_arena(2, n, false));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, arena, n](){
+        pulse_slot *slot = arena->acquire();
+        std::memcpy(slot->samps, in, n*sizeof(std::complex<short>));
+        slot->nsamps = n;
+        arena->release(slot);
+    };
+    return c;
+}
+
+// per-pulse .dat files, the --outfmt dat output
+static bench_case_t write_dat_case(const bench_env_t &env, size_t n, bool direct_io){
+    std::string fname = bench_fname(env, "pulse.dat");
+    boost::shared_ptr<sc16_page_buffer_t> buf = page_buffer(env, n);
+    boost::shared_ptr<pulse_file_sink> sink(new pulse_file_sink(fname, 1, direct_io, direct_io, false));
+    bench_case_t c;
+    c.run = [sink, buf, n](){ sink->write(make_slot(buf->data(), n)); };
+    c.done = [fname](){ boost::filesystem::remove(fname); };
+    return c;
+}
+
+// appending to a capture container, started over every BENCH_MAX_CAPTURE_BYTES
+static bench_case_t write_capture_case(const bench_env_t &env, size_t n, bool direct_io, uint32_t encoding){
+    std::string fname = bench_fname(env, "capture.cap");
+    boost::shared_ptr<sc16_page_buffer_t> buf = page_buffer(env, n);
+    capture_header_t header = make_capture_header();
+    header.rate = BENCH_RATE;
+    header.rx_channels = 0x1;
+    set_capture_encoding(header, encoding);
+    boost::shared_ptr<boost::shared_ptr<capture_file_sink>> sink(new boost::shared_ptr<capture_file_sink>());
+    boost::shared_ptr<uint64_t> written(new uint64_t(0));
+    size_t threads = env.threads;
+    bench_case_t c;
+    c.run = [=](){
+        if (not *sink or *written > BENCH_MAX_CAPTURE_BYTES){
+            sink->reset();
+            sink->reset(new capture_file_sink(fname, header, direct_io, false, 0, threads));
+            *written = 0;
+        }
+        (*sink)->append(make_slot(buf->data(), n), buf->data(), n);
+        *written += n*sizeof(std::complex<short>);
+    };
+    c.done = [sink, fname](){
+        sink->reset();
+        boost::filesystem::remove(fname);
+    };
+    return c;
+}
+
+static bench_case_t codec_encode_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<capture_encoder> encoder(new capture_encoder(CODEC_DEFAULT_BLOCK, env.threads));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, encoder, n](){ encoder->encode(in, n); };
+    return c;
+}
+
+static bench_case_t codec_decode_case(const bench_env_t &env, size_t n){
+    capture_encoder encoder(CODEC_DEFAULT_BLOCK, env.threads);
+    size_t nbytes = encoder.encode(env.samps->data(), n);
+    boost::shared_ptr<std::vector<uint8_t>> coded(new std::vector<uint8_t>(encoder.data(), encoder.data() + nbytes));
+    boost::shared_ptr<sc16_buffer_t> out(new sc16_buffer_t(n));
+    size_t threads = env.threads;
+    bench_case_t c;
+    c.run = [coded, out, n, threads](){ decode_pulse(coded->data(), coded->size(), n, CODEC_DEFAULT_BLOCK, out->data(), threads); };
+    return c;
+}
+
+static bench_case_t ddc_case(const bench_env_t &env, size_t n){
+    ddc_config_t config = default_ddc_config();
+    config.decim = 4;
+    boost::shared_ptr<ddc_filter> filter(new ddc_filter(config, BENCH_RATE));
+    boost::shared_ptr<fc32_buffer_t> out(new fc32_buffer_t(filter->max_output(n)));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, filter, out, n](){ filter->decimate(in, n, out->data()); };
+    return c;
+}
+
+static bench_case_t compress_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<pulse_compressor> compressor(new pulse_compressor(*env.ref, n));
+    boost::shared_ptr<fc32_buffer_t> out(new fc32_buffer_t(n));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, compressor, out, n](){ compressor->compress(in, n, out->data()); };
+    return c;
+}
+
+static bench_case_t impulses_case(const bench_env_t &env, size_t n){
+    boost::shared_ptr<impulse_detector> detector(new impulse_detector(default_impulse_config()));
+    const std::complex<short> *in = env.samps->data();
+    bench_case_t c;
+    c.run = [in, detector, n](){
+        detector->clear();
+        detector->begin(0, 0);
+        detector->scan(in, n);
+        detector->end();
+    };
+    return c;
+}
+
+static bench_case_t synth_case(const bench_env_t &, size_t n){
+    waveform_spec_t spec = parse_waveform_spec("lfm:zeros=0:len=" + boost::lexical_cast<std::string>(std::max<size_t>(n, 3)));
+    boost::shared_ptr<sc16_buffer_t> out(new sc16_buffer_t());
+    bench_case_t c;
+    c.run = [spec, out](){ synthesize_waveform(*out, spec, BENCH_RATE); };
+    return c;
+}
+
+static std::vector<bench_t> all_benchmarks(void){
+    std::vector<bench_t> b;
+    b.push_back({"file2wave", "load a .bin waveform file (mapped, I/Q swapped)", file2wave_case});
+    b.push_back({"iq_swap", "sc16 I/Q swap in memory", iq_swap_case});
+    b.push_back({"sc16_fc32", "sc16 to fc32 conversion", convert_case<short, float>});
+    b.push_back({"fc32_sc16", "fc32 to sc16 conversion", convert_case<float, short>});
+    b.push_back({"sc16_sc8", "sc16 to sc8 conversion", convert_case<short, int8_t>});
+    b.push_back({"sc8_sc16", "sc8 to sc16 conversion", convert_case<int8_t, short>});
+    b.push_back({"pulse_vector", "per-pulse receive buffer allocated, filled and appended (old pulseStream)", pulse_vector_case});
+    b.push_back({"pulse_arena", "per-pulse arena slot acquired, filled and released", pulse_arena_case});
+    b.push_back({"write_dat", "per-pulse .dat file, buffered", [](const bench_env_t &env, size_t n){ return write_dat_case(env, n, false); }});
+    b.push_back({"write_dat_direct", "per-pulse .dat file, O_DIRECT", [](const bench_env_t &env, size_t n){ return write_dat_case(env, n, true); }});
+    b.push_back({"write_capture", "capture container append, buffered",
+                 [](const bench_env_t &env, size_t n){ return write_capture_case(env, n, false, CAPTURE_ENCODING_NONE); }});
+    b.push_back({"write_capture_direct", "capture container append, O_DIRECT",
+                 [](const bench_env_t &env, size_t n){ return write_capture_case(env, n, true, CAPTURE_ENCODING_NONE); }});
+    b.push_back({"write_capture_lossless", "lossless encoded capture container append, buffered",
+                 [](const bench_env_t &env, size_t n){ return write_capture_case(env, n, false, CAPTURE_ENCODING_LOSSLESS); }});
+    b.push_back({"codec_encode", "lossless capture codec, encode", codec_encode_case});
+    b.push_back({"codec_decode", "lossless capture codec, decode", codec_decode_case});
+    b.push_back({"ddc", "host DDC, decimation 4", ddc_case});
+    b.push_back({"compress", "pulse compression against the LFM chirp", compress_case});
+    b.push_back({"impulses", "impulse detector scan", impulses_case});
+    b.push_back({"synth", "LFM chirp synthesis", synth_case});
+    return b;
+}
+
+/***********************************************************************
+ * output
+ **********************************************************************/
+static const char *simd_name(void){
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(HAVE_NEON)
+    return "neon";
+#else
+    return "none";
+#endif
+}
+
+static void write_results(const std::string &fname, const std::vector<bench_result_t> &results){
+    std::ofstream file(fname.c_str());
+    if (not file.is_open())
+        throw std::runtime_error("Could not open file " + fname);
+    if (boost::algorithm::iends_with(fname, ".json")){
+        char date[32];
+        std::time_t now = std::time(NULL);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        file << "{" << std::endl;
+        file << "  \"date\": \"" << date << "\", \"compiler\": \"" << __VERSION__ << "\", \"simd\": \"" << simd_name()
+             << "\", \"cpus\": " << default_thread_count() << "," << std::endl;
+        file << "  \"results\": [" << std::endl;
+        for (size_t i = 0; i < results.size(); i++){
+            const bench_result_t &r = results[i];
+            file << boost::format("    {\"bench\": \"%s\", \"nsamps\": %d, \"reps\": %d, \"min_secs\": %.9g, \"median_secs\": %.9g, \"msps\": %.6g, \"gbps\": %.6g}%s")
+                % r.bench % r.nsamps % r.reps % r.min_secs % r.median_secs % r.msps % r.gbps % ((i + 1 < results.size()) ? "," : "") << std::endl;
+        }
+        file << "  ]" << std::endl << "}" << std::endl;
+    }
+    else {
+        file << "bench,nsamps,reps,min_secs,median_secs,msps,gbps" << std::endl;
+        for (const bench_result_t &r : results)
+            file << boost::format("%s,%d,%d,%.9g,%.9g,%.6g,%.6g") % r.bench % r.nsamps % r.reps % r.min_secs % r.median_secs % r.msps % r.gbps << std::endl;
+    }
+}
+
+static size_t parse_size(const std::string &s){
+    // plain counts or 1e8 style
+    double v;
+    try {
+        v = boost::lexical_cast<double>(s);
+    }
+    catch (boost::bad_lexical_cast &){
+        throw std::invalid_argument("bad size \"" + s + "\"");
+    }
+    if (v < 1.0 or v != std::floor(v))
+        throw std::invalid_argument("bad size \"" + s + "\"");
+    return (size_t)v;
+}
+
+int main(int argc, char *argv[]){
+    std::string sizes_arg, bench_arg, dir, out_fname;
+    size_t threads, min_reps, max_reps;
+    double min_secs;
+
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "help message")
+        ("list", "list the benchmarks and exit")
+        ("bench", po::value<std::string>(&bench_arg)->default_value("all"), "comma separated benchmarks to run, or all")
+        ("sizes", po::value<std::string>(&sizes_arg)->default_value("4096,65536,1048576,16777216"), "comma separated buffer sizes in samples (up to 1e8)")
+        ("min_secs", po::value<double>(&min_secs)->default_value(0.5), "repeat each benchmark for at least this long")
+        ("min_reps", po::value<size_t>(&min_reps)->default_value(3), "... and at least this many times")
+        ("max_reps", po::value<size_t>(&max_reps)->default_value(1000), "... but at most this many times")
+        ("threads", po::value<size_t>(&threads)->default_value(0), "threads of the codec benchmarks (0 for one per CPU)")
+        ("dir", po::value<std::string>(&dir)->default_value(boost::filesystem::temp_directory_path().string()), "directory of the file benchmarks")
+        ("out", po::value<std::string>(&out_fname)->default_value(""), "also write the results to this .csv or .json file")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    try{
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    if (vm.count("help")){
+        std::cout << boost::format("Host side microbenchmarks\nUsage: n300_bench [options]\n%s") % desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    std::vector<bench_t> benchmarks = all_benchmarks();
+    if (vm.count("list")){
+        for (const bench_t &b : benchmarks)
+            std::cout << boost::format("%-24s %s") % b.name % b.what << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<size_t> sizes;
+    std::vector<bench_t> selected;
+    try{
+        std::vector<std::string> tokens;
+        boost::split(tokens, sizes_arg, boost::is_any_of(","), boost::token_compress_on);
+        for (const std::string &t : tokens)
+            sizes.push_back(parse_size(t));
+        boost::split(tokens, bench_arg, boost::is_any_of(","), boost::token_compress_on);
+        for (const std::string &t : tokens){
+            size_t count = selected.size();
+            for (const bench_t &b : benchmarks){
+                if (t == "all" or t == b.name)
+                    selected.push_back(b);
+            }
+            if (selected.size() == count)
+                throw std::invalid_argument("unknown benchmark \"" + t + "\" (see --list)");
+        }
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+
+    sc16_buffer_t ref, samps;
+    synthesize_waveform(ref, parse_waveform_spec("lfm"), BENCH_RATE);
+    make_signal(samps, ref, *std::max_element(sizes.begin(), sizes.end()));
+    bench_env_t env;
+    env.samps = &samps;
+    env.ref = &ref;
+    env.dir = dir;
+    env.threads = threads;
+
+    std::cout << boost::format("%-24s %10s %6s %12s %10s %8s") % "bench" % "nsamps" % "reps" % "median ms" % "Msps" % "GB/s" << std::endl;
+    std::vector<bench_result_t> results;
+    int failed = 0;
+    for (const bench_t &b : selected){
+        for (size_t n : sizes){
+            try{
+                bench_case_t c = b.make(env, n);
+                // one untimed call faults in the buffers
+                c.run();
+                std::vector<double> times;
+                double total = 0.0;
+                while (times.size() < min_reps or (total < min_secs and times.size() < max_reps)){
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    c.run();
+                    times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                    total += times.back();
+                }
+                if (c.done)
+                    c.done();
+                std::sort(times.begin(), times.end());
+                bench_result_t r;
+                r.bench = b.name;
+                r.nsamps = n;
+                r.reps = times.size();
+                r.min_secs = times.front();
+                r.median_secs = times[times.size()/2];
+                r.msps = (r.median_secs > 0.0) ? n/r.median_secs/1e6 : 0.0;
+                r.gbps = r.msps*sizeof(std::complex<short>)/1e3;
+                results.push_back(r);
+                std::cout << boost::format("%-24s %10d %6d %12.4f %10.1f %8.3f") % r.bench % r.nsamps % r.reps
+                    % (r.median_secs*1e3) % r.msps % r.gbps << std::endl;
+            }
+            catch(std::exception &e){
+                std::cerr << "Error: " << b.name << " at " << n << " samples: " << e.what() << std::endl;
+                failed++;
+            }
+        }
+    }
+    if (not out_fname.empty()){
+        try{
+            write_results(out_fname, results);
+        }
+        catch(std::exception &e){
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Periodic impulse scan of captured .dat files (Issue 4: impulses at 2048,
+// 4096, ...). Every file is scanned as one pulse and the impulse offsets are
+// compared to the packet boundaries of the stream. Files are scanned in
+// parallel, one detector per thread.
+//
+
+#include "impulse_detect.hpp"
+#include "mapped_file.hpp"
+#include "thread_sched.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef struct {
+  std::string fname;
+  size_t nsamps;
+  impulse_stats_t stats;
+  std::vector<impulse_t> impulses;
+  std::string error;
+} file_result_t;
+
+// files named on the command line, plus the *ext files of named directories
+static void collect_files(const std::string &path, const std::string &ext, std::vector<std::string> &files){
+    boost::filesystem::path p(path);
+    if (not boost::filesystem::is_directory(p)){
+        files.push_back(path);
+        return;
+    }
+    for (boost::filesystem::directory_iterator it(p), end; it != end; ++it){
+        if (boost::filesystem::is_regular_file(it->path()) and it->path().extension().string() == ext)
+            files.push_back(it->path().string());
+    }
+}
+
+int main(int argc, char *argv[]){
+    impulse_config_t config = default_impulse_config();
+    std::string ext, csv_fname;
+    size_t threads, spp, tolerance;
+    std::vector<std::string> paths;
+
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "help message")
+        ("spp", po::value<size_t>(&spp)->default_value(0), "samples per packet of the captures (0 skips the packet boundary analysis)")
+        ("block", po::value<size_t>(&config.block)->default_value(config.block), "samples per local median/MAD estimate")
+        ("estimate", po::value<size_t>(&config.estimate)->default_value(config.estimate), "samples of a block the median/MAD is taken from (0 for all)")
+        ("threshold", po::value<double>(&config.threshold)->default_value(config.threshold), "flag samples deviating more than this many sigmas (1.4826*MAD)")
+        ("min_dev", po::value<double>(&config.min_deviation)->default_value(config.min_deviation), "... and more than this many sc16 counts")
+        ("merge", po::value<size_t>(&config.merge)->default_value(config.merge), "flagged samples closer than this are one impulse")
+        ("max_width", po::value<size_t>(&config.max_width)->default_value(config.max_width), "wider runs of flagged samples are level steps, not impulses")
+        ("tolerance", po::value<size_t>(&tolerance)->default_value(2), "samples an impulse may be off a period or packet boundary")
+        ("threads", po::value<size_t>(&threads)->default_value(0), "files scanned in parallel (0 for one per CPU)")
+        ("ext", po::value<std::string>(&ext)->default_value(".dat"), "extension of the files taken from a directory")
+        ("csv", po::value<std::string>(&csv_fname)->default_value(""), "also write every impulse to this CSV file")
+        ("paths", po::value<std::vector<std::string>>(&paths), "capture files or directories")
+    ;
+    // clang-format on
+    po::positional_options_description pos;
+    pos.add("paths", -1);
+    po::variables_map vm;
+    try{
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        po::notify(vm);
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    if (vm.count("help") or paths.empty()){
+        std::cout << boost::format("Periodic impulse detector\nUsage: n300_impulses [options] file|dir ...\n%s") % desc << std::endl;
+        return vm.count("help") ? EXIT_SUCCESS : 1;
+    }
+    try{
+        impulse_detector check(config);
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    for (const std::string &path : paths)
+        collect_files(path, ext, files);
+    std::sort(files.begin(), files.end());
+    if (files.empty()){
+        std::cerr<<"Error: no "<<ext<<" files found"<<std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<file_result_t> results(files.size());
+    parallel_for(files.size(), threads, [&](size_t begin, size_t end){
+        impulse_detector detector(config);
+        for (size_t i = begin; i < end; i++){
+            file_result_t &result = results[i];
+            result.fname = files[i];
+            result.nsamps = 0;
+            try{
+                // |x| does not care about the I/Q order, so any sample file is
+                // scanned straight from the mapping
+                mapped_file file(files[i]);
+                result.nsamps = file.size()/sizeof(std::complex<short>);
+                detector.clear();
+                detector.begin(i, 0);
+                detector.scan(file.as<std::complex<short>>(), result.nsamps);
+                detector.end();
+                result.stats = detector.get_stats();
+                result.impulses = detector.impulses();
+            }
+            catch(std::exception &e){
+                result.error = e.what();
+            }
+        }
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream csv;
+    if (not csv_fname.empty()){
+        csv.open(csv_fname.c_str());
+        if (not csv.is_open()){
+            std::cerr<<"Error: could not open "<<csv_fname<<std::endl;
+            return 1;
+        }
+        csv << "file,offset,width,peak,median,score" << std::endl;
+    }
+    int failed = 0;
+    size_t width = 4;
+    for (const std::string &f : files)
+        width = std::max(width, boost::filesystem::path(f).filename().string().size());
+    std::string row = str(boost::format("%%-%ds %%10d %%9d %%9d %%9d %%9s %%11s") % width);
+    std::cout << boost::format(str(boost::format("%%-%ds %%10s %%9s %%9s %%9s %%9s %%11s") % width)) % "file" % "nsamps" % "impulses"
+        % "steps" % "spacing" % "phase" % "boundary %" << std::endl;
+    impulse_stats_t total;
+    std::memset(&total, 0, sizeof(total));
+    std::vector<impulse_t> all;
+    for (const file_result_t &r : results){
+        if (not r.error.empty()){
+            std::cerr << "Error: " << r.fname << ": " << r.error << std::endl;
+            failed++;
+            continue;
+        }
+        impulse_periodicity_t p = impulse_periodicity(r.impulses, spp, tolerance);
+        std::cout << boost::format(row) % boost::filesystem::path(r.fname).filename().string() % r.nsamps
+            % r.stats.impulses % r.stats.steps % p.spacing
+            % (spp and p.impulses ? boost::lexical_cast<std::string>(p.phase) : std::string("-"))
+            % (spp and p.impulses ? str(boost::format("%.1f") % (100.0*p.boundary_fraction)) : std::string("-")) << std::endl;
+        for (const impulse_t &imp : r.impulses){
+            if (csv.is_open())
+                csv << boost::format("%s,%d,%d,%f,%f,%f") % r.fname % imp.offset % imp.width % imp.peak % imp.median % imp.score << std::endl;
+        }
+        all.insert(all.end(), r.impulses.begin(), r.impulses.end());
+        total.samples += r.stats.samples;
+        total.blocks += r.stats.blocks;
+        total.impulses += r.stats.impulses;
+        total.dropped += r.stats.dropped;
+        total.steps += r.stats.steps;
+        total.pulses += r.stats.pulses;
+        total.pulses_hit += r.stats.pulses_hit;
+        total.scan_secs += r.stats.scan_secs;
+    }
+    std::cout << std::endl;
+    print_impulse_report(std::cout, total, impulse_periodicity(all, spp, tolerance));
+    std::cout << boost::format("%d files scanned in %f s (%d failed)") % files.size() % secs % failed << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Spectrum / occupied bandwidth analysis of captured .dat files, the C++
+// counterpart of the obw() plots in plot_usrp_samples_example.m. Files are
+// analyzed in parallel, one Welch estimator per thread.
+//
+
+#include "file2wave.hpp"
+#include "spectrum.hpp"
+#include "thread_sched.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef struct {
+  std::string fname;
+  size_t nsamps;
+  size_t segments;
+  spectrum_stats_t stats;
+  std::string error;
+} file_result_t;
+
+// files named on the command line, plus the *ext files of named directories
+static void collect_files(const std::string &path, const std::string &ext, std::vector<std::string> &files){
+    boost::filesystem::path p(path);
+    if (not boost::filesystem::is_directory(p)){
+        files.push_back(path);
+        return;
+    }
+    for (boost::filesystem::directory_iterator it(p), end; it != end; ++it){
+        if (boost::filesystem::is_regular_file(it->path()) and it->path().extension().string() == ext)
+            files.push_back(it->path().string());
+    }
+}
+
+static void write_psd_csv(const std::string &fname, const welch_psd &estimator, const std::vector<double> &psd){
+    std::ofstream file(fname.c_str());
+    if (not file.is_open())
+        throw std::runtime_error("Could not open file " + fname);
+    file << "freq_hz,psd_db" << std::endl;
+    for (size_t k = 0; k < psd.size(); k++)
+        file << estimator.bin_hz(k) << "," << 10.0*std::log10(psd[k] + 1e-30) << std::endl;
+}
+
+int main(int argc, char *argv[]){
+    spectrum_config_t config = default_spectrum_config();
+    std::string window, ext, csv_fname, psd_dir;
+    size_t threads;
+    std::vector<std::string> paths;
+
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "help message")
+        ("rate", po::value<double>(&config.rate)->default_value(125e6), "sample rate of the captures")
+        ("nfft", po::value<size_t>(&config.nfft)->default_value(1024), "Welch segment length (power of two)")
+        ("overlap", po::value<double>(&config.overlap)->default_value(0.5), "Welch segment overlap, 0..<1")
+        ("window", po::value<std::string>(&window)->default_value("hann"), "Welch window: rect, hann, hamming or blackman")
+        ("obw", po::value<double>(&config.obw_percent)->default_value(99.0), "occupied bandwidth power percentage")
+        ("threads", po::value<size_t>(&threads)->default_value(0), "files analyzed in parallel (0 for one per CPU)")
+        ("ext", po::value<std::string>(&ext)->default_value(".dat"), "extension of the files taken from a directory")
+        ("csv", po::value<std::string>(&csv_fname)->default_value(""), "also write the results to this CSV file")
+        ("psd_dir", po::value<std::string>(&psd_dir)->default_value(""), "write each file's PSD to <psd_dir>/<stem>.psd.csv")
+        ("paths", po::value<std::vector<std::string>>(&paths), "capture files or directories")
+    ;
+    // clang-format on
+    po::positional_options_description pos;
+    pos.add("paths", -1);
+    po::variables_map vm;
+    try{
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        po::notify(vm);
+    }
+    catch(std::exception &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+    if (vm.count("help") or paths.empty()){
+        std::cout << boost::format("Spectrum / OBW analyzer\nUsage: n300_spectrum [options] file|dir ...\n%s") % desc << std::endl;
+        return vm.count("help") ? EXIT_SUCCESS : 1;
+    }
+    try{
+        config.window = parse_window(window);
+        welch_psd check(config);
+    }
+    catch(std::invalid_argument &e){
+        std::cerr<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    for (const std::string &path : paths)
+        collect_files(path, ext, files);
+    std::sort(files.begin(), files.end());
+    if (files.empty()){
+        std::cerr<<"Error: no "<<ext<<" files found"<<std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<file_result_t> results(files.size());
+    parallel_for(files.size(), threads, [&](size_t begin, size_t end){
+        welch_psd estimator(config);
+        fc32_buffer_t data;
+        std::vector<double> psd;
+        for (size_t i = begin; i < end; i++){
+            file_result_t &result = results[i];
+            result.fname = files[i];
+            result.nsamps = result.segments = 0;
+            try{
+                data.clear();
+                file2wave(data, files[i]);
+                result.nsamps = data.size();
+                if (data.empty())
+                    throw std::runtime_error("no samples");
+                result.segments = estimator.compute(&data.front(), data.size(), psd);
+                result.stats = analyze_psd(psd, config);
+                if (not psd_dir.empty()){
+                    boost::filesystem::path p(files[i]);
+                    write_psd_csv((boost::filesystem::path(psd_dir) / (p.stem().string() + ".psd.csv")).string(), estimator, psd);
+                }
+            }
+            catch(std::exception &e){
+                result.error = e.what();
+            }
+        }
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream csv;
+    if (not csv_fname.empty()){
+        csv.open(csv_fname.c_str());
+        if (not csv.is_open()){
+            std::cerr<<"Error: could not open "<<csv_fname<<std::endl;
+            return 1;
+        }
+        csv << "file,nsamps,power_db,obw_hz,obw_lo_hz,obw_hi_hz,centroid_hz,lower_db,upper_db,asymmetry_db" << std::endl;
+    }
+    int failed = 0;
+    size_t width = 4;
+    for (const std::string &f : files)
+        width = std::max(width, boost::filesystem::path(f).filename().string().size());
+    std::string row = str(boost::format("%%-%ds %%10d %%9.2f %%11.4f %%11.4f %%11.4f %%9.3f") % width);
+    std::cout << boost::format(str(boost::format("%%-%ds %%10s %%9s %%11s %%11s %%11s %%9s") % width)) % "file" % "nsamps" % "power dB"
+        % "OBW MHz" % "lo MHz" % "hi MHz" % "asym dB" << std::endl;
+    for (const file_result_t &r : results){
+        std::string name = boost::filesystem::path(r.fname).filename().string();
+        if (not r.error.empty()){
+            std::cerr << "Error: " << r.fname << ": " << r.error << std::endl;
+            failed++;
+            continue;
+        }
+        const spectrum_stats_t &s = r.stats;
+        std::cout << boost::format(row) % name % r.nsamps % s.power_db
+            % (s.obw_hz/1e6) % (s.obw_lo_hz/1e6) % (s.obw_hi_hz/1e6) % s.asymmetry_db << std::endl;
+        if (csv.is_open()){
+            csv << boost::format("%s,%d,%f,%f,%f,%f,%f,%f,%f,%f") % r.fname % r.nsamps % s.power_db % s.obw_hz
+                % s.obw_lo_hz % s.obw_hi_hz % s.centroid_hz % s.lower_db % s.upper_db % s.asymmetry_db << std::endl;
+        }
+    }
+    std::cout << boost::format("%d files analyzed in %f s (%d failed)") % files.size() % secs % failed << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}